@@ -0,0 +1,605 @@
+/*
+ * TinyPkg - Benchmark Harness
+ * Times the hot paths against generated repositories, package databases
+ * and source tarballs. Built by `make bench` with every TinyPkg directory
+ * relocated under build/bench, so it never touches the live system.
+ */
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <time.h>
+#include "../include/tinypkg.h"
+
+// Fixtures are created and wiped under the relocated directories only
+#ifndef BENCH_ROOT
+#error "Build the benchmarks with `make bench`, which relocates the TinyPkg directories"
+#endif
+
+// Global variables normally owned by main.c
+int verbose_mode = 0;
+int debug_mode = 0;
+config_t *global_config = NULL;
+
+// Run each benchmark at least this long and this often
+#define BENCH_MIN_TIME_NS 250000000LL
+#define BENCH_MIN_ITERATIONS 3
+#define BENCH_MAX_ITERATIONS 1000
+
+// Fixture shape
+#define BENCH_MAX_DEPS 6
+#define BENCH_MAX_BUILD_DEPS 2
+#define BENCH_CORE_PACKAGES 50      // Shared libraries most packages pull in
+#define BENCH_FILES_PER_PACKAGE 24
+#define BENCH_RESOLVE_ROOTS 10
+#define BENCH_LOG_MESSAGES 20000
+
+static const char *default_sizes = "100,1000,10000";
+
+static const char *bench_categories[] = {
+    "libs", "devel", "editors", "net", "utils", "graphics", "sound", "x11"
+};
+
+static const char *bench_licenses[] = {
+    "MIT", "GPL-2.0", "GPL-3.0", "BSD-3-Clause", "Apache-2.0", "LGPL-2.1"
+};
+
+static const char *bench_build_systems[] = {
+    "autotools", "cmake", "meson", "make"
+};
+
+static const char *bench_words[] = {
+    "library", "tool", "compression", "network", "editor", "parser",
+    "terminal", "graphics", "audio", "protocol", "daemon", "utility"
+};
+
+// Tarball sizes for the checksum benchmarks
+static const size_t bench_tarball_sizes[] = {1024 * 1024, 16 * 1024 * 1024};
+
+// Fixture state shared by the benchmarks of one size
+typedef struct bench_fixture {
+    int packages;
+    char **names;
+    char **json_files;
+    char **owned_paths;             // One installed file per package
+    char tarballs[2][MAX_PATH];
+} bench_fixture_t;
+
+typedef long (*bench_func_t)(bench_fixture_t *fixture, void *arg);
+
+typedef struct bench_result {
+    const char *name;
+    int packages;
+    int iterations;
+    long ops;                       // Operations per iteration
+    size_t bytes;                   // Bytes processed per operation, if any
+    double best_ns;                 // Per operation
+    double mean_ns;
+} bench_result_t;
+
+static FILE *bench_output = NULL;
+static const char *bench_filter = NULL;
+static uint32_t bench_seed = 0x9e3779b9U;
+
+// Helpers
+static long long bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Deterministic xorshift, so every run sees the same fixtures
+static uint32_t bench_random(void) {
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+static void bench_print_list(FILE *fp, const char *key, int *ids, int count,
+                             const bench_fixture_t *fixture) {
+    fprintf(fp, "  \"%s\": [", key);
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "%s\"%s\"", i ? ", " : "", fixture->names[ids[i]]);
+    }
+    fprintf(fp, "],\n");
+}
+
+// Pick distinct dependencies below a package. Half of them come from the
+// core set at the bottom, which gives the shared fan-in of real
+// repositories; the rest are spread over everything below.
+static int bench_pick_deps(int id, int packages, int max, int *deps) {
+    int below = packages - id - 1;
+    int count = below > 0 ? (int)(bench_random() % (uint32_t)(max + 1)) : 0;
+    int picked = 0;
+
+    for (int attempt = 0; picked < count && attempt < count * 4; attempt++) {
+        int dep;
+        if (bench_random() & 1) {
+            dep = packages - 1 - (int)(bench_random() % (uint32_t)MIN(below, BENCH_CORE_PACKAGES));
+        } else {
+            dep = id + 1 + (int)(bench_random() % (uint32_t)below);
+        }
+
+        int duplicate = 0;
+        for (int i = 0; i < picked; i++) {
+            if (deps[i] == dep) duplicate = 1;
+        }
+        if (!duplicate) deps[picked++] = dep;
+    }
+    return picked;
+}
+
+// Fixture generation
+static int bench_generate_repository(bench_fixture_t *fixture) {
+    char path[MAX_PATH];
+
+    for (int id = 0; id < fixture->packages; id++) {
+        const char *name = fixture->names[id];
+        int deps[BENCH_MAX_DEPS], build_deps[BENCH_MAX_BUILD_DEPS];
+        int dep_count = bench_pick_deps(id, fixture->packages, BENCH_MAX_DEPS, deps);
+        int build_dep_count = bench_pick_deps(id, fixture->packages, BENCH_MAX_BUILD_DEPS,
+                                              build_deps);
+
+        snprintf(path, sizeof(path), "%s/%s", REPO_DIR, name);
+        if (utils_create_directory_recursive(path) != TINYPKG_SUCCESS) {
+            return TINYPKG_ERROR_FILE;
+        }
+        snprintf(path, sizeof(path), "%s/%s/%s.json", REPO_DIR, name, name);
+        fixture->json_files[id] = TINYPKG_STRDUP(path);
+
+        FILE *fp = fopen(path, "w");
+        if (!fp || !fixture->json_files[id]) {
+            if (fp) fclose(fp);
+            fprintf(stderr, "bench: cannot write %s\n", path);
+            return TINYPKG_ERROR_FILE;
+        }
+
+        fprintf(fp, "{\n");
+        fprintf(fp, "  \"name\": \"%s\",\n", name);
+        fprintf(fp, "  \"version\": \"%u.%u.%u\",\n", bench_random() % 10,
+                bench_random() % 30, bench_random() % 10);
+        fprintf(fp, "  \"description\": \"Synthetic %s %s for benchmarking\",\n",
+                bench_words[bench_random() % 12], bench_words[bench_random() % 12]);
+        fprintf(fp, "  \"maintainer\": \"Bench Maintainer <bench%u@example.org>\",\n",
+                bench_random() % 100);
+        fprintf(fp, "  \"homepage\": \"https://example.org/%s\",\n", name);
+        fprintf(fp, "  \"license\": \"%s\",\n", bench_licenses[bench_random() % 6]);
+        fprintf(fp, "  \"category\": \"%s\",\n", bench_categories[bench_random() % 8]);
+        fprintf(fp, "  \"source_url\": \"https://example.org/src/%s.tar.gz\",\n", name);
+        fprintf(fp, "  \"source_type\": \"tarball\",\n");
+        fprintf(fp, "  \"checksum\": \"%08x%08x%08x%08x%08x%08x%08x%08x\",\n",
+                bench_random(), bench_random(), bench_random(), bench_random(),
+                bench_random(), bench_random(), bench_random(), bench_random());
+        fprintf(fp, "  \"build_system\": \"%s\",\n", bench_build_systems[bench_random() % 4]);
+        bench_print_list(fp, "dependencies", deps, dep_count, fixture);
+        bench_print_list(fp, "build_dependencies", build_deps, build_dep_count, fixture);
+        if (id % 10 == 0) {
+            fprintf(fp, "  \"provides\": [\"%s-virtual\"],\n", name);
+        }
+        fprintf(fp, "  \"size_estimate\": %u,\n", 1024 + bench_random() % (64 * 1024 * 1024));
+        fprintf(fp, "  \"build_time_estimate\": %u\n", 10 + bench_random() % 600);
+        fprintf(fp, "}\n");
+        fclose(fp);
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// installed.txt in the legacy format (imported on first open) and one
+// .files list per package
+static int bench_generate_installed(bench_fixture_t *fixture) {
+    char path[MAX_PATH];
+    FILE *db;
+
+    snprintf(path, sizeof(path), "%s/%s", LIB_DIR, PKGDB_LEGACY_FILE);
+    db = fopen(path, "w");
+    if (!db) {
+        fprintf(stderr, "bench: cannot write %s\n", path);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    for (int id = 0; id < fixture->packages; id++) {
+        const char *name = fixture->names[id];
+
+        fprintf(db, "%s\t1.0.%d\tSynthetic package %d\t%ld\t%u\t%d\n", name, id % 10, id,
+                (long)(1700000000 + id), 4096 + bench_random() % (1 << 24), PKG_STATE_INSTALLED);
+
+        snprintf(path, sizeof(path), "%s/%s.files", LIB_DIR, name);
+        FILE *fp = fopen(path, "w");
+        if (!fp) {
+            fclose(db);
+            fprintf(stderr, "bench: cannot write %s\n", path);
+            return TINYPKG_ERROR_FILE;
+        }
+        fprintf(fp, "/usr/bin/%s\n", name);
+        fprintf(fp, "/usr/lib/lib%s.so.1\n", name);
+        fprintf(fp, "/usr/include/%s/%s.h\n", name, name);
+        for (int i = 3; i < BENCH_FILES_PER_PACKAGE; i++) {
+            fprintf(fp, "/usr/share/%s/data/file%02d.dat\n", name, i);
+        }
+        fclose(fp);
+
+        snprintf(path, sizeof(path), "/usr/lib/lib%s.so.1", name);
+        fixture->owned_paths[id] = TINYPKG_STRDUP(path);
+        if (!fixture->owned_paths[id]) {
+            fclose(db);
+            return TINYPKG_ERROR_MEMORY;
+        }
+    }
+    fclose(db);
+    return TINYPKG_SUCCESS;
+}
+
+static int bench_generate_tarballs(bench_fixture_t *fixture) {
+    char block[65536];
+
+    for (size_t t = 0; t < sizeof(bench_tarball_sizes) / sizeof(bench_tarball_sizes[0]); t++) {
+        snprintf(fixture->tarballs[t], sizeof(fixture->tarballs[t]),
+                 "%s/sources/bench-%zuk.tar.gz", CACHE_DIR, bench_tarball_sizes[t] / 1024);
+
+        FILE *fp = fopen(fixture->tarballs[t], "wb");
+        if (!fp) {
+            fprintf(stderr, "bench: cannot write %s\n", fixture->tarballs[t]);
+            return TINYPKG_ERROR_FILE;
+        }
+        for (size_t written = 0; written < bench_tarball_sizes[t]; written += sizeof(block)) {
+            for (size_t i = 0; i < sizeof(block); i += sizeof(uint32_t)) {
+                uint32_t value = bench_random();
+                memcpy(block + i, &value, sizeof(value));
+            }
+            fwrite(block, 1, sizeof(block), fp);
+        }
+        fclose(fp);
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static void bench_fixture_free(bench_fixture_t *fixture) {
+    for (int i = 0; i < fixture->packages; i++) {
+        if (fixture->names) TINYPKG_FREE(fixture->names[i]);
+        if (fixture->json_files) TINYPKG_FREE(fixture->json_files[i]);
+        if (fixture->owned_paths) TINYPKG_FREE(fixture->owned_paths[i]);
+    }
+    TINYPKG_FREE(fixture->names);
+    TINYPKG_FREE(fixture->json_files);
+    TINYPKG_FREE(fixture->owned_paths);
+}
+
+static int bench_fixture_create(bench_fixture_t *fixture, int packages) {
+    const char *dirs[] = {CONFIG_DIR, CACHE_DIR "/sources", LIB_DIR, REPO_DIR, LOG_DIR};
+
+    // Start from an empty tree; nothing may stay mapped from the last size
+    pkgdb_close();
+    fileindex_close();
+    repoindex_close();
+    utils_remove_directory_recursive(LIB_DIR);
+    utils_remove_directory_recursive(CACHE_DIR);
+
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        if (utils_create_directory_recursive(dirs[i]) != TINYPKG_SUCCESS) {
+            fprintf(stderr, "bench: cannot create %s\n", dirs[i]);
+            return TINYPKG_ERROR_FILE;
+        }
+    }
+
+    memset(fixture, 0, sizeof(*fixture));
+    fixture->packages = packages;
+    fixture->names = TINYPKG_CALLOC(packages, sizeof(char *));
+    fixture->json_files = TINYPKG_CALLOC(packages, sizeof(char *));
+    fixture->owned_paths = TINYPKG_CALLOC(packages, sizeof(char *));
+    if (!fixture->names || !fixture->json_files || !fixture->owned_paths) {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    for (int i = 0; i < packages; i++) {
+        char name[MAX_NAME];
+        snprintf(name, sizeof(name), "bench-pkg%05d", i);
+        fixture->names[i] = TINYPKG_STRDUP(name);
+        if (!fixture->names[i]) return TINYPKG_ERROR_MEMORY;
+    }
+
+    bench_seed = 0x9e3779b9U ^ (uint32_t)packages;
+    if (bench_generate_repository(fixture) != TINYPKG_SUCCESS ||
+        bench_generate_installed(fixture) != TINYPKG_SUCCESS ||
+        bench_generate_tarballs(fixture) != TINYPKG_SUCCESS) {
+        return TINYPKG_ERROR_FILE;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Benchmarks; each returns the operations it performed or -1
+static long bench_json_parse(bench_fixture_t *fixture, void *arg) {
+    UNUSED(arg);
+    for (int i = 0; i < fixture->packages; i++) {
+        package_t *pkg = json_parser_load_package_file(fixture->json_files[i]);
+        if (!pkg) return -1;
+        package_free(pkg);
+    }
+    return fixture->packages;
+}
+
+static long bench_repoindex_build(bench_fixture_t *fixture, void *arg) {
+    UNUSED(fixture);
+    UNUSED(arg);
+    return repoindex_build() == TINYPKG_SUCCESS ? 1 : -1;
+}
+
+static long bench_dependency_resolve(bench_fixture_t *fixture, void *arg) {
+    int roots = MIN(fixture->packages, BENCH_RESOLVE_ROOTS);
+    UNUSED(arg);
+
+    for (int i = 0; i < roots; i++) {
+        char **order = NULL;
+        int count = 0;
+
+        if (dependency_resolve(fixture->names[i], &order, &count) != TINYPKG_SUCCESS) {
+            return -1;
+        }
+        for (int j = 0; j < count; j++) {
+            TINYPKG_FREE(order[j]);
+        }
+        TINYPKG_FREE(order);
+    }
+    return roots;
+}
+
+static long bench_search(bench_fixture_t *fixture, void *arg) {
+    static const char *queries[] = {"compression", "bench-pkg0001", "net", "virtual tool"};
+    UNUSED(fixture);
+    UNUSED(arg);
+
+    for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+        search_result_t *results = NULL;
+        int count = 0;
+
+        if (search_query(queries[i], &results, &count) != TINYPKG_SUCCESS) return -1;
+        TINYPKG_FREE(results);
+    }
+    return (long)(sizeof(queries) / sizeof(queries[0]));
+}
+
+static long bench_pkgdb_load(bench_fixture_t *fixture, void *arg) {
+    UNUSED(fixture);
+    UNUSED(arg);
+    pkgdb_close();
+    return package_db_load() == TINYPKG_SUCCESS ? 1 : -1;
+}
+
+static long bench_pkgdb_find(bench_fixture_t *fixture, void *arg) {
+    UNUSED(arg);
+    for (int i = 0; i < fixture->packages; i++) {
+        if (!package_db_find(fixture->names[i])) return -1;
+        // A miss probes as far as a hit, so time both
+        if (package_db_find(fixture->json_files[i])) return -1;
+    }
+    return 2L * fixture->packages;
+}
+
+static long bench_owns_file(bench_fixture_t *fixture, void *arg) {
+    char owner[MAX_NAME];
+    UNUSED(arg);
+
+    for (int i = 0; i < fixture->packages; i++) {
+        if (!package_owns_file(fixture->owned_paths[i], owner, sizeof(owner))) return -1;
+        if (package_owns_file(fixture->json_files[i], owner, sizeof(owner))) return -1;
+    }
+    return 2L * fixture->packages;
+}
+
+static long bench_checksum(bench_fixture_t *fixture, void *arg) {
+    const char *tarball = fixture->tarballs[*(const int *)arg];
+    char hash[65];                  // SHA-256 in hex
+
+    return security_calculate_checksum(tarball, hash, sizeof(hash), HASH_TYPE_SHA256) ==
+           TINYPKG_SUCCESS ? 1 : -1;
+}
+
+static void bench_log(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_message_va(LOG_INFO, __FILE__, __LINE__, __func__, format, args);
+    va_end(args);
+}
+
+static long bench_log_message(bench_fixture_t *fixture, void *arg) {
+    UNUSED(fixture);
+    UNUSED(arg);
+
+    for (int i = 0; i < BENCH_LOG_MESSAGES; i++) {
+        bench_log("Building %s (%d of %d): %s", "bench-pkg00042", i, BENCH_LOG_MESSAGES,
+                  "checking for a thread-safe mkdir -p... /usr/bin/mkdir -p");
+    }
+    logging_flush();
+    return BENCH_LOG_MESSAGES;
+}
+
+// Timing and reporting
+static void bench_report(const bench_result_t *result) {
+    double ops_per_sec = result->best_ns > 0 ? 1e9 / result->best_ns : 0;
+
+    if (result->bytes) {
+        printf("%-28s %7d %12.1f ns/op %12.1f MB/s\n", result->name, result->packages,
+               result->best_ns, result->bytes * ops_per_sec / (1024.0 * 1024.0));
+    } else {
+        printf("%-28s %7d %12.1f ns/op %12.0f ops/s\n", result->name, result->packages,
+               result->best_ns, ops_per_sec);
+    }
+
+    if (bench_output) {
+        fprintf(bench_output,
+                "{\"benchmark\": \"%s\", \"packages\": %d, \"iterations\": %d, \"ops\": %ld, "
+                "\"bytes_per_op\": %zu, \"best_ns_per_op\": %.1f, \"mean_ns_per_op\": %.1f, "
+                "\"ops_per_sec\": %.1f}\n",
+                result->name, result->packages, result->iterations, result->ops, result->bytes,
+                result->best_ns, result->mean_ns, ops_per_sec);
+        fflush(bench_output);
+    }
+}
+
+static int bench_run(const char *name, bench_fixture_t *fixture, bench_func_t func, void *arg,
+                     size_t bytes) {
+    bench_result_t result = {name, fixture->packages, 0, 0, bytes, 0, 0};
+    long long total = 0;
+    long long best = 0;
+
+    if (bench_filter && !strstr(name, bench_filter)) {
+        return TINYPKG_SUCCESS;
+    }
+
+    while (result.iterations < BENCH_MAX_ITERATIONS &&
+           (result.iterations < BENCH_MIN_ITERATIONS || total < BENCH_MIN_TIME_NS)) {
+        long long start = bench_now_ns();
+        long ops = func(fixture, arg);
+        long long elapsed = bench_now_ns() - start;
+
+        if (ops <= 0) {
+            fprintf(stderr, "bench: %s failed with %d packages\n", name, fixture->packages);
+            return TINYPKG_ERROR;
+        }
+        result.ops = ops;
+        if (result.iterations == 0 || elapsed < best) best = elapsed;
+        total += elapsed;
+        result.iterations++;
+    }
+
+    result.best_ns = (double)best / result.ops;
+    result.mean_ns = (double)total / result.iterations / result.ops;
+    bench_report(&result);
+    return TINYPKG_SUCCESS;
+}
+
+static int bench_size(int packages) {
+    bench_fixture_t fixture;
+    int checksum_small = 0, checksum_large = 1;
+    int failed = 0;
+
+    logging_set_level(LOG_WARN);
+    if (bench_fixture_create(&fixture, packages) != TINYPKG_SUCCESS) {
+        bench_fixture_free(&fixture);
+        return TINYPKG_ERROR;
+    }
+
+    // Resolution first reads package JSON, then the precompiled index
+    failed |= bench_run("json_parse_package_file", &fixture, bench_json_parse, NULL, 0);
+    failed |= bench_run("dependency_resolve_json", &fixture, bench_dependency_resolve, NULL, 0);
+    failed |= bench_run("repoindex_build", &fixture, bench_repoindex_build, NULL, 0);
+    failed |= bench_run("dependency_resolve_indexed", &fixture, bench_dependency_resolve, NULL, 0);
+    failed |= bench_run("search_query", &fixture, bench_search, NULL, 0);
+
+    // The first open imports installed.txt and builds the file index
+    if (package_db_load() != TINYPKG_SUCCESS || fileindex_open() != TINYPKG_SUCCESS) {
+        fprintf(stderr, "bench: cannot open the package database fixture\n");
+        bench_fixture_free(&fixture);
+        return TINYPKG_ERROR;
+    }
+    failed |= bench_run("package_db_load", &fixture, bench_pkgdb_load, NULL, 0);
+    failed |= bench_run("package_db_find", &fixture, bench_pkgdb_find, NULL, 0);
+    failed |= bench_run("package_owns_file", &fixture, bench_owns_file, NULL, 0);
+
+    failed |= bench_run("checksum_sha256_1m", &fixture, bench_checksum, &checksum_small,
+                        bench_tarball_sizes[0]);
+    failed |= bench_run("checksum_sha256_16m", &fixture, bench_checksum, &checksum_large,
+                        bench_tarball_sizes[1]);
+
+    // Throughput of enabled messages, through both logging backends
+    logging_set_level(LOG_INFO);
+    logging_set_async(0);
+    failed |= bench_run("log_message_sync", &fixture, bench_log_message, NULL, 0);
+    logging_set_async(1);
+    failed |= bench_run("log_message_async", &fixture, bench_log_message, NULL, 0);
+    logging_set_level(LOG_WARN);
+
+    bench_fixture_free(&fixture);
+    return failed ? TINYPKG_ERROR : TINYPKG_SUCCESS;
+}
+
+static void bench_usage(const char *prog_name) {
+    printf("Usage: %s [--sizes N,N,...] [--output FILE] [--filter NAME]\n\n", prog_name);
+    printf("  --sizes N,N,...   Package counts of the generated fixtures (default %s)\n",
+           default_sizes);
+    printf("  --output FILE     Append one JSON object per result to FILE\n");
+    printf("  --filter NAME     Only run benchmarks whose name contains NAME\n");
+}
+
+int main(int argc, char *argv[]) {
+    char sizes[256];
+    const char *output = NULL;
+    int opt;
+    int result = TINYPKG_SUCCESS;
+
+    static struct option long_options[] = {
+        {"sizes",  required_argument, 0, 's'},
+        {"output", required_argument, 0, 'o'},
+        {"filter", required_argument, 0, 'f'},
+        {"help",   no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    snprintf(sizes, sizeof(sizes), "%s", default_sizes);
+    while ((opt = getopt_long(argc, argv, "s:o:f:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                snprintf(sizes, sizeof(sizes), "%s", optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'f':
+                bench_filter = optarg;
+                break;
+            case 'h':
+                bench_usage(argv[0]);
+                return 0;
+            default:
+                bench_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    // Keep the console for results; messages go to the fixture log
+    utils_create_directory_recursive(LOG_DIR);
+    logging_set_output(LOG_OUTPUT_FILE);
+    logging_set_file(LOG_DIR "/bench.log");
+    logging_set_level(LOG_WARN);
+    if (logging_init() != TINYPKG_SUCCESS) {
+        fprintf(stderr, "bench: failed to initialize logging\n");
+        return 1;
+    }
+
+    global_config = config_create_default();
+    if (!global_config) {
+        fprintf(stderr, "bench: failed to create configuration\n");
+        return 1;
+    }
+
+    if (output) {
+        bench_output = fopen(output, "a");
+        if (!bench_output) {
+            fprintf(stderr, "bench: cannot open %s: %s\n", output, strerror(errno));
+            return 1;
+        }
+        fprintf(bench_output, "{\"tinypkg\": \"%s\", \"timestamp\": %ld}\n", TINYPKG_VERSION,
+                (long)time(NULL));
+    }
+
+    printf("%-28s %7s %18s %17s\n", "Benchmark", "Pkgs", "Best", "Throughput");
+    for (char *saveptr = NULL, *size = strtok_r(sizes, ", ", &saveptr); size;
+         size = strtok_r(NULL, ", ", &saveptr)) {
+        int packages = atoi(size);
+        if (packages <= 0) {
+            fprintf(stderr, "bench: invalid size: %s\n", size);
+            result = TINYPKG_ERROR;
+            break;
+        }
+        if (bench_size(packages) != TINYPKG_SUCCESS) {
+            result = TINYPKG_ERROR;
+        }
+    }
+
+    if (bench_output) fclose(bench_output);
+    pkgdb_close();
+    fileindex_close();
+    repoindex_close();
+    config_free(global_config);
+    logging_cleanup();
+    return result == TINYPKG_SUCCESS ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Compare two benchmark result files written by `make bench`.
+# Uses the last run of each benchmark and size in either file and prints
+# the change in best time per operation; positive means slower.
+#
+# Usage: bench/compare.sh OLD.jsonl NEW.jsonl [THRESHOLD_PERCENT]
+# Exits 1 when any benchmark regressed by more than the threshold (default 10).
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 OLD.jsonl NEW.jsonl [THRESHOLD_PERCENT]" >&2
+    exit 2
+fi
+
+awk -v threshold="${3:-10}" '
+function field(line, key,    rest) {
+    if (!match(line, "\"" key "\": *\"?[^,\"}]*")) return ""
+    rest = substr(line, RSTART, RLENGTH)
+    sub("\"" key "\": *\"?", "", rest)
+    return rest
+}
+/"benchmark"/ {
+    id = field($0, "benchmark") " " field($0, "packages")
+    if (FILENAME == ARGV[1]) {
+        old[id] = field($0, "best_ns_per_op")
+    } else {
+        if (!(id in new)) order[count++] = id
+        new[id] = field($0, "best_ns_per_op")
+    }
+}
+END {
+    printf "%-36s %14s %14s %9s\n", "Benchmark", "Old ns/op", "New ns/op", "Change"
+    for (i = 0; i < count; i++) {
+        id = order[i]
+        if (!(id in old) || old[id] == 0) {
+            printf "%-36s %14s %14.1f %9s\n", id, "-", new[id], "new"
+            continue
+        }
+        change = (new[id] - old[id]) * 100.0 / old[id]
+        flag = change > threshold ? "  REGRESSION" : ""
+        if (change > threshold) regressed = 1
+        printf "%-36s %14.1f %14.1f %+8.1f%%%s\n", id, old[id], new[id], change, flag
+    }
+    exit regressed
+}' "$1" "$2"
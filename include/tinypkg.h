@@ -28,13 +28,24 @@
 #define MAX_DESCRIPTION 512
 #define MAX_URL 512
 
-// Default directories
+// Default directories; a build can relocate them (the benchmarks run
+// against fixtures under build/bench)
+#ifndef CONFIG_DIR
 #define CONFIG_DIR "/etc/tinypkg"
+#endif
+#ifndef CACHE_DIR
 #define CACHE_DIR "/var/cache/tinypkg"
+#endif
+#ifndef LIB_DIR
 #define LIB_DIR "/var/lib/tinypkg"
-#define REPO_DIR "/var/lib/tinypkg/repo"
+#endif
+#define REPO_DIR LIB_DIR "/repo"
+#ifndef LOG_DIR
 #define LOG_DIR "/var/log/tinypkg"
+#endif
+#ifndef BUILD_DIR
 #define BUILD_DIR "/tmp/tinypkg-build"
+#endif
 
 // Repository settings
 #define DEFAULT_REPO_URL "https://github.com/user7210unix/tinypkg-repo.git"
@@ -71,7 +82,8 @@ typedef enum {
     BUILD_TYPE_AUTOTOOLS = 0,
     BUILD_TYPE_CMAKE = 1,
     BUILD_TYPE_MAKE = 2,
-    BUILD_TYPE_CUSTOM = 3
+    BUILD_TYPE_CUSTOM = 3,
+    BUILD_TYPE_MESON = 4
 } build_type_t;
 
 // Forward declarations
@@ -123,6 +135,8 @@ extern config_t *global_config;
 // Include module headers
 #include "../src/repository.h"
 #include "../src/download.h"
+#include "../src/mirror.h"
+#include "../src/bincache.h"
 #include "../src/build.h"
 #include "../src/config.h"
 #include "../src/utils.h"
@@ -130,7 +144,25 @@ extern config_t *global_config;
 #include "../src/dependency.h"
 #include "../src/security.h"
 #include "../src/logging.h"
+#include "../src/metrics.h"
+#include "../src/search.h"
 #include "../src/package.h"
+#include "../src/pkgdb.h"
+#include "../src/fileindex.h"
+#include "../src/depindex.h"
+#include "../src/repoindex.h"
+#include "../src/archive.h"
+#include "../src/compcache.h"
+#include "../src/jobserver.h"
+#include "../src/stage.h"
+#include "../src/profile.h"
+#include "../src/buildlog.h"
+#include "../src/prefetch.h"
+#include "../src/scheduler.h"
+#include "../src/verify.h"
+#include "../src/planner.h"
+#include "../src/daemon.h"
+#include "../src/sandbox.h"
 //#include "package.h"
 //#include "repository.h"
 //#include "download.h"
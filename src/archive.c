@@ -0,0 +1,1132 @@
+/*
+ * TinyPkg - Archive Extraction Implementation
+ * In-process, streaming extraction of compressed source tarballs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <bzlib.h>
+#include <lzma.h>
+#include <zstd.h>
+#include "../include/tinypkg.h"
+
+#define ARCHIVE_BLOCK 512
+#define ARCHIVE_CHUNK (256 * 1024)
+
+// Tar reader states
+typedef enum {
+    TAR_STATE_HEADER = 0,
+    TAR_STATE_DATA,             // File contents
+    TAR_STATE_META,             // GNU long name/link or pax header contents
+    TAR_STATE_SKIP,             // Contents of entries we do not extract
+    TAR_STATE_PADDING,
+    TAR_STATE_END
+} tar_state_t;
+
+// Tar stream reader writing entries below root_fd
+typedef struct tar_reader {
+    int root_fd;
+    int strip_components;
+    tar_state_t state;
+    unsigned char header[ARCHIVE_BLOCK];
+    size_t header_fill;
+    int zero_blocks;
+    uint64_t remaining;         // Bytes left in the current entry
+    size_t padding;             // Bytes left to the next block boundary
+
+    // Current entry
+    char type;
+    char path[MAX_PATH];
+    char link[MAX_PATH];
+    mode_t mode;
+    time_t mtime;
+    int fd;
+
+    // Metadata for the next entry
+    char meta_type;
+    char *meta;
+    size_t meta_length;
+    char *next_path;
+    char *next_link;
+    uint64_t next_size;
+    int have_next_size;
+    time_t next_mtime;
+    int have_next_mtime;
+
+    // Last parent directory opened, reused for consecutive entries
+    char dir_path[MAX_PATH];
+    int dir_fd;
+
+    char error[MAX_PATH + 64];
+} tar_reader_t;
+
+// Decompressor in front of the tar reader
+typedef struct archive_pipeline {
+    archive_format_t format;
+    unsigned char detect[ARCHIVE_DETECT_SIZE];
+    size_t detect_length;
+    int detected;
+    int decoder_ready;
+    int stream_end;
+    z_stream zlib;
+    bz_stream bzip2;
+    lzma_stream xz;
+    ZSTD_DStream *zstd;
+    unsigned char *out;
+    tar_reader_t tar;
+    int result;
+} archive_pipeline_t;
+
+// Streaming extractor: producer -> ring buffer -> worker -> pipeline
+struct archive_extractor {
+    char dest_dir[MAX_PATH];
+    int strip_components;
+    archive_pipeline_t pipeline;
+
+    unsigned char *queue;
+    size_t head;
+    size_t count;
+    off_t consumed;             // Bytes accepted since the last reset
+    int finishing;
+    int aborting;
+    int restarting;             // Worker clears dest_dir before taking more bytes
+    unsigned generation;        // Bumped by each restart
+    int failed;                 // Pipeline error; later bytes are dropped
+    int worker_running;
+    int result;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+// Format detection
+archive_format_t archive_detect_format(const unsigned char *data, size_t length) {
+    if (!data) return ARCHIVE_FORMAT_UNKNOWN;
+
+    if (length >= 2 && data[0] == 0x1f && data[1] == 0x8b) return ARCHIVE_FORMAT_GZIP;
+    if (length >= 3 && memcmp(data, "BZh", 3) == 0) return ARCHIVE_FORMAT_BZIP2;
+    if (length >= 6 && memcmp(data, "\xfd" "7zXZ\0", 6) == 0) return ARCHIVE_FORMAT_XZ;
+    if (length >= 4 && memcmp(data, "\x28\xb5\x2f\xfd", 4) == 0) return ARCHIVE_FORMAT_ZSTD;
+    if (length >= 4 && memcmp(data, "PK\x03\x04", 4) == 0) return ARCHIVE_FORMAT_ZIP;
+    if (length >= 262 && memcmp(data + 257, "ustar", 5) == 0) return ARCHIVE_FORMAT_TAR;
+
+    return ARCHIVE_FORMAT_UNKNOWN;
+}
+
+const char *archive_format_to_string(archive_format_t format) {
+    switch (format) {
+        case ARCHIVE_FORMAT_TAR: return "tar";
+        case ARCHIVE_FORMAT_GZIP: return "gzip";
+        case ARCHIVE_FORMAT_BZIP2: return "bzip2";
+        case ARCHIVE_FORMAT_XZ: return "xz";
+        case ARCHIVE_FORMAT_ZSTD: return "zstd";
+        case ARCHIVE_FORMAT_ZIP: return "zip";
+        default: return "unknown";
+    }
+}
+
+// Tar numeric fields: octal, or GNU base-256 for large values
+static uint64_t tar_number(const unsigned char *field, size_t size) {
+    uint64_t value = 0;
+
+    if (field[0] & 0x80) {
+        for (size_t i = 1; i < size; i++) {
+            value = (value << 8) | field[i];
+        }
+        return value;
+    }
+
+    size_t i = 0;
+    while (i < size && (field[i] == ' ' || field[i] == '\0')) i++;
+    for (; i < size && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = (value << 3) | (uint64_t)(field[i] - '0');
+    }
+    return value;
+}
+
+static int tar_checksum_ok(const unsigned char *header) {
+    uint64_t expected = tar_number(header + 148, 8);
+    uint64_t sum = 0;
+
+    for (int i = 0; i < ARCHIVE_BLOCK; i++) {
+        sum += (i >= 148 && i < 156) ? ' ' : header[i];
+    }
+    return sum == expected;
+}
+
+// Normalize an entry path: drop leading "/" and "." components, refuse
+// "..", and strip leading components. Returns 0 if nothing is left.
+static int tar_clean_path(const char *path, int strip, char *out, size_t out_size) {
+    char copy[MAX_PATH];
+    char *save = NULL;
+    size_t used = 0;
+    int skipped = 0;
+
+    if (strlen(path) >= sizeof(copy)) return -1;
+    strcpy(copy, path);
+    out[0] = '\0';
+
+    for (char *part = strtok_r(copy, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        if (strcmp(part, ".") == 0) continue;
+        if (strcmp(part, "..") == 0) return -1;
+        if (skipped < strip) {
+            skipped++;
+            continue;
+        }
+
+        size_t length = strlen(part);
+        if (used + length + 2 > out_size) return -1;
+        if (used > 0) out[used++] = '/';
+        memcpy(out + used, part, length);
+        used += length;
+        out[used] = '\0';
+    }
+
+    return used > 0;
+}
+
+// Open (creating as needed) the directory holding path, without following
+// symlinks, and return the last component in leaf
+static int tar_open_dir(tar_reader_t *tar, const char *dir_path) {
+    int fd = dup(tar->root_fd);
+    char copy[MAX_PATH];
+    char *save = NULL;
+
+    if (fd < 0) return -1;
+    strncpy(copy, dir_path, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    for (char *part = strtok_r(copy, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        int next = openat(fd, part, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (next < 0 && errno == ENOENT) {
+            if (mkdirat(fd, part, 0755) != 0 && errno != EEXIST) {
+                close(fd);
+                return -1;
+            }
+            next = openat(fd, part, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        }
+        close(fd);
+        if (next < 0) return -1;
+        fd = next;
+    }
+    return fd;
+}
+
+static int tar_parent(tar_reader_t *tar, const char *path, const char **leaf) {
+    const char *slash = strrchr(path, '/');
+    char dir_path[MAX_PATH];
+
+    if (!slash) {
+        *leaf = path;
+        return tar->root_fd;
+    }
+
+    size_t length = (size_t)(slash - path);
+    memcpy(dir_path, path, length);
+    dir_path[length] = '\0';
+    *leaf = slash + 1;
+
+    if (tar->dir_fd >= 0 && strcmp(tar->dir_path, dir_path) == 0) {
+        return tar->dir_fd;
+    }
+
+    if (tar->dir_fd >= 0) close(tar->dir_fd);
+    tar->dir_fd = tar_open_dir(tar, dir_path);
+    strcpy(tar->dir_path, tar->dir_fd >= 0 ? dir_path : "");
+    return tar->dir_fd;
+}
+
+static void tar_set_mtime(int dir_fd, const char *leaf, time_t mtime, int flags) {
+    struct timespec times[2] = { { mtime, 0 }, { mtime, 0 } };
+    utimensat(dir_fd, leaf, times, flags);
+}
+
+static int tar_fail(tar_reader_t *tar, const char *message, const char *path) {
+    snprintf(tar->error, sizeof(tar->error), "%s: %s", message, path);
+    return TINYPKG_ERROR;
+}
+
+// Create the entry described by the current header
+static int tar_begin_entry(tar_reader_t *tar) {
+    const char *leaf;
+    int dir_fd;
+
+    switch (tar->type) {
+        case '0':
+        case '\0':
+        case '7':
+            dir_fd = tar_parent(tar, tar->path, &leaf);
+            if (dir_fd < 0) return tar_fail(tar, "cannot create directory for", tar->path);
+
+            tar->fd = openat(dir_fd, leaf, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                             0600);
+            if (tar->fd < 0 && (errno == ELOOP || errno == EISDIR || errno == ETXTBSY)) {
+                unlinkat(dir_fd, leaf, 0);
+                tar->fd = openat(dir_fd, leaf,
+                                 O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+            }
+            if (tar->fd < 0) return tar_fail(tar, "cannot create", tar->path);
+            tar->state = tar->remaining > 0 ? TAR_STATE_DATA : TAR_STATE_PADDING;
+            return TINYPKG_SUCCESS;
+
+        case '5':
+            dir_fd = tar_parent(tar, tar->path, &leaf);
+            if (dir_fd < 0 || (mkdirat(dir_fd, leaf, (tar->mode & 0777) | 0700) != 0 &&
+                               errno != EEXIST)) {
+                return tar_fail(tar, "cannot create directory", tar->path);
+            }
+            break;
+
+        case '2':
+            dir_fd = tar_parent(tar, tar->path, &leaf);
+            if (dir_fd < 0) return tar_fail(tar, "cannot create directory for", tar->path);
+            unlinkat(dir_fd, leaf, 0);
+            if (symlinkat(tar->link, dir_fd, leaf) != 0) {
+                return tar_fail(tar, "cannot create symlink", tar->path);
+            }
+            tar_set_mtime(dir_fd, leaf, tar->mtime, AT_SYMLINK_NOFOLLOW);
+            break;
+
+        case '1': {
+            char target[MAX_PATH];
+            const char *target_leaf;
+            int target_fd;
+
+            if (tar_clean_path(tar->link, tar->strip_components, target, sizeof(target)) <= 0) {
+                break;
+            }
+
+            // The target's directory is opened separately from the cached one
+            const char *slash = strrchr(target, '/');
+            if (slash) {
+                char target_dir[MAX_PATH];
+                memcpy(target_dir, target, (size_t)(slash - target));
+                target_dir[slash - target] = '\0';
+                target_fd = tar_open_dir(tar, target_dir);
+                target_leaf = slash + 1;
+            } else {
+                target_fd = dup(tar->root_fd);
+                target_leaf = target;
+            }
+
+            dir_fd = tar_parent(tar, tar->path, &leaf);
+            if (target_fd >= 0 && dir_fd >= 0) {
+                unlinkat(dir_fd, leaf, 0);
+                if (linkat(target_fd, target_leaf, dir_fd, leaf, 0) != 0) {
+                    log_warn("Cannot create hard link %s -> %s", tar->path, target);
+                }
+            }
+            if (target_fd >= 0) close(target_fd);
+            break;
+        }
+
+        default:
+            // Devices, FIFOs and unknown types are not extracted
+            log_debug("Skipping tar entry of type '%c': %s", tar->type, tar->path);
+            break;
+    }
+
+    tar->state = tar->remaining > 0 ? TAR_STATE_SKIP : TAR_STATE_PADDING;
+    return TINYPKG_SUCCESS;
+}
+
+static int tar_finish_entry(tar_reader_t *tar) {
+    if (tar->fd < 0) return TINYPKG_SUCCESS;
+
+    struct timespec times[2] = { { tar->mtime, 0 }, { tar->mtime, 0 } };
+    fchmod(tar->fd, tar->mode & 0777);
+    futimens(tar->fd, times);
+
+    int result = close(tar->fd) == 0 ? TINYPKG_SUCCESS :
+                 tar_fail(tar, "write error", tar->path);
+    tar->fd = -1;
+    return result;
+}
+
+// Apply pax records ("<length> <key>=<value>\n") to the next entry
+static void tar_parse_pax(tar_reader_t *tar) {
+    char *p = tar->meta;
+    char *end = tar->meta + tar->meta_length;
+
+    while (p < end) {
+        char *space;
+        long length = strtol(p, &space, 10);
+        if (length <= 0 || space >= end || *space != ' ' || p + length > end) break;
+
+        char *key = space + 1;
+        char *record_end = p + length - 1;     // The trailing newline
+        char *eq = memchr(key, '=', (size_t)(record_end - key));
+        if (eq) {
+            *eq = '\0';
+            *record_end = '\0';
+            char *value = eq + 1;
+
+            if (strcmp(key, "path") == 0) {
+                TINYPKG_FREE(tar->next_path);
+                tar->next_path = TINYPKG_STRDUP(value);
+            } else if (strcmp(key, "linkpath") == 0) {
+                TINYPKG_FREE(tar->next_link);
+                tar->next_link = TINYPKG_STRDUP(value);
+            } else if (strcmp(key, "size") == 0) {
+                tar->next_size = strtoull(value, NULL, 10);
+                tar->have_next_size = 1;
+            } else if (strcmp(key, "mtime") == 0) {
+                tar->next_mtime = (time_t)strtoll(value, NULL, 10);
+                tar->have_next_mtime = 1;
+            }
+        }
+        p += length;
+    }
+}
+
+static void tar_finish_meta(tar_reader_t *tar) {
+    if (!tar->meta) return;
+    tar->meta[tar->meta_length] = '\0';
+
+    if (tar->meta_type == 'L') {
+        TINYPKG_FREE(tar->next_path);
+        tar->next_path = TINYPKG_STRDUP(tar->meta);
+    } else if (tar->meta_type == 'K') {
+        TINYPKG_FREE(tar->next_link);
+        tar->next_link = TINYPKG_STRDUP(tar->meta);
+    } else if (tar->meta_type == 'x') {
+        tar_parse_pax(tar);
+    }
+    TINYPKG_FREE(tar->meta);
+    tar->meta_length = 0;
+}
+
+static void tar_clear_next(tar_reader_t *tar) {
+    TINYPKG_FREE(tar->next_path);
+    TINYPKG_FREE(tar->next_link);
+    tar->have_next_size = 0;
+    tar->have_next_mtime = 0;
+}
+
+static int tar_parse_header(tar_reader_t *tar) {
+    const unsigned char *h = tar->header;
+    char name[MAX_PATH];
+
+    // Two zero blocks end the archive
+    int zero = 1;
+    for (int i = 0; i < ARCHIVE_BLOCK && zero; i++) zero = h[i] == 0;
+    if (zero) {
+        if (++tar->zero_blocks == 2) tar->state = TAR_STATE_END;
+        return TINYPKG_SUCCESS;
+    }
+    tar->zero_blocks = 0;
+
+    if (!tar_checksum_ok(h)) {
+        snprintf(tar->error, sizeof(tar->error), "invalid tar header checksum");
+        return TINYPKG_ERROR;
+    }
+
+    tar->type = (char)h[156];
+    tar->mode = (mode_t)tar_number(h + 100, 8);
+    tar->mtime = (time_t)tar_number(h + 136, 12);
+    tar->remaining = tar_number(h + 124, 12);
+
+    // Metadata entries describe the header that follows
+    if (tar->type == 'L' || tar->type == 'K' || tar->type == 'x' || tar->type == 'g') {
+        tar->padding = (size_t)((ARCHIVE_BLOCK - tar->remaining % ARCHIVE_BLOCK) % ARCHIVE_BLOCK);
+    } else {
+        if (tar->have_next_size) tar->remaining = tar->next_size;
+        if (tar->have_next_mtime) tar->mtime = tar->next_mtime;
+        tar->padding = (size_t)((ARCHIVE_BLOCK - tar->remaining % ARCHIVE_BLOCK) % ARCHIVE_BLOCK);
+    }
+
+    if (tar->type == 'L' || tar->type == 'K' || tar->type == 'x') {
+        if (tar->remaining > ARCHIVE_MAX_META) {
+            snprintf(tar->error, sizeof(tar->error), "tar metadata too large");
+            return TINYPKG_ERROR;
+        }
+        tar->meta_type = tar->type;
+        tar->meta = TINYPKG_MALLOC((size_t)tar->remaining + 1);
+        if (!tar->meta) return TINYPKG_ERROR_MEMORY;
+        tar->meta_length = 0;
+        tar->state = tar->remaining > 0 ? TAR_STATE_META : TAR_STATE_PADDING;
+        if (tar->remaining == 0) tar_finish_meta(tar);
+        return TINYPKG_SUCCESS;
+    }
+    if (tar->type == 'g') {
+        tar->state = tar->remaining > 0 ? TAR_STATE_SKIP : TAR_STATE_PADDING;
+        return TINYPKG_SUCCESS;
+    }
+
+    // ustar splits long names into prefix and name
+    if (tar->next_path) {
+        snprintf(name, sizeof(name), "%s", tar->next_path);
+    } else if (memcmp(h + 257, "ustar", 5) == 0 && h[345]) {
+        snprintf(name, sizeof(name), "%.155s/%.100s", (const char *)h + 345, (const char *)h);
+    } else {
+        snprintf(name, sizeof(name), "%.100s", (const char *)h);
+    }
+
+    if (tar->next_link) {
+        snprintf(tar->link, sizeof(tar->link), "%s", tar->next_link);
+    } else {
+        snprintf(tar->link, sizeof(tar->link), "%.100s", (const char *)h + 157);
+    }
+    tar_clear_next(tar);
+
+    int clean = tar_clean_path(name, tar->strip_components, tar->path, sizeof(tar->path));
+    if (clean < 0) {
+        log_warn("Skipping unsafe archive path: %s", name);
+    }
+    if (clean <= 0) {
+        tar->state = tar->remaining > 0 ? TAR_STATE_SKIP : TAR_STATE_PADDING;
+        return TINYPKG_SUCCESS;
+    }
+
+    return tar_begin_entry(tar);
+}
+
+// Feed decompressed tar data
+static int tar_feed(tar_reader_t *tar, const unsigned char *data, size_t length) {
+    while (length > 0) {
+        size_t n;
+
+        switch (tar->state) {
+            case TAR_STATE_HEADER:
+                n = MIN(length, ARCHIVE_BLOCK - tar->header_fill);
+                memcpy(tar->header + tar->header_fill, data, n);
+                tar->header_fill += n;
+                if (tar->header_fill == ARCHIVE_BLOCK) {
+                    tar->header_fill = 0;
+                    int result = tar_parse_header(tar);
+                    if (result != TINYPKG_SUCCESS) return result;
+                }
+                break;
+
+            case TAR_STATE_DATA:
+            case TAR_STATE_META:
+            case TAR_STATE_SKIP:
+                n = (size_t)MIN((uint64_t)length, tar->remaining);
+                if (tar->state == TAR_STATE_DATA) {
+                    size_t written = 0;
+                    while (written < n) {
+                        ssize_t w = write(tar->fd, data + written, n - written);
+                        if (w < 0 && errno == EINTR) continue;
+                        if (w <= 0) return tar_fail(tar, "write error", tar->path);
+                        written += (size_t)w;
+                    }
+                } else if (tar->state == TAR_STATE_META) {
+                    memcpy(tar->meta + tar->meta_length, data, n);
+                    tar->meta_length += n;
+                }
+                tar->remaining -= n;
+                if (tar->remaining == 0) {
+                    if (tar->state == TAR_STATE_META) tar_finish_meta(tar);
+                    tar->state = TAR_STATE_PADDING;
+                }
+                break;
+
+            case TAR_STATE_PADDING:
+                n = MIN(length, tar->padding);
+                tar->padding -= n;
+                if (tar->padding == 0) {
+                    int result = tar_finish_entry(tar);
+                    if (result != TINYPKG_SUCCESS) return result;
+                    tar->state = TAR_STATE_HEADER;
+                }
+                break;
+
+            case TAR_STATE_END:
+            default:
+                return TINYPKG_SUCCESS;     // Trailing blocks after the end marker
+        }
+
+        data += n;
+        length -= n;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Entries that end exactly at the end of the data still need closing
+static int tar_finish(tar_reader_t *tar) {
+    if (tar->state == TAR_STATE_PADDING && tar->padding == 0) {
+        int result = tar_finish_entry(tar);
+        if (result != TINYPKG_SUCCESS) return result;
+        tar->state = TAR_STATE_HEADER;
+    }
+    if (tar->state == TAR_STATE_END ||
+        (tar->state == TAR_STATE_HEADER && tar->header_fill == 0)) {
+        return TINYPKG_SUCCESS;
+    }
+    snprintf(tar->error, sizeof(tar->error), "archive is truncated");
+    return TINYPKG_ERROR;
+}
+
+static void tar_free(tar_reader_t *tar) {
+    if (tar->fd >= 0) close(tar->fd);
+    if (tar->dir_fd >= 0) close(tar->dir_fd);
+    if (tar->root_fd >= 0) close(tar->root_fd);
+    tar->fd = tar->dir_fd = tar->root_fd = -1;
+    TINYPKG_FREE(tar->meta);
+    tar_clear_next(tar);
+}
+
+// Decompression pipeline
+static int pipeline_init(archive_pipeline_t *p, const char *dest_dir, int strip_components) {
+    memset(p, 0, sizeof(*p));
+    p->tar.fd = -1;
+    p->tar.dir_fd = -1;
+    p->tar.root_fd = -1;
+    p->tar.strip_components = strip_components;
+
+    if (utils_create_directory_recursive(dest_dir) != TINYPKG_SUCCESS) {
+        return TINYPKG_ERROR_FILE;
+    }
+    p->tar.root_fd = open(dest_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (p->tar.root_fd < 0) {
+        log_error("Cannot open extraction directory: %s", dest_dir);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    p->out = TINYPKG_MALLOC(ARCHIVE_CHUNK);
+    return p->out ? TINYPKG_SUCCESS : TINYPKG_ERROR_MEMORY;
+}
+
+static void pipeline_free(archive_pipeline_t *p) {
+    if (p->decoder_ready) {
+        switch (p->format) {
+            case ARCHIVE_FORMAT_GZIP: inflateEnd(&p->zlib); break;
+            case ARCHIVE_FORMAT_BZIP2: BZ2_bzDecompressEnd(&p->bzip2); break;
+            case ARCHIVE_FORMAT_XZ: lzma_end(&p->xz); break;
+            case ARCHIVE_FORMAT_ZSTD: ZSTD_freeDStream(p->zstd); break;
+            default: break;
+        }
+        p->decoder_ready = 0;
+    }
+    tar_free(&p->tar);
+    TINYPKG_FREE(p->out);
+}
+
+static int pipeline_start_decoder(archive_pipeline_t *p) {
+    switch (p->format) {
+        case ARCHIVE_FORMAT_TAR:
+            break;
+
+        case ARCHIVE_FORMAT_GZIP:
+            // 15 + 32: gzip or zlib header, detected automatically
+            if (inflateInit2(&p->zlib, 15 + 32) != Z_OK) return TINYPKG_ERROR;
+            break;
+
+        case ARCHIVE_FORMAT_BZIP2:
+            if (BZ2_bzDecompressInit(&p->bzip2, 0, 0) != BZ_OK) return TINYPKG_ERROR;
+            break;
+
+        case ARCHIVE_FORMAT_XZ: {
+            lzma_stream init = LZMA_STREAM_INIT;
+            p->xz = init;
+#if LZMA_VERSION >= 50040002
+            // Files written with xz -T have independent blocks that decode
+            // in parallel; single-block files fall back to one thread
+            lzma_mt mt;
+            memset(&mt, 0, sizeof(mt));
+            mt.flags = LZMA_CONCATENATED;
+            mt.threads = global_config && global_config->parallel_jobs > 0 ?
+                         (uint32_t)global_config->parallel_jobs : lzma_cputhreads();
+            mt.memlimit_threading = lzma_physmem() / 4;
+            mt.memlimit_stop = UINT64_MAX;
+            if (mt.threads == 0) mt.threads = 1;
+            if (lzma_stream_decoder_mt(&p->xz, &mt) != LZMA_OK)
+#endif
+            if (lzma_stream_decoder(&p->xz, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+                return TINYPKG_ERROR;
+            }
+            break;
+        }
+
+        case ARCHIVE_FORMAT_ZSTD:
+            p->zstd = ZSTD_createDStream();
+            if (!p->zstd || ZSTD_isError(ZSTD_initDStream(p->zstd))) {
+                if (p->zstd) ZSTD_freeDStream(p->zstd);
+                return TINYPKG_ERROR;
+            }
+            break;
+
+        case ARCHIVE_FORMAT_ZIP:
+            snprintf(p->tar.error, sizeof(p->tar.error), "zip archives cannot be streamed");
+            return TINYPKG_ERROR;
+
+        default:
+            snprintf(p->tar.error, sizeof(p->tar.error), "unrecognized archive format");
+            return TINYPKG_ERROR;
+    }
+
+    p->decoder_ready = p->format != ARCHIVE_FORMAT_TAR;
+    log_debug("Extracting %s archive", archive_format_to_string(p->format));
+    return TINYPKG_SUCCESS;
+}
+
+// Run compressed input through the decoder into the tar reader
+static int pipeline_decode(archive_pipeline_t *p, const unsigned char *data, size_t length,
+                           int finish) {
+    int result = TINYPKG_SUCCESS;
+
+    if (p->tar.state == TAR_STATE_END) return TINYPKG_SUCCESS;
+
+    switch (p->format) {
+        case ARCHIVE_FORMAT_TAR:
+            return tar_feed(&p->tar, data, length);
+
+        case ARCHIVE_FORMAT_GZIP:
+            p->zlib.next_in = (Bytef *)data;
+            p->zlib.avail_in = (uInt)length;
+            while (result == TINYPKG_SUCCESS && (p->zlib.avail_in > 0 || !p->stream_end)) {
+                // Concatenated gzip members continue after a stream end
+                if (p->stream_end) {
+                    if (inflateReset(&p->zlib) != Z_OK) return TINYPKG_ERROR;
+                    p->stream_end = 0;
+                }
+                p->zlib.next_out = p->out;
+                p->zlib.avail_out = ARCHIVE_CHUNK;
+                int ret = inflate(&p->zlib, Z_NO_FLUSH);
+                if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                    snprintf(p->tar.error, sizeof(p->tar.error), "gzip: %s",
+                             p->zlib.msg ? p->zlib.msg : "data error");
+                    return TINYPKG_ERROR;
+                }
+                result = tar_feed(&p->tar, p->out, ARCHIVE_CHUNK - p->zlib.avail_out);
+                if (ret == Z_STREAM_END) p->stream_end = 1;
+                if (p->tar.state == TAR_STATE_END) break;
+                if (p->zlib.avail_out != 0 && p->zlib.avail_in == 0) break;
+            }
+            break;
+
+        case ARCHIVE_FORMAT_BZIP2:
+            p->bzip2.next_in = (char *)data;
+            p->bzip2.avail_in = (unsigned int)length;
+            while (result == TINYPKG_SUCCESS && (p->bzip2.avail_in > 0 || !p->stream_end)) {
+                if (p->stream_end) {
+                    unsigned int avail = p->bzip2.avail_in;
+                    BZ2_bzDecompressEnd(&p->bzip2);
+                    memset(&p->bzip2, 0, sizeof(p->bzip2));
+                    p->bzip2.next_in = (char *)data + (length - avail);
+                    p->bzip2.avail_in = avail;
+                    if (BZ2_bzDecompressInit(&p->bzip2, 0, 0) != BZ_OK) return TINYPKG_ERROR;
+                    p->stream_end = 0;
+                }
+                p->bzip2.next_out = (char *)p->out;
+                p->bzip2.avail_out = ARCHIVE_CHUNK;
+                int ret = BZ2_bzDecompress(&p->bzip2);
+                if (ret != BZ_OK && ret != BZ_STREAM_END) {
+                    snprintf(p->tar.error, sizeof(p->tar.error), "bzip2: data error %d", ret);
+                    return TINYPKG_ERROR;
+                }
+                result = tar_feed(&p->tar, p->out, ARCHIVE_CHUNK - p->bzip2.avail_out);
+                if (ret == BZ_STREAM_END) p->stream_end = 1;
+                if (p->tar.state == TAR_STATE_END) break;
+                if (p->bzip2.avail_out != 0 && p->bzip2.avail_in == 0) break;
+            }
+            break;
+
+        case ARCHIVE_FORMAT_XZ:
+            p->xz.next_in = data;
+            p->xz.avail_in = length;
+            while (result == TINYPKG_SUCCESS) {
+                p->xz.next_out = p->out;
+                p->xz.avail_out = ARCHIVE_CHUNK;
+                lzma_ret ret = lzma_code(&p->xz, finish ? LZMA_FINISH : LZMA_RUN);
+                if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+                    snprintf(p->tar.error, sizeof(p->tar.error), "xz: data error %d", (int)ret);
+                    return TINYPKG_ERROR;
+                }
+                result = tar_feed(&p->tar, p->out, ARCHIVE_CHUNK - p->xz.avail_out);
+                if (ret == LZMA_STREAM_END) {
+                    p->stream_end = 1;
+                    break;
+                }
+                if (p->tar.state == TAR_STATE_END) break;
+                if (p->xz.avail_out != 0 && p->xz.avail_in == 0 && !finish) break;
+            }
+            break;
+
+        case ARCHIVE_FORMAT_ZSTD: {
+            ZSTD_inBuffer in = { data, length, 0 };
+            size_t ret = 1;
+            while (result == TINYPKG_SUCCESS) {
+                ZSTD_outBuffer out = { p->out, ARCHIVE_CHUNK, 0 };
+                ret = ZSTD_decompressStream(p->zstd, &out, &in);
+                if (ZSTD_isError(ret)) {
+                    snprintf(p->tar.error, sizeof(p->tar.error), "zstd: %s",
+                             ZSTD_getErrorName(ret));
+                    return TINYPKG_ERROR;
+                }
+                result = tar_feed(&p->tar, p->out, out.pos);
+                if (p->tar.state == TAR_STATE_END) break;
+                if (in.pos == in.size && out.pos < out.size) break;
+            }
+            // 0 means the last frame is complete
+            p->stream_end = ret == 0;
+            break;
+        }
+
+        default:
+            return TINYPKG_ERROR;
+    }
+
+    return result;
+}
+
+static int pipeline_feed(archive_pipeline_t *p, const unsigned char *data, size_t length) {
+    if (p->result != TINYPKG_SUCCESS) return p->result;
+
+    // Buffer the first bytes until the format is known
+    if (!p->detected) {
+        size_t n = MIN(length, ARCHIVE_DETECT_SIZE - p->detect_length);
+        memcpy(p->detect + p->detect_length, data, n);
+        p->detect_length += n;
+        data += n;
+        length -= n;
+        if (p->detect_length < ARCHIVE_DETECT_SIZE) return TINYPKG_SUCCESS;
+
+        p->detected = 1;
+        p->format = archive_detect_format(p->detect, p->detect_length);
+        p->result = pipeline_start_decoder(p);
+        if (p->result == TINYPKG_SUCCESS) {
+            p->result = pipeline_decode(p, p->detect, p->detect_length, 0);
+        }
+        if (p->result != TINYPKG_SUCCESS) return p->result;
+    }
+
+    if (length > 0) {
+        p->result = pipeline_decode(p, data, length, 0);
+    }
+    return p->result;
+}
+
+static int pipeline_finish(archive_pipeline_t *p) {
+    if (p->result != TINYPKG_SUCCESS) return p->result;
+
+    // Archives shorter than the detection window
+    if (!p->detected) {
+        p->detected = 1;
+        p->format = archive_detect_format(p->detect, p->detect_length);
+        p->result = pipeline_start_decoder(p);
+        if (p->result == TINYPKG_SUCCESS) {
+            p->result = pipeline_decode(p, p->detect, p->detect_length, 0);
+        }
+        if (p->result != TINYPKG_SUCCESS) return p->result;
+    }
+
+    if (p->format == ARCHIVE_FORMAT_XZ && !p->stream_end && p->tar.state != TAR_STATE_END) {
+        p->result = pipeline_decode(p, NULL, 0, 1);
+        if (p->result != TINYPKG_SUCCESS) return p->result;
+    }
+
+    if (p->format != ARCHIVE_FORMAT_TAR && !p->stream_end && p->tar.state != TAR_STATE_END) {
+        snprintf(p->tar.error, sizeof(p->tar.error), "compressed stream is truncated");
+        p->result = TINYPKG_ERROR;
+        return p->result;
+    }
+
+    p->result = tar_finish(&p->tar);
+    return p->result;
+}
+
+// Zip archives need their central directory, so they go through unzip
+static int archive_extract_zip(const char *archive_path, const char *dest_dir) {
+    char cmd[MAX_CMD];
+
+    if (snprintf(cmd, sizeof(cmd), "unzip -q -o '%s' -d '%s'", archive_path, dest_dir) >=
+        (int)sizeof(cmd)) {
+        log_error("Extract command too long");
+        return TINYPKG_ERROR;
+    }
+    return utils_run_command(cmd, NULL);
+}
+
+// Extract an archive file in the calling thread
+int archive_extract_file(const char *archive_path, const char *dest_dir,
+                         int strip_components) {
+    archive_pipeline_t pipeline;
+    unsigned char magic[ARCHIVE_DETECT_SIZE];
+
+    if (!archive_path || !dest_dir) return TINYPKG_ERROR;
+
+    int fd = open(archive_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_error("Cannot open archive: %s", archive_path);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    ssize_t n = pread(fd, magic, sizeof(magic), 0);
+    if (n > 0 && archive_detect_format(magic, (size_t)n) == ARCHIVE_FORMAT_ZIP) {
+        close(fd);
+        return archive_extract_zip(archive_path, dest_dir);
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int result = pipeline_init(&pipeline, dest_dir, strip_components);
+    unsigned char *buffer = TINYPKG_MALLOC(ARCHIVE_CHUNK);
+    if (!buffer && result == TINYPKG_SUCCESS) result = TINYPKG_ERROR_MEMORY;
+
+    while (result == TINYPKG_SUCCESS) {
+        n = read(fd, buffer, ARCHIVE_CHUNK);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            result = TINYPKG_ERROR_FILE;
+            break;
+        }
+        if (n == 0) {
+            result = pipeline_finish(&pipeline);
+            break;
+        }
+        result = pipeline_feed(&pipeline, buffer, (size_t)n);
+    }
+
+    if (result != TINYPKG_SUCCESS) {
+        log_error("Failed to extract %s: %s", archive_path,
+                  pipeline.tar.error[0] ? pipeline.tar.error : "I/O error");
+    }
+
+    TINYPKG_FREE(buffer);
+    pipeline_free(&pipeline);
+    close(fd);
+    return result;
+}
+
+// Streaming extractor worker: drain the queue into the pipeline
+static void *archive_worker(void *arg) {
+    archive_extractor_t *x = (archive_extractor_t *)arg;
+    unsigned char *chunk = TINYPKG_MALLOC(ARCHIVE_CHUNK);
+
+    pthread_mutex_lock(&x->lock);
+    for (;;) {
+        while (x->count == 0 && !x->finishing && !x->aborting && !x->restarting) {
+            pthread_cond_wait(&x->cond, &x->lock);
+        }
+        if (x->aborting) break;
+        if (x->restarting) {
+            // Done here rather than by the producer, which may be the
+            // download engine thread
+            x->restarting = 0;
+            pthread_mutex_unlock(&x->lock);
+            pipeline_free(&x->pipeline);
+            utils_remove_directory_recursive(x->dest_dir);
+            int result = pipeline_init(&x->pipeline, x->dest_dir, x->strip_components);
+            pthread_mutex_lock(&x->lock);
+            if (result != TINYPKG_SUCCESS && !x->restarting) {
+                log_debug("Failed to restart streaming extraction into %s", x->dest_dir);
+                x->failed = 1;
+            }
+            continue;
+        }
+        if (x->count == 0 && x->finishing) {
+            pthread_mutex_unlock(&x->lock);
+            int result = (x->failed || !chunk) ? TINYPKG_ERROR : pipeline_finish(&x->pipeline);
+            pthread_mutex_lock(&x->lock);
+            x->result = result;
+            break;
+        }
+
+        size_t n = MIN(x->count, MIN((size_t)ARCHIVE_CHUNK, ARCHIVE_QUEUE_SIZE - x->head));
+        unsigned generation = x->generation;
+        if (chunk) memcpy(chunk, x->queue + x->head, n);
+        x->head = (x->head + n) % ARCHIVE_QUEUE_SIZE;
+        x->count -= n;
+        pthread_cond_broadcast(&x->cond);
+
+        // Keep draining after an error so the producer never blocks
+        if (x->failed || !chunk) {
+            x->failed = 1;
+            continue;
+        }
+        pthread_mutex_unlock(&x->lock);
+        int result = pipeline_feed(&x->pipeline, chunk, n);
+        pthread_mutex_lock(&x->lock);
+        // Bytes queued before a restart may fail; they no longer count
+        if (result != TINYPKG_SUCCESS && generation == x->generation) {
+            log_debug("Streaming extraction stopped: %s", x->pipeline.tar.error);
+            x->failed = 1;
+        }
+    }
+    x->worker_running = 0;
+    pthread_cond_broadcast(&x->cond);
+    pthread_mutex_unlock(&x->lock);
+
+    TINYPKG_FREE(chunk);
+    return NULL;
+}
+
+static int archive_extractor_start(archive_extractor_t *x) {
+    x->head = 0;
+    x->count = 0;
+    x->consumed = 0;
+    x->finishing = 0;
+    x->aborting = 0;
+    x->restarting = 0;
+    x->failed = 0;
+    x->result = TINYPKG_ERROR;
+
+    int result = pipeline_init(&x->pipeline, x->dest_dir, x->strip_components);
+    if (result != TINYPKG_SUCCESS) {
+        pipeline_free(&x->pipeline);
+        return result;
+    }
+
+    x->worker_running = 1;
+    if (pthread_create(&x->worker, NULL, archive_worker, x) != 0) {
+        x->worker_running = 0;
+        pipeline_free(&x->pipeline);
+        return TINYPKG_ERROR;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static void archive_extractor_stop(archive_extractor_t *x, int abort) {
+    pthread_mutex_lock(&x->lock);
+    if (abort) x->aborting = 1;
+    x->finishing = 1;
+    pthread_cond_broadcast(&x->cond);
+    pthread_mutex_unlock(&x->lock);
+
+    pthread_join(x->worker, NULL);
+    pipeline_free(&x->pipeline);
+}
+
+archive_extractor_t *archive_extractor_create(const char *dest_dir, int strip_components) {
+    if (!dest_dir) return NULL;
+
+    archive_extractor_t *x = TINYPKG_CALLOC(1, sizeof(archive_extractor_t));
+    if (!x) return NULL;
+
+    strncpy(x->dest_dir, dest_dir, sizeof(x->dest_dir) - 1);
+    x->strip_components = strip_components;
+    x->queue = TINYPKG_MALLOC(ARCHIVE_QUEUE_SIZE);
+    pthread_mutex_init(&x->lock, NULL);
+    pthread_cond_init(&x->cond, NULL);
+
+    if (!x->queue || archive_extractor_start(x) != TINYPKG_SUCCESS) {
+        pthread_mutex_destroy(&x->lock);
+        pthread_cond_destroy(&x->cond);
+        TINYPKG_FREE(x->queue);
+        TINYPKG_FREE(x);
+        return NULL;
+    }
+    return x;
+}
+
+// Copy bytes into the queue, waiting for room if block is set. Returns
+// the bytes taken; everything counts as taken once extraction failed.
+static size_t archive_extractor_queue(archive_extractor_t *x, const unsigned char *bytes,
+                                      size_t length, int block) {
+    size_t taken = 0;
+
+    pthread_mutex_lock(&x->lock);
+    while (taken < length && !x->failed && x->worker_running) {
+        while (block && x->count == ARCHIVE_QUEUE_SIZE && !x->failed && x->worker_running) {
+            pthread_cond_wait(&x->cond, &x->lock);
+        }
+        if (x->failed || !x->worker_running || x->count == ARCHIVE_QUEUE_SIZE) break;
+
+        size_t tail = (x->head + x->count) % ARCHIVE_QUEUE_SIZE;
+        size_t n = MIN(length - taken,
+                       MIN(ARCHIVE_QUEUE_SIZE - x->count, ARCHIVE_QUEUE_SIZE - tail));
+        memcpy(x->queue + tail, bytes + taken, n);
+        x->count += n;
+        taken += n;
+        pthread_cond_broadcast(&x->cond);
+    }
+    if (x->failed || !x->worker_running) taken = length;
+    x->consumed += (off_t)taken;
+    pthread_mutex_unlock(&x->lock);
+    return taken;
+}
+
+// Queue bytes for extraction; blocks while the queue is full
+int archive_extractor_write(archive_extractor_t *x, const void *data, size_t length) {
+    if (!x || (!data && length > 0)) return TINYPKG_ERROR;
+
+    archive_extractor_queue(x, (const unsigned char *)data, length, 1);
+    return TINYPKG_SUCCESS;
+}
+
+// Queue what fits without blocking
+size_t archive_extractor_offer(archive_extractor_t *x, const void *data, size_t length) {
+    if (!x || !data) return length;
+    return archive_extractor_queue(x, (const unsigned char *)data, length, 0);
+}
+
+// Discard everything extracted so far and start over. Never blocks while
+// the worker runs: it empties dest_dir before taking the next bytes.
+int archive_extractor_reset(archive_extractor_t *x) {
+    if (!x) return TINYPKG_ERROR;
+
+    pthread_mutex_lock(&x->lock);
+    if (x->worker_running) {
+        if (x->consumed > 0) {
+            x->head = 0;
+            x->count = 0;
+            x->consumed = 0;
+            x->failed = 0;
+            x->restarting = 1;
+            x->generation++;
+            pthread_cond_broadcast(&x->cond);
+        }
+        pthread_mutex_unlock(&x->lock);
+        return TINYPKG_SUCCESS;
+    }
+    pthread_mutex_unlock(&x->lock);
+
+    // Finished or never started: nothing else touches dest_dir
+    pipeline_free(&x->pipeline);
+    utils_remove_directory_recursive(x->dest_dir);
+    return archive_extractor_start(x);
+}
+
+// Wait for the queued bytes to be extracted and return the result
+int archive_extractor_finish(archive_extractor_t *x) {
+    if (!x) return TINYPKG_ERROR;
+    if (!x->worker_running) return x->result;
+
+    pthread_mutex_lock(&x->lock);
+    x->finishing = 1;
+    pthread_cond_broadcast(&x->cond);
+    pthread_mutex_unlock(&x->lock);
+
+    pthread_join(x->worker, NULL);
+    if (x->result != TINYPKG_SUCCESS && x->pipeline.tar.error[0]) {
+        log_debug("Streaming extraction failed: %s", x->pipeline.tar.error);
+    }
+    pipeline_free(&x->pipeline);
+    return x->result;
+}
+
+off_t archive_extractor_consumed(const archive_extractor_t *x) {
+    return x ? x->consumed : 0;
+}
+
+void archive_extractor_free(archive_extractor_t *x) {
+    if (!x) return;
+
+    if (x->worker_running) {
+        archive_extractor_stop(x, 1);
+    }
+    pthread_mutex_destroy(&x->lock);
+    pthread_cond_destroy(&x->cond);
+    TINYPKG_FREE(x->queue);
+    TINYPKG_FREE(x);
+}
+
+size_t archive_extractor_sink(void *extractor, const void *data, size_t length) {
+    archive_extractor_t *x = (archive_extractor_t *)extractor;
+
+    if (!data) {
+        if (archive_extractor_reset(x) != TINYPKG_SUCCESS) {
+            log_warn("Failed to restart streaming extraction");
+        }
+        return 0;
+    }
+    return archive_extractor_offer(x, data, length);
+}
@@ -0,0 +1,57 @@
+/*
+ * TinyPkg - Archive Extraction Header
+ * In-process, streaming extraction of compressed source tarballs
+ */
+
+#ifndef TINYPKG_ARCHIVE_H
+#define TINYPKG_ARCHIVE_H
+
+#include <sys/types.h>
+
+// Archive formats, detected from magic bytes
+typedef enum {
+    ARCHIVE_FORMAT_UNKNOWN = 0,
+    ARCHIVE_FORMAT_TAR = 1,
+    ARCHIVE_FORMAT_GZIP = 2,
+    ARCHIVE_FORMAT_BZIP2 = 3,
+    ARCHIVE_FORMAT_XZ = 4,
+    ARCHIVE_FORMAT_ZSTD = 5,
+    ARCHIVE_FORMAT_ZIP = 6
+} archive_format_t;
+
+// Leading bytes needed to tell every format apart (ustar magic is at 257)
+#define ARCHIVE_DETECT_SIZE 512
+
+// Bytes buffered between the download and the extraction thread
+#define ARCHIVE_QUEUE_SIZE (8 * 1024 * 1024)
+
+// Largest GNU long name or pax header accepted
+#define ARCHIVE_MAX_META (1024 * 1024)
+
+typedef struct archive_extractor archive_extractor_t;
+
+// Function declarations
+
+// Format detection
+archive_format_t archive_detect_format(const unsigned char *data, size_t length);
+const char *archive_format_to_string(archive_format_t format);
+
+// Whole-file extraction
+int archive_extract_file(const char *archive_path, const char *dest_dir,
+                         int strip_components);
+
+// Streaming extraction: bytes are queued as they arrive and unpacked on
+// a worker thread
+archive_extractor_t *archive_extractor_create(const char *dest_dir, int strip_components);
+int archive_extractor_write(archive_extractor_t *extractor, const void *data, size_t length);
+size_t archive_extractor_offer(archive_extractor_t *extractor, const void *data, size_t length);
+int archive_extractor_reset(archive_extractor_t *extractor);
+int archive_extractor_finish(archive_extractor_t *extractor);
+off_t archive_extractor_consumed(const archive_extractor_t *extractor);
+void archive_extractor_free(archive_extractor_t *extractor);
+
+// download_sink_t adapter, never blocking; a NULL buffer resets the
+// extractor
+size_t archive_extractor_sink(void *extractor, const void *data, size_t length);
+
+#endif /* TINYPKG_ARCHIVE_H */
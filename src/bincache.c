@@ -0,0 +1,443 @@
+/*
+ * TinyPkg - Binary Package Cache Implementation
+ * Content-addressed cache of built packages, shared over HTTP
+ */
+
+#include "../include/tinypkg.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+static int bincache_enabled(void)
+{
+    return global_config && global_config->binary_cache;
+}
+
+static int bincache_remote_url(void)
+{
+    return bincache_enabled() && global_config->binary_cache_url[0] != '\0';
+}
+
+// Key inputs are hashed as "label=value" lines
+static void bincache_hash_field(security_hash_t *hash, const char *label,
+                                const char *value)
+{
+    security_hash_update(hash, label, strlen(label));
+    security_hash_update(hash, "=", 1);
+    if (value)
+    {
+        security_hash_update(hash, value, strlen(value));
+    }
+    security_hash_update(hash, "\n", 1);
+}
+
+// Hash the versions the resolver will pick for a dependency list
+static void bincache_hash_deps(security_hash_t *hash, const char *label,
+                               char **deps, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        char field[MAX_NAME + 64];
+        package_t *dep;
+        int id;
+
+        if (!deps[i])
+        {
+            continue;
+        }
+
+        snprintf(field, sizeof(field), "%s %s", label, deps[i]);
+        id = repoindex_find(deps[i]);
+        if (id >= 0)
+        {
+            bincache_hash_field(hash, field, repoindex_get_string(id, REPOINDEX_STR_VERSION));
+            continue;
+        }
+
+        // Stale index: parse the definition
+        dep = package_load_info(deps[i]);
+        bincache_hash_field(hash, field, dep ? dep->version : "");
+        package_free(dep);
+    }
+}
+
+// Key a build by everything that affects its output: the package
+// definition, resolved dependency versions, build settings and arch
+int bincache_get_key(const package_t *pkg, char *key, size_t key_size)
+{
+    security_hash_t *hash;
+    char value[64];
+    char arch[64];
+    int result;
+
+    if (!pkg || !key || key_size < BINCACHE_KEY_SIZE)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    hash = security_hash_create(HASH_TYPE_SHA256);
+    if (!hash)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    snprintf(value, sizeof(value), "%d", BINCACHE_KEY_VERSION);
+    bincache_hash_field(hash, "bincache", value);
+
+    // The definition file covers fields package_t does not carry; the
+    // parsed fields cover definitions whose file has moved
+    if (strlen(pkg->json_file) > 0 &&
+        security_hash_update_file(hash, pkg->json_file, -1) != TINYPKG_SUCCESS)
+    {
+        log_debug("Package definition not readable for cache key: %s",
+                  pkg->json_file);
+    }
+    bincache_hash_field(hash, "name", pkg->name);
+    bincache_hash_field(hash, "version", pkg->version);
+    bincache_hash_field(hash, "source_url", pkg->source_url);
+    bincache_hash_field(hash, "checksum", pkg->checksum);
+    bincache_hash_field(hash, "build_cmd", pkg->build_cmd);
+    bincache_hash_field(hash, "install_cmd", pkg->install_cmd);
+    bincache_hash_field(hash, "configure_args", pkg->configure_args);
+    snprintf(value, sizeof(value), "%d", (int)pkg->build_system);
+    bincache_hash_field(hash, "build_system", value);
+
+    bincache_hash_deps(hash, "dep", pkg->dependencies, pkg->dep_count);
+    bincache_hash_deps(hash, "build_dep", pkg->build_dependencies,
+                       pkg->build_dep_count);
+
+    bincache_hash_field(hash, "build_flags", global_config->build_flags);
+    bincache_hash_field(hash, "install_prefix", global_config->install_prefix);
+    snprintf(value, sizeof(value), "%d %d", global_config->enable_optimizations,
+             global_config->debug_symbols);
+    bincache_hash_field(hash, "options", value);
+
+    if (config_detect_architecture(arch, sizeof(arch)) != 0)
+    {
+        strncpy(arch, "unknown", sizeof(arch) - 1);
+    }
+    bincache_hash_field(hash, "arch", arch);
+
+    result = security_hash_final(hash, key, key_size);
+    security_hash_free(hash);
+    return result;
+}
+
+int bincache_get_path(const char *key, char *path, size_t path_size)
+{
+    if (!key || !path)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    if (snprintf(path, path_size, "%s/%s%s", BINCACHE_DIR, key, BINCACHE_EXT) >=
+        (int)path_size)
+    {
+        return TINYPKG_ERROR;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Read the digest from a sha256sum style sidecar
+static int bincache_read_digest(const char *checksum_path, char *digest,
+                                size_t digest_size)
+{
+    FILE *fp = fopen(checksum_path, "r");
+    char line[MAX_PATH];
+    int result = TINYPKG_ERROR;
+
+    if (!fp)
+    {
+        return TINYPKG_ERROR_FILE;
+    }
+
+    if (fgets(line, sizeof(line), fp))
+    {
+        size_t length = strspn(line, "0123456789abcdefABCDEF");
+        if (length == BINCACHE_KEY_SIZE - 1 && length < digest_size)
+        {
+            memcpy(digest, line, length);
+            digest[length] = '\0';
+            result = TINYPKG_SUCCESS;
+        }
+    }
+
+    fclose(fp);
+    return result;
+}
+
+// Check a local artifact against its sidecar; drop it if it is corrupt
+static int bincache_verify(const char *artifact)
+{
+    char checksum_path[MAX_PATH];
+    char digest[BINCACHE_KEY_SIZE];
+    char calculated[BINCACHE_KEY_SIZE];
+
+    // Always checked: verify_checksums covers upstream sources, not our
+    // own artifacts
+    snprintf(checksum_path, sizeof(checksum_path), "%s.sha256", artifact);
+    if (bincache_read_digest(checksum_path, digest, sizeof(digest)) ==
+            TINYPKG_SUCCESS &&
+        security_calculate_checksum(artifact, calculated, sizeof(calculated),
+                                    HASH_TYPE_SHA256) == TINYPKG_SUCCESS &&
+        strcasecmp(calculated, digest) == 0)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    log_warn("Discarding corrupt cached package: %s", artifact);
+    unlink(artifact);
+    unlink(checksum_path);
+    return TINYPKG_ERROR;
+}
+
+int bincache_has_local(const package_t *pkg)
+{
+    char key[BINCACHE_KEY_SIZE];
+    char artifact[MAX_PATH];
+
+    if (!bincache_enabled() || bincache_get_key(pkg, key, sizeof(key)) != TINYPKG_SUCCESS ||
+        bincache_get_path(key, artifact, sizeof(artifact)) != TINYPKG_SUCCESS)
+    {
+        return 0;
+    }
+    return utils_file_exists(artifact);
+}
+
+// Fetch "<url>/<key>.tar.gz" after its ".sha256" sidecar, so the download
+// is verified as it streams
+static int bincache_pull(const char *key, const char *artifact)
+{
+    char url[MAX_URL];
+    char checksum_url[MAX_URL];
+    char checksum_path[MAX_PATH];
+    char digest[BINCACHE_KEY_SIZE];
+    int result;
+
+    if (snprintf(url, sizeof(url), "%s/%s%s", global_config->binary_cache_url,
+                 key, BINCACHE_EXT) >= (int)sizeof(url) ||
+        snprintf(checksum_url, sizeof(checksum_url), "%s.sha256", url) >=
+            (int)sizeof(checksum_url))
+    {
+        log_error("Binary cache URL too long");
+        return TINYPKG_ERROR;
+    }
+    snprintf(checksum_path, sizeof(checksum_path), "%s.sha256.part", artifact);
+
+    log_info("Checking binary cache: %s", url);
+    result = download_file(checksum_url, checksum_path);
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = bincache_read_digest(checksum_path, digest, sizeof(digest));
+    }
+    unlink(checksum_path);
+    if (result != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR_NETWORK;
+    }
+
+    // download_promote() writes the local sidecar
+    return download_file_verified(url, artifact, digest);
+}
+
+// Find the cached build of a package, locally or on the shared cache
+int bincache_fetch(const package_t *pkg, char *artifact, size_t artifact_size)
+{
+    char key[BINCACHE_KEY_SIZE];
+
+    if (!pkg || !artifact || !bincache_enabled())
+    {
+        return TINYPKG_ERROR;
+    }
+
+    if (bincache_get_key(pkg, key, sizeof(key)) != TINYPKG_SUCCESS ||
+        bincache_get_path(key, artifact, artifact_size) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    if (utils_file_exists(artifact) && bincache_verify(artifact) == TINYPKG_SUCCESS)
+    {
+        log_debug("Binary cache hit for %s: %s", pkg->name, key);
+        metrics_add(METRICS_BINARY_CACHE_HITS, 1);
+        return TINYPKG_SUCCESS;
+    }
+
+    if (bincache_remote_url() && bincache_pull(key, artifact) == TINYPKG_SUCCESS)
+    {
+        log_info("Fetched %s from the binary cache", pkg->name);
+        metrics_add(METRICS_BINARY_CACHE_HITS, 1);
+        return TINYPKG_SUCCESS;
+    }
+
+    metrics_add(METRICS_BINARY_CACHE_MISSES, 1);
+    return TINYPKG_ERROR;
+}
+
+static int bincache_dir_is_empty(const char *path)
+{
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    int empty = 1;
+
+    if (!dir)
+    {
+        return 1;
+    }
+
+    while ((entry = readdir(dir)))
+    {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+        {
+            empty = 0;
+            break;
+        }
+    }
+
+    closedir(dir);
+    return empty;
+}
+
+static void bincache_push(const char *key, const char *artifact)
+{
+    char url[MAX_URL];
+    char checksum_url[MAX_URL];
+    char checksum_path[MAX_PATH];
+
+    if (snprintf(url, sizeof(url), "%s/%s%s", global_config->binary_cache_url,
+                 key, BINCACHE_EXT) >= (int)sizeof(url) ||
+        snprintf(checksum_url, sizeof(checksum_url), "%s.sha256", url) >=
+            (int)sizeof(checksum_url))
+    {
+        log_warn("Binary cache URL too long, not uploading");
+        return;
+    }
+    if (snprintf(checksum_path, sizeof(checksum_path), "%s.sha256", artifact) >=
+        (int)sizeof(checksum_path))
+    {
+        log_warn("Binary cache path too long, not uploading");
+        return;
+    }
+
+    // The sidecar goes last: readers only trust artifacts that have one
+    if (download_upload_file(url, artifact) != TINYPKG_SUCCESS ||
+        download_upload_file(checksum_url, checksum_path) != TINYPKG_SUCCESS)
+    {
+        log_warn("Failed to upload to the binary cache: %s", url);
+        return;
+    }
+    log_info("Uploaded to the binary cache: %s", url);
+}
+
+// Pack a staged DESTDIR tree into the cache under a key taken before the
+// build started; building changes fields such as the detected build system
+int bincache_store(const package_t *pkg, const char *key, const char *staging_dir)
+{
+    char artifact[MAX_PATH];
+    char temp_path[MAX_PATH];
+    char checksum_path[MAX_PATH];
+    char digest[BINCACHE_KEY_SIZE];
+    char cmd[MAX_CMD];
+    int level;
+    int result;
+
+    if (!pkg || !staging_dir)
+    {
+        return TINYPKG_ERROR;
+    }
+    if (!bincache_enabled() || !key || key[0] == '\0')
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    // Custom install commands may bypass DESTDIR; never cache an empty tree
+    if (bincache_dir_is_empty(staging_dir))
+    {
+        log_debug("Nothing staged for %s, not caching", pkg->name);
+        return TINYPKG_SUCCESS;
+    }
+
+    if (bincache_get_path(key, artifact, sizeof(artifact)) != TINYPKG_SUCCESS ||
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", artifact) >=
+            (int)sizeof(temp_path) ||
+        snprintf(checksum_path, sizeof(checksum_path), "%s.sha256", artifact) >=
+            (int)sizeof(checksum_path))
+    {
+        log_error("Binary cache path too long for %s", pkg->name);
+        return TINYPKG_ERROR;
+    }
+
+    if (utils_create_directory_recursive(BINCACHE_DIR) != TINYPKG_SUCCESS)
+    {
+        log_error("Failed to create binary cache directory: %s", BINCACHE_DIR);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    level = global_config->compression_level;
+    level = level < 1 ? 1 : (level > 9 ? 9 : level);
+    if (snprintf(cmd, sizeof(cmd), "tar -C '%s' -I 'gzip -%d' -cf '%s' .",
+                 staging_dir, level, temp_path) >= (int)sizeof(cmd))
+    {
+        log_error("Binary cache command too long");
+        return TINYPKG_ERROR;
+    }
+
+    result = utils_run_command(cmd, NULL);
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = security_calculate_checksum(temp_path, digest, sizeof(digest),
+                                             HASH_TYPE_SHA256);
+    }
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = security_write_checksum_file(checksum_path, artifact, digest);
+    }
+    if (result == TINYPKG_SUCCESS && rename(temp_path, artifact) != 0)
+    {
+        result = TINYPKG_ERROR_FILE;
+    }
+
+    if (result != TINYPKG_SUCCESS)
+    {
+        log_warn("Failed to cache binary package for %s", pkg->name);
+        unlink(temp_path);
+        unlink(checksum_path);
+        return result;
+    }
+
+    log_info("Cached binary package for %s: %s", pkg->name, key);
+
+    if (bincache_remote_url() && global_config->binary_cache_push)
+    {
+        bincache_push(key, artifact);
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Unpack a cached artifact into a staging directory
+int bincache_unpack(const char *artifact, const char *dest_dir)
+{
+    char cmd[MAX_CMD];
+
+    if (!artifact || !dest_dir)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    if (utils_create_directory_recursive(dest_dir) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR_FILE;
+    }
+
+    if (snprintf(cmd, sizeof(cmd), "tar -C '%s' -xzpf '%s'", dest_dir, artifact) >=
+        (int)sizeof(cmd))
+    {
+        log_error("Unpack command too long");
+        return TINYPKG_ERROR;
+    }
+
+    return utils_run_command(cmd, NULL);
+}
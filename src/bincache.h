@@ -0,0 +1,33 @@
+/*
+ * TinyPkg - Binary Package Cache Header
+ * Content-addressed cache of built packages, shared over HTTP
+ */
+
+#ifndef TINYPKG_BINCACHE_H
+#define TINYPKG_BINCACHE_H
+
+// Cache directory and artifact naming: <BINCACHE_DIR>/<key><BINCACHE_EXT>
+#define BINCACHE_DIR CACHE_DIR "/packages"
+#define BINCACHE_EXT ".tar.gz"
+
+// Bumped when the key inputs or the artifact layout change
+#define BINCACHE_KEY_VERSION 1
+
+// SHA-256 hex digest
+#define BINCACHE_KEY_SIZE 65
+
+// Function declarations
+
+// Cache keys
+int bincache_get_key(const package_t *pkg, char *key, size_t key_size);
+int bincache_get_path(const char *key, char *path, size_t path_size);
+
+// Cache lookups
+int bincache_has_local(const package_t *pkg);
+int bincache_fetch(const package_t *pkg, char *artifact, size_t artifact_size);
+
+// Cache updates
+int bincache_store(const package_t *pkg, const char *key, const char *staging_dir);
+int bincache_unpack(const char *artifact, const char *dest_dir);
+
+#endif /* TINYPKG_BINCACHE_H */
@@ -6,101 +6,115 @@
 #include "../include/tinypkg.h"
 #include "download.h"
 #include "package.h"
+#include "prefetch.h"
 #include "security.h"
 #include "utils.h"
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <linux/magic.h>
+#include <strings.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/statvfs.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
-// Global build tracking
-static build_context_t *active_builds[16] = {0};
+// Global build tracking, shared by concurrent scheduler workers
+static build_context_t *active_builds[BUILD_MAX_ACTIVE] = {0};
 static int active_build_count = 0;
+static pthread_mutex_t active_builds_lock = PTHREAD_MUTEX_INITIALIZER;
 
-// Helper functions for safe path operations
-static int safe_path_join(char *dest, size_t dest_size, const char *base,
-                          const char *suffix)
+// tmpfs space promised to workspaces whose builds have not finished yet.
+// A workspace fills up as it builds, long after the free space was
+// checked, so concurrent builds (and the prefetcher) count each other's
+// estimates against the free space.
+typedef struct tmpfs_reservation
 {
-    size_t base_len = strlen(base);
-    size_t suffix_len = strlen(suffix);
+    char build_dir[MAX_PATH];
+    size_t bytes;
+} tmpfs_reservation_t;
+
+static tmpfs_reservation_t *tmpfs_reservations = NULL;
+static int tmpfs_reservation_count = 0;
+static size_t tmpfs_reserved = 0;
+static pthread_mutex_t tmpfs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Held from the file conflict check until the file index records the new
+// owner, so two workers installing the same path cannot both pass the check
+static pthread_mutex_t install_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Whether the workspace fits in memory: the package's estimated footprint,
+// on top of what unfinished builds reserved, must fit both the free tmpfs
+// space and a share of physical RAM. Called with tmpfs_lock held.
+static int build_tmpfs_fits(size_t needed)
+{
+    struct statvfs vfs;
 
-    if (base_len + suffix_len + 1 >= dest_size)
-    {
-        return TINYPKG_ERROR; // Path too long
-    }
+    if (statvfs(BUILD_TMPFS_MOUNT, &vfs) != 0)
+        return 0;
 
-    strcpy(dest, base);
-    strcat(dest, suffix);
-    return TINYPKG_SUCCESS;
+    size_t available = (size_t)vfs.f_bavail * vfs.f_frsize;
+    size_t memory = config_detect_memory_size();
+    size_t total = tmpfs_reserved + needed;
+
+    return total <= available && total <= memory / 100 * BUILD_TMPFS_MEMORY_PERCENT;
 }
 
-static int build_download_command(char *cmd, size_t cmd_size,
-                                  const char *download_path,
-                                  const char *source_url)
+// Hold needed bytes for a new workspace. Called with tmpfs_lock held.
+static int build_tmpfs_reserve(const char *build_dir, size_t needed)
 {
-    int needed = snprintf(NULL, 0, "wget -O '%s' '%s' || curl -o '%s' -L '%s'",
-                          download_path, source_url, download_path, source_url);
-
-    if (needed >= (int)cmd_size)
-    {
-        log_error("Download command too long: %d bytes needed, %zu available",
-                  needed, cmd_size);
-        return TINYPKG_ERROR;
-    }
+    tmpfs_reservation_t *reservations =
+        TINYPKG_REALLOC(tmpfs_reservations,
+                        (tmpfs_reservation_count + 1) * sizeof(tmpfs_reservation_t));
+    if (!reservations)
+        return TINYPKG_ERROR_MEMORY;
 
-    snprintf(cmd, cmd_size, "wget -O '%s' '%s' || curl -o '%s' -L '%s'",
-             download_path, source_url, download_path, source_url);
+    tmpfs_reservations = reservations;
+    snprintf(reservations[tmpfs_reservation_count].build_dir, MAX_PATH, "%s", build_dir);
+    reservations[tmpfs_reservation_count].bytes = needed;
+    tmpfs_reservation_count++;
+    tmpfs_reserved += needed;
     return TINYPKG_SUCCESS;
 }
 
-static int build_extract_command(char *cmd, size_t cmd_size,
-                                 const char *archive_path, const char *dest_dir,
-                                 const char *format)
+// Give back a workspace's reservation once its build finished: what it
+// still occupies shows up in the free space from then on
+static void build_tmpfs_release(const build_context_t *ctx)
 {
-    const char *extract_templates[] = {
-        "tar -xzf '%s' -C '%s' --strip-components=1", // .tar.gz
-        "tar -xjf '%s' -C '%s' --strip-components=1", // .tar.bz2
-        "tar -xJf '%s' -C '%s' --strip-components=1", // .tar.xz
-        "unzip -q '%s' -d '%s'"                       // .zip
-    };
+    if (!ctx->on_tmpfs)
+        return;
 
-    int template_idx = 0;
-    if (strstr(format, ".tar.gz") || strstr(format, ".tgz"))
-    {
-        template_idx = 0;
-    }
-    else if (strstr(format, ".tar.bz2") || strstr(format, ".tbz2"))
-    {
-        template_idx = 1;
-    }
-    else if (strstr(format, ".tar.xz"))
-    {
-        template_idx = 2;
-    }
-    else if (strstr(format, ".zip"))
+    pthread_mutex_lock(&tmpfs_lock);
+    for (int i = 0; i < tmpfs_reservation_count; i++)
     {
-        template_idx = 3;
-    }
-    else
-    {
-        return TINYPKG_ERROR;
+        if (strcmp(tmpfs_reservations[i].build_dir, ctx->build_dir) == 0)
+        {
+            tmpfs_reserved -= tmpfs_reservations[i].bytes;
+            tmpfs_reservations[i] = tmpfs_reservations[--tmpfs_reservation_count];
+            break;
+        }
     }
+    pthread_mutex_unlock(&tmpfs_lock);
+}
 
-    int needed = snprintf(NULL, 0, extract_templates[template_idx],
-                          archive_path, dest_dir);
-    if (needed >= (int)cmd_size)
+// Helper functions for safe path operations
+static int safe_path_join(char *dest, size_t dest_size, const char *base,
+                          const char *suffix)
+{
+    size_t base_len = strlen(base);
+    size_t suffix_len = strlen(suffix);
+
+    if (base_len + suffix_len + 1 >= dest_size)
     {
-        log_error("Extract command too long: %d bytes needed, %zu available",
-                  needed, cmd_size);
-        return TINYPKG_ERROR;
+        return TINYPKG_ERROR; // Path too long
     }
 
-    snprintf(cmd, cmd_size, extract_templates[template_idx], archive_path,
-             dest_dir);
+    strcpy(dest, base);
+    strcat(dest, suffix);
     return TINYPKG_SUCCESS;
 }
 
@@ -160,19 +174,126 @@ static int safe_cmake_command(char *cmd, size_t cmd_size,
     return TINYPKG_SUCCESS;
 }
 
+// ninja 1.13 and later take job slots from a FIFO jobserver
+static int g_ninja_jobserver = 0;
+static pthread_once_t g_ninja_once = PTHREAD_ONCE_INIT;
+
+static void build_detect_ninja(void)
+{
+    char *output = NULL;
+    int exit_code = -1;
+    int major = 0, minor = 0;
+
+    if (utils_run_command_with_output("ninja --version", NULL, &output,
+                                      &exit_code) == TINYPKG_SUCCESS &&
+        exit_code == 0 && output &&
+        sscanf(output, "%d.%d", &major, &minor) == 2)
+    {
+        g_ninja_jobserver = major > 1 || (major == 1 && minor >= 13);
+    }
+    TINYPKG_FREE(output);
+}
+
+// Build a ninja invocation for the generated tree of this build
+static int build_ninja_command(build_context_t *ctx, const char *target,
+                               char *cmd, size_t cmd_size)
+{
+    const char *dir =
+        ctx->package->build_system == BUILD_TYPE_MESON ? BUILD_MESON_DIR : ".";
+    char jobs[32] = "";
+    int result;
+
+    // Join the shared pool when ninja can; otherwise fall back to the slots
+    // granted to this build
+    pthread_once(&g_ninja_once, build_detect_ninja);
+    if (!(g_ninja_jobserver && jobserver_uses_fifo()))
+    {
+        int parallel_jobs = ctx->parallel_jobs;
+        if (parallel_jobs <= 0)
+            parallel_jobs = global_config ? global_config->parallel_jobs : 4;
+        snprintf(jobs, sizeof(jobs), " -j%d", parallel_jobs);
+    }
+
+    if (target)
+    {
+        result = snprintf(cmd, cmd_size, "DESTDIR='%s' ninja%s -C %s %s",
+                          ctx->install_dir, jobs, dir, target);
+    }
+    else
+    {
+        result = snprintf(cmd, cmd_size, "ninja%s -C %s", jobs, dir);
+    }
+
+    if (result >= (int)cmd_size)
+    {
+        log_error("Ninja command too long");
+        return TINYPKG_ERROR;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Run a build step in the source tree with the compiler cache settings,
+// as a client of the shared jobserver when one is running, and inside the
+// build's sandbox when it has one
+static int build_run_step(build_context_t *ctx, const char *cmd)
+{
+    char wrapped[MAX_CMD];
+    char step[MAX_CMD];
+    char flags[MAX_PATH + 64];
+
+    if (jobserver_get_makeflags(flags, sizeof(flags)) == TINYPKG_SUCCESS)
+    {
+        if (snprintf(step, sizeof(step), "export MAKEFLAGS='%s'; %s", flags,
+                     cmd) >= (int)sizeof(step))
+        {
+            log_error("Build command too long with jobserver settings");
+            return TINYPKG_ERROR;
+        }
+        cmd = step;
+    }
+
+    if (compcache_wrap_command(ctx, cmd, wrapped, sizeof(wrapped)) !=
+        TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+    // Output goes to the build log when there is one, else the console
+    buildlog_command(ctx->log, cmd);
+    struct rusage usage;
+    int result = ctx->sandbox
+                     ? sandbox_run(ctx->sandbox, wrapped, ctx->source_dir,
+                                   buildlog_fd(ctx->log), &usage)
+                     : utils_run_command_redirect(wrapped, ctx->source_dir,
+                                                  buildlog_fd(ctx->log), &usage);
+    profile_add_usage(ctx->profile, &usage);
+    return result;
+}
+
+static void build_set_status(build_context_t *ctx, build_status_t status)
+{
+    ctx->status = status;
+    buildlog_set_phase(ctx->log, build_status_to_string(status));
+}
+
 // Helper functions for active builds
 static int add_active_build(build_context_t *ctx)
 {
-    if (active_build_count >= 16)
+    pthread_mutex_lock(&active_builds_lock);
+    if (active_build_count >= BUILD_MAX_ACTIVE)
+    {
+        pthread_mutex_unlock(&active_builds_lock);
         return TINYPKG_ERROR;
+    }
 
     active_builds[active_build_count] = ctx;
     active_build_count++;
+    pthread_mutex_unlock(&active_builds_lock);
     return TINYPKG_SUCCESS;
 }
 
 static void remove_active_build(build_context_t *ctx)
 {
+    pthread_mutex_lock(&active_builds_lock);
     for (int i = 0; i < active_build_count; i++)
     {
         if (active_builds[i] == ctx)
@@ -186,15 +307,23 @@ static void remove_active_build(build_context_t *ctx)
             break;
         }
     }
+    pthread_mutex_unlock(&active_builds_lock);
 }
 
 // Main build function
 int build_package(package_t *pkg)
+{
+    int parallel_jobs = global_config ? global_config->parallel_jobs : 4;
+    return build_package_with_jobs(pkg, parallel_jobs);
+}
+
+int build_package_with_jobs(package_t *pkg, int parallel_jobs)
 {
     if (!pkg)
         return TINYPKG_ERROR;
 
-    log_info("Building package: %s %s", pkg->name, pkg->version);
+    log_info("Building package: %s %s (%d jobs)", pkg->name, pkg->version,
+             parallel_jobs);
 
     build_context_t *ctx = build_context_create(pkg);
     if (!ctx)
@@ -202,33 +331,75 @@ int build_package(package_t *pkg)
 
     int result = TINYPKG_SUCCESS;
 
+    ctx->parallel_jobs = parallel_jobs > 0 ? parallel_jobs : 1;
     ctx->start_time = time(NULL);
-    add_active_build(ctx);
-
-    // Step 1: Download source
-    ctx->status = BUILD_STATUS_DOWNLOADING;
-    log_info("Downloading source for %s", pkg->name);
-    result = build_download_source(ctx);
-    if (result != TINYPKG_SUCCESS)
+    ctx->profile = pkg->profile;
+    if (ctx->on_tmpfs)
     {
-        log_error("Failed to download source for %s", pkg->name);
-        goto cleanup;
+        profile_set_flag(ctx->profile, PROFILE_FLAG_TMPFS);
+    }
+    if (add_active_build(ctx) != TINYPKG_SUCCESS)
+    {
+        log_warn("Too many active builds, %s will not be tracked", pkg->name);
+    }
+    ctx->log = buildlog_open(pkg);
+    // Keyed before configure rewrites the detected build system, so the
+    // artifact is found again by bincache_fetch()
+    if (global_config && global_config->binary_cache &&
+        bincache_get_key(pkg, ctx->cache_key, sizeof(ctx->cache_key)) != TINYPKG_SUCCESS)
+    {
+        ctx->cache_key[0] = '\0';
+    }
+    if (global_config && global_config->sandbox_builds)
+    {
+        ctx->sandbox = sandbox_create(pkg, ctx->build_dir, ctx->parallel_jobs);
+        if (!ctx->sandbox && !global_config->sandbox_fallback)
+        {
+            log_error("Cannot set up the build sandbox for %s", pkg->name);
+            result = TINYPKG_ERROR_BUILD;
+            goto cleanup;
+        }
     }
 
-    // Step 2: Extract source
-    ctx->status = BUILD_STATUS_EXTRACTING;
-    log_info("Extracting source for %s", pkg->name);
-    result = build_extract_source(ctx);
-    if (result != TINYPKG_SUCCESS)
+    // Steps 1-2 may already have been done by the prefetcher
+    if (prefetch_claim(pkg->name) == TINYPKG_SUCCESS)
     {
-        log_error("Failed to extract source for %s", pkg->name);
-        goto cleanup;
+        log_info("Using prefetched source for %s", pkg->name);
+        profile_set_flag(ctx->profile, PROFILE_FLAG_PREFETCHED);
+    }
+    else
+    {
+        // Step 1: Download source
+        build_set_status(ctx, BUILD_STATUS_DOWNLOADING);
+        log_info("Downloading source for %s", pkg->name);
+        profile_phase_begin(ctx->profile, PROFILE_PHASE_DOWNLOAD);
+        result = build_download_source(ctx);
+        profile_phase_end(ctx->profile, PROFILE_PHASE_DOWNLOAD);
+        if (result != TINYPKG_SUCCESS)
+        {
+            log_error("Failed to download source for %s", pkg->name);
+            goto cleanup;
+        }
+
+        // Step 2: Extract source
+        build_set_status(ctx, BUILD_STATUS_EXTRACTING);
+        log_info("Extracting source for %s", pkg->name);
+        profile_phase_begin(ctx->profile, PROFILE_PHASE_EXTRACT);
+        result = build_extract_source(ctx);
+        profile_phase_end(ctx->profile, PROFILE_PHASE_EXTRACT);
+        if (result != TINYPKG_SUCCESS)
+        {
+            log_error("Failed to extract source for %s", pkg->name);
+            goto cleanup;
+        }
     }
 
     // Step 3: Configure
-    ctx->status = BUILD_STATUS_CONFIGURING;
+    build_set_status(ctx, BUILD_STATUS_CONFIGURING);
     log_info("Configuring %s", pkg->name);
+    profile_phase_begin(ctx->profile, PROFILE_PHASE_CONFIGURE);
     result = build_configure_package(ctx);
+    profile_phase_end(ctx->profile, PROFILE_PHASE_CONFIGURE);
     if (result != TINYPKG_SUCCESS)
     {
         log_error("Failed to configure %s", pkg->name);
@@ -236,19 +407,43 @@ int build_package(package_t *pkg)
     }
 
     // Step 4: Build
-    ctx->status = BUILD_STATUS_BUILDING;
+    build_set_status(ctx, BUILD_STATUS_BUILDING);
     log_info("Compiling %s", pkg->name);
+    profile_phase_begin(ctx->profile, PROFILE_PHASE_COMPILE);
     result = build_compile_package(ctx);
+    profile_phase_end(ctx->profile, PROFILE_PHASE_COMPILE);
     if (result != TINYPKG_SUCCESS)
     {
         log_error("Failed to compile %s", pkg->name);
         goto cleanup;
     }
 
-    ctx->status = BUILD_STATUS_COMPLETE;
+    // Step 5: Stage into DESTDIR and keep a binary package of the result
+    build_set_status(ctx, BUILD_STATUS_INSTALLING);
+    log_info("Staging %s", pkg->name);
+    profile_phase_begin(ctx->profile, PROFILE_PHASE_STAGE);
+    result = build_stage_files(ctx);
+    profile_phase_end(ctx->profile, PROFILE_PHASE_STAGE);
+    if (result != TINYPKG_SUCCESS)
+    {
+        log_error("Failed to stage %s", pkg->name);
+        goto cleanup;
+    }
+    profile_phase_begin(ctx->profile, PROFILE_PHASE_PACKAGE);
+    bincache_store(pkg, ctx->cache_key, ctx->install_dir);
+    profile_phase_end(ctx->profile, PROFILE_PHASE_PACKAGE);
+
+    build_set_status(ctx, BUILD_STATUS_COMPLETE);
     ctx->end_time = time(NULL);
     log_info("Successfully built %s in %ld seconds", pkg->name,
              ctx->end_time - ctx->start_time);
+    compcache_report(ctx);
+
+    long hits, misses;
+    if (compcache_stats(ctx, &hits, &misses) == TINYPKG_SUCCESS)
+    {
+        profile_set_cache_stats(ctx->profile, hits, misses);
+    }
 
 cleanup:
     if (result != TINYPKG_SUCCESS)
@@ -257,13 +452,27 @@ cleanup:
         ctx->end_time = time(NULL);
     }
 
+    // Shows the end of the output when the build failed
+    if (ctx->log)
+    {
+        log_debug("Build log for %s: %s", pkg->name, buildlog_path(ctx->log));
+        buildlog_finish(ctx->log, result != TINYPKG_SUCCESS);
+        ctx->log = NULL;
+    }
     remove_active_build(ctx);
 
-    // Cleanup unless configured to keep build directory
-    if (!global_config->keep_build_dir || result != TINYPKG_SUCCESS)
+    // The staged tree stays for build_install_package(); the sources go
+    // unless configured to keep the build directory
+    if (result != TINYPKG_SUCCESS)
     {
         build_context_cleanup(ctx);
     }
+    else if (!global_config->keep_build_dir)
+    {
+        utils_remove_directory_recursive(ctx->source_dir);
+    }
+    prefetch_release(pkg->name);
+    build_tmpfs_release(ctx);
 
     build_context_free(ctx);
     return result;
@@ -280,11 +489,11 @@ int build_install_package(package_t *pkg)
     if (!ctx)
         return TINYPKG_ERROR_MEMORY;
 
-    // For installation, we assume the package was already built
-    // and we're installing from the build directory
-
+    // Install the tree staged by build_package() or build_restore_package()
     ctx->status = BUILD_STATUS_INSTALLING;
+    profile_phase_begin(pkg->profile, PROFILE_PHASE_INSTALL);
     int result = build_install_files(ctx);
+    profile_phase_end(pkg->profile, PROFILE_PHASE_INSTALL);
 
     if (result == TINYPKG_SUCCESS)
     {
@@ -295,11 +504,111 @@ int build_install_package(package_t *pkg)
         log_error("Failed to install %s", pkg->name);
     }
 
+    if (!global_config->keep_build_dir || result != TINYPKG_SUCCESS)
+    {
+        build_context_cleanup(ctx);
+    }
+
+    build_context_free(ctx);
+    return result;
+}
+
+// Stage a cached binary package in place of building it
+int build_restore_package(package_t *pkg, const char *artifact)
+{
+    if (!pkg || !artifact)
+        return TINYPKG_ERROR;
+
+    log_info("Installing %s %s from the binary cache", pkg->name, pkg->version);
+
+    build_context_t *ctx = build_context_create(pkg);
+    if (!ctx)
+        return TINYPKG_ERROR_MEMORY;
+
+    // Start from an empty staging tree
+    utils_remove_directory_recursive(ctx->install_dir);
+    profile_phase_begin(pkg->profile, PROFILE_PHASE_EXTRACT);
+    int result = bincache_unpack(artifact, ctx->install_dir);
+    profile_phase_end(pkg->profile, PROFILE_PHASE_EXTRACT);
+    if (result != TINYPKG_SUCCESS)
+    {
+        log_error("Failed to unpack cached package: %s", artifact);
+        build_context_cleanup(ctx);
+    }
+    build_tmpfs_release(ctx);
+
     build_context_free(ctx);
     return result;
 }
 
 // Build context management
+
+// The tmpfs mount is world-writable, so only build below a directory
+// that we own and nobody else can write to
+static int build_tmpfs_usable(void)
+{
+    struct statfs fs;
+    struct stat st;
+
+    if (statfs(BUILD_TMPFS_MOUNT, &fs) != 0 || fs.f_type != TMPFS_MAGIC)
+        return 0;
+
+    if (mkdir(BUILD_TMPFS_ROOT, 0755) != 0 && errno != EEXIST)
+        return 0;
+    if (lstat(BUILD_TMPFS_ROOT, &st) != 0 || !S_ISDIR(st.st_mode) ||
+        st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+    {
+        log_warn("Not building on tmpfs: %s is not owned by us",
+                 BUILD_TMPFS_ROOT);
+        return 0;
+    }
+    return 1;
+}
+
+// Pick the workspace for a package. Once chosen it sticks: the prefetcher,
+// the build and the install step each create their own context and must
+// all find the same directory.
+static int build_use_tmpfs(const package_t *pkg)
+{
+    const char *mode = global_config ? global_config->build_workspace : "disk";
+    char tmpfs_path[MAX_PATH];
+    char path[MAX_PATH];
+
+    if (strcasecmp(mode, "disk") == 0)
+        return 0;
+
+    int usable = build_tmpfs_usable();
+    snprintf(tmpfs_path, sizeof(tmpfs_path), "%s/%s-%s", BUILD_TMPFS_DIR, pkg->name,
+             pkg->version);
+    if (usable && utils_directory_exists(tmpfs_path))
+        return 1;
+    snprintf(path, sizeof(path), "%s/%s-%s", BUILD_DISK_DIR, pkg->name,
+             pkg->version);
+    if (utils_directory_exists(path))
+        return 0;
+
+    size_t needed = pkg->size_estimate > 0
+                        ? pkg->size_estimate * BUILD_TMPFS_FACTOR
+                        : (size_t)BUILD_TMPFS_DEFAULT_MB * 1024 * 1024;
+    int fits = 0;
+    if (usable)
+    {
+        pthread_mutex_lock(&tmpfs_lock);
+        fits = build_tmpfs_fits(needed) &&
+               build_tmpfs_reserve(tmpfs_path, needed) == TINYPKG_SUCCESS;
+        pthread_mutex_unlock(&tmpfs_lock);
+    }
+
+    if (fits)
+        return 1;
+    if (strcasecmp(mode, "tmpfs") == 0)
+    {
+        log_warn("Not enough memory to build %s on tmpfs, using %s",
+                 pkg->name, BUILD_DISK_DIR);
+    }
+    return 0;
+}
+
 build_context_t *build_context_create(package_t *pkg)
 {
     if (!pkg)
@@ -314,45 +623,50 @@ build_context_t *build_context_create(package_t *pkg)
     ctx->build_pid = 0;
 
     // Set up directories with safe path joining
+    ctx->on_tmpfs = build_use_tmpfs(pkg);
     int result = 0;
-    result |= snprintf(ctx->build_dir, sizeof(ctx->build_dir),
-                       "%s/builds/%s-%s", CACHE_DIR, pkg->name, pkg->version);
+    result |= snprintf(ctx->build_dir, sizeof(ctx->build_dir), "%s/%s-%s",
+                       ctx->on_tmpfs ? BUILD_TMPFS_DIR : BUILD_DISK_DIR,
+                       pkg->name, pkg->version);
     if (result >= (int)sizeof(ctx->build_dir))
     {
         log_error("Build directory path too long");
-        build_context_free(ctx);
-        return NULL;
+        goto fail;
     }
 
     if (safe_path_join(ctx->source_dir, sizeof(ctx->source_dir), ctx->build_dir,
                        "/source") != TINYPKG_SUCCESS)
     {
         log_error("Source directory path too long");
-        build_context_free(ctx);
-        return NULL;
+        goto fail;
     }
 
     if (safe_path_join(ctx->install_dir, sizeof(ctx->install_dir),
                        ctx->build_dir, "/install") != TINYPKG_SUCCESS)
     {
         log_error("Install directory path too long");
-        build_context_free(ctx);
-        return NULL;
+        goto fail;
     }
 
     if (build_context_setup_directories(ctx) != TINYPKG_SUCCESS)
     {
-        build_context_free(ctx);
-        return NULL;
+        goto fail;
     }
 
     return ctx;
+
+fail:
+    // Paths are truncated alike, so a reservation is still found
+    build_tmpfs_release(ctx);
+    build_context_free(ctx);
+    return NULL;
 }
 
 void build_context_free(build_context_t *ctx)
 {
     if (!ctx)
         return;
+    sandbox_free(ctx->sandbox);
     TINYPKG_FREE(ctx);
 }
 
@@ -375,6 +689,7 @@ int build_context_cleanup(build_context_t *ctx)
         return TINYPKG_ERROR;
 
     log_debug("Cleaning up build directory: %s", ctx->build_dir);
+    build_tmpfs_release(ctx);
     return utils_remove_directory_recursive(ctx->build_dir);
 }
 
@@ -408,9 +723,11 @@ int build_download_source(build_context_t *ctx)
     if (utils_file_exists(download_path))
     {
         log_info("Source already downloaded: %s", basename);
+        metrics_add(METRICS_SOURCE_CACHE_HITS, 1);
         TINYPKG_FREE(basename);
         return TINYPKG_SUCCESS;
     }
+    metrics_add(METRICS_SOURCE_CACHE_MISSES, 1);
 
     // Create sources directory
     char sources_dir[MAX_PATH];
@@ -424,18 +741,44 @@ int build_download_source(build_context_t *ctx)
     }
     utils_create_directory_recursive(sources_dir);
 
-    // Download using wget or curl with safe command building
-    char cmd[MAX_CMD];
-    int result = build_download_command(cmd, sizeof(cmd), download_path,
-                                        pkg->source_url);
-    if (result != TINYPKG_SUCCESS)
+    // Download through the best mirror (or upstream); the file only appears
+    // under its final name once the package checksum has been verified.
+    // The body is unpacked into source_dir while it arrives.
+    archive_extractor_t *extractor =
+        archive_extractor_create(ctx->source_dir, 1);
+    download_options_t options = {
+        .max_retries = -1,
+        .checksum = pkg->checksum,
+        .sink = extractor ? archive_extractor_sink : NULL,
+        .sink_data = extractor,
+    };
+    int result =
+        mirror_download_with_options(pkg->source_url, download_path, &options);
+
+    struct stat st;
+    if (result == TINYPKG_SUCCESS && stat(download_path, &st) == 0)
     {
-        TINYPKG_FREE(basename);
-        return result;
+        profile_add_download(ctx->profile, (uint64_t)st.st_size);
     }
 
-    log_debug("Download command: %s", cmd);
-    result = utils_run_command(cmd, NULL);
+    if (extractor)
+    {
+        // Only trust the tree if the extractor saw exactly the verified file
+        int extracted = archive_extractor_finish(extractor) == TINYPKG_SUCCESS;
+        if (extracted && result == TINYPKG_SUCCESS &&
+            stat(download_path, &st) == 0 &&
+            archive_extractor_consumed(extractor) == st.st_size)
+        {
+            log_debug("Extracted %s while downloading", basename);
+            ctx->source_extracted = 1;
+        }
+        else
+        {
+            utils_remove_directory_recursive(ctx->source_dir);
+            utils_create_directory_recursive(ctx->source_dir);
+        }
+        archive_extractor_free(extractor);
+    }
 
     TINYPKG_FREE(basename);
     return result;
@@ -446,6 +789,9 @@ int build_extract_source(build_context_t *ctx)
     if (!ctx || !ctx->package)
         return TINYPKG_ERROR;
 
+    if (ctx->source_extracted)
+        return TINYPKG_SUCCESS;
+
     package_t *pkg = ctx->package;
     char *basename = utils_get_basename(pkg->source_url);
     if (!basename)
@@ -468,19 +814,8 @@ int build_extract_source(build_context_t *ctx)
         return TINYPKG_ERROR;
     }
 
-    // Use safe command building for extraction
-    char cmd[MAX_CMD];
-    int result = build_extract_command(cmd, sizeof(cmd), archive_path,
-                                       ctx->source_dir, basename);
-    if (result != TINYPKG_SUCCESS)
-    {
-        log_error("Unsupported archive format: %s", basename);
-        TINYPKG_FREE(basename);
-        return result;
-    }
-
-    log_debug("Extract command: %s", cmd);
-    result = utils_run_command(cmd, NULL);
+    // The format comes from the archive contents, not its name
+    int result = archive_extract_file(archive_path, ctx->source_dir, 1);
 
     TINYPKG_FREE(basename);
     return result;
@@ -500,6 +835,17 @@ int build_configure_package(build_context_t *ctx)
         pkg->build_system = build_detect_system(ctx->source_dir);
     }
 
+    // meson always generates ninja files; CMake does when ninja is
+    // installed, unless the package opts out or drives make itself
+    ctx->use_ninja =
+        pkg->build_system == BUILD_TYPE_MESON ||
+        (pkg->build_system == BUILD_TYPE_CMAKE && !pkg->disable_ninja &&
+         strlen(pkg->build_cmd) == 0 && strlen(pkg->install_cmd) == 0 &&
+         utils_find_program("ninja"));
+
+    // Wrap the compilers before the build system records them
+    compcache_setup(ctx);
+
     // Run appropriate configure step
     switch (pkg->build_system)
     {
@@ -507,6 +853,8 @@ int build_configure_package(build_context_t *ctx)
         return build_run_autotools(ctx);
     case BUILD_TYPE_CMAKE:
         return build_run_cmake(ctx);
+    case BUILD_TYPE_MESON:
+        return build_run_meson(ctx);
     case BUILD_TYPE_MAKE:
         return TINYPKG_SUCCESS; // Make doesn't need configure
     case BUILD_TYPE_CUSTOM:
@@ -537,10 +885,23 @@ int build_compile_package(build_context_t *ctx)
         strncpy(cmd, pkg->build_cmd, sizeof(cmd) - 1);
         cmd[sizeof(cmd) - 1] = '\0';
     }
+    else if (ctx->use_ninja)
+    {
+        if (build_ninja_command(ctx, NULL, cmd, sizeof(cmd)) != TINYPKG_SUCCESS)
+            return TINYPKG_ERROR;
+    }
+    else if (jobserver_is_active())
+    {
+        // Job slots come from the shared pool via MAKEFLAGS; an explicit
+        // -j would make this make its own jobserver
+        snprintf(cmd, sizeof(cmd), "make");
+    }
     else
     {
-        // Use standard make command
-        int parallel_jobs = global_config ? global_config->parallel_jobs : 4;
+        // Use standard make command with the slots granted to this build
+        int parallel_jobs = ctx->parallel_jobs;
+        if (parallel_jobs <= 0)
+            parallel_jobs = global_config ? global_config->parallel_jobs : 4;
         int result = snprintf(cmd, sizeof(cmd), "make -j%d", parallel_jobs);
         if (result >= (int)sizeof(cmd))
         {
@@ -550,10 +911,11 @@ int build_compile_package(build_context_t *ctx)
     }
 
     log_debug("Build command: %s", cmd);
-    return utils_run_command(cmd, ctx->source_dir);
+    return build_run_step(ctx, cmd);
 }
 
-int build_install_files(build_context_t *ctx)
+// Run the package install step into install_dir (DESTDIR)
+int build_stage_files(build_context_t *ctx)
 {
     if (!ctx || !ctx->package)
         return TINYPKG_ERROR;
@@ -573,6 +935,12 @@ int build_install_files(build_context_t *ctx)
         strncpy(cmd, pkg->install_cmd, sizeof(cmd) - 1);
         cmd[sizeof(cmd) - 1] = '\0';
     }
+    else if (ctx->use_ninja)
+    {
+        if (build_ninja_command(ctx, "install", cmd, sizeof(cmd)) !=
+            TINYPKG_SUCCESS)
+            return TINYPKG_ERROR;
+    }
     else
     {
         // Use standard make install
@@ -589,23 +957,136 @@ int build_install_files(build_context_t *ctx)
     }
 
     log_debug("Install command: %s", cmd);
-    int result = utils_run_command(cmd, ctx->source_dir);
+    return build_run_step(ctx, cmd);
+}
+
+static int build_compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// An update installs over the previous version: remove the files it no
+// longer ships, unless another package has taken them over since
+static void build_remove_stale_files(const char *package_name, char **files,
+                                     int count, int threads)
+{
+    char **sorted = NULL;
+    char **stale = NULL;
+    char **owners = NULL;
+    int old_count = 0;
+    int stale_count = 0;
+
+    char **old_files = package_get_file_list(package_name, &old_count);
+    if (!old_files || old_count == 0)
+    {
+        utils_string_array_free(old_files, old_count);
+        return;
+    }
+
+    sorted = TINYPKG_MALLOC(MAX(count, 1) * sizeof(char *));
+    stale = TINYPKG_MALLOC(old_count * sizeof(char *));
+    owners = TINYPKG_CALLOC(old_count, sizeof(char *));
+    if (!sorted || !stale || !owners)
+    {
+        goto out;
+    }
+
+    memcpy(sorted, files, count * sizeof(char *));
+    qsort(sorted, count, sizeof(char *), build_compare_paths);
+    for (int i = 0; i < old_count; i++)
+    {
+        if (!bsearch(&old_files[i], sorted, count, sizeof(char *),
+                     build_compare_paths))
+        {
+            stale[stale_count++] = old_files[i];
+        }
+    }
+    if (stale_count == 0)
+    {
+        goto out;
+    }
+
+    package_owns_files((const char **)stale, stale_count, owners);
+    int kept = 0;
+    for (int i = 0; i < stale_count; i++)
+    {
+        if (!owners[i] || TINYPKG_STREQ(owners[i], package_name))
+        {
+            stale[kept++] = stale[i];
+        }
+        TINYPKG_FREE(owners[i]);
+    }
+
+    log_debug("Removing %d files dropped from %s", kept, package_name);
+    if (kept > 0 && verify_remove_files(stale, kept, threads) != 0)
+    {
+        log_warn("Failed to remove some old files of %s", package_name);
+    }
+
+out:
+    TINYPKG_FREE(sorted);
+    TINYPKG_FREE(stale);
+    TINYPKG_FREE(owners);
+    utils_string_array_free(old_files, old_count);
+}
+
+int build_install_files(build_context_t *ctx)
+{
+    if (!ctx || !ctx->package)
+        return TINYPKG_ERROR;
+
+    package_t *pkg = ctx->package;
+    stage_plan_t *plan = NULL;
+
+    // One walk of the staging tree yields both what to install and the
+    // file list recorded for the package
+    int result = stage_plan_create(ctx->install_dir, &plan);
+    if (result != TINYPKG_SUCCESS)
+    {
+        log_error("Failed to list staged files for %s", pkg->name);
+        return result;
+    }
+
+    // Refuse to overwrite files owned by other packages
+    pthread_mutex_lock(&install_lock);
+    result = package_check_file_conflicts(pkg, plan->files, plan->file_count);
 
     if (result == TINYPKG_SUCCESS)
     {
-        // Copy installed files to system
-        char copy_cmd[MAX_CMD];
-        int copy_result =
-            snprintf(copy_cmd, sizeof(copy_cmd),
-                     "cp -a '%s'/* / 2>/dev/null || true", ctx->install_dir);
-        if (copy_result >= (int)sizeof(copy_cmd))
+        // A kept build directory must stay intact, so copy instead of move
+        int move = !(global_config && global_config->keep_build_dir);
+        int threads = ctx->parallel_jobs > 0 ? ctx->parallel_jobs
+                                             : config_detect_cpu_count();
+        result = stage_plan_commit(plan, "/", move, threads);
+    }
+
+    // Record ownership of the installed files
+    if (result == TINYPKG_SUCCESS)
+    {
+        build_remove_stale_files(pkg->name, plan->files, plan->file_count,
+                                 ctx->parallel_jobs);
+
+        if (package_write_file_list(pkg->name, plan->files, plan->file_count) !=
+                TINYPKG_SUCCESS ||
+            fileindex_add_package(pkg->name, plan->files, plan->file_count) !=
+                TINYPKG_SUCCESS)
         {
-            log_error("Copy command too long");
-            return TINYPKG_ERROR;
+            log_warn("Failed to record installed files for %s", pkg->name);
+        }
+    }
+    pthread_mutex_unlock(&install_lock);
+
+    if (result == TINYPKG_SUCCESS)
+    {
+        // Sums for --verify --checksums, while the files are still cached
+        if (verify_record_sums(pkg->name, plan->files, plan->file_count, 0) !=
+            TINYPKG_SUCCESS)
+        {
+            log_warn("Failed to record file checksums for %s", pkg->name);
         }
-        result = utils_run_command(copy_cmd, NULL);
     }
 
+    stage_plan_free(plan);
     return result;
 }
 
@@ -631,6 +1112,13 @@ build_type_t build_detect_system(const char *source_dir)
         return BUILD_TYPE_AUTOTOOLS;
     }
 
+    // Check for meson
+    result = snprintf(path, sizeof(path), "%s/meson.build", source_dir);
+    if (result < (int)sizeof(path) && utils_file_exists(path))
+    {
+        return BUILD_TYPE_MESON;
+    }
+
     // Check for Makefile
     result = snprintf(path, sizeof(path), "%s/Makefile", source_dir);
     if (result < (int)sizeof(path) && utils_file_exists(path))
@@ -670,7 +1158,7 @@ int build_run_autotools(build_context_t *ctx)
             return TINYPKG_ERROR;
         }
 
-        int result = utils_run_command(cmd, ctx->source_dir);
+        int result = build_run_step(ctx, cmd);
         if (result != TINYPKG_SUCCESS)
         {
             log_warn("Failed to generate configure script");
@@ -690,7 +1178,7 @@ int build_run_autotools(build_context_t *ctx)
     }
 
     log_debug("Configure command: %s", cmd);
-    return utils_run_command(cmd, ctx->source_dir);
+    return build_run_step(ctx, cmd);
 }
 
 int build_run_cmake(build_context_t *ctx)
@@ -703,16 +1191,59 @@ int build_run_cmake(build_context_t *ctx)
     const char *build_type =
         global_config && global_config->debug_symbols ? "Debug" : "Release";
 
+    // Generator and compiler launchers go first so package arguments can
+    // override them
+    char args[MAX_CMD];
+    if (snprintf(args, sizeof(args), "%s%s %s",
+                 ctx->use_ninja ? "-G Ninja " : "", compcache_cmake_args(ctx),
+                 ctx->package->configure_args) >= (int)sizeof(args))
+    {
+        log_error("CMake arguments too long");
+        return TINYPKG_ERROR;
+    }
+
     char cmd[MAX_CMD];
     int result = safe_cmake_command(cmd, sizeof(cmd), build_type, prefix,
-                                    ctx->package->configure_args);
+                                    args);
     if (result != TINYPKG_SUCCESS)
     {
         return result;
     }
 
     log_debug("CMake command: %s", cmd);
-    return utils_run_command(cmd, ctx->source_dir);
+    return build_run_step(ctx, cmd);
+}
+
+int build_run_meson(build_context_t *ctx)
+{
+    if (!ctx || !ctx->package)
+        return TINYPKG_ERROR;
+
+    if (!utils_find_program("meson") || !utils_find_program("ninja"))
+    {
+        log_error("meson and ninja are required to build %s",
+                  ctx->package->name);
+        return TINYPKG_ERROR;
+    }
+
+    const char *prefix =
+        global_config ? global_config->install_prefix : "/usr/local";
+    const char *build_type =
+        global_config && global_config->debug_symbols ? "debug" : "release";
+
+    char cmd[MAX_CMD];
+    int result = snprintf(cmd, sizeof(cmd),
+                          "meson setup --prefix=%s --buildtype=%s %s %s",
+                          prefix, build_type, ctx->package->configure_args,
+                          BUILD_MESON_DIR);
+    if (result >= (int)sizeof(cmd))
+    {
+        log_error("Meson command too long");
+        return TINYPKG_ERROR;
+    }
+
+    log_debug("Meson command: %s", cmd);
+    return build_run_step(ctx, cmd);
 }
 
 int build_run_make(build_context_t *ctx)
@@ -769,16 +1300,28 @@ int build_is_running(const char *package_name)
     if (!package_name)
         return 0;
 
+    int running = 0;
+    pthread_mutex_lock(&active_builds_lock);
     for (int i = 0; i < active_build_count; i++)
     {
         if (active_builds[i] &&
             strcmp(active_builds[i]->package->name, package_name) == 0)
         {
-            return 1;
+            running = 1;
+            break;
         }
     }
+    pthread_mutex_unlock(&active_builds_lock);
 
-    return 0;
+    return running;
+}
+
+int build_get_active_count(void)
+{
+    pthread_mutex_lock(&active_builds_lock);
+    int count = active_build_count;
+    pthread_mutex_unlock(&active_builds_lock);
+    return count;
 }
 
 int build_clean_package(const char *package_name)
@@ -786,18 +1329,11 @@ int build_clean_package(const char *package_name)
     if (!package_name)
         return TINYPKG_ERROR;
 
-    // Remove build directory for this package
-    char build_dir[MAX_PATH];
-    int result = snprintf(build_dir, sizeof(build_dir), "%s/builds/%s-*",
-                          CACHE_DIR, package_name);
-    if (result >= (int)sizeof(build_dir))
-    {
-        log_error("Build directory path too long");
-        return TINYPKG_ERROR;
-    }
-
+    // Remove build directories for this package from both workspaces
     char cmd[MAX_CMD];
-    result = snprintf(cmd, sizeof(cmd), "rm -rf %s", build_dir);
+    int result = snprintf(cmd, sizeof(cmd), "rm -rf %s/%s-* %s/%s-*",
+                          BUILD_DISK_DIR, package_name, BUILD_TMPFS_DIR,
+                          package_name);
     if (result >= (int)sizeof(cmd))
     {
         log_error("Clean command too long");
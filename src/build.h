@@ -8,6 +8,21 @@
 
 #include <sys/types.h>
 
+// Maximum number of builds tracked concurrently
+#define BUILD_MAX_ACTIVE 16
+
+// Out-of-tree build directory for meson, relative to the source tree
+#define BUILD_MESON_DIR "_build"
+
+// Build workspaces: on disk below CACHE_DIR, or in memory when it fits
+#define BUILD_DISK_DIR CACHE_DIR "/builds"
+#define BUILD_TMPFS_MOUNT "/dev/shm"
+#define BUILD_TMPFS_ROOT BUILD_TMPFS_MOUNT "/tinypkg"
+#define BUILD_TMPFS_DIR BUILD_TMPFS_ROOT "/builds"
+#define BUILD_TMPFS_FACTOR 4            // Workspace size per installed byte
+#define BUILD_TMPFS_DEFAULT_MB 2048     // Assumed when size_estimate is unset
+#define BUILD_TMPFS_MEMORY_PERCENT 50   // Share of RAM unfinished workspaces may use
+
 // Build configuration
 typedef struct build_config {
     int parallel_jobs;
@@ -41,13 +56,29 @@ typedef struct build_context {
     time_t start_time;
     time_t end_time;
     pid_t build_pid;
+    int parallel_jobs;      // make -j slots granted to this build
+    int source_extracted;   // source_dir was unpacked while downloading
+    int use_ninja;          // Generated build files are driven by ninja
+    int on_tmpfs;           // build_dir lives below BUILD_TMPFS_DIR
+    struct profile *profile;  // Timings of the owning build, NULL to skip
+    struct buildlog *log;   // Captured command output, NULL for the console
+    struct sandbox *sandbox;  // Isolates build steps, NULL to run them directly
+    char cache_key[BINCACHE_KEY_SIZE];  // Binary cache key of the unbuilt package
+
+    // Compiler cache (see compcache.h)
+    int compiler_cache;     // compcache_tool_t wrapping this build
+    char cache_env[2048];   // Shell prefix exporting CC/CXX and cache settings
+    long cache_hits;        // sccache counters when the build started
+    long cache_misses;
 } build_context_t;
 
 // Function declarations
 
 // Main build functions
 int build_package(package_t *pkg);
+int build_package_with_jobs(package_t *pkg, int parallel_jobs);
 int build_install_package(package_t *pkg);
+int build_restore_package(package_t *pkg, const char *artifact);
 int build_clean_package(const char *package_name);
 
 // Build steps
@@ -55,6 +86,7 @@ int build_download_source(build_context_t *ctx);
 int build_extract_source(build_context_t *ctx);
 int build_configure_package(build_context_t *ctx);
 int build_compile_package(build_context_t *ctx);
+int build_stage_files(build_context_t *ctx);
 int build_install_files(build_context_t *ctx);
 
 // Build context management
@@ -67,6 +99,7 @@ int build_context_cleanup(build_context_t *ctx);
 build_type_t build_detect_system(const char *source_dir);
 int build_run_autotools(build_context_t *ctx);
 int build_run_cmake(build_context_t *ctx);
+int build_run_meson(build_context_t *ctx);
 int build_run_make(build_context_t *ctx);
 int build_run_custom(build_context_t *ctx);
 
@@ -74,6 +107,7 @@ int build_run_custom(build_context_t *ctx);
 const char *build_status_to_string(build_status_t status);
 int build_get_progress(const char *package_name);
 int build_is_running(const char *package_name);
+int build_get_active_count(void);
 int build_cancel(const char *package_name);
 
 #endif /* TINYPKG_BUILD_H */
@@ -0,0 +1,519 @@
+/*
+ * TinyPkg - Build Output Implementation
+ * Captured build output: a bounded in-memory tail, a compressed log file
+ * per build and a live status line
+ */
+
+#include "../include/tinypkg.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// One build's output. The build's commands write into the pipe; the reader
+// thread moves it into the ring and the compressed file, so memory use
+// does not depend on how much a build prints.
+struct buildlog
+{
+    char name[MAX_NAME];
+    char path[MAX_PATH];
+    char phase[32];
+    int read_fd;
+    int write_fd;
+    gzFile file;
+    time_t start_time;
+    int eof;
+    int abandoned;
+
+    // Newest output; ring_total counts every byte ever received
+    char ring[BUILDLOG_RING_SIZE];
+    size_t ring_total;
+
+    // Last line for the status display
+    char last_line[BUILDLOG_STATUS_TEXT + 1];
+    char partial[BUILDLOG_STATUS_TEXT + 1];
+    size_t partial_length;
+    int in_escape;
+
+    struct buildlog *next;
+};
+
+// All open logs, drained by one reader thread
+static struct
+{
+    buildlog_t *logs;
+    int count;
+    int running;
+    int wake_fds[2];
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} g_buildlogs = {
+    .wake_fds = {-1, -1},
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void buildlog_wake(void)
+{
+    char byte = 1;
+    if (g_buildlogs.wake_fds[1] >= 0 &&
+        write(g_buildlogs.wake_fds[1], &byte, 1) < 0 && errno != EAGAIN)
+    {
+        log_debug("Failed to wake build output reader: %s", strerror(errno));
+    }
+}
+
+// Remember the newest line, without colour codes, for the status line
+static void buildlog_track_line(buildlog_t *log, const char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char c = (unsigned char)data[i];
+
+        if (log->in_escape)
+        {
+            if (c >= 0x40 && c <= 0x7e && c != '[')
+                log->in_escape = 0;
+            continue;
+        }
+        if (c == 0x1b)
+        {
+            log->in_escape = 1;
+        }
+        else if (c == '\n' || c == '\r')
+        {
+            if (log->partial_length > 0)
+            {
+                memcpy(log->last_line, log->partial, log->partial_length);
+                log->last_line[log->partial_length] = '\0';
+                log->partial_length = 0;
+            }
+        }
+        else if (log->partial_length < BUILDLOG_STATUS_TEXT &&
+                 (c >= 0x20 || c == '\t') && c != 0x7f)
+        {
+            log->partial[log->partial_length++] = c == '\t' ? ' ' : (char)c;
+        }
+    }
+}
+
+static void buildlog_consume(buildlog_t *log, const char *data, size_t length)
+{
+    if (log->file && gzwrite(log->file, data, (unsigned)length) <= 0)
+    {
+        log_warn("Failed to write build log %s, no longer saving it", log->path);
+        gzclose(log->file);
+        log->file = NULL;
+    }
+
+    // Only the last BUILDLOG_RING_SIZE bytes can survive
+    if (length > BUILDLOG_RING_SIZE)
+    {
+        log->ring_total += length - BUILDLOG_RING_SIZE;
+        data += length - BUILDLOG_RING_SIZE;
+        length = BUILDLOG_RING_SIZE;
+    }
+    size_t offset = log->ring_total % BUILDLOG_RING_SIZE;
+    size_t first = MIN(length, BUILDLOG_RING_SIZE - offset);
+    memcpy(log->ring + offset, data, first);
+    memcpy(log->ring, data + first, length - first);
+    log->ring_total += length;
+
+    buildlog_track_line(log, data, length);
+}
+
+// "gcc [compile] 2m10s: CC foo.o | zlib [configure] 4s: checking ..."
+// Called on the reader thread.
+static void buildlog_update_status(void)
+{
+    char status[1024];
+    size_t used = 0;
+    time_t now = time(NULL);
+
+    status[0] = '\0';
+    pthread_mutex_lock(&g_buildlogs.lock);
+    for (buildlog_t *log = g_buildlogs.logs; log && used < sizeof(status);
+         log = log->next)
+    {
+        long elapsed = (long)(now - log->start_time);
+        used += (size_t)snprintf(status + used, sizeof(status) - used,
+                                 "%s%s [%s] %ldm%02lds%s%s", used ? " | " : "",
+                                 log->name, log->phase, elapsed / 60,
+                                 elapsed % 60, log->last_line[0] ? ": " : "",
+                                 log->last_line);
+    }
+    pthread_mutex_unlock(&g_buildlogs.lock);
+
+    logging_set_status(used ? status : NULL);
+}
+
+static void *buildlog_reader(void *arg)
+{
+    struct pollfd *fds = NULL;
+    buildlog_t **polled = NULL;
+    int capacity = 0;
+    char buffer[16384];
+    struct timespec last_status = {0, 0};
+
+    UNUSED(arg);
+
+    for (;;)
+    {
+        int count = 0;
+
+        pthread_mutex_lock(&g_buildlogs.lock);
+        if (g_buildlogs.count == 0)
+        {
+            g_buildlogs.running = 0;
+            pthread_mutex_unlock(&g_buildlogs.lock);
+            break;
+        }
+        if (g_buildlogs.count + 1 > capacity)
+        {
+            int grown_capacity = g_buildlogs.count + 8;
+            struct pollfd *grown_fds =
+                TINYPKG_REALLOC(fds, grown_capacity * sizeof(struct pollfd));
+            if (grown_fds)
+                fds = grown_fds;
+            buildlog_t **grown_logs =
+                TINYPKG_REALLOC(polled, grown_capacity * sizeof(buildlog_t *));
+            if (grown_logs)
+                polled = grown_logs;
+            if (grown_fds && grown_logs)
+                capacity = grown_capacity;
+        }
+        if (capacity == 0)
+        {
+            // Nothing to poll with yet; try to grow again shortly
+            pthread_mutex_unlock(&g_buildlogs.lock);
+            usleep(BUILDLOG_STATUS_INTERVAL_MS * 1000);
+            continue;
+        }
+        fds[count].fd = g_buildlogs.wake_fds[0];
+        fds[count++].events = POLLIN;
+        for (buildlog_t *log = g_buildlogs.logs; log && count < capacity;
+             log = log->next)
+        {
+            if (log->eof)
+                continue;
+            if (log->abandoned)
+            {
+                // The owner stopped waiting for the end of its output
+                log->eof = 1;
+                pthread_cond_broadcast(&g_buildlogs.cond);
+                continue;
+            }
+            polled[count] = log;
+            fds[count].fd = log->read_fd;
+            fds[count++].events = POLLIN;
+        }
+        pthread_mutex_unlock(&g_buildlogs.lock);
+
+        if (poll(fds, (nfds_t)count, BUILDLOG_STATUS_INTERVAL_MS) < 0 &&
+            errno != EINTR)
+        {
+            log_warn("Polling build output failed: %s", strerror(errno));
+            usleep(BUILDLOG_STATUS_INTERVAL_MS * 1000);
+        }
+
+        if (fds[0].revents)
+        {
+            while (read(g_buildlogs.wake_fds[0], buffer, sizeof(buffer)) > 0)
+                ;
+        }
+
+        for (int i = 1; i < count; i++)
+        {
+            if (!fds[i].revents)
+                continue;
+
+            buildlog_t *log = polled[i];
+            ssize_t n = read(log->read_fd, buffer, sizeof(buffer));
+            if (n > 0)
+            {
+                buildlog_consume(log, buffer, (size_t)n);
+            }
+            else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+            {
+                // The owner may free the log as soon as it sees this
+                pthread_mutex_lock(&g_buildlogs.lock);
+                log->eof = 1;
+                pthread_cond_broadcast(&g_buildlogs.cond);
+                pthread_mutex_unlock(&g_buildlogs.lock);
+            }
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - last_status.tv_sec) * 1000 +
+                (now.tv_nsec - last_status.tv_nsec) / 1000000 >=
+            BUILDLOG_STATUS_INTERVAL_MS)
+        {
+            buildlog_update_status();
+            last_status = now;
+        }
+    }
+
+    logging_set_status(NULL);
+    TINYPKG_FREE(fds);
+    TINYPKG_FREE(polled);
+    return NULL;
+}
+
+// Register a log and make sure the reader is running. Called with the
+// lock held.
+static int buildlog_register(buildlog_t *log)
+{
+    if (g_buildlogs.wake_fds[0] < 0 &&
+        pipe2(g_buildlogs.wake_fds, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        g_buildlogs.wake_fds[0] = g_buildlogs.wake_fds[1] = -1;
+        return TINYPKG_ERROR;
+    }
+
+    if (!g_buildlogs.running)
+    {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int started = pthread_create(&g_buildlogs.thread, &attr,
+                                     buildlog_reader, NULL) == 0;
+        pthread_attr_destroy(&attr);
+        if (!started)
+            return TINYPKG_ERROR;
+        g_buildlogs.running = 1;
+    }
+
+    log->next = g_buildlogs.logs;
+    g_buildlogs.logs = log;
+    g_buildlogs.count++;
+    buildlog_wake();
+    return TINYPKG_SUCCESS;
+}
+
+// Lifecycle
+buildlog_t *buildlog_open(const package_t *pkg)
+{
+    int fds[2];
+
+    if (!pkg)
+        return NULL;
+
+    if (utils_create_directory_recursive(BUILDLOG_DIR) != TINYPKG_SUCCESS)
+    {
+        log_warn("Cannot create %s, build output goes to the console",
+                 BUILDLOG_DIR);
+        return NULL;
+    }
+
+    buildlog_t *log = TINYPKG_CALLOC(1, sizeof(buildlog_t));
+    if (!log)
+        return NULL;
+
+    snprintf(log->name, sizeof(log->name), "%s", pkg->name);
+    strncpy(log->phase, "start", sizeof(log->phase) - 1);
+    log->start_time = time(NULL);
+    snprintf(log->path, sizeof(log->path), "%s/%s-%s.log.gz", BUILDLOG_DIR,
+             pkg->name, pkg->version);
+
+    // Both ends are close-on-exec so concurrent builds do not inherit
+    // each other's pipes; commands get the write end as stdout/stderr
+    if (pipe2(fds, O_CLOEXEC) != 0)
+    {
+        log_warn("Cannot capture build output: %s", strerror(errno));
+        TINYPKG_FREE(log);
+        return NULL;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    log->read_fd = fds[0];
+    log->write_fd = fds[1];
+
+    log->file = gzopen(log->path, "wb");
+    if (!log->file)
+    {
+        log_warn("Cannot create build log %s", log->path);
+    }
+
+    pthread_mutex_lock(&g_buildlogs.lock);
+    int result = buildlog_register(log);
+    pthread_mutex_unlock(&g_buildlogs.lock);
+
+    if (result != TINYPKG_SUCCESS)
+    {
+        log_warn("Cannot start build output reader");
+        close(log->read_fd);
+        close(log->write_fd);
+        if (log->file)
+            gzclose(log->file);
+        TINYPKG_FREE(log);
+        return NULL;
+    }
+    return log;
+}
+
+// Print the newest lines of the captured output
+static void buildlog_dump_tail(const buildlog_t *log, int lines)
+{
+    size_t length = MIN(log->ring_total, (size_t)BUILDLOG_RING_SIZE);
+    if (length == 0)
+        return;
+
+    char *text = TINYPKG_MALLOC(length + 1);
+    if (!text)
+        return;
+
+    // Unroll the ring into chronological order
+    size_t start = (log->ring_total - length) % BUILDLOG_RING_SIZE;
+    size_t first = MIN(length, BUILDLOG_RING_SIZE - start);
+    memcpy(text, log->ring + start, first);
+    memcpy(text + first, log->ring, length - first);
+    while (length > 0 && text[length - 1] == '\n')
+        length--;
+    text[length] = '\0';
+
+    // Walk back to the start of the line we want first
+    char *begin = text + length;
+    int found = 0;
+    while (begin > text && found < lines)
+    {
+        begin--;
+        if (*begin == '\n' && ++found == lines)
+        {
+            begin++;
+            break;
+        }
+    }
+    // The oldest bytes in the ring usually begin mid-line
+    if (begin == text && log->ring_total > BUILDLOG_RING_SIZE)
+    {
+        char *newline = strchr(text, '\n');
+        begin = newline ? newline + 1 : text;
+    }
+
+    log_error("Last lines of the %s build output (full log: %s):", log->name,
+              log->path);
+    char *save = NULL;
+    for (char *line = strtok_r(begin, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save))
+    {
+        log_error("  %s", line);
+    }
+    TINYPKG_FREE(text);
+}
+
+int buildlog_finish(buildlog_t *log, int failed)
+{
+    int result = TINYPKG_SUCCESS;
+    struct timespec deadline;
+
+    if (!log)
+        return TINYPKG_ERROR;
+
+    // Our end is the last writer once the build's commands have exited,
+    // unless one of them left a process behind that still holds it
+    close(log->write_fd);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += BUILDLOG_DRAIN_MS / 1000;
+    deadline.tv_nsec += (long)(BUILDLOG_DRAIN_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&g_buildlogs.lock);
+    buildlog_wake();
+    while (!log->eof)
+    {
+        if (!log->abandoned &&
+            pthread_cond_timedwait(&g_buildlogs.cond, &g_buildlogs.lock,
+                                   &deadline) == ETIMEDOUT &&
+            !log->eof)
+        {
+            // The reader lets go of the log on its next pass
+            log_warn("Output of %s is still open after the build step "
+                     "exited, no longer reading it",
+                     log->name);
+            log->abandoned = 1;
+            buildlog_wake();
+        }
+        else if (log->abandoned)
+        {
+            pthread_cond_wait(&g_buildlogs.cond, &g_buildlogs.lock);
+        }
+    }
+    for (buildlog_t **link = &g_buildlogs.logs; *link; link = &(*link)->next)
+    {
+        if (*link == log)
+        {
+            *link = log->next;
+            g_buildlogs.count--;
+            break;
+        }
+    }
+    buildlog_wake();
+    pthread_mutex_unlock(&g_buildlogs.lock);
+
+    close(log->read_fd);
+    if (log->file && gzclose(log->file) != Z_OK)
+    {
+        log_warn("Failed to finish build log %s", log->path);
+        result = TINYPKG_ERROR_FILE;
+    }
+
+    if (failed)
+        buildlog_dump_tail(log, BUILDLOG_TAIL_LINES);
+
+    TINYPKG_FREE(log);
+    return result;
+}
+
+// Build integration
+int buildlog_fd(const buildlog_t *log)
+{
+    return log ? log->write_fd : -1;
+}
+
+void buildlog_set_phase(buildlog_t *log, const char *phase)
+{
+    if (!log || !phase)
+        return;
+
+    pthread_mutex_lock(&g_buildlogs.lock);
+    strncpy(log->phase, phase, sizeof(log->phase) - 1);
+    log->phase[sizeof(log->phase) - 1] = '\0';
+    pthread_mutex_unlock(&g_buildlogs.lock);
+}
+
+// Mark where each command's output starts
+void buildlog_command(buildlog_t *log, const char *cmd)
+{
+    char header[MAX_CMD + 8];
+
+    if (!log || !cmd)
+        return;
+
+    int length = snprintf(header, sizeof(header), "==> %s\n", cmd);
+    length = MIN(length, (int)sizeof(header) - 1);
+    for (int done = 0; done < length;)
+    {
+        ssize_t n = write(log->write_fd, header + done, (size_t)(length - done));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += (int)n;
+    }
+}
+
+const char *buildlog_path(const buildlog_t *log)
+{
+    return log ? log->path : NULL;
+}
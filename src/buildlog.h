@@ -0,0 +1,44 @@
+/*
+ * TinyPkg - Build Output Header
+ * Captured build output: a bounded in-memory tail, a compressed log file
+ * per build and a live status line
+ */
+
+#ifndef TINYPKG_BUILDLOG_H
+#define TINYPKG_BUILDLOG_H
+
+#include <sys/types.h>
+#include <time.h>
+
+// Compressed logs, one per package version, inside LOG_DIR
+#define BUILDLOG_DIR LOG_DIR "/builds"
+
+// Most recent output kept in memory per build
+#define BUILDLOG_RING_SIZE (64 * 1024)
+
+// Lines shown when a build fails
+#define BUILDLOG_TAIL_LINES 40
+
+// Status line refresh and the part of a build's last line it shows
+#define BUILDLOG_STATUS_INTERVAL_MS 250
+#define BUILDLOG_STATUS_TEXT 64
+
+// How long output is still read once a build step has exited. A daemon
+// the step left behind may hold the pipe open for good.
+#define BUILDLOG_DRAIN_MS 2000
+
+typedef struct buildlog buildlog_t;
+
+// Function declarations
+
+// Lifecycle; failed dumps the tail of the output before closing
+buildlog_t *buildlog_open(const package_t *pkg);
+int buildlog_finish(buildlog_t *log, int failed);
+
+// Build integration
+int buildlog_fd(const buildlog_t *log);
+void buildlog_set_phase(buildlog_t *log, const char *phase);
+void buildlog_command(buildlog_t *log, const char *cmd);
+const char *buildlog_path(const buildlog_t *log);
+
+#endif /* TINYPKG_BUILDLOG_H */
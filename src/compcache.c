@@ -0,0 +1,367 @@
+/*
+ * TinyPkg - Compiler Cache Implementation
+ * ccache/sccache integration for package builds
+ */
+
+#include "../include/tinypkg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+compcache_tool_t compcache_detect(void)
+{
+    const char *mode = global_config ? global_config->compiler_cache : "none";
+
+    if (strcasecmp(mode, "ccache") == 0 || strcasecmp(mode, "sccache") == 0)
+    {
+        compcache_tool_t tool = strcasecmp(mode, "ccache") == 0
+                                    ? COMPCACHE_CCACHE
+                                    : COMPCACHE_SCCACHE;
+        if (utils_find_program(compcache_tool_to_string(tool)))
+        {
+            return tool;
+        }
+        log_warn("Compiler cache %s not found in PATH, building without it",
+                 mode);
+        return COMPCACHE_NONE;
+    }
+
+    if (strcasecmp(mode, "auto") == 0)
+    {
+        if (utils_find_program("ccache"))
+            return COMPCACHE_CCACHE;
+        if (utils_find_program("sccache"))
+            return COMPCACHE_SCCACHE;
+    }
+    return COMPCACHE_NONE;
+}
+
+const char *compcache_tool_to_string(compcache_tool_t tool)
+{
+    switch (tool)
+    {
+    case COMPCACHE_CCACHE:
+        return "ccache";
+    case COMPCACHE_SCCACHE:
+        return "sccache";
+    default:
+        return "none";
+    }
+}
+
+// Append "NAME='value' " to the export list; values that cannot be
+// single-quoted are left out
+static int compcache_export(char *env, size_t env_size, const char *name,
+                            const char *value)
+{
+    size_t used = strlen(env);
+
+    if (strchr(value, '\''))
+    {
+        log_warn("Not exporting %s for the compiler cache: %s", name, value);
+        return TINYPKG_SUCCESS;
+    }
+    if (snprintf(env + used, env_size - used, "%s='%s' ", name, value) >=
+        (int)(env_size - used))
+    {
+        env[used] = '\0';
+        return TINYPKG_ERROR;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Wrap the compiler the build would use anyway
+static int compcache_export_compiler(char *env, size_t env_size,
+                                     compcache_tool_t tool, const char *name,
+                                     const char *fallback)
+{
+    const char *compiler = getenv(name);
+    char value[MAX_PATH];
+
+    if (!compiler || !*compiler)
+    {
+        compiler = fallback;
+    }
+    if (strncmp(compiler, compcache_tool_to_string(tool),
+                strlen(compcache_tool_to_string(tool))) == 0)
+    {
+        return compcache_export(env, env_size, name, compiler);
+    }
+
+    snprintf(value, sizeof(value), "%s %s", compcache_tool_to_string(tool),
+             compiler);
+    return compcache_export(env, env_size, name, value);
+}
+
+// Read the sccache server's cumulative hit and miss counters
+static int compcache_sccache_counters(const build_context_t *ctx, long *hits,
+                                      long *misses)
+{
+    char cmd[MAX_CMD];
+    char *output = NULL;
+    int exit_code = -1;
+
+    *hits = 0;
+    *misses = 0;
+    snprintf(cmd, sizeof(cmd), "%ssccache --show-stats", ctx->cache_env);
+    if (utils_run_command_with_output(cmd, NULL, &output, &exit_code) !=
+            TINYPKG_SUCCESS ||
+        exit_code != 0 || !output)
+    {
+        TINYPKG_FREE(output);
+        return TINYPKG_ERROR;
+    }
+
+    // "Cache hits   123" / "Cache misses   45"; per-language lines such
+    // as "Cache hits (C/C++)" are not counted twice
+    char *save = NULL;
+    for (char *line = strtok_r(output, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save))
+    {
+        long value;
+        if (sscanf(line, "Cache hits %ld", &value) == 1)
+        {
+            *hits = value;
+        }
+        else if (sscanf(line, "Cache misses %ld", &value) == 1)
+        {
+            *misses = value;
+        }
+    }
+
+    TINYPKG_FREE(output);
+    return TINYPKG_SUCCESS;
+}
+
+// Choose a wrapper for this build and prepare the environment every
+// build step runs with
+int compcache_setup(build_context_t *ctx)
+{
+    char cache_dir[MAX_PATH];
+    char value[MAX_PATH];
+    int result = TINYPKG_SUCCESS;
+
+    if (!ctx || !ctx->package)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    ctx->cache_env[0] = '\0';
+    ctx->compiler_cache = compcache_detect();
+    if (ctx->compiler_cache == COMPCACHE_NONE)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    compcache_tool_t tool = (compcache_tool_t)ctx->compiler_cache;
+    snprintf(cache_dir, sizeof(cache_dir), "%s/%s", COMPCACHE_DIR,
+             compcache_tool_to_string(tool));
+    if (utils_create_directory_recursive(cache_dir) != TINYPKG_SUCCESS)
+    {
+        log_warn("Cannot create compiler cache directory %s", cache_dir);
+        ctx->compiler_cache = COMPCACHE_NONE;
+        return TINYPKG_SUCCESS;
+    }
+
+    char *env = ctx->cache_env;
+    size_t env_size = sizeof(ctx->cache_env);
+    int size_mb = global_config ? global_config->compiler_cache_size : 0;
+
+    snprintf(env, env_size, "export ");
+    if (tool == COMPCACHE_CCACHE)
+    {
+        // Paths below the source tree are rewritten relative to it, so a
+        // new version unpacked into a differently named build directory
+        // still hits the objects of the previous one
+        result |= compcache_export(env, env_size, "CCACHE_DIR", cache_dir);
+        result |= compcache_export(env, env_size, "CCACHE_BASEDIR",
+                                   ctx->source_dir);
+        result |= compcache_export(env, env_size, "CCACHE_NOHASHDIR", "1");
+        // Without the log the hit rate is not reported; the cache still works
+        if ((size_t)snprintf(value, sizeof(value), "%s/%s", ctx->build_dir,
+                             COMPCACHE_STATS_LOG) < sizeof(value))
+        {
+            unlink(value);
+            result |= compcache_export(env, env_size, "CCACHE_STATSLOG", value);
+        }
+        if (size_mb > 0)
+        {
+            snprintf(value, sizeof(value), "%dM", size_mb);
+            result |= compcache_export(env, env_size, "CCACHE_MAXSIZE", value);
+        }
+    }
+    else
+    {
+        // Read by the sccache server when it starts
+        result |= compcache_export(env, env_size, "SCCACHE_DIR", cache_dir);
+        if (size_mb > 0)
+        {
+            snprintf(value, sizeof(value), "%dM", size_mb);
+            result |= compcache_export(env, env_size, "SCCACHE_CACHE_SIZE",
+                                       value);
+        }
+    }
+
+    // CMake takes the wrapper as a compiler launcher instead
+    if (ctx->package->build_system != BUILD_TYPE_CMAKE)
+    {
+        result |= compcache_export_compiler(env, env_size, tool, "CC", "cc");
+        result |= compcache_export_compiler(env, env_size, tool, "CXX", "c++");
+    }
+
+    size_t used = strlen(env);
+    if (result != TINYPKG_SUCCESS || used + 3 > env_size ||
+        used == strlen("export "))
+    {
+        log_warn("Compiler cache environment too long, building without it");
+        ctx->cache_env[0] = '\0';
+        ctx->compiler_cache = COMPCACHE_NONE;
+        return TINYPKG_SUCCESS;
+    }
+    env[used - 1] = ';';
+    env[used] = ' ';
+    env[used + 1] = '\0';
+
+    if (tool == COMPCACHE_SCCACHE &&
+        compcache_sccache_counters(ctx, &ctx->cache_hits, &ctx->cache_misses) !=
+            TINYPKG_SUCCESS)
+    {
+        ctx->cache_hits = ctx->cache_misses = -1;
+    }
+
+    log_debug("Using %s for %s (%s)", compcache_tool_to_string(tool),
+              ctx->package->name, cache_dir);
+    return TINYPKG_SUCCESS;
+}
+
+// Prefix a build command with the compiler cache environment
+int compcache_wrap_command(const build_context_t *ctx, const char *cmd,
+                           char *out, size_t out_size)
+{
+    if (!ctx || !cmd || !out)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    if (snprintf(out, out_size, "%s%s", ctx->cache_env, cmd) >= (int)out_size)
+    {
+        log_error("Build command too long with compiler cache settings");
+        return TINYPKG_ERROR;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+const char *compcache_cmake_args(const build_context_t *ctx)
+{
+    if (!ctx)
+        return "";
+
+    switch (ctx->compiler_cache)
+    {
+    case COMPCACHE_CCACHE:
+        return "-DCMAKE_C_COMPILER_LAUNCHER=ccache "
+               "-DCMAKE_CXX_COMPILER_LAUNCHER=ccache";
+    case COMPCACHE_SCCACHE:
+        return "-DCMAKE_C_COMPILER_LAUNCHER=sccache "
+               "-DCMAKE_CXX_COMPILER_LAUNCHER=sccache";
+    default:
+        return "";
+    }
+}
+
+// Count the results ccache logged for this build
+static int compcache_ccache_counters(const build_context_t *ctx, long *hits,
+                                     long *misses)
+{
+    char path[MAX_PATH];
+    char line[256];
+
+    *hits = 0;
+    *misses = 0;
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", ctx->build_dir,
+                         COMPCACHE_STATS_LOG) >= sizeof(path))
+    {
+        return TINYPKG_ERROR;
+    }
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        return TINYPKG_ERROR_FILE;
+    }
+
+    // One "# <source>" line per compilation followed by its counters
+    while (fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\n")] = '\0';
+        if (strcmp(line, "direct_cache_hit") == 0 ||
+            strcmp(line, "preprocessed_cache_hit") == 0)
+        {
+            (*hits)++;
+        }
+        else if (strcmp(line, "cache_miss") == 0)
+        {
+            (*misses)++;
+        }
+    }
+
+    fclose(fp);
+    return TINYPKG_SUCCESS;
+}
+
+// Hits and misses of this build so far
+int compcache_stats(const build_context_t *ctx, long *hits, long *misses)
+{
+    if (!ctx || !hits || !misses || ctx->compiler_cache == COMPCACHE_NONE)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    if (ctx->compiler_cache == COMPCACHE_CCACHE)
+    {
+        return compcache_ccache_counters(ctx, hits, misses);
+    }
+
+    // The sccache server is shared, so concurrent builds blur this
+    if (ctx->cache_hits < 0 ||
+        compcache_sccache_counters(ctx, hits, misses) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+    *hits = MAX(0, *hits - ctx->cache_hits);
+    *misses = MAX(0, *misses - ctx->cache_misses);
+    return TINYPKG_SUCCESS;
+}
+
+// Log the cache hit rate for the build summary
+void compcache_report(const build_context_t *ctx)
+{
+    long hits = 0;
+    long misses = 0;
+
+    if (!ctx || !ctx->package || ctx->compiler_cache == COMPCACHE_NONE)
+    {
+        return;
+    }
+
+    if (compcache_stats(ctx, &hits, &misses) != TINYPKG_SUCCESS)
+    {
+        log_debug("No %s statistics for %s",
+                  compcache_tool_to_string((compcache_tool_t)ctx->compiler_cache),
+                  ctx->package->name);
+        return;
+    }
+
+    long total = hits + misses;
+    if (total == 0)
+    {
+        log_info("Compiler cache (%s): no cacheable compilations",
+                 compcache_tool_to_string((compcache_tool_t)ctx->compiler_cache));
+        return;
+    }
+
+    log_info("Compiler cache (%s): %ld of %ld compilations hit (%.1f%%)",
+             compcache_tool_to_string((compcache_tool_t)ctx->compiler_cache),
+             hits, total, 100.0 * (double)hits / (double)total);
+}
@@ -0,0 +1,36 @@
+/*
+ * TinyPkg - Compiler Cache Header
+ * ccache/sccache integration for package builds
+ */
+
+#ifndef TINYPKG_COMPCACHE_H
+#define TINYPKG_COMPCACHE_H
+
+// Compiler cache wrappers
+typedef enum {
+    COMPCACHE_NONE = 0,
+    COMPCACHE_CCACHE = 1,
+    COMPCACHE_SCCACHE = 2
+} compcache_tool_t;
+
+// Cache storage: <COMPCACHE_DIR>/<tool>, local to this host
+#define COMPCACHE_DIR CACHE_DIR "/compiler"
+
+// Per-build ccache statistics log, relative to the build directory
+#define COMPCACHE_STATS_LOG "ccache.stats"
+
+// Function declarations
+
+// Tool selection
+compcache_tool_t compcache_detect(void);
+const char *compcache_tool_to_string(compcache_tool_t tool);
+
+// Build integration
+int compcache_setup(build_context_t *ctx);
+int compcache_wrap_command(const build_context_t *ctx, const char *cmd,
+                           char *out, size_t out_size);
+const char *compcache_cmake_args(const build_context_t *ctx);
+int compcache_stats(const build_context_t *ctx, long *hits, long *misses);
+void compcache_report(const build_context_t *ctx);
+
+#endif /* TINYPKG_COMPCACHE_H */
@@ -39,11 +39,19 @@ static const char *DEFAULT_CONFIG_TEMPLATE =
 "enable_optimizations = true\n"
 "debug_symbols = false\n"
 "keep_build_dir = false\n"
+"prefetch_disk_budget = 4096\n"
+"binary_cache = true\n"
+"binary_cache_url =\n"
+"binary_cache_push = false\n"
+"compiler_cache = auto\n"
+"compiler_cache_size = 5120\n"
+"build_workspace = auto\n"
 "install_prefix = /usr/local\n"
 "build_flags = -O2 -march=native\n\n"
 
 "[security]\n"
 "sandbox_builds = true\n"
+"sandbox_fallback = false\n"
 "sandbox_user = nobody\n"
 "sandbox_group = nobody\n\n"
 
@@ -60,7 +68,16 @@ static const char *DEFAULT_CONFIG_TEMPLATE =
 "max_retries = 3\n"
 "verify_ssl = true\n"
 "max_concurrent_downloads = 4\n"
-"user_agent = TinyPkg/%s\n\n";
+"download_segments = 4\n"
+"segment_min_size = 64\n"
+"user_agent = TinyPkg/%s\n\n"
+
+"[mirrors]\n"
+"use_mirrors = false\n"
+"mirrors =\n"
+"mirror_timeout = 10\n"
+"mirror_race = true\n"
+"mirror_min_speed = 64\n\n";
 
 // Global variables
 static config_parser_t *g_parser = NULL;
@@ -126,6 +143,12 @@ config_t *config_create_default(void) {
     config->enable_optimizations = 1;
     config->debug_symbols = 0;
     config->keep_build_dir = 0;
+    config->prefetch_disk_budget = 4096;
+    config->binary_cache = 1;
+    config->binary_cache_push = 0;
+    strncpy(config->compiler_cache, "auto", sizeof(config->compiler_cache) - 1);
+    config->compiler_cache_size = 5120;
+    strncpy(config->build_workspace, "auto", sizeof(config->build_workspace) - 1);
     strncpy(config->install_prefix, "/usr/local", sizeof(config->install_prefix) - 1);
     strncpy(config->build_flags, "-O2 -march=native", sizeof(config->build_flags) - 1);
     
@@ -139,6 +162,7 @@ config_t *config_create_default(void) {
     
     // Security settings
     config->sandbox_builds = 1;
+    config->sandbox_fallback = 0;
     strncpy(config->sandbox_user, "nobody", sizeof(config->sandbox_user) - 1);
     strncpy(config->sandbox_group, "nobody", sizeof(config->sandbox_group) - 1);
     
@@ -155,9 +179,19 @@ config_t *config_create_default(void) {
     config->max_retries = 3;
     config->verify_ssl = 1;
     config->max_concurrent_downloads = 4;
+    config->download_segments = 4;
+    config->segment_min_size = 64;
     snprintf(config->user_agent, sizeof(config->user_agent), 
              "TinyPkg/%s", TINYPKG_VERSION);
     
+    // Mirror settings
+    config->mirrors = NULL;
+    config->mirror_count = 0;
+    config->use_mirrors = 0;
+    config->mirror_timeout = 10;
+    config->mirror_race = 1;
+    config->mirror_min_speed = 64;
+    
     // Advanced settings
     config->compression_level = 6;
     config->use_progress_bar = 1;
@@ -259,15 +293,58 @@ config_t *config_load_file(const char *config_file) {
         strncpy(config->build_flags, value, sizeof(config->build_flags) - 1);
     }
     
+    if ((value = config_parser_get_value(g_parser, "build", "prefetch_disk_budget"))) {
+        config->prefetch_disk_budget = atoi(value);
+        if (config->prefetch_disk_budget < 0) config->prefetch_disk_budget = 0;
+    }
+    
+    if ((value = config_parser_get_value(g_parser, "build", "binary_cache"))) {
+        config->binary_cache = (strcasecmp(value, "true") == 0) ? 1 : 0;
+    }
+    
+    if ((value = config_parser_get_value(g_parser, "build", "binary_cache_url"))) {
+        strncpy(config->binary_cache_url, value, sizeof(config->binary_cache_url) - 1);
+        // Artifact URLs are built as "<url>/<key>"
+        size_t len = strlen(config->binary_cache_url);
+        while (len > 0 && config->binary_cache_url[len - 1] == '/') {
+            config->binary_cache_url[--len] = '\0';
+        }
+    }
+    
+    if ((value = config_parser_get_value(g_parser, "build", "binary_cache_push"))) {
+        config->binary_cache_push = (strcasecmp(value, "true") == 0) ? 1 : 0;
+    }
+    
+    if ((value = config_parser_get_value(g_parser, "build", "compiler_cache"))) {
+        strncpy(config->compiler_cache, value, sizeof(config->compiler_cache) - 1);
+    }
+    
+    if ((value = config_parser_get_value(g_parser, "build", "compiler_cache_size"))) {
+        config->compiler_cache_size = atoi(value);
+        if (config->compiler_cache_size < 0) config->compiler_cache_size = 0;
+    }
+    
+    if ((value = config_parser_get_value(g_parser, "build", "build_workspace"))) {
+        strncpy(config->build_workspace, value, sizeof(config->build_workspace) - 1);
+    }
+    
     // Security settings
     if ((value = config_parser_get_value(g_parser, "security", "sandbox_builds"))) {
         config->sandbox_builds = (strcasecmp(value, "true") == 0) ? 1 : 0;
     }
     
+    if ((value = config_parser_get_value(g_parser, "security", "sandbox_fallback"))) {
+        config->sandbox_fallback = (strcasecmp(value, "true") == 0) ? 1 : 0;
+    }
+    
     if ((value = config_parser_get_value(g_parser, "security", "sandbox_user"))) {
         strncpy(config->sandbox_user, value, sizeof(config->sandbox_user) - 1);
     }
     
+    if ((value = config_parser_get_value(g_parser, "security", "allowed_build_paths"))) {
+        strncpy(config->allowed_build_paths, value, sizeof(config->allowed_build_paths) - 1);
+    }
+    
     // Logging settings
     if ((value = config_parser_get_value(g_parser, "logging", "log_level"))) {
         config->log_level = log_level_from_string(value);
@@ -290,10 +367,49 @@ config_t *config_load_file(const char *config_file) {
         config->verify_ssl = (strcasecmp(value, "true") == 0) ? 1 : 0;
     }
     
+    if ((value = config_parser_get_value(g_parser, "network", "max_concurrent_downloads"))) {
+        config->max_concurrent_downloads = atoi(value);
+        if (config->max_concurrent_downloads < 0) config->max_concurrent_downloads = 0;
+    }
+    
+    if ((value = config_parser_get_value(g_parser, "network", "download_segments"))) {
+        config->download_segments = atoi(value);
+        if (config->download_segments < 1) config->download_segments = 1;
+    }
+    
+    if ((value = config_parser_get_value(g_parser, "network", "segment_min_size"))) {
+        config->segment_min_size = atoi(value);
+        if (config->segment_min_size < 0) config->segment_min_size = 0;
+    }
+    
     if ((value = config_parser_get_value(g_parser, "network", "user_agent"))) {
         strncpy(config->user_agent, value, sizeof(config->user_agent) - 1);
     }
     
+    // Mirror settings
+    if ((value = config_parser_get_value(g_parser, "mirrors", "use_mirrors"))) {
+        config->use_mirrors = (strcasecmp(value, "true") == 0) ? 1 : 0;
+    }
+    
+    if ((value = config_parser_get_value(g_parser, "mirrors", "mirrors"))) {
+        config->mirrors = utils_string_split(value, ", \t", &config->mirror_count);
+        if (!config->mirrors) config->mirror_count = 0;
+    }
+    
+    if ((value = config_parser_get_value(g_parser, "mirrors", "mirror_timeout"))) {
+        config->mirror_timeout = atoi(value);
+        if (config->mirror_timeout <= 0) config->mirror_timeout = 10;
+    }
+    
+    if ((value = config_parser_get_value(g_parser, "mirrors", "mirror_race"))) {
+        config->mirror_race = (strcasecmp(value, "true") == 0) ? 1 : 0;
+    }
+    
+    if ((value = config_parser_get_value(g_parser, "mirrors", "mirror_min_speed"))) {
+        config->mirror_min_speed = atoi(value);
+        if (config->mirror_min_speed < 0) config->mirror_min_speed = 0;
+    }
+    
     // Update paths based on root_dir if changed
     if (strcmp(config->root_dir, "/") != 0) {
         snprintf(config->config_dir, sizeof(config->config_dir), 
@@ -355,13 +471,27 @@ int config_save_file(const config_t *config, const char *config_file) {
     fprintf(fp, "enable_optimizations = %s\n", config->enable_optimizations ? "true" : "false");
     fprintf(fp, "debug_symbols = %s\n", config->debug_symbols ? "true" : "false");
     fprintf(fp, "keep_build_dir = %s\n", config->keep_build_dir ? "true" : "false");
+    fprintf(fp, "prefetch_disk_budget = %d\n", config->prefetch_disk_budget);
+    fprintf(fp, "binary_cache = %s\n", config->binary_cache ? "true" : "false");
+    if (strlen(config->binary_cache_url) > 0) {
+        fprintf(fp, "binary_cache_url = %s\n", config->binary_cache_url);
+    }
+    fprintf(fp, "binary_cache_push = %s\n", config->binary_cache_push ? "true" : "false");
+    fprintf(fp, "compiler_cache = %s\n", config->compiler_cache);
+    fprintf(fp, "compiler_cache_size = %d\n", config->compiler_cache_size);
+    fprintf(fp, "build_workspace = %s\n", config->build_workspace);
     fprintf(fp, "install_prefix = %s\n", config->install_prefix);
     fprintf(fp, "build_flags = %s\n\n", config->build_flags);
     
     fprintf(fp, "[security]\n");
     fprintf(fp, "sandbox_builds = %s\n", config->sandbox_builds ? "true" : "false");
+    fprintf(fp, "sandbox_fallback = %s\n", config->sandbox_fallback ? "true" : "false");
     fprintf(fp, "sandbox_user = %s\n", config->sandbox_user);
-    fprintf(fp, "sandbox_group = %s\n\n", config->sandbox_group);
+    fprintf(fp, "sandbox_group = %s\n", config->sandbox_group);
+    if (config->allowed_build_paths[0]) {
+        fprintf(fp, "allowed_build_paths = %s\n", config->allowed_build_paths);
+    }
+    fprintf(fp, "\n");
     
     fprintf(fp, "[logging]\n");
     fprintf(fp, "log_level = %s\n", log_level_to_string(config->log_level));
@@ -376,12 +506,25 @@ int config_save_file(const config_t *config, const char *config_file) {
     fprintf(fp, "max_retries = %d\n", config->max_retries);
     fprintf(fp, "verify_ssl = %s\n", config->verify_ssl ? "true" : "false");
     fprintf(fp, "max_concurrent_downloads = %d\n", config->max_concurrent_downloads);
+    fprintf(fp, "download_segments = %d\n", config->download_segments);
+    fprintf(fp, "segment_min_size = %d\n", config->segment_min_size);
     fprintf(fp, "user_agent = %s\n", config->user_agent);
     
     if (strlen(config->proxy_url) > 0) {
         fprintf(fp, "proxy_url = %s\n", config->proxy_url);
     }
     
+    fprintf(fp, "\n[mirrors]\n");
+    fprintf(fp, "use_mirrors = %s\n", config->use_mirrors ? "true" : "false");
+    fprintf(fp, "mirrors =");
+    for (int i = 0; i < config->mirror_count; i++) {
+        fprintf(fp, "%s%s", i ? ", " : " ", config->mirrors[i]);
+    }
+    fprintf(fp, "\n");
+    fprintf(fp, "mirror_timeout = %d\n", config->mirror_timeout);
+    fprintf(fp, "mirror_race = %s\n", config->mirror_race ? "true" : "false");
+    fprintf(fp, "mirror_min_speed = %d\n", config->mirror_min_speed);
+    
     fclose(fp);
     return 0;
 }
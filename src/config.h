@@ -33,6 +33,13 @@ typedef struct config {
     int enable_optimizations;
     int debug_symbols;
     int keep_build_dir;
+    int prefetch_disk_budget;       // MB of unpacked sources fetched ahead (0 = off)
+    int binary_cache;               // Reuse and keep built packages
+    char binary_cache_url[512];     // Shared HTTP cache ("" = local only)
+    int binary_cache_push;          // Upload new builds to binary_cache_url
+    char compiler_cache[16];        // auto, ccache, sccache or none
+    int compiler_cache_size;        // MB cap of the compiler cache
+    char build_workspace[16];       // auto, tmpfs or disk
     
     // Package settings
     int force_mode;
@@ -44,6 +51,7 @@ typedef struct config {
     
     // Security settings
     int sandbox_builds;
+    int sandbox_fallback;           // Build unisolated where sandboxing fails
     char sandbox_user[64];
     char sandbox_group[64];
     char allowed_build_paths[1024];
@@ -63,12 +71,16 @@ typedef struct config {
     char user_agent[256];
     char proxy_url[256];
     int verify_ssl;
+    int download_segments;          // Parallel byte ranges for large files
+    int segment_min_size;           // MB before a download is segmented
     
     // Mirror settings
     char **mirrors;
     int mirror_count;
     int mirror_timeout;
     int use_mirrors;
+    int mirror_race;                // Race the two best mirrors for first bytes
+    int mirror_min_speed;           // KB/s below which a mirror is abandoned
     
     // Advanced settings
     int max_concurrent_downloads;
@@ -0,0 +1,841 @@
+/*
+ * TinyPkg - Daemon Implementation
+ * Resident server keeping the databases warm, and the client side of it
+ */
+
+#include "../include/tinypkg.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// On-disk state the daemon keeps open. Commands run in children, so what
+// they change, like anything changed behind the daemon's back (a command
+// run in-process, a second mutating tool), is reloaded before the next
+// request.
+typedef struct daemon_cache
+{
+    const char *file;
+    void (*close)(void);
+    struct stat st;
+    int present;
+} daemon_cache_t;
+
+static daemon_cache_t g_daemon_caches[] = {
+    {PKGDB_FILE, pkgdb_close, {0}, 0},
+    {PKGDB_JOURNAL_FILE, pkgdb_close, {0}, 0},
+    {FILEINDEX_FILE, fileindex_close, {0}, 0},
+    {FILEINDEX_JOURNAL_FILE, fileindex_close, {0}, 0},
+    {DEPINDEX_FILE, depindex_close, {0}, 0},
+    {REPOINDEX_FILE, repoindex_close, {0}, 0},
+};
+
+#define DAEMON_CACHE_COUNT (int)(sizeof(g_daemon_caches) / sizeof(g_daemon_caches[0]))
+
+static int daemon_socket_path(struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int length = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s", LIB_DIR,
+                          DAEMON_SOCKET_FILE);
+    return (length > 0 && (size_t)length < sizeof(addr->sun_path)) ? TINYPKG_SUCCESS
+                                                                   : TINYPKG_ERROR;
+}
+
+static int daemon_read_full(int fd, void *buf, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = recv(fd, (char *)buf + done, length - done, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return TINYPKG_ERROR;
+        }
+        done += (size_t)n;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static int daemon_write_full(int fd, const void *buf, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = send(fd, (const char *)buf + done, length - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return TINYPKG_ERROR;
+        }
+        done += (size_t)n;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Caches
+static void daemon_stat_cache(daemon_cache_t *cache, struct stat *st, int *present)
+{
+    char path[MAX_PATH];
+
+    snprintf(path, sizeof(path), "%s/%s", LIB_DIR, cache->file);
+    *present = stat(path, st) == 0;
+    if (!*present)
+    {
+        memset(st, 0, sizeof(*st));
+    }
+}
+
+static void daemon_snapshot_caches(void)
+{
+    for (int i = 0; i < DAEMON_CACHE_COUNT; i++)
+    {
+        daemon_cache_t *cache = &g_daemon_caches[i];
+        daemon_stat_cache(cache, &cache->st, &cache->present);
+    }
+}
+
+static void daemon_warm_caches(void)
+{
+    if (package_db_load() != TINYPKG_SUCCESS)
+    {
+        log_warn("Failed to load package database");
+    }
+    if (repoindex_open() != TINYPKG_SUCCESS)
+    {
+        log_debug("No repository index yet");
+    }
+    if (fileindex_open() != TINYPKG_SUCCESS)
+    {
+        log_warn("Failed to open file index");
+    }
+    if (depindex_open() != TINYPKG_SUCCESS)
+    {
+        log_warn("Failed to open dependency index");
+    }
+}
+
+// Reopen whatever changed on disk so every child starts out warm
+static void daemon_refresh_caches(void)
+{
+    int stale[DAEMON_CACHE_COUNT] = {0};
+    int reload = 0;
+
+    for (int i = 0; i < DAEMON_CACHE_COUNT; i++)
+    {
+        daemon_cache_t *cache = &g_daemon_caches[i];
+        struct stat st;
+        int present;
+
+        daemon_stat_cache(cache, &st, &present);
+        stale[i] = present != cache->present || st.st_ino != cache->st.st_ino ||
+                   st.st_size != cache->st.st_size ||
+                   st.st_mtim.tv_sec != cache->st.st_mtim.tv_sec ||
+                   st.st_mtim.tv_nsec != cache->st.st_mtim.tv_nsec;
+    }
+
+    for (int i = 0; i < DAEMON_CACHE_COUNT; i++)
+    {
+        if (!stale[i])
+        {
+            continue;
+        }
+
+        log_debug("%s changed on disk, reloading", g_daemon_caches[i].file);
+        g_daemon_caches[i].close();
+        reload = 1;
+        for (int j = i + 1; j < DAEMON_CACHE_COUNT; j++)
+        {
+            if (g_daemon_caches[j].close == g_daemon_caches[i].close)
+            {
+                stale[j] = 0;
+            }
+        }
+    }
+
+    // Snapshot first: a change racing the reload is caught next time
+    if (reload)
+    {
+        daemon_snapshot_caches();
+        daemon_warm_caches();
+    }
+}
+
+// Server
+// Environment taken from clients that are not root: only how to present
+// output. Root clients get their whole environment, as in-process.
+static const char *g_daemon_client_env[] = {
+    "TERM", "NO_COLOR", "COLUMNS", "LINES", "LANG", "LC_", "TZ",
+};
+
+#define DAEMON_CLIENT_ENV_COUNT (int)(sizeof(g_daemon_client_env) / sizeof(g_daemon_client_env[0]))
+
+static int daemon_env_allowed(const char *entry)
+{
+    for (int i = 0; i < DAEMON_CLIENT_ENV_COUNT; i++)
+    {
+        const char *name = g_daemon_client_env[i];
+        size_t length = strlen(name);
+
+        // Names ending in '_' are prefixes
+        if (strncmp(entry, name, length) == 0 &&
+            (name[length - 1] == '_' || entry[length] == '='))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void daemon_apply_environment(char **envp, uid_t uid)
+{
+    if (uid == 0)
+    {
+        clearenv();
+    }
+    for (char **entry = envp; *entry; entry++)
+    {
+        if (strchr(*entry, '=') && (uid == 0 || daemon_env_allowed(*entry)))
+        {
+            putenv(*entry);
+        }
+    }
+}
+
+// In the child: take on the client's descriptors, working directory and
+// environment, run the command and exit with its status
+static void daemon_child(daemon_handler_t handler, int argc, char **argv, char **envp,
+                         const char *cwd, const int *fds, uid_t uid, int listener, int client)
+{
+    // Its own group, so stopping it stops whatever it started too
+    setpgid(0, 0);
+    signal(SIGPIPE, SIG_DFL);
+    close(listener);
+    close(client);
+
+    dup2(fds[0], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    if (chdir(cwd) != 0 && chdir("/") != 0)
+    {
+        log_warn("Failed to change to the client's working directory");
+    }
+    daemon_apply_environment(envp, uid);
+
+    int status = handler(argc, argv, uid);
+
+    // Scores learned by this command; the daemon reads them back
+    mirror_cleanup();
+    fflush(stdout);
+    fflush(stderr);
+    logging_set_status(NULL);
+    logging_flush();
+    _exit(status & 0xff);
+}
+
+// Wait for the child to exit. Returns NULL once it has, or why it has to
+// be stopped.
+static const char *daemon_wait(int done_fd, int client, volatile sig_atomic_t *stop)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    time_t deadline = now.tv_sec + DAEMON_COMMAND_TIMEOUT;
+
+    while (1)
+    {
+        if (*stop)
+        {
+            return "the daemon is stopping";
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec >= deadline)
+        {
+            return "it ran too long";
+        }
+
+        // Woken by signals, but a stop arriving just before the poll would
+        // otherwise wait out the whole deadline
+        struct pollfd pfds[2] = {{done_fd, POLLIN, 0}, {client, POLLIN, 0}};
+        int n = poll(pfds, 2, 1000);
+        if (n < 0 && errno != EINTR)
+        {
+            return "waiting for it failed";
+        }
+        if (n > 0 && pfds[0].revents)
+        {
+            return NULL;
+        }
+        // The client sends nothing more, so anything here means it is gone
+        if (n > 0 && pfds[1].revents)
+        {
+            return "its client went away";
+        }
+    }
+}
+
+static void daemon_signal_command(pid_t pid, int sig)
+{
+    if (kill(-pid, sig) != 0)
+    {
+        kill(pid, sig);
+    }
+}
+
+static void daemon_stop_command(pid_t pid, int done_fd)
+{
+    struct pollfd pfd = {done_fd, POLLIN, 0};
+    int n;
+
+    daemon_signal_command(pid, SIGTERM);
+    do
+    {
+        n = poll(&pfd, 1, DAEMON_STOP_GRACE * 1000);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0)
+    {
+        log_warn("Command did not stop within %d seconds, killing it", DAEMON_STOP_GRACE);
+        daemon_signal_command(pid, SIGKILL);
+    }
+}
+
+// Run a command in a child of the daemon, so a stuck one can be stopped
+// and whatever it does to the process state ends with it
+static int daemon_execute(daemon_handler_t handler, int argc, char **argv, char **envp,
+                          const char *cwd, const int *fds, const struct ucred *cred,
+                          int listener, int client, volatile sig_atomic_t *stop)
+{
+    int done[2];
+
+    daemon_refresh_caches();
+    if (pipe2(done, O_CLOEXEC) != 0)
+    {
+        log_error("Failed to create pipe: %s", strerror(errno));
+        return 1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    logging_flush();
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        log_error("Failed to start command: %s", strerror(errno));
+        close(done[0]);
+        close(done[1]);
+        return 1;
+    }
+    if (pid == 0)
+    {
+        // The write end closes when the child exits
+        close(done[0]);
+        daemon_child(handler, argc, argv, envp, cwd, fds, cred->uid, listener, client);
+    }
+    close(done[1]);
+    setpgid(pid, pid);
+
+    const char *reason = daemon_wait(done[0], client, stop);
+    if (reason)
+    {
+        log_warn("Stopping command from pid %d: %s", (int)cred->pid, reason);
+        daemon_stop_command(pid, done[0]);
+    }
+
+    int wait_status = 0;
+    while (waitpid(pid, &wait_status, 0) < 0 && errno == EINTR)
+    {
+    }
+    close(done[0]);
+    mirror_load_scores();
+
+    if (reason)
+    {
+        return DAEMON_STATUS_TIMEOUT;
+    }
+    if (WIFEXITED(wait_status))
+    {
+        return WEXITSTATUS(wait_status);
+    }
+    log_warn("Command from pid %d died of signal %d", (int)cred->pid,
+             WIFSIGNALED(wait_status) ? WTERMSIG(wait_status) : 0);
+    return 128 + (WIFSIGNALED(wait_status) ? WTERMSIG(wait_status) : 0);
+}
+
+// Receive the header and the descriptors riding along with it
+static int daemon_receive_header(int client, daemon_request_t *request, int *fds)
+{
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {request, sizeof(*request)};
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    do
+    {
+        n = recvmsg(client, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        {
+            continue;
+        }
+
+        int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (int i = 0; i < count; i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (i < 2 && fds[i] < 0)
+            {
+                fds[i] = fd;
+            }
+            else
+            {
+                close(fd);
+            }
+        }
+    }
+
+    if ((size_t)n < sizeof(*request) &&
+        daemon_read_full(client, (char *)request + n, sizeof(*request) - (size_t)n) !=
+            TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Split the payload into the working directory, a NULL-terminated argv
+// starting with the program name and a NULL-terminated environment. Both
+// arrays come from one allocation starting at the returned argv.
+static char **daemon_parse_payload(char *payload, uint32_t length, uint32_t argc,
+                                   uint32_t envc, const char **cwd, char ***envp)
+{
+    if (length == 0 || payload[length - 1] != '\0')
+    {
+        return NULL;
+    }
+
+    char **argv = TINYPKG_CALLOC(argc + envc + 3, sizeof(char *));
+    if (!argv)
+    {
+        return NULL;
+    }
+
+    argv[0] = "tinypkg";
+    *envp = argv + argc + 2;
+    char *p = payload;
+    char *end = payload + length;
+    *cwd = p;
+    p += strlen(p) + 1;
+    for (uint32_t i = 0; i < argc + envc; i++)
+    {
+        if (p >= end)
+        {
+            TINYPKG_FREE(argv);
+            return NULL;
+        }
+        if (i < argc)
+        {
+            argv[i + 1] = p;
+        }
+        else
+        {
+            (*envp)[i - argc] = p;
+        }
+        p += strlen(p) + 1;
+    }
+
+    if (p != end)
+    {
+        TINYPKG_FREE(argv);
+        return NULL;
+    }
+    return argv;
+}
+
+static void daemon_serve(int client, int listener, daemon_handler_t handler,
+                         volatile sig_atomic_t *stop)
+{
+    struct timeval timeout = {DAEMON_REQUEST_TIMEOUT, 0};
+    struct ucred cred;
+    socklen_t cred_length = sizeof(cred);
+    daemon_request_t request;
+    daemon_response_t response = {DAEMON_MAGIC, 1};
+    uint32_t ready = DAEMON_READY;
+    uint32_t go = 0;
+    int fds[2] = {-1, -1};
+    char *payload = NULL;
+    char **argv = NULL;
+    char **envp = NULL;
+    const char *cwd = "/";
+
+    // A stalled client must not hold up the others
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &cred_length) != 0)
+    {
+        log_warn("Failed to identify daemon client: %s", strerror(errno));
+        return;
+    }
+
+    if (daemon_receive_header(client, &request, fds) != TINYPKG_SUCCESS)
+    {
+        goto out;
+    }
+
+    if (request.magic != DAEMON_MAGIC || request.version != DAEMON_PROTOCOL_VERSION ||
+        request.argc == 0 || request.argc > DAEMON_MAX_ARGS ||
+        request.envc > DAEMON_MAX_ENV || request.length > DAEMON_MAX_REQUEST ||
+        fds[0] < 0 || fds[1] < 0)
+    {
+        log_warn("Ignoring malformed request from pid %d", (int)cred.pid);
+        goto out;
+    }
+
+    payload = TINYPKG_MALLOC(request.length + 1);
+    if (!payload || daemon_read_full(client, payload, request.length) != TINYPKG_SUCCESS)
+    {
+        goto out;
+    }
+    argv = daemon_parse_payload(payload, request.length, request.argc, request.envc, &cwd,
+                                &envp);
+    if (!argv)
+    {
+        log_warn("Ignoring malformed request from pid %d", (int)cred.pid);
+        goto out;
+    }
+
+    // The client may have given up waiting and run the command itself
+    if (daemon_write_full(client, &ready, sizeof(ready)) != TINYPKG_SUCCESS ||
+        daemon_read_full(client, &go, sizeof(go)) != TINYPKG_SUCCESS || go != DAEMON_GO)
+    {
+        log_debug("Client pid %d gave up before its command started", (int)cred.pid);
+        goto out;
+    }
+
+    log_debug("Request from pid %d (uid %d): %s", (int)cred.pid, (int)cred.uid, argv[1]);
+    response.status = daemon_execute(handler, (int)request.argc + 1, argv, envp, cwd, fds,
+                                     &cred, listener, client, stop);
+    if (daemon_write_full(client, &response, sizeof(response)) != TINYPKG_SUCCESS)
+    {
+        log_debug("Client pid %d went away before the response", (int)cred.pid);
+    }
+
+out:
+    for (int i = 0; i < 2; i++)
+    {
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+        }
+    }
+    TINYPKG_FREE(argv);
+    TINYPKG_FREE(payload);
+}
+
+int daemon_run(daemon_handler_t handler, volatile sig_atomic_t *stop)
+{
+    struct sockaddr_un addr;
+    int listener;
+
+    if (!handler || !stop)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    if (daemon_socket_path(&addr) != TINYPKG_SUCCESS)
+    {
+        log_error("Daemon socket path is too long");
+        return TINYPKG_ERROR;
+    }
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+    {
+        log_error("Failed to create daemon socket: %s", strerror(errno));
+        return TINYPKG_ERROR;
+    }
+
+    // A socket nobody answers on is left over from a daemon that died
+    if (connect(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        log_error("A daemon is already listening on %s", addr.sun_path);
+        close(listener);
+        return TINYPKG_ERROR;
+    }
+    close(listener);
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    utils_create_directory_recursive(LIB_DIR);
+    unlink(addr.sun_path);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        chmod(addr.sun_path, 0666) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        log_error("Failed to listen on %s: %s", addr.sun_path, strerror(errno));
+        if (listener >= 0)
+        {
+            close(listener);
+        }
+        unlink(addr.sun_path);
+        return TINYPKG_ERROR;
+    }
+
+    // Clients may disappear before their response; commands get the
+    // default back
+    signal(SIGPIPE, SIG_IGN);
+
+    daemon_warm_caches();
+    daemon_snapshot_caches();
+    log_info("Daemon listening on %s", addr.sun_path);
+
+    // One request at a time: waiting connections queue in the backlog in
+    // arrival order, and mutating commands never overlap. Clients that
+    // wait too long run their command themselves.
+    int result = TINYPKG_SUCCESS;
+    while (!*stop)
+    {
+        int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            log_error("Failed to accept daemon client: %s", strerror(errno));
+            result = TINYPKG_ERROR;
+            break;
+        }
+
+        daemon_serve(client, listener, handler, stop);
+        close(client);
+    }
+
+    close(listener);
+    unlink(addr.sun_path);
+    log_info("Daemon stopped");
+    return result;
+}
+
+// Client
+// Read a reply within timeout_ms. With interrupted set, a signal (the
+// user pressing ^C) ends the wait as well.
+static int daemon_client_wait(int client, void *buf, size_t length, long timeout_ms,
+                              int *interrupted)
+{
+    struct timespec start, now;
+    size_t done = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (done < length)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (long)(now.tv_sec - start.tv_sec) * 1000 +
+                       (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= timeout_ms)
+        {
+            return TINYPKG_ERROR;
+        }
+
+        struct pollfd pfd = {client, POLLIN, 0};
+        int n = poll(&pfd, 1, (int)(timeout_ms - elapsed));
+        if (n < 0 && errno == EINTR && interrupted)
+        {
+            *interrupted = 1;
+            return TINYPKG_ERROR;
+        }
+        if (n < 0 && errno != EINTR)
+        {
+            return TINYPKG_ERROR;
+        }
+        if (n <= 0)
+        {
+            continue;
+        }
+
+        ssize_t got = recv(client, (char *)buf + done, length - done, MSG_DONTWAIT);
+        if (got < 0 && (errno == EINTR || errno == EAGAIN))
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return TINYPKG_ERROR;
+        }
+        done += (size_t)got;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static void daemon_client_response(int client, int *exit_status)
+{
+    const long timeout_ms =
+        (DAEMON_COMMAND_TIMEOUT + DAEMON_STOP_GRACE + DAEMON_REQUEST_TIMEOUT) * 1000L;
+    daemon_response_t response;
+    int interrupted = 0;
+
+    // Closing the connection has the daemon stop the command
+    if (daemon_client_wait(client, &response, sizeof(response), timeout_ms, &interrupted) !=
+            TINYPKG_SUCCESS ||
+        response.magic != DAEMON_MAGIC)
+    {
+        if (interrupted)
+        {
+            *exit_status = 130;
+            return;
+        }
+        fprintf(stderr, "tinypkg: lost connection to the daemon\n");
+        *exit_status = 1;
+        return;
+    }
+
+    if (response.status == DAEMON_STATUS_TIMEOUT)
+    {
+        fprintf(stderr, "tinypkg: the daemon stopped the command\n");
+    }
+    *exit_status = response.status;
+}
+
+int daemon_client_run(int argc, char **argv, int *exit_status)
+{
+    struct sockaddr_un addr;
+    char cwd[MAX_PATH];
+    int client;
+
+    if (argc <= 0 || argc > DAEMON_MAX_ARGS || !argv || !exit_status ||
+        getenv(DAEMON_DISABLE_ENV) || daemon_socket_path(&addr) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    if (!getcwd(cwd, sizeof(cwd)))
+    {
+        strcpy(cwd, "/");
+    }
+
+    // The command sees our environment, and through the passed
+    // descriptors whether it writes to a terminal
+    int envc = 0;
+    size_t length = strlen(cwd) + 1;
+    for (int i = 0; i < argc; i++)
+    {
+        length += strlen(argv[i]) + 1;
+    }
+    for (char **entry = environ; *entry; entry++)
+    {
+        length += strlen(*entry) + 1;
+        envc++;
+    }
+    if (length > DAEMON_MAX_REQUEST || envc > DAEMON_MAX_ENV)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    client = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (client < 0)
+    {
+        return TINYPKG_ERROR;
+    }
+    if (connect(client, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        // No daemon: the caller runs the command itself
+        close(client);
+        return TINYPKG_ERROR;
+    }
+
+    char *payload = TINYPKG_MALLOC(length);
+    if (!payload)
+    {
+        close(client);
+        return TINYPKG_ERROR_MEMORY;
+    }
+    size_t offset = 0;
+    memcpy(payload, cwd, strlen(cwd) + 1);
+    offset += strlen(cwd) + 1;
+    for (int i = 0; i < argc; i++)
+    {
+        memcpy(payload + offset, argv[i], strlen(argv[i]) + 1);
+        offset += strlen(argv[i]) + 1;
+    }
+    for (int i = 0; i < envc; i++)
+    {
+        memcpy(payload + offset, environ[i], strlen(environ[i]) + 1);
+        offset += strlen(environ[i]) + 1;
+    }
+
+    // The header carries our stdout and stderr for the command to use
+    daemon_request_t request = {DAEMON_MAGIC, DAEMON_PROTOCOL_VERSION, (uint32_t)argc,
+                                (uint32_t)envc, (uint32_t)length};
+    int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {&request, sizeof(request)};
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    do
+    {
+        sent = sendmsg(client, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+
+    // A daemon busy with another command does not get to ours in time;
+    // without the go it never runs it, so running it here is safe
+    int result = TINYPKG_ERROR;
+    uint32_t ready = 0;
+    uint32_t go = DAEMON_GO;
+    if (sent == (ssize_t)sizeof(request) &&
+        daemon_write_full(client, payload, length) == TINYPKG_SUCCESS &&
+        daemon_client_wait(client, &ready, sizeof(ready), DAEMON_READY_TIMEOUT_MS, NULL) ==
+            TINYPKG_SUCCESS &&
+        ready == DAEMON_READY && daemon_write_full(client, &go, sizeof(go)) == TINYPKG_SUCCESS)
+    {
+        // The daemon has the command now; running it here as well could
+        // do it twice
+        result = TINYPKG_SUCCESS;
+        daemon_client_response(client, exit_status);
+    }
+
+    TINYPKG_FREE(payload);
+    close(client);
+    return result;
+}
@@ -0,0 +1,80 @@
+/*
+ * TinyPkg - Daemon Header
+ * Resident server keeping the databases warm, and the client side of it
+ */
+
+#ifndef TINYPKG_DAEMON_H
+#define TINYPKG_DAEMON_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Socket inside LIB_DIR. Anyone may connect; commands that need root are
+// refused unless the peer is root.
+#define DAEMON_SOCKET_FILE "tinypkgd.sock"
+
+#define DAEMON_MAGIC 0x444b5054U    // "TPKD"
+#define DAEMON_PROTOCOL_VERSION 2
+
+// Limits on what a client may send
+#define DAEMON_MAX_REQUEST 262144
+#define DAEMON_MAX_ARGS 256
+#define DAEMON_MAX_ENV 1024
+#define DAEMON_REQUEST_TIMEOUT 5    // Seconds to receive a whole request
+
+// Each command runs in a child of the daemon, stopped (SIGTERM, then
+// SIGKILL after the grace period) once it runs over, its client goes away
+// or the daemon is asked to stop
+#define DAEMON_COMMAND_TIMEOUT (6 * 60 * 60)   // Seconds, builds included
+#define DAEMON_STOP_GRACE 10                   // Seconds
+#define DAEMON_STATUS_TIMEOUT 124              // Exit status of a stopped command
+
+// Milliseconds a client waits for the daemon to get to its request before
+// running the command itself
+#define DAEMON_READY_TIMEOUT_MS 2000
+
+// Set in the client to always run in-process
+#define DAEMON_DISABLE_ENV "TINYPKG_NO_DAEMON"
+
+// A request is this header, sent with the client's stdout and stderr as
+// SCM_RIGHTS, then length bytes: the client's working directory, argc
+// arguments and envc environment entries, each NUL-terminated. The daemon
+// answers DAEMON_READY, and only runs the command once the client sends
+// DAEMON_GO back; a client that gave up waiting never has it run twice.
+// The command writes straight to the passed descriptors; the response
+// only carries its exit status.
+typedef struct daemon_request {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t length;
+} daemon_request_t;
+
+#define DAEMON_READY 0x59444552U    // "REDY"
+#define DAEMON_GO 0x21214f47U       // "GO!!"
+
+typedef struct daemon_response {
+    uint32_t magic;
+    int32_t status;
+} daemon_response_t;
+
+// Runs one command line (argv[0] is the program name) for a peer with
+// the given uid; returns the exit status. Called in a child of the daemon
+// with the client's descriptors, working directory and environment.
+typedef int (*daemon_handler_t)(int argc, char **argv, uid_t uid);
+
+// Function declarations
+
+// Serve requests one at a time until *stop is set; waiting connections
+// queue in the backlog, so mutating commands never overlap
+int daemon_run(daemon_handler_t handler, volatile sig_atomic_t *stop);
+
+// Hand a command line (without the program name) to a running daemon.
+// Returns TINYPKG_SUCCESS with the command's exit status once the daemon
+// took the request, or an error when none is running or it did not get to
+// the request in time.
+int daemon_client_run(int argc, char **argv, int *exit_status);
+
+#endif /* TINYPKG_DAEMON_H */
@@ -8,47 +8,78 @@
 #include <string.h>
 #include "../include/tinypkg.h"
 
-// Main dependency resolution function using topological sort
-int dependency_resolve(const char *package_name, char ***install_order, int *count) {
-    if (!package_name || !install_order || !count) {
-        return TINYPKG_ERROR;
+// Build and validate the dependency graph for a set of root packages
+dependency_graph_t *dependency_resolve_graph(char **package_names, int package_count) {
+    if (!package_names || package_count <= 0) {
+        return NULL;
     }
     
-    *install_order = NULL;
-    *count = 0;
-    
-    log_debug("Resolving dependencies for: %s", package_name);
+    int64_t start_us = metrics_now_us();
     
     // Create dependency graph
     dependency_graph_t *graph = dependency_graph_create();
     if (!graph) {
-        return TINYPKG_ERROR_MEMORY;
+        return NULL;
     }
     
-    // Add the target package to the graph
-    int result = dependency_graph_add_package(graph, package_name);
-    if (result != TINYPKG_SUCCESS) {
-        dependency_graph_free(graph);
-        return result;
+    // Add the target packages to the graph
+    for (int i = 0; i < package_count; i++) {
+        log_debug("Resolving dependencies for: %s", package_names[i]);
+        if (dependency_graph_add_package(graph, package_names[i]) != TINYPKG_SUCCESS) {
+            dependency_graph_free(graph);
+            return NULL;
+        }
     }
     
     // Build the complete dependency graph
-    result = dependency_graph_build(graph);
-    if (result != TINYPKG_SUCCESS) {
+    if (dependency_graph_build(graph) != TINYPKG_SUCCESS) {
         dependency_graph_free(graph);
-        return result;
+        return NULL;
     }
     
     // Check for circular dependencies
-    result = dependency_detect_cycles(graph);
-    if (result != TINYPKG_SUCCESS) {
-        log_error("Circular dependencies detected for package: %s", package_name);
+    if (dependency_detect_cycles(graph) != TINYPKG_SUCCESS) {
+        log_error("Circular dependencies detected");
         dependency_graph_free(graph);
+        return NULL;
+    }
+    
+    int64_t end_us = metrics_now_us();
+    metrics_add(METRICS_RESOLVER_RUNS, 1);
+    metrics_add(METRICS_RESOLVER_NODES, (uint64_t)graph->node_count);
+    metrics_add(METRICS_RESOLVER_EDGES, (uint64_t)graph->edge_count);
+    metrics_observe(METRICS_RESOLVE_SECONDS, (end_us - start_us) / 1e6);
+    metrics_trace_span("resolve", "resolve", package_names[0], start_us, end_us);
+    
+    return graph;
+}
+
+// Main dependency resolution function using topological sort
+int dependency_resolve(const char *package_name, char ***install_order, int *count) {
+    if (!package_name) {
+        return TINYPKG_ERROR;
+    }
+    
+    char *names[] = {(char *)package_name};
+    return dependency_resolve_all(names, 1, install_order, count);
+}
+
+int dependency_resolve_all(char **package_names, int package_count,
+                          char ***install_order, int *count) {
+    if (!package_names || !install_order || !count) {
+        return TINYPKG_ERROR;
+    }
+    
+    *install_order = NULL;
+    *count = 0;
+    
+    dependency_graph_t *graph = dependency_resolve_graph(package_names, package_count);
+    if (!graph) {
         return TINYPKG_ERROR_DEPENDENCY;
     }
     
     // Perform topological sort to get installation order
-    result = dependency_graph_topological_sort(graph, install_order, count);
+    int result = dependency_graph_topological_sort(graph, install_order, count);
     
     dependency_graph_free(graph);
     
@@ -62,6 +93,37 @@ int dependency_resolve(const char *package_name, char ***install_order, int *cou
     return result;
 }
 
+// Arena for interned package names; freed with the graph
+#define DEPENDENCY_ARENA_BLOCK 16384
+
+struct dependency_arena {
+    struct dependency_arena *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+static char *dependency_arena_strdup(dependency_graph_t *graph, const char *str) {
+    size_t length = strlen(str) + 1;
+    dependency_arena_t *block = graph->arena;
+    
+    if (!block || block->size - block->used < length) {
+        size_t size = MAX((size_t)DEPENDENCY_ARENA_BLOCK, length);
+        block = TINYPKG_MALLOC(sizeof(dependency_arena_t) + size);
+        if (!block) return NULL;
+        
+        block->next = graph->arena;
+        block->used = 0;
+        block->size = size;
+        graph->arena = block;
+    }
+    
+    char *copy = block->data + block->used;
+    memcpy(copy, str, length);
+    block->used += length;
+    return copy;
+}
+
 // Dependency graph management
 dependency_graph_t *dependency_graph_create(void) {
     dependency_graph_t *graph = TINYPKG_CALLOC(1, sizeof(dependency_graph_t));
@@ -71,71 +133,173 @@ dependency_graph_t *dependency_graph_create(void) {
 void dependency_graph_free(dependency_graph_t *graph) {
     if (!graph) return;
     
-    dependency_node_t *node = graph->nodes;
-    while (node) {
-        dependency_node_t *next = node->next;
-        dependency_node_free(node);
-        node = next;
+    dependency_arena_t *block = graph->arena;
+    while (block) {
+        dependency_arena_t *next = block->next;
+        TINYPKG_FREE(block);
+        block = next;
     }
     
+    TINYPKG_FREE(graph->nodes);
+    TINYPKG_FREE(graph->edges);
+    TINYPKG_FREE(graph->index);
     TINYPKG_FREE(graph);
 }
 
+int dependency_graph_find_id(dependency_graph_t *graph, const char *package_name) {
+    if (!graph || !package_name || graph->index_capacity == 0) return -1;
+    
+    int mask = graph->index_capacity - 1;
+    for (int i = (int)(utils_hash_string(package_name) & (uint32_t)mask); graph->index[i];
+         i = (i + 1) & mask) {
+        int id = graph->index[i] - 1;
+        if (strcmp(graph->nodes[id].package_name, package_name) == 0) {
+            return id;
+        }
+    }
+    
+    return -1;
+}
+
+dependency_node_t *dependency_graph_find_node(dependency_graph_t *graph, 
+                                              const char *package_name) {
+    int id = dependency_graph_find_id(graph, package_name);
+    return id >= 0 ? &graph->nodes[id] : NULL;
+}
+
+const int *dependency_graph_get_deps(dependency_graph_t *graph, int id, int *count) {
+    if (!graph || !count || id < 0 || id >= graph->node_count) {
+        if (count) *count = 0;
+        return NULL;
+    }
+    
+    *count = graph->nodes[id].dep_count;
+    return graph->edges ? graph->edges + graph->nodes[id].dep_start : NULL;
+}
+
+static int dependency_graph_grow_index(dependency_graph_t *graph) {
+    int capacity = graph->index_capacity ? graph->index_capacity * 2 : 64;
+    int *index = TINYPKG_CALLOC(capacity, sizeof(int));
+    if (!index) return TINYPKG_ERROR_MEMORY;
+    
+    for (int id = 0; id < graph->node_count; id++) {
+        int i = (int)(utils_hash_string(graph->nodes[id].package_name) & (uint32_t)(capacity - 1));
+        while (index[i]) i = (i + 1) & (capacity - 1);
+        index[i] = id + 1;
+    }
+    
+    TINYPKG_FREE(graph->index);
+    graph->index = index;
+    graph->index_capacity = capacity;
+    return TINYPKG_SUCCESS;
+}
+
+// Add a package if needed and return its node ID, or -1 on failure
+static int dependency_graph_intern(dependency_graph_t *graph, const char *package_name) {
+    int id = dependency_graph_find_id(graph, package_name);
+    if (id >= 0) return id;
+    
+    if ((graph->node_count + 1) * 2 > graph->index_capacity &&
+        dependency_graph_grow_index(graph) != TINYPKG_SUCCESS) {
+        return -1;
+    }
+    
+    if (graph->node_count == graph->node_capacity) {
+        int capacity = graph->node_capacity ? graph->node_capacity * 2 : 32;
+        dependency_node_t *nodes = TINYPKG_REALLOC(graph->nodes, capacity * sizeof(dependency_node_t));
+        if (!nodes) return -1;
+        graph->nodes = nodes;
+        graph->node_capacity = capacity;
+    }
+    
+    const char *name = dependency_arena_strdup(graph, package_name);
+    if (!name) return -1;
+    
+    id = graph->node_count++;
+    memset(&graph->nodes[id], 0, sizeof(dependency_node_t));
+    graph->nodes[id].package_name = name;
+    
+    int mask = graph->index_capacity - 1;
+    int i = (int)(utils_hash_string(name) & (uint32_t)mask);
+    while (graph->index[i]) i = (i + 1) & mask;
+    graph->index[i] = id + 1;
+    
+    log_debug("Added package to dependency graph: %s", package_name);
+    return id;
+}
+
 int dependency_graph_add_package(dependency_graph_t *graph, const char *package_name) {
     if (!graph || !package_name) {
         return TINYPKG_ERROR;
     }
     
-    // Check if package already exists in graph
-    if (dependency_graph_find_node(graph, package_name)) {
-        return TINYPKG_SUCCESS; // Already added
+    return dependency_graph_intern(graph, package_name) >= 0 ? TINYPKG_SUCCESS : TINYPKG_ERROR_MEMORY;
+}
+
+static int dependency_graph_add_edge(dependency_graph_t *graph, int id, const char *dep_name) {
+    int dep = dependency_graph_intern(graph, dep_name);
+    if (dep < 0) return TINYPKG_ERROR_MEMORY;
+    
+    if (graph->edge_count == graph->edge_capacity) {
+        int capacity = graph->edge_capacity ? graph->edge_capacity * 2 : 64;
+        int *edges = TINYPKG_REALLOC(graph->edges, capacity * sizeof(int));
+        if (!edges) return TINYPKG_ERROR_MEMORY;
+        graph->edges = edges;
+        graph->edge_capacity = capacity;
     }
     
-    // Create new node
-    dependency_node_t *node = dependency_node_create(package_name);
-    if (!node) {
-        return TINYPKG_ERROR_MEMORY;
+    graph->edges[graph->edge_count++] = dep;
+    graph->nodes[id].dep_count++;
+    return TINYPKG_SUCCESS;
+}
+
+// Read one node's dependencies, appending its edges
+static int dependency_graph_load_node(dependency_graph_t *graph, int id) {
+    int result = TINYPKG_SUCCESS;
+    
+    graph->nodes[id].loaded = 1;
+    graph->nodes[id].dep_start = graph->edge_count;
+    graph->nodes[id].dep_count = 0;
+    
+    // The repository index has the lists without materializing a package
+    int index_id = repoindex_find(graph->nodes[id].package_name);
+    if (index_id >= 0) {
+        const uint32_t *refs;
+        int count = repoindex_get_list(index_id, REPOINDEX_LIST_DEPENDENCIES, &refs);
+        for (int i = 0; i < count && result == TINYPKG_SUCCESS; i++) {
+            result = dependency_graph_add_edge(graph, id, repoindex_ref_name(refs[i]));
+        }
+        return result;
     }
     
-    // Add to linked list
-    node->next = graph->nodes;
-    graph->nodes = node;
-    graph->node_count++;
+    package_t *pkg = package_load_info(graph->nodes[id].package_name);
+    if (!pkg) return TINYPKG_SUCCESS;
     
-    log_debug("Added package to dependency graph: %s", package_name);
-    return TINYPKG_SUCCESS;
+    for (int i = 0; i < pkg->dep_count && result == TINYPKG_SUCCESS; i++) {
+        result = dependency_graph_add_edge(graph, id, pkg->dependencies[i]);
+    }
+    package_free(pkg);
+    return result;
 }
 
 int dependency_graph_build(dependency_graph_t *graph) {
     if (!graph) return TINYPKG_ERROR;
     
-    // For each node, load its dependencies and add them recursively
-    dependency_node_t *node = graph->nodes;
-    while (node) {
-        if (!node->dependencies) {
-            // Load package information to get dependencies
-            package_t *pkg = package_load_info(node->package_name);
-            if (pkg && pkg->dependencies && pkg->dep_count > 0) {
-                // Copy dependencies
-                node->dependencies = TINYPKG_MALLOC(sizeof(char*) * pkg->dep_count);
-                if (node->dependencies) {
-                    node->dep_count = pkg->dep_count;
-                    for (int i = 0; i < pkg->dep_count; i++) {
-                        node->dependencies[i] = TINYPKG_STRDUP(pkg->dependencies[i]);
-                        
-                        // Recursively add dependency to graph
-                        dependency_graph_add_package(graph, pkg->dependencies[i]);
-                    }
-                }
-                package_free(pkg);
-            }
+    // Nodes are loaded in ID order, so each node's edges are contiguous
+    for (int id = 0; id < graph->node_count; id++) {
+        if (graph->nodes[id].loaded) continue;
+        
+        int result = dependency_graph_load_node(graph, id);
+        if (result != TINYPKG_SUCCESS) {
+            return result;
         }
-        node = node->next;
     }
     
     return TINYPKG_SUCCESS;
 }
 
+// Kahn's algorithm over the reversed edges: a package comes after all of
+// its dependencies
 int dependency_graph_topological_sort(dependency_graph_t *graph, 
                                      char ***sorted_packages, int *count) {
     if (!graph || !sorted_packages || !count) {
@@ -145,111 +309,84 @@ int dependency_graph_topological_sort(dependency_graph_t *graph,
     *sorted_packages = NULL;
     *count = 0;
     
-    if (graph->node_count == 0) {
+    int n = graph->node_count;
+    if (n == 0) {
         return TINYPKG_SUCCESS;
     }
     
-    // Allocate result array
-    char **result = TINYPKG_MALLOC(sizeof(char*) * graph->node_count);
-    if (!result) {
-        return TINYPKG_ERROR_MEMORY;
-    }
-    
-    // Calculate in-degrees for all nodes
-    int *in_degree = TINYPKG_CALLOC(graph->node_count, sizeof(int));
-    if (!in_degree) {
+    char **result = TINYPKG_CALLOC(n, sizeof(char*));
+    int *pending = TINYPKG_CALLOC(n, sizeof(int));
+    int *rev_start = TINYPKG_CALLOC(n + 1, sizeof(int));
+    int *rev_edges = TINYPKG_MALLOC(sizeof(int) * MAX(graph->edge_count, 1));
+    int *queue = TINYPKG_MALLOC(sizeof(int) * n);
+    if (!result || !pending || !rev_start || !rev_edges || !queue) {
         TINYPKG_FREE(result);
+        TINYPKG_FREE(pending);
+        TINYPKG_FREE(rev_start);
+        TINYPKG_FREE(rev_edges);
+        TINYPKG_FREE(queue);
         return TINYPKG_ERROR_MEMORY;
     }
     
-    // Create node index mapping
-    dependency_node_t **node_array = TINYPKG_MALLOC(sizeof(dependency_node_t*) * graph->node_count);
-    if (!node_array) {
-        TINYPKG_FREE(result);
-        TINYPKG_FREE(in_degree);
-        return TINYPKG_ERROR_MEMORY;
+    // Build the dependents lists in CSR form
+    for (int id = 0; id < n; id++) {
+        const dependency_node_t *node = &graph->nodes[id];
+        pending[id] = node->dep_count;
+        for (int e = 0; e < node->dep_count; e++) {
+            rev_start[graph->edges[node->dep_start + e] + 1]++;
+        }
+    }
+    for (int id = 0; id < n; id++) {
+        rev_start[id + 1] += rev_start[id];
     }
     
-    // Fill node array and calculate in-degrees
-    dependency_node_t *node = graph->nodes;
-    int idx = 0;
-    while (node) {
-        node_array[idx] = node;
-        
-        // Count in-degrees
-        for (int i = 0; i < node->dep_count; i++) {
-            for (int j = 0; j < graph->node_count; j++) {
-                dependency_node_t *dep_node = graph->nodes;
-                int dep_idx = 0;
-                while (dep_node && dep_idx < j) {
-                    dep_node = dep_node->next;
-                    dep_idx++;
-                }
-                if (dep_node && strcmp(dep_node->package_name, node->dependencies[i]) == 0) {
-                    in_degree[j]++;
-                    break;
-                }
-            }
+    int *fill = queue;      // Reused as insertion cursors before the sort
+    memcpy(fill, rev_start, sizeof(int) * n);
+    for (int id = 0; id < n; id++) {
+        const dependency_node_t *node = &graph->nodes[id];
+        for (int e = 0; e < node->dep_count; e++) {
+            rev_edges[fill[graph->edges[node->dep_start + e]]++] = id;
         }
-        
-        node = node->next;
-        idx++;
     }
     
-    // Topological sort using Kahn's algorithm
-    int result_count = 0;
-    int queue[graph->node_count];
     int queue_start = 0, queue_end = 0;
-    
-    // Find nodes with no incoming edges
-    for (int i = 0; i < graph->node_count; i++) {
-        if (in_degree[i] == 0) {
-            queue[queue_end++] = i;
+    for (int id = 0; id < n; id++) {
+        if (pending[id] == 0) {
+            queue[queue_end++] = id;
         }
     }
     
+    int result_count = 0;
+    int status = TINYPKG_SUCCESS;
     while (queue_start < queue_end) {
-        int current_idx = queue[queue_start++];
-        dependency_node_t *current = node_array[current_idx];
+        int current = queue[queue_start++];
         
-        // Add to result
-        result[result_count] = TINYPKG_STRDUP(current->package_name);
+        result[result_count] = TINYPKG_STRDUP(graph->nodes[current].package_name);
         if (!result[result_count]) {
-            // Cleanup on memory error
-            for (int i = 0; i < result_count; i++) {
-                TINYPKG_FREE(result[i]);
-            }
-            TINYPKG_FREE(result);
-            TINYPKG_FREE(in_degree);
-            TINYPKG_FREE(node_array);
-            return TINYPKG_ERROR_MEMORY;
+            status = TINYPKG_ERROR_MEMORY;
+            break;
         }
         result_count++;
         
-        // Decrease in-degree of dependent nodes
-        for (int i = 0; i < current->dep_count; i++) {
-            for (int j = 0; j < graph->node_count; j++) {
-                if (strcmp(node_array[j]->package_name, current->dependencies[i]) == 0) {
-                    in_degree[j]--;
-                    if (in_degree[j] == 0) {
-                        queue[queue_end++] = j;
-                    }
-                    break;
-                }
+        for (int e = rev_start[current]; e < rev_start[current + 1]; e++) {
+            if (--pending[rev_edges[e]] == 0) {
+                queue[queue_end++] = rev_edges[e];
             }
         }
     }
     
-    TINYPKG_FREE(in_degree);
-    TINYPKG_FREE(node_array);
+    TINYPKG_FREE(pending);
+    TINYPKG_FREE(rev_start);
+    TINYPKG_FREE(rev_edges);
+    TINYPKG_FREE(queue);
     
-    // Check for cycles (if not all nodes processed)
-    if (result_count != graph->node_count) {
-        for (int i = 0; i < result_count; i++) {
-            TINYPKG_FREE(result[i]);
-        }
-        TINYPKG_FREE(result);
-        return TINYPKG_ERROR_DEPENDENCY;
+    // Nodes left over are on a cycle
+    if (status == TINYPKG_SUCCESS && result_count != n) {
+        status = TINYPKG_ERROR_DEPENDENCY;
+    }
+    if (status != TINYPKG_SUCCESS) {
+        utils_string_array_free(result, result_count);
+        return status;
     }
     
     *sorted_packages = result;
@@ -257,162 +394,89 @@ int dependency_graph_topological_sort(dependency_graph_t *graph,
     return TINYPKG_SUCCESS;
 }
 
-// Cycle detection using DFS
-static int dfs_cycle_check(dependency_node_t *node, dependency_graph_t *graph) {
-    node->visited = 1;
-    node->in_stack = 1;
-    
-    // Visit all dependencies
-    for (int i = 0; i < node->dep_count; i++) {
-        dependency_node_t *dep_node = dependency_graph_find_node(graph, node->dependencies[i]);
-        if (dep_node) {
-            if (dep_node->in_stack) {
-                return 1; // Back edge found - cycle detected
-            }
-            if (!dep_node->visited && dfs_cycle_check(dep_node, graph)) {
-                return 1;
-            }
-        }
-    }
-    
-    node->in_stack = 0;
-    return 0;
-}
-
+// Cycle detection using an iterative DFS (0 = unvisited, 1 = on the
+// stack, 2 = done)
 int dependency_detect_cycles(dependency_graph_t *graph) {
     if (!graph) return TINYPKG_ERROR;
     
-    // Reset visited flags
-    dependency_node_t *node = graph->nodes;
-    while (node) {
-        node->visited = 0;
-        node->in_stack = 0;
-        node = node->next;
+    int n = graph->node_count;
+    if (n == 0) return TINYPKG_SUCCESS;
+    
+    char *state = TINYPKG_CALLOC(n, 1);
+    int *stack = TINYPKG_MALLOC(sizeof(int) * n);
+    int *next_edge = TINYPKG_MALLOC(sizeof(int) * n);
+    if (!state || !stack || !next_edge) {
+        TINYPKG_FREE(state);
+        TINYPKG_FREE(stack);
+        TINYPKG_FREE(next_edge);
+        return TINYPKG_ERROR_MEMORY;
     }
     
-    // Check each unvisited node
-    node = graph->nodes;
-    while (node) {
-        if (!node->visited) {
-            if (dfs_cycle_check(node, graph)) {
+    int result = TINYPKG_SUCCESS;
+    for (int root = 0; root < n && result == TINYPKG_SUCCESS; root++) {
+        if (state[root]) continue;
+        
+        int depth = 0;
+        stack[depth] = root;
+        next_edge[depth] = 0;
+        state[root] = 1;
+        
+        while (depth >= 0) {
+            const dependency_node_t *node = &graph->nodes[stack[depth]];
+            
+            if (next_edge[depth] == node->dep_count) {
+                state[stack[depth--]] = 2;
+                continue;
+            }
+            
+            int dep = graph->edges[node->dep_start + next_edge[depth]++];
+            if (state[dep] == 1) {
+                log_debug("Dependency cycle: %s -> %s", node->package_name,
+                          graph->nodes[dep].package_name);
                 graph->has_cycles = 1;
-                return TINYPKG_ERROR_DEPENDENCY;
+                result = TINYPKG_ERROR_DEPENDENCY;
+                break;
+            }
+            if (state[dep] == 0) {
+                state[dep] = 1;
+                stack[++depth] = dep;
+                next_edge[depth] = 0;
             }
         }
-        node = node->next;
-    }
-    
-    return TINYPKG_SUCCESS;
-}
-
-// Node management
-dependency_node_t *dependency_node_create(const char *package_name) {
-    if (!package_name) return NULL;
-    
-    dependency_node_t *node = TINYPKG_CALLOC(1, sizeof(dependency_node_t));
-    if (!node) return NULL;
-    
-    strncpy(node->package_name, package_name, sizeof(node->package_name) - 1);
-    return node;
-}
-
-void dependency_node_free(dependency_node_t *node) {
-    if (!node) return;
-    
-    if (node->dependencies) {
-        for (int i = 0; i < node->dep_count; i++) {
-            TINYPKG_FREE(node->dependencies[i]);
-        }
-        TINYPKG_FREE(node->dependencies);
     }
     
-    TINYPKG_FREE(node);
+    TINYPKG_FREE(state);
+    TINYPKG_FREE(stack);
+    TINYPKG_FREE(next_edge);
+    return result;
 }
 
-dependency_node_t *dependency_graph_find_node(dependency_graph_t *graph, 
-                                              const char *package_name) {
-    if (!graph || !package_name) return NULL;
-    
-    dependency_node_t *node = graph->nodes;
-    while (node) {
-        if (strcmp(node->package_name, package_name) == 0) {
-            return node;
-        }
-        node = node->next;
-    }
-    
-    return NULL;
+// Find installed packages that depend on the given package
+int dependency_find_dependents(const char *package_name, char ***dependents, int *count) {
+    return depindex_dependents(package_name, 0, dependents, count);
 }
 
-// Find packages that depend on the given package
-int dependency_find_dependents(const char *package_name, char ***dependents, int *count) {
-    if (!package_name || !dependents || !count) {
-        return TINYPKG_ERROR;
-    }
-    
-    *dependents = NULL;
-    *count = 0;
-    
-    // Load package database and check each installed package
-    if (package_db_load() != TINYPKG_SUCCESS) {
-        return TINYPKG_ERROR;
-    }
-    
-    char **result = NULL;
-    int result_count = 0;
-    int result_capacity = 16;
-    
-    result = TINYPKG_MALLOC(sizeof(char*) * result_capacity);
-    if (!result) return TINYPKG_ERROR_MEMORY;
-    
-    package_db_entry_t *entry = package_db_get_all();
-    while (entry) {
-        package_t *pkg = package_load_info(entry->name);
-        if (pkg && pkg->dependencies) {
-            // Check if this package depends on the target package
-            for (int i = 0; i < pkg->dep_count; i++) {
-                if (strcmp(pkg->dependencies[i], package_name) == 0) {
-                    // Expand array if needed
-                    if (result_count >= result_capacity) {
-                        result_capacity *= 2;
-                        char **new_result = TINYPKG_REALLOC(result, sizeof(char*) * result_capacity);
-                        if (!new_result) {
-                            utils_string_array_free(result, result_count);
-                            package_free(pkg);
-                            return TINYPKG_ERROR_MEMORY;
-                        }
-                        result = new_result;
-                    }
-                    
-                    result[result_count] = TINYPKG_STRDUP(entry->name);
-                    if (!result[result_count]) {
-                        utils_string_array_free(result, result_count);
-                        package_free(pkg);
-                        return TINYPKG_ERROR_MEMORY;
-                    }
-                    result_count++;
-                    break; // Found dependency, no need to check others
-                }
-            }
-        }
-        if (pkg) package_free(pkg);
-        entry = entry->next;
-    }
-    
-    if (result_count == 0) {
-        TINYPKG_FREE(result);
-        result = NULL;
-    }
-    
-    *dependents = result;
-    *count = result_count;
-    return TINYPKG_SUCCESS;
+// Everything that depends on the package directly or indirectly, in an
+// order that is safe to remove
+int dependency_find_all_dependents(const char *package_name, char ***dependents, int *count) {
+    return depindex_dependents(package_name, 1, dependents, count);
 }
 
 int dependency_check_satisfied(const char *package_name) {
     if (!package_name) return 0;
     
-    // For now, simply check if package is installed
-    // In a full implementation, this would check version requirements
-    return package_is_installed(package_name);
+    if (!package_is_installed(package_name)) return 0;
+    package_db_entry_t *installed = package_db_find(package_name);
+
+    // Dependencies name no versions of their own: the installed version
+    // has to be compatible with what the repositories now provide
+    int id = repoindex_find(package_name);
+    const char *available = repoindex_get_string(id, REPOINDEX_STR_VERSION);
+    version_t current, next;
+    if (!available ||
+        version_parse(installed->version, &current) != TINYPKG_SUCCESS ||
+        version_parse(available, &next) != TINYPKG_SUCCESS) {
+        return 1;
+    }
+    return version_is_compatible(&current, &next);
 }
@@ -6,20 +6,29 @@
 #ifndef TINYPKG_DEPENDENCY_H
 #define TINYPKG_DEPENDENCY_H
 
-// Dependency node for graph representation
+// Dependency node; its edges are dep_count node IDs starting at
+// graph->edges[dep_start]
 typedef struct dependency_node {
-    char package_name[MAX_NAME];
-    char **dependencies;
+    const char *package_name;   // Interned in the graph arena
+    int dep_start;
     int dep_count;
-    int visited;
-    int in_stack;
-    struct dependency_node *next;
+    int loaded;                 // Dependencies have been read
 } dependency_node_t;
 
-// Dependency graph
+typedef struct dependency_arena dependency_arena_t;
+
+// Dependency graph: dense node IDs in insertion order, CSR adjacency and
+// a hash index by name
 typedef struct dependency_graph {
     dependency_node_t *nodes;
     int node_count;
+    int node_capacity;
+    int *edges;
+    int edge_count;
+    int edge_capacity;
+    int *index;                 // Node ID + 1, 0 = empty
+    int index_capacity;         // Power of two
+    dependency_arena_t *arena;
     int has_cycles;
 } dependency_graph_t;
 
@@ -29,6 +38,7 @@ typedef struct dependency_graph {
 int dependency_resolve(const char *package_name, char ***install_order, int *count);
 int dependency_resolve_all(char **package_names, int package_count, 
                           char ***install_order, int *count);
+dependency_graph_t *dependency_resolve_graph(char **package_names, int package_count);
 
 // Dependency graph operations
 dependency_graph_t *dependency_graph_create(void);
@@ -45,13 +55,14 @@ int dependency_find_cycle_path(dependency_graph_t *graph, const char *package_na
 
 // Dependency queries  
 int dependency_find_dependents(const char *package_name, char ***dependents, int *count);
+int dependency_find_all_dependents(const char *package_name, char ***dependents, int *count);
 int dependency_get_recursive_deps(const char *package_name, char ***deps, int *count);
 int dependency_check_satisfied(const char *package_name);
 
-// Node management
-dependency_node_t *dependency_node_create(const char *package_name);
-void dependency_node_free(dependency_node_t *node);
+// Node lookup (IDs stay valid for the life of the graph)
+int dependency_graph_find_id(dependency_graph_t *graph, const char *package_name);
 dependency_node_t *dependency_graph_find_node(dependency_graph_t *graph, 
                                               const char *package_name);
+const int *dependency_graph_get_deps(dependency_graph_t *graph, int id, int *count);
 
 #endif /* TINYPKG_DEPENDENCY_H */
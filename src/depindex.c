@@ -0,0 +1,980 @@
+/*
+ * TinyPkg - Reverse Dependency Index Implementation
+ * Memory-mapped dependency graph of the installed packages
+ */
+
+#include "../include/tinypkg.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+// Mapped index. Builds update it from worker threads, so every access
+// goes through the lock; updates also hold the file lock, lock_fd.
+typedef struct depindex
+{
+    int opened;
+    ino_t inode;                // Of the mapped file, to notice replacements
+    dev_t device;
+    void *map;
+    size_t map_size;
+    const depindex_header_t *header;
+    const depindex_node_t *nodes;
+    const uint32_t *edges;
+    const uint32_t *index;
+    const char *strtab;
+} depindex_t;
+
+static depindex_t g_depindex;
+static pthread_mutex_t g_depindex_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_depindex_lock_fd = -1;
+
+// New index under construction. Each installed node's dependencies are
+// one run of the edge array. Names are borrowed from the old mapping or
+// the caller and must stay alive until depindex_builder_write().
+typedef struct depindex_builder
+{
+    const char **names;
+    uint32_t *hashes;
+    uint32_t *installed;
+    uint32_t *deps_start;
+    uint32_t *deps_count;
+    uint32_t count;
+    uint32_t capacity;
+
+    uint32_t *table;            // Node number + 1
+    uint32_t table_capacity;
+
+    uint32_t *edges;
+    uint32_t edge_count;
+    uint32_t edge_capacity;
+} depindex_builder_t;
+
+static void depindex_path(char *path, size_t size)
+{
+    snprintf(path, size, "%s/%s", LIB_DIR, DEPINDEX_FILE);
+}
+
+// Mapped file
+static const char *depindex_string(uint32_t offset)
+{
+    return offset < g_depindex.header->strtab_size ? g_depindex.strtab + offset : "";
+}
+
+static const char *depindex_node_name(uint32_t node)
+{
+    return node < g_depindex.header->node_count
+               ? depindex_string(g_depindex.nodes[node].name)
+               : "";
+}
+
+static int depindex_find(const char *name)
+{
+    const depindex_header_t *header = g_depindex.header;
+
+    if (!header || header->node_count == 0)
+    {
+        return -1;
+    }
+
+    uint32_t hash = utils_hash_string(name);
+    uint32_t mask = header->bucket_count - 1;
+    for (uint32_t i = hash & mask, probes = 0; probes < header->bucket_count;
+         i = (i + 1) & mask, probes++)
+    {
+        uint32_t ref = g_depindex.index[i];
+        if (ref == 0 || ref > header->node_count)
+        {
+            return -1;
+        }
+
+        const depindex_node_t *node = &g_depindex.nodes[ref - 1];
+        if (node->hash == hash && TINYPKG_STREQ(depindex_string(node->name), name))
+        {
+            return (int)(ref - 1);
+        }
+    }
+    return -1;
+}
+
+static void depindex_unmap(void)
+{
+    if (g_depindex.map)
+    {
+        munmap(g_depindex.map, g_depindex.map_size);
+    }
+    memset(&g_depindex, 0, sizeof(g_depindex));
+}
+
+// Every node's edge ranges have to lie inside the edge array and name
+// existing nodes
+static int depindex_check_edges(const void *map)
+{
+    const depindex_header_t *header = (const depindex_header_t *)map;
+    const depindex_node_t *nodes =
+        (const depindex_node_t *)((const char *)map + header->nodes_offset);
+    const uint32_t *edges = (const uint32_t *)((const char *)map + header->edges_offset);
+
+    for (uint32_t i = 0; i < header->node_count; i++)
+    {
+        if ((uint64_t)nodes[i].deps_start + nodes[i].deps_count > header->edge_count ||
+            (uint64_t)nodes[i].dependents_start + nodes[i].dependents_count >
+                header->edge_count)
+        {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < header->edge_count; i++)
+    {
+        if (edges[i] >= header->node_count)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int depindex_map(const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return errno == ENOENT ? TINYPKG_SUCCESS : TINYPKG_ERROR_FILE;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(depindex_header_t))
+    {
+        close(fd);
+        log_error("Dependency index is truncated: %s", path);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        log_error("Failed to map dependency index: %s", strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+
+    const depindex_header_t *header = (const depindex_header_t *)map;
+    uint64_t size = (uint64_t)st.st_size;
+
+    if (memcmp(header->magic, DEPINDEX_MAGIC, sizeof(DEPINDEX_MAGIC)) != 0 ||
+        header->version != DEPINDEX_FORMAT_VERSION || header->file_size != size ||
+        header->bucket_count == 0 ||
+        (header->bucket_count & (header->bucket_count - 1)) != 0 ||
+        header->bucket_count <= header->node_count ||
+        header->nodes_offset + (uint64_t)header->node_count * sizeof(depindex_node_t) >
+            size ||
+        header->edges_offset + (uint64_t)header->edge_count * sizeof(uint32_t) > size ||
+        header->index_offset + (uint64_t)header->bucket_count * sizeof(uint32_t) > size ||
+        header->strtab_size == 0 ||
+        header->strtab_offset + header->strtab_size > size ||
+        ((const char *)map)[header->strtab_offset + header->strtab_size - 1] != '\0' ||
+        !depindex_check_edges(map))
+    {
+        munmap(map, (size_t)st.st_size);
+        log_error("Dependency index is corrupt: %s", path);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    const char *base = (const char *)map;
+    g_depindex.inode = st.st_ino;
+    g_depindex.device = st.st_dev;
+    g_depindex.map = map;
+    g_depindex.map_size = (size_t)st.st_size;
+    g_depindex.header = header;
+    g_depindex.nodes = (const depindex_node_t *)(base + header->nodes_offset);
+    g_depindex.edges = (const uint32_t *)(base + header->edges_offset);
+    g_depindex.index = (const uint32_t *)(base + header->index_offset);
+    g_depindex.strtab = base + header->strtab_offset;
+    return TINYPKG_SUCCESS;
+}
+
+// Builder
+static void depindex_builder_free(depindex_builder_t *builder)
+{
+    TINYPKG_FREE(builder->names);
+    TINYPKG_FREE(builder->hashes);
+    TINYPKG_FREE(builder->installed);
+    TINYPKG_FREE(builder->deps_start);
+    TINYPKG_FREE(builder->deps_count);
+    TINYPKG_FREE(builder->table);
+    TINYPKG_FREE(builder->edges);
+}
+
+static int depindex_builder_grow_table(depindex_builder_t *builder)
+{
+    uint32_t capacity = builder->table_capacity ? builder->table_capacity * 2 : 256;
+    uint32_t *table = TINYPKG_CALLOC(capacity, sizeof(uint32_t));
+    if (!table)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    for (uint32_t i = 0; i < builder->count; i++)
+    {
+        uint32_t j = builder->hashes[i] & (capacity - 1);
+        while (table[j])
+        {
+            j = (j + 1) & (capacity - 1);
+        }
+        table[j] = i + 1;
+    }
+
+    TINYPKG_FREE(builder->table);
+    builder->table = table;
+    builder->table_capacity = capacity;
+    return TINYPKG_SUCCESS;
+}
+
+static int depindex_builder_grow_nodes(depindex_builder_t *builder)
+{
+    uint32_t capacity = builder->capacity ? builder->capacity * 2 : 256;
+
+    const char **names = TINYPKG_REALLOC(builder->names, capacity * sizeof(char *));
+    if (!names)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+    builder->names = names;
+
+    uint32_t **arrays[] = {&builder->hashes, &builder->installed, &builder->deps_start,
+                           &builder->deps_count};
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++)
+    {
+        uint32_t *grown = TINYPKG_REALLOC(*arrays[i], capacity * sizeof(uint32_t));
+        if (!grown)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        *arrays[i] = grown;
+    }
+
+    builder->capacity = capacity;
+    return TINYPKG_SUCCESS;
+}
+
+// Find or add the node for a name
+static int depindex_builder_node(depindex_builder_t *builder, const char *name,
+                                 uint32_t *node)
+{
+    if ((builder->count + 1) * 2 > builder->table_capacity &&
+        depindex_builder_grow_table(builder) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    uint32_t hash = utils_hash_string(name);
+    uint32_t mask = builder->table_capacity - 1;
+    uint32_t i = hash & mask;
+    while (builder->table[i])
+    {
+        uint32_t ref = builder->table[i] - 1;
+        if (builder->hashes[ref] == hash && TINYPKG_STREQ(builder->names[ref], name))
+        {
+            *node = ref;
+            return TINYPKG_SUCCESS;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (builder->count == builder->capacity &&
+        depindex_builder_grow_nodes(builder) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    *node = builder->count;
+    builder->names[*node] = name;
+    builder->hashes[*node] = hash;
+    builder->installed[*node] = 0;
+    builder->deps_start[*node] = 0;
+    builder->deps_count[*node] = 0;
+    builder->table[i] = ++builder->count;
+    return TINYPKG_SUCCESS;
+}
+
+// Start an installed package; its dependencies have to follow before the
+// next package is added
+static int depindex_builder_add_package(depindex_builder_t *builder, const char *name,
+                                        uint32_t *node)
+{
+    if (depindex_builder_node(builder, name, node) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    builder->installed[*node] = 1;
+    builder->deps_start[*node] = builder->edge_count;
+    builder->deps_count[*node] = 0;
+    return TINYPKG_SUCCESS;
+}
+
+static int depindex_builder_add_dependency(depindex_builder_t *builder, uint32_t node,
+                                           const char *dependency)
+{
+    uint32_t target;
+
+    if (!dependency || dependency[0] == '\0')
+    {
+        return TINYPKG_SUCCESS;
+    }
+    if (depindex_builder_node(builder, dependency, &target) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    // Lists are short; drop self references and duplicates
+    if (target == node)
+    {
+        return TINYPKG_SUCCESS;
+    }
+    for (uint32_t i = 0; i < builder->deps_count[node]; i++)
+    {
+        if (builder->edges[builder->deps_start[node] + i] == target)
+        {
+            return TINYPKG_SUCCESS;
+        }
+    }
+
+    if (builder->edge_count == builder->edge_capacity)
+    {
+        uint32_t capacity = builder->edge_capacity ? builder->edge_capacity * 2 : 1024;
+        uint32_t *edges = TINYPKG_REALLOC(builder->edges, capacity * sizeof(uint32_t));
+        if (!edges)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        builder->edges = edges;
+        builder->edge_capacity = capacity;
+    }
+
+    builder->edges[builder->edge_count++] = target;
+    builder->deps_count[node]++;
+    return TINYPKG_SUCCESS;
+}
+
+// Carry over the mapped index, minus one package's dependencies
+static int depindex_builder_add_existing(depindex_builder_t *builder,
+                                         const char *skip_package)
+{
+    const depindex_header_t *header = g_depindex.header;
+    int result = TINYPKG_SUCCESS;
+
+    if (!header)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    for (uint32_t i = 0; i < header->node_count && result == TINYPKG_SUCCESS; i++)
+    {
+        const depindex_node_t *old = &g_depindex.nodes[i];
+        const char *name = depindex_string(old->name);
+        uint32_t node;
+
+        if (!old->installed || (skip_package && TINYPKG_STREQ(name, skip_package)))
+        {
+            continue;
+        }
+
+        result = depindex_builder_add_package(builder, name, &node);
+        for (uint32_t e = 0; e < old->deps_count && result == TINYPKG_SUCCESS; e++)
+        {
+            result = depindex_builder_add_dependency(
+                builder, node, depindex_node_name(g_depindex.edges[old->deps_start + e]));
+        }
+    }
+    return result;
+}
+
+static int depindex_write_full(int fd, const void *buf, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = write(fd, (const char *)buf + done, length - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return TINYPKG_ERROR_FILE;
+        }
+        done += (size_t)n;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Serialize the builder to a temp file, swap it in and map it. The
+// dependents lists are derived here from the dependency runs.
+static int depindex_builder_write(depindex_builder_t *builder)
+{
+    char path[MAX_PATH];
+    char temp_path[MAX_PATH];
+    depindex_header_t header;
+    depindex_node_t *nodes = NULL;
+    uint32_t *edges = NULL;
+    uint32_t *cursor = NULL;
+    uint32_t *index = NULL;
+    char *strtab = NULL;
+    size_t strtab_size = 1;     // Offset 0 is the empty string
+    uint64_t dependency_count = 0;
+    int result = TINYPKG_ERROR_MEMORY;
+
+    uint32_t buckets = 16;
+    while (buckets < builder->count * 2)
+    {
+        buckets *= 2;
+    }
+
+    for (uint32_t i = 0; i < builder->count; i++)
+    {
+        strtab_size += strlen(builder->names[i]) + 1;
+        if (builder->installed[i])
+        {
+            dependency_count += builder->deps_count[i];
+        }
+    }
+    if (strtab_size > UINT32_MAX || dependency_count * 2 > UINT32_MAX)
+    {
+        log_error("Dependency index too large");
+        return TINYPKG_ERROR;
+    }
+    uint32_t edge_count = (uint32_t)dependency_count * 2;
+
+    nodes = TINYPKG_CALLOC(builder->count + 1, sizeof(depindex_node_t));
+    edges = TINYPKG_CALLOC(edge_count + 1, sizeof(uint32_t));
+    cursor = TINYPKG_CALLOC(builder->count + 1, sizeof(uint32_t));
+    index = TINYPKG_CALLOC(buckets, sizeof(uint32_t));
+    strtab = TINYPKG_MALLOC(strtab_size);
+    if (!nodes || !edges || !cursor || !index || !strtab)
+    {
+        goto out;
+    }
+
+    // Names, hash index and dependency runs
+    size_t offset = 0;
+    uint32_t position = 0;
+    strtab[offset++] = '\0';
+    for (uint32_t i = 0; i < builder->count; i++)
+    {
+        size_t length = strlen(builder->names[i]) + 1;
+        memcpy(strtab + offset, builder->names[i], length);
+        nodes[i].name = (uint32_t)offset;
+        nodes[i].hash = builder->hashes[i];
+        nodes[i].installed = builder->installed[i];
+        offset += length;
+
+        uint32_t j = nodes[i].hash & (buckets - 1);
+        while (index[j])
+        {
+            j = (j + 1) & (buckets - 1);
+        }
+        index[j] = i + 1;
+
+        if (!builder->installed[i])
+        {
+            continue;
+        }
+        nodes[i].deps_start = position;
+        nodes[i].deps_count = builder->deps_count[i];
+        for (uint32_t e = 0; e < builder->deps_count[i]; e++)
+        {
+            uint32_t target = builder->edges[builder->deps_start[i] + e];
+            edges[position++] = target;
+            nodes[target].dependents_count++;
+        }
+    }
+
+    // Dependents runs: reserve, then fill in node order
+    for (uint32_t i = 0; i < builder->count; i++)
+    {
+        nodes[i].dependents_start = position;
+        cursor[i] = position;
+        position += nodes[i].dependents_count;
+    }
+    for (uint32_t i = 0; i < builder->count; i++)
+    {
+        for (uint32_t e = 0; e < nodes[i].deps_count; e++)
+        {
+            edges[cursor[edges[nodes[i].deps_start + e]]++] = i;
+        }
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DEPINDEX_MAGIC, sizeof(DEPINDEX_MAGIC));
+    header.version = DEPINDEX_FORMAT_VERSION;
+    header.node_count = builder->count;
+    header.edge_count = edge_count;
+    header.bucket_count = buckets;
+    header.strtab_size = (uint32_t)strtab_size;
+    header.nodes_offset = sizeof(header);
+    header.edges_offset =
+        header.nodes_offset + (uint64_t)builder->count * sizeof(depindex_node_t);
+    header.index_offset = header.edges_offset + (uint64_t)edge_count * sizeof(uint32_t);
+    header.strtab_offset = header.index_offset + (uint64_t)buckets * sizeof(uint32_t);
+    header.file_size = header.strtab_offset + strtab_size;
+
+    utils_create_directory_recursive(LIB_DIR);
+    depindex_path(path, sizeof(path));
+    if ((size_t)snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= sizeof(temp_path))
+    {
+        log_error("Dependency index path too long: %s", path);
+        result = TINYPKG_ERROR;
+        goto out;
+    }
+
+    result = TINYPKG_ERROR_FILE;
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        log_error("Failed to open dependency index for writing: %s", temp_path);
+        goto out;
+    }
+
+    if (depindex_write_full(fd, &header, sizeof(header)) != TINYPKG_SUCCESS ||
+        depindex_write_full(fd, nodes, (size_t)builder->count * sizeof(depindex_node_t)) !=
+            TINYPKG_SUCCESS ||
+        depindex_write_full(fd, edges, (size_t)edge_count * sizeof(uint32_t)) !=
+            TINYPKG_SUCCESS ||
+        depindex_write_full(fd, index, (size_t)buckets * sizeof(uint32_t)) !=
+            TINYPKG_SUCCESS ||
+        depindex_write_full(fd, strtab, strtab_size) != TINYPKG_SUCCESS || fsync(fd) != 0)
+    {
+        log_error("Failed to write dependency index: %s", strerror(errno));
+        close(fd);
+        unlink(temp_path);
+        goto out;
+    }
+    close(fd);
+
+    if (rename(temp_path, path) != 0)
+    {
+        log_error("Failed to replace dependency index: %s", strerror(errno));
+        unlink(temp_path);
+        goto out;
+    }
+
+    // The builder may borrow names from the old mapping; swap last
+    depindex_unmap();
+    result = depindex_map(path);
+    g_depindex.opened = (result == TINYPKG_SUCCESS);
+
+out:
+    TINYPKG_FREE(nodes);
+    TINYPKG_FREE(edges);
+    TINYPKG_FREE(cursor);
+    TINYPKG_FREE(index);
+    TINYPKG_FREE(strtab);
+    return result;
+}
+
+// Take the file lock that serializes updates between processes. Called
+// with the lock held.
+static int depindex_lock_file(void)
+{
+    char path[MAX_PATH];
+
+    utils_create_directory_recursive(LIB_DIR);
+    snprintf(path, sizeof(path), "%s/%s", LIB_DIR, DEPINDEX_LOCK_FILE);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        log_error("Cannot open dependency index lock %s: %s", path, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+    while (flock(fd, LOCK_EX) != 0)
+    {
+        if (errno != EINTR)
+        {
+            log_error("Failed to lock dependency index: %s", strerror(errno));
+            close(fd);
+            return TINYPKG_ERROR_FILE;
+        }
+    }
+    g_depindex_lock_fd = fd;
+    return TINYPKG_SUCCESS;
+}
+
+static void depindex_unlock_file(void)
+{
+    if (g_depindex_lock_fd >= 0)
+    {
+        close(g_depindex_lock_fd);
+        g_depindex_lock_fd = -1;
+    }
+}
+
+// Build the index from the installed packages. Their dependencies come
+// from the repository index; only packages missing there are parsed.
+// Called with the lock held.
+static int depindex_rebuild_locked(void)
+{
+    depindex_builder_t builder = {0};
+    package_t **parsed = NULL;
+    int package_count = 0;
+    int parsed_count = 0;
+    int result = TINYPKG_SUCCESS;
+
+    for (package_db_entry_t *entry = package_db_get_all(); entry; entry = entry->next)
+    {
+        package_count++;
+    }
+
+    if (package_count > 0)
+    {
+        parsed = TINYPKG_CALLOC(package_count, sizeof(package_t *));
+        if (!parsed)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+    }
+
+    for (package_db_entry_t *entry = package_db_get_all();
+         entry && result == TINYPKG_SUCCESS; entry = entry->next)
+    {
+        const uint32_t *refs = NULL;
+        uint32_t node;
+        int id = repoindex_find(entry->name);
+
+        result = depindex_builder_add_package(&builder, entry->name, &node);
+        if (result != TINYPKG_SUCCESS)
+        {
+            break;
+        }
+
+        if (id >= 0)
+        {
+            int ref_count = repoindex_get_list(id, REPOINDEX_LIST_DEPENDENCIES, &refs);
+            for (int i = 0; i < ref_count && result == TINYPKG_SUCCESS; i++)
+            {
+                result = depindex_builder_add_dependency(&builder, node,
+                                                         repoindex_ref_name(refs[i]));
+            }
+            continue;
+        }
+
+        package_t *pkg = package_load_info(entry->name);
+        if (!pkg)
+        {
+            log_warn("No dependency information for installed package %s", entry->name);
+            continue;
+        }
+        parsed[parsed_count++] = pkg;
+        for (int i = 0; i < pkg->dep_count && result == TINYPKG_SUCCESS; i++)
+        {
+            result = depindex_builder_add_dependency(&builder, node, pkg->dependencies[i]);
+        }
+    }
+
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = depindex_builder_write(&builder);
+        if (result == TINYPKG_SUCCESS)
+        {
+            log_info("Indexed dependencies of %d installed packages", package_count);
+        }
+    }
+
+    for (int i = 0; i < parsed_count; i++)
+    {
+        package_free(parsed[i]);
+    }
+    TINYPKG_FREE(parsed);
+    depindex_builder_free(&builder);
+    return result;
+}
+
+static int depindex_open_locked(void)
+{
+    char path[MAX_PATH];
+
+    if (g_depindex.opened)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    depindex_path(path, sizeof(path));
+    if (!utils_file_exists(path))
+    {
+        // First run with an index: build it from the installed packages,
+        // unless another process got there while we waited for the lock
+        int locked_here = g_depindex_lock_fd < 0;
+        if (locked_here && depindex_lock_file() != TINYPKG_SUCCESS)
+        {
+            return TINYPKG_ERROR_FILE;
+        }
+
+        int result;
+        if (utils_file_exists(path))
+        {
+            result = depindex_map(path);
+            g_depindex.opened = (result == TINYPKG_SUCCESS);
+        }
+        else
+        {
+            result = package_db_load();
+            if (result == TINYPKG_SUCCESS)
+            {
+                result = depindex_rebuild_locked();
+            }
+        }
+        if (locked_here)
+        {
+            depindex_unlock_file();
+        }
+        return result;
+    }
+
+    int result = depindex_map(path);
+    g_depindex.opened = (result == TINYPKG_SUCCESS);
+    return result;
+}
+
+// Start an update: take the file lock, then drop the mapping if another
+// process has replaced the index since it was mapped, so the update
+// builds on the newest one. Called with the lock held.
+static int depindex_begin_update(void)
+{
+    char path[MAX_PATH];
+    struct stat st;
+
+    int result = depindex_lock_file();
+    if (result != TINYPKG_SUCCESS)
+    {
+        return result;
+    }
+
+    depindex_path(path, sizeof(path));
+    if (g_depindex.opened &&
+        (stat(path, &st) != 0 || st.st_ino != g_depindex.inode ||
+         st.st_dev != g_depindex.device))
+    {
+        depindex_unmap();
+    }
+
+    result = depindex_open_locked();
+    if (result != TINYPKG_SUCCESS)
+    {
+        depindex_unlock_file();
+    }
+    return result;
+}
+
+// Index lifecycle
+int depindex_open(void)
+{
+    pthread_mutex_lock(&g_depindex_lock);
+    int result = depindex_open_locked();
+    pthread_mutex_unlock(&g_depindex_lock);
+    return result;
+}
+
+void depindex_close(void)
+{
+    pthread_mutex_lock(&g_depindex_lock);
+    depindex_unmap();
+    pthread_mutex_unlock(&g_depindex_lock);
+}
+
+int depindex_rebuild(void)
+{
+    pthread_mutex_lock(&g_depindex_lock);
+    int result = depindex_lock_file();
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = package_db_load();
+        if (result == TINYPKG_SUCCESS)
+        {
+            result = depindex_rebuild_locked();
+        }
+        depindex_unlock_file();
+    }
+    pthread_mutex_unlock(&g_depindex_lock);
+    return result;
+}
+
+// Queries. Transitive walks are depth first over the dependents runs,
+// emitting each package once all of its own dependents have been.
+static int depindex_collect(uint32_t root, int transitive, uint32_t *found,
+                            uint32_t *found_count)
+{
+    const depindex_node_t *nodes = g_depindex.nodes;
+    uint32_t node_count = g_depindex.header->node_count;
+
+    if (!transitive)
+    {
+        for (uint32_t e = 0; e < nodes[root].dependents_count; e++)
+        {
+            found[(*found_count)++] = g_depindex.edges[nodes[root].dependents_start + e];
+        }
+        return TINYPKG_SUCCESS;
+    }
+
+    unsigned char *visited = TINYPKG_CALLOC(node_count, 1);
+    uint32_t *stack = TINYPKG_MALLOC(node_count * sizeof(uint32_t));
+    uint32_t *next = TINYPKG_MALLOC(node_count * sizeof(uint32_t));
+    if (!visited || !stack || !next)
+    {
+        TINYPKG_FREE(visited);
+        TINYPKG_FREE(stack);
+        TINYPKG_FREE(next);
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    uint32_t depth = 0;
+    visited[root] = 1;
+    stack[depth] = root;
+    next[depth++] = 0;
+    while (depth > 0)
+    {
+        uint32_t node = stack[depth - 1];
+        if (next[depth - 1] < nodes[node].dependents_count)
+        {
+            uint32_t dependent =
+                g_depindex.edges[nodes[node].dependents_start + next[depth - 1]++];
+            if (!visited[dependent])
+            {
+                visited[dependent] = 1;
+                stack[depth] = dependent;
+                next[depth++] = 0;
+            }
+            continue;
+        }
+
+        depth--;
+        if (node != root)
+        {
+            found[(*found_count)++] = node;
+        }
+    }
+
+    TINYPKG_FREE(visited);
+    TINYPKG_FREE(stack);
+    TINYPKG_FREE(next);
+    return TINYPKG_SUCCESS;
+}
+
+int depindex_dependents(const char *package_name, int transitive, char ***dependents,
+                        int *count)
+{
+    uint32_t *found = NULL;
+    uint32_t found_count = 0;
+    int result;
+
+    if (!package_name || !dependents || !count)
+    {
+        return TINYPKG_ERROR;
+    }
+    *dependents = NULL;
+    *count = 0;
+
+    metrics_add(METRICS_DEPINDEX_LOOKUPS, 1);
+    pthread_mutex_lock(&g_depindex_lock);
+    result = depindex_open_locked();
+    int node = result == TINYPKG_SUCCESS ? depindex_find(package_name) : -1;
+    if (node >= 0)
+    {
+        found = TINYPKG_MALLOC((g_depindex.header->node_count + 1) * sizeof(uint32_t));
+        result = found ? depindex_collect((uint32_t)node, transitive, found, &found_count)
+                       : TINYPKG_ERROR_MEMORY;
+    }
+
+    if (result == TINYPKG_SUCCESS && found_count > 0)
+    {
+        char **names = TINYPKG_CALLOC(found_count, sizeof(char *));
+        for (uint32_t i = 0; names && i < found_count; i++)
+        {
+            names[i] = TINYPKG_STRDUP(depindex_node_name(found[i]));
+            if (!names[i])
+            {
+                utils_string_array_free(names, (int)i);
+                names = NULL;
+            }
+        }
+
+        if (names)
+        {
+            *dependents = names;
+            *count = (int)found_count;
+        }
+        else
+        {
+            result = TINYPKG_ERROR_MEMORY;
+        }
+    }
+    pthread_mutex_unlock(&g_depindex_lock);
+
+    TINYPKG_FREE(found);
+    return result;
+}
+
+// Incremental updates: the new index is the old one with the package's
+// previous dependencies replaced
+int depindex_add_package(const char *package_name, char **dependencies, int count)
+{
+    depindex_builder_t builder = {0};
+    uint32_t node;
+    int result;
+
+    if (!package_name || (count > 0 && !dependencies))
+    {
+        return TINYPKG_ERROR;
+    }
+
+    pthread_mutex_lock(&g_depindex_lock);
+    result = depindex_begin_update();
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = depindex_builder_add_existing(&builder, package_name);
+        if (result == TINYPKG_SUCCESS)
+        {
+            result = depindex_builder_add_package(&builder, package_name, &node);
+        }
+        for (int i = 0; i < count && result == TINYPKG_SUCCESS; i++)
+        {
+            result = depindex_builder_add_dependency(&builder, node, dependencies[i]);
+        }
+        if (result == TINYPKG_SUCCESS)
+        {
+            result = depindex_builder_write(&builder);
+        }
+        depindex_unlock_file();
+    }
+    pthread_mutex_unlock(&g_depindex_lock);
+
+    depindex_builder_free(&builder);
+    return result;
+}
+
+int depindex_remove_package(const char *package_name)
+{
+    depindex_builder_t builder = {0};
+    int result;
+
+    if (!package_name)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    pthread_mutex_lock(&g_depindex_lock);
+    result = depindex_begin_update();
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = depindex_builder_add_existing(&builder, package_name);
+        if (result == TINYPKG_SUCCESS)
+        {
+            result = depindex_builder_write(&builder);
+        }
+        depindex_unlock_file();
+    }
+    pthread_mutex_unlock(&g_depindex_lock);
+
+    depindex_builder_free(&builder);
+    return result;
+}
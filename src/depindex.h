@@ -0,0 +1,70 @@
+/*
+ * TinyPkg - Reverse Dependency Index Header
+ * Memory-mapped dependency graph of the installed packages
+ */
+
+#ifndef TINYPKG_DEPINDEX_H
+#define TINYPKG_DEPINDEX_H
+
+#include <stdint.h>
+
+// Index file inside LIB_DIR
+#define DEPINDEX_FILE "depends.idx"
+
+// Updates rename a new index over the old one, so processes serialize
+// them with flock() on this file next to it
+#define DEPINDEX_LOCK_FILE "depends.lock"
+
+#define DEPINDEX_MAGIC "TPKGRD1"
+#define DEPINDEX_FORMAT_VERSION 1
+
+// On-disk layout: header, node array, edge array, hash index, string
+// table. There is a node per installed package and per name one of them
+// depends on. The edge array holds node numbers: first every installed
+// package's dependencies, then every node's installed dependents. The
+// index is an open-addressing table of node numbers + 1 (0 = empty)
+// probed linearly from the FNV-1a hash of the name.
+typedef struct depindex_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_count;
+    uint32_t edge_count;
+    uint32_t bucket_count;      // Power of two
+    uint32_t strtab_size;
+    uint32_t reserved;
+    uint64_t nodes_offset;
+    uint64_t edges_offset;
+    uint64_t index_offset;
+    uint64_t strtab_offset;
+    uint64_t file_size;
+} depindex_header_t;
+
+typedef struct depindex_node {
+    uint32_t name;              // String table offset
+    uint32_t hash;              // FNV-1a of the name
+    uint32_t installed;
+    uint32_t deps_start;        // Edge array ranges
+    uint32_t deps_count;
+    uint32_t dependents_start;
+    uint32_t dependents_count;
+    uint32_t reserved;
+} depindex_node_t;
+
+// Function declarations
+
+// Index lifecycle
+int depindex_open(void);
+void depindex_close(void);
+int depindex_rebuild(void);
+
+// Installed packages that depend on a package, or with transitive set
+// everything that does so indirectly too. Transitive results are ordered
+// so that each package comes before every package it depends on.
+int depindex_dependents(const char *package_name, int transitive, char ***dependents,
+                        int *count);
+
+// Incremental updates, with the dependencies the package was built with
+int depindex_add_package(const char *package_name, char **dependencies, int count);
+int depindex_remove_package(const char *package_name);
+
+#endif /* TINYPKG_DEPINDEX_H */
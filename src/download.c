@@ -1,17 +1,442 @@
 /*
  * TinyPkg - Download System Implementation
- * Simple HTTP/HTTPS download functionality using external tools
+ * HTTP/HTTPS downloads on a shared libcurl multi-handle engine
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <strings.h>
 #include <sys/stat.h>
+#include <curl/curl.h>
 #include "../include/tinypkg.h"
 
+// Download engine: one thread drives every transfer through a single multi
+// handle, so connections, DNS lookups and TLS sessions are reused and
+// HTTP/2 capable servers multiplex requests over one connection.
+typedef struct download_engine {
+    CURLM *multi;
+    CURLSH *share;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+    download_context_t *pending;    // Submitted, not yet added to multi
+    download_context_t *paused;     // Paused by a full sink (engine thread only)
+    int thread_started;
+    int stopping;
+} download_engine_t;
+
 // Global state
 static int download_initialized = 0;
+static int download_atfork_registered = 0;
+static download_engine_t g_engine;
+
+// Share interface locking
+static void engine_share_lock(CURL *handle, curl_lock_data data,
+                              curl_lock_access access, void *userptr) {
+    UNUSED(handle);
+    UNUSED(access);
+    UNUSED(userptr);
+    pthread_mutex_lock(&g_engine.share_locks[data]);
+}
+
+static void engine_share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+    UNUSED(handle);
+    UNUSED(userptr);
+    pthread_mutex_unlock(&g_engine.share_locks[data]);
+}
+
+// Transfer callbacks
+static size_t engine_write_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    download_context_t *ctx = (download_context_t *)userdata;
+    size_t bytes = size * nmemb;
+    
+    // Response bodies of uploads are not kept
+    if (ctx->mode == DOWNLOAD_MODE_UPLOAD) {
+        return bytes;
+    }
+    
+    // Check that the server honoured our Range request before writing
+    if (!ctx->checked_response) {
+        long code = 0;
+        curl_easy_getinfo((CURL *)ctx->handle, CURLINFO_RESPONSE_CODE, &code);
+        ctx->checked_response = 1;
+        
+        if (ctx->mode == DOWNLOAD_MODE_SEGMENT && code != 206) {
+            snprintf(ctx->error, sizeof(ctx->error),
+                     "server ignored range request (HTTP %ld)", code);
+            return 0;
+        }
+        
+        if (ctx->mode == DOWNLOAD_MODE_RESUME && ctx->resume_from > 0 && code == 200) {
+            // Full body instead of the remainder: start over
+            log_debug("Server does not support resume, restarting %s", ctx->url);
+            if (ftruncate(fileno(ctx->fp), 0) != 0) {
+                return 0;
+            }
+            rewind(ctx->fp);
+            ctx->resume_from = 0;
+            if (ctx->hash) {
+                security_hash_reset(ctx->hash);
+            }
+            if (ctx->sink) {
+                ctx->sink(ctx->sink_data, NULL, 0);
+                ctx->sink_offset = 0;
+            }
+        }
+    }
+    
+    if (ctx->mode == DOWNLOAD_MODE_SEGMENT) {
+        size_t written = 0;
+        while (written < bytes) {
+            ssize_t n = pwrite(ctx->fd, ptr + written, bytes - written,
+                               ctx->write_offset);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return 0;
+            }
+            written += (size_t)n;
+            ctx->write_offset += n;
+        }
+        return bytes;
+    }
+    
+    // A paused chunk is delivered again in full once resumed
+    if (!ctx->chunk_stored) {
+        if (fwrite(ptr, 1, bytes, ctx->fp) != bytes) {
+            return 0; // Abort transfer on write error
+        }
+        if (ctx->hash && security_hash_update(ctx->hash, ptr, bytes) != TINYPKG_SUCCESS) {
+            return 0;
+        }
+    }
+    if (ctx->sink) {
+        size_t n = ctx->sink(ctx->sink_data, ptr + ctx->chunk_sunk, bytes - ctx->chunk_sunk);
+        ctx->sink_offset += (off_t)n;
+        ctx->chunk_sunk += n;
+        if (ctx->chunk_sunk < bytes) {
+            // The extractor is behind; wait for it without blocking the
+            // other transfers
+            ctx->chunk_stored = 1;
+            if (!ctx->paused) {
+                ctx->paused = 1;
+                ctx->paused_next = g_engine.paused;
+                g_engine.paused = ctx;
+            }
+            return CURL_WRITEFUNC_PAUSE;
+        }
+    }
+    ctx->chunk_stored = 0;
+    ctx->chunk_sunk = 0;
+    return bytes;
+}
+
+// Offer paused transfers their data again. Called on the engine thread.
+static void engine_resume_paused(void) {
+    download_context_t *paused = g_engine.paused;
+    
+    g_engine.paused = NULL;
+    while (paused) {
+        download_context_t *next = paused->paused_next;
+        paused->paused_next = NULL;
+        paused->paused = 0;
+        // Delivers the chunk again, which may pause it once more
+        curl_easy_pause((CURL *)paused->handle, CURLPAUSE_CONT);
+        paused = next;
+    }
+}
+
+static void engine_unlink_paused(download_context_t *ctx) {
+    for (download_context_t **p = &g_engine.paused; *p; p = &(*p)->paused_next) {
+        if (*p == ctx) {
+            *p = ctx->paused_next;
+            break;
+        }
+    }
+    ctx->paused_next = NULL;
+    ctx->paused = 0;
+}
+
+// Bring the sink in line with the bytes already on disk before resuming
+static int engine_sync_sink(download_context_t *ctx) {
+    char buffer[64 * 1024];
+    
+    if (ctx->sink_offset == ctx->resume_from) {
+        return TINYPKG_SUCCESS;
+    }
+    
+    ctx->sink(ctx->sink_data, NULL, 0);
+    ctx->sink_offset = 0;
+    if (ctx->resume_from == 0) {
+        return TINYPKG_SUCCESS;
+    }
+    
+    FILE *fp = fopen(ctx->dest_path, "rb");
+    if (!fp) {
+        return TINYPKG_ERROR_FILE;
+    }
+    while (ctx->sink_offset < ctx->resume_from) {
+        size_t want = (size_t)MIN((off_t)sizeof(buffer), ctx->resume_from - ctx->sink_offset);
+        size_t n = fread(buffer, 1, want, fp);
+        if (n == 0) break;
+        // Not on the engine thread yet, so waiting for room is fine
+        for (size_t done = 0; done < n;) {
+            size_t taken = ctx->sink(ctx->sink_data, buffer + done, n - done);
+            if (taken == 0) {
+                usleep(DOWNLOAD_SINK_RETRY_MS * 1000);
+            }
+            done += taken;
+        }
+        ctx->sink_offset += (off_t)n;
+    }
+    fclose(fp);
+    
+    return ctx->sink_offset == ctx->resume_from ? TINYPKG_SUCCESS : TINYPKG_ERROR_FILE;
+}
+
+static size_t engine_header_callback(char *buffer, size_t size, size_t nitems, void *userdata) {
+    download_context_t *ctx = (download_context_t *)userdata;
+    size_t bytes = size * nitems;
+    
+    // A new status line starts the headers of the next (redirected) response
+    if (bytes >= 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+        ctx->accept_ranges = 0;
+    } else if (bytes > 14 && strncasecmp(buffer, "Accept-Ranges:", 14) == 0) {
+        ctx->accept_ranges = strstr(buffer + 14, "bytes") != NULL;
+    }
+    
+    return bytes;
+}
+
+static int engine_xferinfo_callback(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+                                    curl_off_t ultotal, curl_off_t ulnow) {
+    download_context_t *ctx = (download_context_t *)clientp;
+    time_t elapsed;
+    
+    ctx->status = DOWNLOAD_STATUS_DOWNLOADING;
+    // Report progress for the whole file, including resumed bytes
+    ctx->total_size = dltotal > 0 ? (size_t)(dltotal + ctx->resume_from) : 0;
+    ctx->downloaded_size = (size_t)(dlnow + ctx->resume_from);
+    
+    elapsed = time(NULL) - ctx->start_time;
+    ctx->speed = elapsed > 0 ? (double)dlnow / (double)elapsed : (double)dlnow;
+    
+    if (ctx->progress_callback) {
+        return ctx->progress_callback(ctx->progress_data, (double)ctx->total_size,
+                                      (double)ctx->downloaded_size,
+                                      (double)ultotal, (double)ulnow);
+    }
+    return 0;
+}
+
+// Configure an easy handle from config_t
+static CURL *engine_create_handle(download_context_t *ctx) {
+    CURL *curl = curl_easy_init();
+    if (!curl) return NULL;
+    
+    curl_easy_setopt(curl, CURLOPT_URL, ctx->url);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, ctx);
+    curl_easy_setopt(curl, CURLOPT_SHARE, g_engine.share);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, engine_write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, ctx);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, engine_xferinfo_callback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, ctx);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, ctx->error);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    
+    switch (ctx->mode) {
+        case DOWNLOAD_MODE_HEAD:
+            curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+            curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, engine_header_callback);
+            curl_easy_setopt(curl, CURLOPT_HEADERDATA, ctx);
+            break;
+        case DOWNLOAD_MODE_RESUME:
+            if (ctx->resume_from > 0) {
+                curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE,
+                                 (curl_off_t)ctx->resume_from);
+            }
+            break;
+        case DOWNLOAD_MODE_SEGMENT: {
+            char range[64];
+            snprintf(range, sizeof(range), "%lld-%lld",
+                     (long long)ctx->write_offset, (long long)ctx->range_end);
+            curl_easy_setopt(curl, CURLOPT_RANGE, range);
+            break;
+        }
+        case DOWNLOAD_MODE_UPLOAD:
+            curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+            curl_easy_setopt(curl, CURLOPT_READDATA, ctx->fp);
+            curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)ctx->total_size);
+            break;
+        default:
+            break;
+    }
+    
+    // Prefer HTTP/2 and wait for a multiplexable connection when possible
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    
+    if (global_config) {
+        long timeout = global_config->connection_timeout > 0 ?
+                       global_config->connection_timeout : 30;
+        
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
+        // Treat a stalled (or, if requested, slow) transfer as failed
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT,
+                         ctx->low_speed_limit > 0 ? ctx->low_speed_limit : 1L);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME,
+                         ctx->low_speed_time > 0 ? ctx->low_speed_time : timeout);
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, global_config->user_agent);
+        
+        if (strlen(global_config->proxy_url) > 0) {
+            curl_easy_setopt(curl, CURLOPT_PROXY, global_config->proxy_url);
+        }
+        
+        if (!global_config->verify_ssl) {
+            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+        }
+    }
+    
+    return curl;
+}
+
+// Classify a finished transfer. Called on the engine thread.
+static void engine_finish_transfer(CURL *curl, CURLcode code) {
+    download_context_t *ctx = NULL;
+    
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&ctx);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &ctx->http_code);
+    
+    curl_off_t first_byte = 0, speed = 0, total_time = 0, received = 0;
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+    curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total_time);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+    ctx->first_byte_time = (double)first_byte / 1000000.0;
+    ctx->transfer_speed = (double)speed;
+    
+    if (code == CURLE_OK && ctx->mode == DOWNLOAD_MODE_HEAD) {
+        curl_off_t length = -1;
+        curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        ctx->total_size = length > 0 ? (size_t)length : 0;
+    }
+    
+    if (ctx->paused) {
+        engine_unlink_paused(ctx);
+    }
+    curl_multi_remove_handle(g_engine.multi, curl);
+    curl_easy_cleanup(curl);
+    
+    if (ctx->fp) {
+        if (fclose(ctx->fp) != 0 && code == CURLE_OK) {
+            code = CURLE_WRITE_ERROR;
+        }
+        ctx->fp = NULL;
+    }
+    
+    // Range past the end of a resumed file: it is already complete
+    if (code == CURLE_HTTP_RETURNED_ERROR && ctx->http_code == 416 &&
+        ctx->mode == DOWNLOAD_MODE_RESUME && ctx->resume_from > 0) {
+        code = CURLE_OK;
+    }
+    
+    if (code == CURLE_OK) {
+        ctx->result = TINYPKG_SUCCESS;
+        ctx->retryable = 0;
+    } else {
+        if (strlen(ctx->error) == 0) {
+            strncpy(ctx->error, curl_easy_strerror(code), sizeof(ctx->error) - 1);
+        }
+        ctx->result = TINYPKG_ERROR_NETWORK;
+        // Retry transport failures and server-side errors, not 4xx
+        ctx->retryable = (code != CURLE_HTTP_RETURNED_ERROR ||
+                          ctx->http_code >= 500 || ctx->http_code == 429) &&
+                         code != CURLE_WRITE_ERROR &&
+                         code != CURLE_ABORTED_BY_CALLBACK &&
+                         code != CURLE_URL_MALFORMAT &&
+                         code != CURLE_UNSUPPORTED_PROTOCOL;
+    }
+    
+    // The transfer started total_time ago on the engine thread
+    int64_t end_us = metrics_now_us();
+    metrics_add(METRICS_DOWNLOADS, 1);
+    if (code != CURLE_OK) {
+        metrics_add(METRICS_DOWNLOAD_FAILURES, 1);
+    }
+    metrics_add(METRICS_DOWNLOAD_BYTES, received > 0 ? (uint64_t)received : 0);
+    metrics_observe(METRICS_DOWNLOAD_SECONDS, (double)total_time / 1000000.0);
+    if (first_byte > 0) {
+        metrics_observe(METRICS_DOWNLOAD_FIRST_BYTE_SECONDS, ctx->first_byte_time);
+    }
+    metrics_trace_span("download", ctx->mode == DOWNLOAD_MODE_HEAD ? "head" : "fetch",
+                       ctx->url, end_us - (int64_t)total_time, end_us);
+    
+    pthread_mutex_lock(&g_engine.lock);
+    ctx->handle = NULL;
+    ctx->done = 1;
+    pthread_cond_broadcast(&g_engine.cond);
+    pthread_mutex_unlock(&g_engine.lock);
+}
+
+// Engine thread main loop
+static void *engine_thread(void *arg) {
+    UNUSED(arg);
+    int running = 0;
+    
+    metrics_trace_thread_name("download engine");
+    
+    for (;;) {
+        download_context_t *pending;
+        
+        pthread_mutex_lock(&g_engine.lock);
+        if (g_engine.stopping && running == 0 && !g_engine.pending) {
+            pthread_mutex_unlock(&g_engine.lock);
+            break;
+        }
+        pending = g_engine.pending;
+        g_engine.pending = NULL;
+        pthread_mutex_unlock(&g_engine.lock);
+        
+        while (pending) {
+            download_context_t *next = pending->next;
+            pending->next = NULL;
+            curl_multi_add_handle(g_engine.multi, (CURL *)pending->handle);
+            pending = next;
+        }
+        
+        engine_resume_paused();
+        curl_multi_perform(g_engine.multi, &running);
+        
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(g_engine.multi, &queued))) {
+            if (msg->msg == CURLMSG_DONE) {
+                engine_finish_transfer(msg->easy_handle, msg->data.result);
+            }
+        }
+        
+        curl_multi_poll(g_engine.multi, NULL, 0,
+                        g_engine.paused ? DOWNLOAD_SINK_RETRY_MS : 1000, NULL);
+    }
+    
+    return NULL;
+}
+
+// A forked child (a daemon command) has no engine thread. It starts its
+// own on first use and leaves the handles it shares with the parent alone.
+static void download_atfork_child(void) {
+    download_initialized = 0;
+}
 
 // System initialization
 int download_init(void) {
@@ -19,37 +444,91 @@ int download_init(void) {
         return TINYPKG_SUCCESS;
     }
     
+    if (!download_atfork_registered) {
+        pthread_atfork(NULL, NULL, download_atfork_child);
+        download_atfork_registered = 1;
+    }
+    
     log_debug("Initializing download system");
     
-    // Check if wget or curl is available
-    int has_wget = (system("which wget >/dev/null 2>&1") == 0);
-    int has_curl = (system("which curl >/dev/null 2>&1") == 0);
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+        log_error("Failed to initialize libcurl");
+        return TINYPKG_ERROR;
+    }
+    
+    memset(&g_engine, 0, sizeof(g_engine));
+    pthread_mutex_init(&g_engine.lock, NULL);
+    pthread_cond_init(&g_engine.cond, NULL);
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&g_engine.share_locks[i], NULL);
+    }
     
-    if (!has_wget && !has_curl) {
-        log_error("Neither wget nor curl found. Please install one of them.");
+    g_engine.share = curl_share_init();
+    g_engine.multi = curl_multi_init();
+    if (!g_engine.share || !g_engine.multi) {
+        log_error("Failed to create download engine");
+        download_initialized = 1;
+        download_cleanup();
         return TINYPKG_ERROR;
     }
     
-    if (has_wget) {
-        log_debug("Using wget for downloads");
-    } else {
-        log_debug("Using curl for downloads");
+    curl_share_setopt(g_engine.share, CURLSHOPT_LOCKFUNC, engine_share_lock);
+    curl_share_setopt(g_engine.share, CURLSHOPT_UNLOCKFUNC, engine_share_unlock);
+    curl_share_setopt(g_engine.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(g_engine.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(g_engine.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    
+    curl_multi_setopt(g_engine.multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    if (global_config && global_config->max_concurrent_downloads > 0) {
+        curl_multi_setopt(g_engine.multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                          (long)global_config->max_concurrent_downloads);
     }
     
+    if (pthread_create(&g_engine.thread, NULL, engine_thread, NULL) != 0) {
+        log_error("Failed to start download engine thread");
+        download_initialized = 1;
+        download_cleanup();
+        return TINYPKG_ERROR;
+    }
+    
+    log_debug("Using %s", curl_version());
+    g_engine.thread_started = 1;
     download_initialized = 1;
     return TINYPKG_SUCCESS;
 }
 
 void download_cleanup(void) {
-    if (download_initialized) {
-        log_debug("Cleaning up download system");
-        download_initialized = 0;
+    if (!download_initialized) {
+        return;
     }
+    
+    log_debug("Cleaning up download system");
+    
+    // Stop the engine once in-flight transfers have finished
+    if (g_engine.thread_started) {
+        pthread_mutex_lock(&g_engine.lock);
+        g_engine.stopping = 1;
+        pthread_mutex_unlock(&g_engine.lock);
+        curl_multi_wakeup(g_engine.multi);
+        pthread_join(g_engine.thread, NULL);
+    }
+    
+    if (g_engine.multi) curl_multi_cleanup(g_engine.multi);
+    if (g_engine.share) curl_share_cleanup(g_engine.share);
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&g_engine.share_locks[i]);
+    }
+    pthread_mutex_destroy(&g_engine.lock);
+    pthread_cond_destroy(&g_engine.cond);
+    memset(&g_engine, 0, sizeof(g_engine));
+    
+    curl_global_cleanup();
+    download_initialized = 0;
 }
 
-// Basic download function
-int download_file(const char *url, const char *dest_path) {
-    if (!url || !dest_path) {
+// Asynchronous transfers
+int download_submit(download_context_t *ctx) {
+    if (!ctx) {
         return TINYPKG_ERROR;
     }
     
@@ -59,82 +538,578 @@ int download_file(const char *url, const char *dest_path) {
         }
     }
     
-    log_info("Downloading: %s", url);
-    log_debug("Destination: %s", dest_path);
-    
-    // Create destination directory if needed
-    char *dest_dir = utils_get_dirname(dest_path);
-    if (dest_dir) {
-        utils_create_directory_recursive(dest_dir);
-        TINYPKG_FREE(dest_dir);
-    }
-    
-    // Try wget first, then curl
-    char cmd[MAX_CMD];
-    int result;
-    
-    // Try wget
-    if (system("which wget >/dev/null 2>&1") == 0) {
-        snprintf(cmd, sizeof(cmd), 
-                 "wget --no-check-certificate --timeout=30 --tries=3 -O '%s' '%s'",
-                 dest_path, url);
+    ctx->fp = NULL;
+    if (ctx->mode == DOWNLOAD_MODE_FILE || ctx->mode == DOWNLOAD_MODE_RESUME) {
+        // Create destination directory if needed
+        char *dest_dir = utils_get_dirname(ctx->dest_path);
+        if (dest_dir) {
+            utils_create_directory_recursive(dest_dir);
+            TINYPKG_FREE(dest_dir);
+        }
         
-        log_debug("Download command: %s", cmd);
-        result = utils_run_command(cmd, NULL);
+        ctx->fp = fopen(ctx->dest_path, ctx->mode == DOWNLOAD_MODE_RESUME ? "ab" : "wb");
+        if (!ctx->fp) {
+            log_error("Failed to open %s for writing", ctx->dest_path);
+            return TINYPKG_ERROR_FILE;
+        }
+        ctx->resume_from = 0;
+        if (ctx->mode == DOWNLOAD_MODE_RESUME) {
+            fseeko(ctx->fp, 0, SEEK_END);
+            ctx->resume_from = ftello(ctx->fp);
+            if (ctx->resume_from > 0) {
+                log_info("Resuming %s at %lld bytes", ctx->url,
+                         (long long)ctx->resume_from);
+            }
+        }
         
-        if (result == TINYPKG_SUCCESS) {
-            log_info("Download completed successfully");
-            return TINYPKG_SUCCESS;
+        // Restart the streamed digest, covering any bytes already on disk
+        if (ctx->hash) {
+            if (security_hash_reset(ctx->hash) != TINYPKG_SUCCESS ||
+                (ctx->resume_from > 0 &&
+                 security_hash_update_file(ctx->hash, ctx->dest_path,
+                                           ctx->resume_from) != TINYPKG_SUCCESS)) {
+                log_error("Failed to hash partial download: %s", ctx->dest_path);
+                fclose(ctx->fp);
+                ctx->fp = NULL;
+                return TINYPKG_ERROR_FILE;
+            }
         }
+        
+        // Replay the partial file into the sink unless it already saw it
+        if (ctx->sink && engine_sync_sink(ctx) != TINYPKG_SUCCESS) {
+            log_error("Failed to replay partial download: %s", ctx->dest_path);
+            fclose(ctx->fp);
+            ctx->fp = NULL;
+            return TINYPKG_ERROR_FILE;
+        }
+    } else if (ctx->mode == DOWNLOAD_MODE_SEGMENT && ctx->fd < 0) {
+        return TINYPKG_ERROR;
     }
     
-    // Try curl as fallback
-    if (system("which curl >/dev/null 2>&1") == 0) {
-        snprintf(cmd, sizeof(cmd), 
-                 "curl -k --connect-timeout 30 --max-time 300 --retry 3 -L -o '%s' '%s'",
-                 dest_path, url);
-        
-        log_debug("Download command (fallback): %s", cmd);
-        result = utils_run_command(cmd, NULL);
-        
-        if (result == TINYPKG_SUCCESS) {
-            log_info("Download completed successfully");
-            return TINYPKG_SUCCESS;
+    size_t upload_size = 0;
+    if (ctx->mode == DOWNLOAD_MODE_UPLOAD) {
+        struct stat st;
+        ctx->fp = fopen(ctx->dest_path, "rb");
+        if (!ctx->fp || fstat(fileno(ctx->fp), &st) != 0) {
+            log_error("Failed to open %s for upload", ctx->dest_path);
+            if (ctx->fp) fclose(ctx->fp);
+            ctx->fp = NULL;
+            return TINYPKG_ERROR_FILE;
+        }
+        upload_size = (size_t)st.st_size;
+    }
+    
+    ctx->checked_response = 0;
+    ctx->chunk_stored = 0;
+    ctx->chunk_sunk = 0;
+    ctx->total_size = upload_size;
+    ctx->handle = engine_create_handle(ctx);
+    if (!ctx->handle) {
+        if (ctx->fp) {
+            fclose(ctx->fp);
+            ctx->fp = NULL;
         }
+        return TINYPKG_ERROR_NETWORK;
     }
     
-    log_error("Download failed: %s", url);
+    ctx->status = DOWNLOAD_STATUS_CONNECTING;
+    ctx->start_time = time(NULL);
+    ctx->total_size = upload_size;
+    ctx->downloaded_size = 0;
+    ctx->speed = 0;
+    ctx->http_code = 0;
+    ctx->error[0] = '\0';
+    ctx->attempts++;
+    
+    pthread_mutex_lock(&g_engine.lock);
+    ctx->done = 0;
+    ctx->next = g_engine.pending;
+    g_engine.pending = ctx;
+    pthread_mutex_unlock(&g_engine.lock);
     
-    // Remove partial file if it exists
-    if (utils_file_exists(dest_path)) {
-        unlink(dest_path);
+    curl_multi_wakeup(g_engine.multi);
+    return TINYPKG_SUCCESS;
+}
+
+int download_wait(download_context_t *ctx) {
+    if (!ctx) {
+        return TINYPKG_ERROR;
     }
     
-    return TINYPKG_ERROR_NETWORK;
+    pthread_mutex_lock(&g_engine.lock);
+    while (!ctx->done) {
+        pthread_cond_wait(&g_engine.cond, &g_engine.lock);
+    }
+    pthread_mutex_unlock(&g_engine.lock);
+    
+    ctx->status = (ctx->result == TINYPKG_SUCCESS) ?
+                  DOWNLOAD_STATUS_COMPLETE : DOWNLOAD_STATUS_FAILED;
+    return ctx->result;
+}
+
+// Basic download function
+int download_file(const char *url, const char *dest_path) {
+    return download_file_with_progress(url, dest_path, NULL, NULL);
 }
 
 // Download with progress callback
 int download_file_with_progress(const char *url, const char *dest_path,
                                download_progress_callback_t callback, void *data) {
-    // For this simple implementation, we'll just call the basic download
-    // and simulate progress. In a full implementation, this would use libcurl
-    // for real progress reporting.
+    if (!url || !dest_path) {
+        return TINYPKG_ERROR;
+    }
     
-    if (callback) {
-        callback(data, 0, 0, 0, 0); // Start
+    download_context_t *ctx = download_context_create(url, dest_path);
+    if (!ctx) {
+        return TINYPKG_ERROR_MEMORY;
     }
     
-    int result = download_file(url, dest_path);
+    ctx->progress_callback = callback;
+    ctx->progress_data = data;
     
-    if (callback) {
-        if (result == TINYPKG_SUCCESS) {
-            struct stat st;
-            if (stat(dest_path, &st) == 0) {
-                callback(data, st.st_size, st.st_size, 0, 0); // Complete
+    int result = download_execute(ctx);
+    download_context_free(ctx);
+    return result;
+}
+
+// Segment state sidecar: "<size> <count>" then "<start> <end> <offset>"
+// per segment, so an interrupted segmented download resumes where it was.
+static int segments_load_state(const char *state_path, size_t size,
+                               download_context_t **segments, int count) {
+    FILE *fp = fopen(state_path, "r");
+    if (!fp) return TINYPKG_ERROR;
+    
+    unsigned long long saved_size;
+    int saved_count;
+    int result = TINYPKG_ERROR;
+    
+    if (fscanf(fp, "%llu %d", &saved_size, &saved_count) == 2 &&
+        saved_size == (unsigned long long)size && saved_count == count) {
+        result = TINYPKG_SUCCESS;
+        for (int i = 0; i < count; i++) {
+            long long start, end, offset;
+            if (fscanf(fp, "%lld %lld %lld", &start, &end, &offset) != 3 ||
+                start != (long long)segments[i]->range_start ||
+                end != (long long)segments[i]->range_end ||
+                offset < start || offset > end + 1) {
+                result = TINYPKG_ERROR;
+                break;
+            }
+            segments[i]->write_offset = (off_t)offset;
+        }
+    }
+    
+    fclose(fp);
+    return result;
+}
+
+// Replaced atomically, so a crash while saving keeps the previous state
+static void segments_save_state(const char *state_path, size_t size,
+                                download_context_t **segments, int count) {
+    char temp_path[MAX_PATH];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", state_path) >=
+        (int)sizeof(temp_path)) {
+        return;
+    }
+    
+    FILE *fp = fopen(temp_path, "w");
+    if (!fp) return;
+    
+    fprintf(fp, "%llu %d\n", (unsigned long long)size, count);
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "%lld %lld %lld\n", (long long)segments[i]->range_start,
+                (long long)segments[i]->range_end,
+                (long long)segments[i]->write_offset);
+    }
+    if (fclose(fp) != 0 || rename(temp_path, state_path) != 0) {
+        unlink(temp_path);
+    }
+}
+
+// Progress of the segments of one download, checkpointed while they run
+typedef struct segments_progress {
+    const char *state_path;
+    size_t size;
+    download_context_t **segments;
+    int count;
+    off_t saved_bytes;          // Bytes written when the state was last saved
+    time_t saved_time;
+} segments_progress_t;
+
+static off_t segments_written(download_context_t **segments, int count) {
+    off_t written = 0;
+    for (int i = 0; i < count; i++) {
+        written += segments[i]->write_offset - segments[i]->range_start;
+    }
+    return written;
+}
+
+// Progress callback of every segment. Segments are written on the engine
+// thread that also calls this, so the offsets it saves are all on disk
+// (in the page cache: a power loss is caught by the checksum instead).
+static int segments_progress_callback(void *clientp, double dltotal, double dlnow,
+                                      double ultotal, double ulnow) {
+    segments_progress_t *progress = (segments_progress_t *)clientp;
+    UNUSED(dltotal);
+    UNUSED(dlnow);
+    UNUSED(ultotal);
+    UNUSED(ulnow);
+    
+    off_t written = segments_written(progress->segments, progress->count);
+    time_t now = time(NULL);
+    if (written - progress->saved_bytes >= SEGMENT_STATE_BYTES ||
+        (written > progress->saved_bytes &&
+         now - progress->saved_time >= SEGMENT_STATE_INTERVAL)) {
+        segments_save_state(progress->state_path, progress->size,
+                            progress->segments, progress->count);
+        progress->saved_bytes = written;
+        progress->saved_time = now;
+    }
+    return 0;
+}
+
+// Fetch a file as parallel byte-range segments into part_path
+static int download_segmented(const char *url, const char *part_path,
+                              size_t size, int count,
+                              const download_options_t *options) {
+    char state_path[MAX_PATH];
+    download_context_t **segments;
+    int max_retries = options->max_retries;
+    int result = TINYPKG_SUCCESS;
+    off_t chunk = (off_t)(size / (size_t)count);
+    
+    if (snprintf(state_path, sizeof(state_path), "%s.state", part_path) >=
+        (int)sizeof(state_path)) {
+        return TINYPKG_ERROR;
+    }
+    
+    segments = TINYPKG_CALLOC(count, sizeof(download_context_t *));
+    if (!segments) return TINYPKG_ERROR_MEMORY;
+    
+    int fd = open(part_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        log_error("Failed to open %s: %s", part_path, strerror(errno));
+        TINYPKG_FREE(segments);
+        return TINYPKG_ERROR_FILE;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        segments[i] = download_context_create(url, part_path);
+        if (!segments[i]) {
+            result = TINYPKG_ERROR_MEMORY;
+            count = i;
+            goto done;
+        }
+        segments[i]->mode = DOWNLOAD_MODE_SEGMENT;
+        segments[i]->fd = fd;
+        segments[i]->low_speed_limit = options->low_speed_limit;
+        segments[i]->low_speed_time = options->low_speed_time;
+        segments[i]->range_start = chunk * i;
+        segments[i]->range_end = (i == count - 1) ? (off_t)size - 1 : chunk * (i + 1) - 1;
+        segments[i]->write_offset = segments[i]->range_start;
+    }
+    
+    // Pick up where an earlier attempt stopped, otherwise start fresh
+    if (segments_load_state(state_path, size, segments, count) == TINYPKG_SUCCESS) {
+        log_info("Resuming segmented download of %s", url);
+    } else {
+        for (int i = 0; i < count; i++) {
+            segments[i]->write_offset = segments[i]->range_start;
+        }
+        if (ftruncate(fd, (off_t)size) != 0) {
+            result = TINYPKG_ERROR_FILE;
+            goto done;
+        }
+    }
+    segments_save_state(state_path, size, segments, count);
+    
+    segments_progress_t progress = {
+        .state_path = state_path, .size = size, .segments = segments, .count = count,
+        .saved_bytes = segments_written(segments, count), .saved_time = time(NULL)
+    };
+    for (int i = 0; i < count; i++) {
+        segments[i]->progress_callback = segments_progress_callback;
+        segments[i]->progress_data = &progress;
+    }
+    
+    log_info("Downloading %s in %d segments (%zu bytes)", url, count, size);
+    
+    for (int attempt = 0; attempt <= max_retries; attempt++) {
+        int failed = 0;
+        int retryable = 1;
+        
+        // Submit every unfinished segment, then wait for all of them
+        for (int i = 0; i < count; i++) {
+            if (segments[i]->write_offset <= segments[i]->range_end &&
+                download_submit(segments[i]) != TINYPKG_SUCCESS) {
+                segments[i]->done = 1;
+                segments[i]->result = TINYPKG_ERROR_NETWORK;
+                segments[i]->retryable = 0;
             }
         }
+        
+        for (int i = 0; i < count; i++) {
+            if (segments[i]->write_offset > segments[i]->range_end) continue;
+            if (download_wait(segments[i]) != TINYPKG_SUCCESS ||
+                segments[i]->write_offset <= segments[i]->range_end) {
+                log_warn("Segment %d of %s failed: %s", i, url, segments[i]->error);
+                failed++;
+                retryable &= segments[i]->retryable;
+            }
+        }
+        segments_save_state(state_path, size, segments, count);
+        progress.saved_bytes = segments_written(segments, count);
+        progress.saved_time = time(NULL);
+        
+        if (failed == 0) break;
+        if (!retryable || attempt == max_retries) {
+            result = TINYPKG_ERROR_NETWORK;
+            if (!retryable) {
+                // Not resumable as segments; let the caller start over
+                unlink(state_path);
+            }
+            goto done;
+        }
+        
+        int delay = MIN(1 << (attempt + 1), 30);
+        log_warn("Retrying %d segments in %d seconds", failed, delay);
+        sleep(delay);
+    }
+    
+done:
+    if (fsync(fd) != 0 && result == TINYPKG_SUCCESS) {
+        result = TINYPKG_ERROR_FILE;
+    }
+    close(fd);
+    for (int i = 0; i < count; i++) {
+        download_context_free(segments[i]);
+    }
+    TINYPKG_FREE(segments);
+    
+    if (result == TINYPKG_SUCCESS) {
+        unlink(state_path);
+    }
+    return result;
+}
+
+// Ask the server for the size and range support of a URL
+static int download_probe(const char *url, size_t *size, int *accept_ranges) {
+    download_context_t *ctx = download_context_create(url, "");
+    if (!ctx) return TINYPKG_ERROR_MEMORY;
+    
+    ctx->mode = DOWNLOAD_MODE_HEAD;
+    int result = download_submit(ctx);
+    if (result == TINYPKG_SUCCESS) {
+        result = download_wait(ctx);
+    }
+    
+    *size = ctx->total_size;
+    *accept_ranges = ctx->accept_ranges;
+    download_context_free(ctx);
+    return result;
+}
+
+// Fill in options left at their defaults from config_t
+static void download_resolve_options(const download_options_t *in,
+                                     download_options_t *out) {
+    out->max_retries = global_config ? global_config->max_retries : 3;
+    out->segments = global_config ? global_config->download_segments : 1;
+    out->low_speed_limit = 0;
+    out->low_speed_time = 0;
+    out->checksum = NULL;
+    out->sink = NULL;
+    out->sink_data = NULL;
+    
+    if (in) {
+        if (in->max_retries >= 0) out->max_retries = in->max_retries;
+        if (in->segments > 0) out->segments = in->segments;
+        out->low_speed_limit = in->low_speed_limit;
+        out->low_speed_time = in->low_speed_time;
+        out->checksum = in->checksum;
+        out->sink = in->sink;
+        out->sink_data = in->sink_data;
+    }
+}
+
+// Download into part_path, resuming an earlier partial download. Large
+// files from servers that support ranges are fetched in segments.
+// Single-stream downloads are hashed as they arrive and the digest is
+// returned in digest; it is left empty when the file must be hashed later.
+int download_fetch_part(const char *url, const char *part_path,
+                        const download_options_t *options,
+                        char *digest, size_t digest_size) {
+    char state_path[MAX_PATH];
+    download_options_t opts;
+    int result = TINYPKG_ERROR;
+    size_t min_size = global_config ?
+                      (size_t)global_config->segment_min_size * 1024 * 1024 : 0;
+    
+    if (!url || !part_path) {
+        return TINYPKG_ERROR;
+    }
+    
+    if (digest && digest_size > 0) {
+        digest[0] = '\0';
+    }
+    
+    if (snprintf(state_path, sizeof(state_path), "%s.state", part_path) >= (int)sizeof(state_path)) {
+        log_error("Download path too long: %s", part_path);
+        return TINYPKG_ERROR;
+    }
+    
+    download_resolve_options(options, &opts);
+    
+    int use_segments = 0;
+    size_t size = 0;
+    if (opts.segments > 1) {
+        int accept_ranges = 0;
+        use_segments = download_probe(url, &size, &accept_ranges) == TINYPKG_SUCCESS &&
+                       accept_ranges && size >= min_size && size >= (size_t)opts.segments;
+    }
+    
+    if (use_segments) {
+        result = download_segmented(url, part_path, size, opts.segments, &opts);
+        if (result != TINYPKG_SUCCESS && !utils_file_exists(state_path)) {
+            // Range requests not usable; fall back to a single stream
+            unlink(part_path);
+            use_segments = 0;
+        }
+    } else if (utils_file_exists(state_path)) {
+        // A preallocated segmented partial cannot be resumed as a stream
+        unlink(state_path);
+        unlink(part_path);
+    }
+    
+    // Single stream, resuming from an existing partial file
+    if (!use_segments) {
+        download_context_t *ctx = download_context_create(url, part_path);
+        if (!ctx) return TINYPKG_ERROR_MEMORY;
+        
+        ctx->mode = DOWNLOAD_MODE_RESUME;
+        ctx->max_retries = opts.max_retries;
+        ctx->low_speed_limit = opts.low_speed_limit;
+        ctx->low_speed_time = opts.low_speed_time;
+        ctx->sink = opts.sink;
+        ctx->sink_data = opts.sink_data;
+        ctx->sink_offset = -1;  // Unknown: the sink may have seen another source
+        if (digest && digest_size > 0) {
+            ctx->hash = security_hash_create(opts.checksum && strlen(opts.checksum) > 0 ?
+                                             security_detect_hash_type(opts.checksum) :
+                                             HASH_TYPE_SHA256);
+        }
+        result = download_execute(ctx);
+        if (result == TINYPKG_SUCCESS && ctx->hash &&
+            security_hash_final(ctx->hash, digest, digest_size) != TINYPKG_SUCCESS) {
+            digest[0] = '\0';
+        }
+        download_context_free(ctx);
+    }
+    
+    if (result != TINYPKG_SUCCESS) {
+        log_warn("Download incomplete: %s (partial data kept for resume)", url);
+    }
+    return result;
+}
+
+// Verify a completed partial download and rename it into place, recording
+// its digest in a "<dest>.<type>" sidecar for later cache verification. A
+// partial that fails verification is discarded so it is never resumed.
+// digest is the streamed digest from download_fetch_part (NULL or empty if
+// the file still has to be hashed).
+int download_promote(const char *part_path, const char *dest_path,
+                     const char *checksum, const char *digest) {
+    char state_path[MAX_PATH];
+    char sidecar_path[MAX_PATH];
+    char calculated[256];
+    int have_checksum = checksum && strlen(checksum) > 0;
+    hash_type_t type = have_checksum ? security_detect_hash_type(checksum) : HASH_TYPE_SHA256;
+    
+    if (!part_path || !dest_path) {
+        return TINYPKG_ERROR;
+    }
+    
+    snprintf(state_path, sizeof(state_path), "%s.state", part_path);
+    snprintf(sidecar_path, sizeof(sidecar_path), "%s.%s", dest_path,
+             security_hash_type_to_string(type));
+    
+    if (digest && strlen(digest) > 0) {
+        strncpy(calculated, digest, sizeof(calculated) - 1);
+        calculated[sizeof(calculated) - 1] = '\0';
+    } else if (security_calculate_checksum(part_path, calculated, sizeof(calculated),
+                                           type) != TINYPKG_SUCCESS) {
+        calculated[0] = '\0';
+    }
+    
+    if (have_checksum) {
+        if (calculated[0] == '\0' ||
+            security_verify_digest(dest_path, calculated, checksum) != TINYPKG_SUCCESS) {
+            log_error("Checksum mismatch for %s, discarding download", dest_path);
+            unlink(part_path);
+            unlink(state_path);
+            return TINYPKG_ERROR;
+        }
+    }
+    
+    if (rename(part_path, dest_path) != 0) {
+        log_error("Failed to move %s into place: %s", part_path, strerror(errno));
+        return TINYPKG_ERROR_FILE;
     }
     
+    if (calculated[0] != '\0') {
+        security_write_checksum_file(sidecar_path, dest_path, calculated);
+    }
+    
+    log_info("Download completed: %s", dest_path);
+    return TINYPKG_SUCCESS;
+}
+
+// Download to "<dest>.part", resuming earlier partial downloads, and only
+// rename it into place once the checksum (if given) matches
+int download_file_verified(const char *url, const char *dest_path,
+                           const char *checksum) {
+    download_options_t options = { .max_retries = -1, .checksum = checksum };
+    return download_file_with_options(url, dest_path, &options);
+}
+
+// As download_file_verified, with per-call transfer options
+int download_file_with_options(const char *url, const char *dest_path,
+                               const download_options_t *options) {
+    char part_path[MAX_PATH];
+    const char *checksum = options ? options->checksum : NULL;
+    
+    if (!url || !dest_path) {
+        return TINYPKG_ERROR;
+    }
+    
+    if (snprintf(part_path, sizeof(part_path), "%s.part", dest_path) >= (int)sizeof(part_path)) {
+        log_error("Download path too long: %s", dest_path);
+        return TINYPKG_ERROR;
+    }
+    
+    char digest[256];
+    int result = download_fetch_part(url, part_path, options, digest, sizeof(digest));
+    if (result != TINYPKG_SUCCESS) {
+        log_error("Download failed: %s", url);
+        return result;
+    }
+    
+    return download_promote(part_path, dest_path, checksum, digest);
+}
+
+// Upload a file with HTTP PUT, e.g. to a shared binary cache
+int download_upload_file(const char *url, const char *src_path) {
+    if (!url || !src_path) {
+        return TINYPKG_ERROR;
+    }
+    
+    download_context_t *ctx = download_context_create(url, src_path);
+    if (!ctx) {
+        return TINYPKG_ERROR_MEMORY;
+    }
+    
+    ctx->mode = DOWNLOAD_MODE_UPLOAD;
+    int result = download_execute(ctx);
+    download_context_free(ctx);
     return result;
 }
 
@@ -152,6 +1127,9 @@ download_context_t *download_context_create(const char *url, const char *dest_pa
     strncpy(ctx->url, url, sizeof(ctx->url) - 1);
     strncpy(ctx->dest_path, dest_path, sizeof(ctx->dest_path) - 1);
     ctx->status = DOWNLOAD_STATUS_INIT;
+    ctx->mode = DOWNLOAD_MODE_FILE;
+    ctx->fd = -1;
+    ctx->max_retries = -1;
     ctx->start_time = time(NULL);
     
     return ctx;
@@ -159,6 +1137,7 @@ download_context_t *download_context_create(const char *url, const char *dest_pa
 
 void download_context_free(download_context_t *ctx) {
     if (ctx) {
+        security_hash_free(ctx->hash);
         TINYPKG_FREE(ctx);
     }
 }
@@ -168,15 +1147,48 @@ int download_execute(download_context_t *ctx) {
         return TINYPKG_ERROR;
     }
     
-    ctx->status = DOWNLOAD_STATUS_CONNECTING;
+    int max_retries = ctx->max_retries >= 0 ? ctx->max_retries :
+                      (global_config ? global_config->max_retries : 3);
+    int result = TINYPKG_ERROR_NETWORK;
     
-    int result = download_file_with_progress(ctx->url, ctx->dest_path,
-                                           ctx->progress_callback, ctx->progress_data);
+    if (ctx->mode == DOWNLOAD_MODE_FILE || ctx->mode == DOWNLOAD_MODE_RESUME) {
+        log_info("Downloading: %s", ctx->url);
+        log_debug("Destination: %s", ctx->dest_path);
+    } else if (ctx->mode == DOWNLOAD_MODE_UPLOAD) {
+        log_info("Uploading: %s", ctx->url);
+    }
     
-    if (result == TINYPKG_SUCCESS) {
-        ctx->status = DOWNLOAD_STATUS_COMPLETE;
-    } else {
-        ctx->status = DOWNLOAD_STATUS_FAILED;
+    for (int attempt = 0; attempt <= max_retries; attempt++) {
+        if (attempt > 0) {
+            int delay = MIN(1 << attempt, 30);
+            log_warn("Retrying download in %d seconds (%d/%d): %s",
+                     delay, attempt, max_retries, ctx->url);
+            sleep(delay);
+        }
+        
+        result = download_submit(ctx);
+        if (result != TINYPKG_SUCCESS) {
+            break;
+        }
+        
+        result = download_wait(ctx);
+        if (result == TINYPKG_SUCCESS) {
+            log_debug("Transfer completed: %zu bytes in %lds",
+                      ctx->downloaded_size, (long)(time(NULL) - ctx->start_time));
+            return TINYPKG_SUCCESS;
+        }
+        
+        log_warn("Download failed: %s (%s)", ctx->url, ctx->error);
+        if (!ctx->retryable) {
+            break;
+        }
+    }
+    
+    log_error("Download failed: %s", ctx->url);
+    
+    // Remove partial file unless it can be resumed later
+    if (ctx->mode == DOWNLOAD_MODE_FILE && utils_file_exists(ctx->dest_path)) {
+        unlink(ctx->dest_path);
     }
     
     return result;
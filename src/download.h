@@ -6,8 +6,14 @@
 #ifndef TINYPKG_DOWNLOAD_H
 #define TINYPKG_DOWNLOAD_H
 
+#include <stdio.h>
 #include <sys/types.h>
 
+// Segmented downloads save their progress after this many new bytes, or
+// this many seconds, so a crash loses little of it
+#define SEGMENT_STATE_BYTES (4 * 1024 * 1024)
+#define SEGMENT_STATE_INTERVAL 2
+
 // Download status
 typedef enum {
     DOWNLOAD_STATUS_INIT = 0,
@@ -17,6 +23,37 @@ typedef enum {
     DOWNLOAD_STATUS_FAILED = -1
 } download_status_t;
 
+// Transfer modes
+typedef enum {
+    DOWNLOAD_MODE_FILE = 0,     // Whole body written to dest_path
+    DOWNLOAD_MODE_RESUME = 1,   // Appended to dest_path, resuming with Range
+    DOWNLOAD_MODE_SEGMENT = 2,  // Byte range written at its offset in fd
+    DOWNLOAD_MODE_HEAD = 3,     // Headers only (size and range support)
+    DOWNLOAD_MODE_UPLOAD = 4    // HTTP PUT of dest_path to url
+} download_mode_t;
+
+// Receives the body of single-stream downloads as it arrives; a NULL
+// buffer means the transfer restarted from byte 0. Runs on the engine
+// thread, so it must not block: it returns the bytes it took, and the
+// transfer is paused and the rest offered again when it takes fewer.
+typedef size_t (*download_sink_t)(void *data, const void *buf, size_t length);
+
+// How often a transfer paused by a full sink is offered its data again
+#define DOWNLOAD_SINK_RETRY_MS 10
+
+// Per-call transfer options (NULL means config_t defaults)
+typedef struct download_options {
+    int max_retries;            // -1: max_retries from config
+    int segments;               // 0: download_segments from config
+    long low_speed_limit;       // Abort below this many bytes/s (0: stall only)
+    long low_speed_time;        // ... for this many seconds (0: connection_timeout)
+    const char *checksum;       // Expected digest; selects the streamed hash type
+    download_sink_t sink;       // Optional body consumer (not for segmented downloads)
+    void *sink_data;
+} download_options_t;
+
+struct security_hash;
+
 // Download progress callback
 typedef int (*download_progress_callback_t)(void *clientp, double dltotal, double dlnow, 
                                            double ultotal, double ulnow);
@@ -32,6 +69,40 @@ typedef struct download_context {
     double speed;
     download_progress_callback_t progress_callback;
     void *progress_data;
+    
+    // Transfer mode and byte ranges
+    download_mode_t mode;
+    int fd;                     // Shared output for DOWNLOAD_MODE_SEGMENT
+    off_t range_start;
+    off_t range_end;            // Inclusive
+    off_t write_offset;         // Next byte to write (segments)
+    off_t resume_from;          // Bytes already present (resume)
+    int accept_ranges;          // Server advertised byte ranges (HEAD)
+    int checked_response;
+    int max_retries;            // -1: config max_retries
+    long low_speed_limit;
+    long low_speed_time;
+    double first_byte_time;     // Seconds to first byte of the last attempt
+    double transfer_speed;      // Bytes/s of the last attempt
+    struct security_hash *hash; // Fed with the body as it arrives (owned)
+    download_sink_t sink;       // Also fed with the body (FILE/RESUME modes)
+    void *sink_data;
+    off_t sink_offset;          // Bytes passed to sink since its last reset
+    int chunk_stored;           // Paused chunk is already on disk and hashed
+    size_t chunk_sunk;          // Bytes of the paused chunk the sink took
+    
+    // Engine state, owned by download.c while a transfer is in flight
+    void *handle;               // CURL easy handle
+    FILE *fp;
+    int done;
+    int result;                 // TINYPKG_* result of the last attempt
+    int retryable;
+    long http_code;
+    int attempts;
+    char error[256];
+    struct download_context *next;
+    struct download_context *paused_next;   // Waiting for the sink (engine thread)
+    int paused;
 } download_context_t;
 
 // Function declarations
@@ -44,12 +115,28 @@ void download_cleanup(void);
 int download_file(const char *url, const char *dest_path);
 int download_file_with_progress(const char *url, const char *dest_path,
                                download_progress_callback_t callback, void *data);
+int download_file_verified(const char *url, const char *dest_path,
+                           const char *checksum);
+int download_file_with_options(const char *url, const char *dest_path,
+                               const download_options_t *options);
+int download_upload_file(const char *url, const char *src_path);
+
+// Partial downloads: fetch into a .part file, then verify and promote it
+int download_fetch_part(const char *url, const char *part_path,
+                        const download_options_t *options,
+                        char *digest, size_t digest_size);
+int download_promote(const char *part_path, const char *dest_path,
+                     const char *checksum, const char *digest);
 
 // Download context management
 download_context_t *download_context_create(const char *url, const char *dest_path);
 void download_context_free(download_context_t *ctx);
 int download_execute(download_context_t *ctx);
 
+// Asynchronous transfers on the shared engine
+int download_submit(download_context_t *ctx);
+int download_wait(download_context_t *ctx);
+
 // Utility functions
 const char *download_status_to_string(download_status_t status);
 int download_verify_url(const char *url);
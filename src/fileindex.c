@@ -0,0 +1,1444 @@
+/*
+ * TinyPkg - File Ownership Index Implementation
+ * Memory-mapped path -> owning package index for all installed packages
+ */
+
+#include "../include/tinypkg.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#define FILEINDEX_NO_OWNER UINT32_MAX
+
+// Path recorded by the journal since the mapped file was written
+typedef struct fileindex_overlay_entry
+{
+    char *path;
+    uint32_t hash;
+    uint32_t owner;             // Overlay owner, FILEINDEX_NO_OWNER once dropped
+} fileindex_overlay_entry_t;
+
+// Journal records applied on top of the mapped file. Every package named
+// in a record replaces all of its mapped files, so the mapping's entries
+// of those owners are hidden. Each owner chains the entries it was ever
+// given, to drop them again without scanning the whole overlay.
+typedef struct fileindex_overlay
+{
+    fileindex_overlay_entry_t *entries;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *table;            // Entry number + 1
+    uint32_t buckets;
+
+    char **owners;
+    uint32_t *chains;           // First node per owner
+    uint32_t owner_count;
+    uint32_t owner_capacity;
+
+    uint32_t *node_entry;
+    uint32_t *node_next;
+    uint32_t node_count;
+    uint32_t node_capacity;
+
+    uint8_t *hidden;            // Per mapped owner slot
+} fileindex_overlay_t;
+
+// Mapped index plus its journal. Builds update it from worker threads, so
+// every access goes through the lock; processes sharing the files take
+// flock() on the journal to update them.
+typedef struct fileindex
+{
+    int opened;
+    void *map;
+    size_t map_size;
+    ino_t inode;                // Of the mapped file, to notice replacements
+    const fileindex_header_t *header;
+    const uint32_t *owners;
+    const fileindex_entry_t *entries;
+    const uint32_t *index;
+    const char *strtab;
+
+    int journal_fd;
+    off_t journal_end;          // Records up to here are in the overlay
+    uint32_t journal_paths;     // Paths those records carried
+    fileindex_overlay_t overlay;
+} fileindex_t;
+
+static fileindex_t g_fileindex = {.journal_fd = -1};
+static pthread_mutex_t g_fileindex_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// New index under construction. Strings are borrowed from the old mapping,
+// the overlay or the caller and must stay alive until
+// fileindex_builder_write().
+typedef struct fileindex_builder
+{
+    const char **paths;
+    uint32_t *path_owners;
+    uint32_t *hashes;
+    uint32_t count;
+    uint32_t capacity;
+
+    uint32_t *table;            // Entry number + 1, for duplicate detection
+    uint32_t table_capacity;
+
+    const char **owners;
+    uint32_t owner_count;
+    uint32_t owner_capacity;
+} fileindex_builder_t;
+
+static void fileindex_path(char *path, size_t size, const char *file)
+{
+    snprintf(path, size, "%s/%s", LIB_DIR, file);
+}
+
+// Mapped file
+static const char *fileindex_string(uint32_t offset)
+{
+    return offset < g_fileindex.header->strtab_size ? g_fileindex.strtab + offset
+                                                     : "";
+}
+
+static const char *fileindex_owner(uint32_t owner)
+{
+    return owner < g_fileindex.header->owner_count
+               ? fileindex_string(g_fileindex.owners[owner])
+               : "";
+}
+
+static const fileindex_entry_t *fileindex_find(const char *path, uint32_t hash)
+{
+    const fileindex_header_t *header = g_fileindex.header;
+
+    if (!header || header->path_count == 0)
+    {
+        return NULL;
+    }
+
+    uint32_t mask = header->bucket_count - 1;
+    for (uint32_t i = hash & mask, probes = 0; probes < header->bucket_count;
+         i = (i + 1) & mask, probes++)
+    {
+        uint32_t ref = g_fileindex.index[i];
+        if (ref == 0 || ref > header->path_count)
+        {
+            return NULL;
+        }
+
+        const fileindex_entry_t *entry = &g_fileindex.entries[ref - 1];
+        if (entry->hash == hash && TINYPKG_STREQ(fileindex_string(entry->path), path))
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void fileindex_unmap(void)
+{
+    if (g_fileindex.map)
+    {
+        munmap(g_fileindex.map, g_fileindex.map_size);
+    }
+    g_fileindex.map = NULL;
+    g_fileindex.map_size = 0;
+    g_fileindex.inode = 0;
+    g_fileindex.header = NULL;
+    g_fileindex.owners = NULL;
+    g_fileindex.entries = NULL;
+    g_fileindex.index = NULL;
+    g_fileindex.strtab = NULL;
+}
+
+static int fileindex_map(const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return errno == ENOENT ? TINYPKG_SUCCESS : TINYPKG_ERROR_FILE;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(fileindex_header_t))
+    {
+        close(fd);
+        log_error("File index is truncated: %s", path);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        log_error("Failed to map file index: %s", strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+
+    const fileindex_header_t *header = (const fileindex_header_t *)map;
+    uint64_t size = (uint64_t)st.st_size;
+
+    if (memcmp(header->magic, FILEINDEX_MAGIC, sizeof(FILEINDEX_MAGIC)) != 0 ||
+        header->version != FILEINDEX_FORMAT_VERSION || header->file_size != size ||
+        header->bucket_count == 0 ||
+        (header->bucket_count & (header->bucket_count - 1)) != 0 ||
+        header->bucket_count <= header->path_count ||
+        header->owners_offset + (uint64_t)header->owner_count * sizeof(uint32_t) > size ||
+        header->entries_offset + (uint64_t)header->path_count * sizeof(fileindex_entry_t) >
+            size ||
+        header->index_offset + (uint64_t)header->bucket_count * sizeof(uint32_t) > size ||
+        header->strtab_size == 0 ||
+        header->strtab_offset + header->strtab_size > size ||
+        ((const char *)map)[header->strtab_offset + header->strtab_size - 1] != '\0')
+    {
+        munmap(map, (size_t)st.st_size);
+        log_error("File index is corrupt: %s", path);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    const char *base = (const char *)map;
+    g_fileindex.map = map;
+    g_fileindex.map_size = (size_t)st.st_size;
+    g_fileindex.inode = st.st_ino;
+    g_fileindex.header = header;
+    g_fileindex.owners = (const uint32_t *)(base + header->owners_offset);
+    g_fileindex.entries = (const fileindex_entry_t *)(base + header->entries_offset);
+    g_fileindex.index = (const uint32_t *)(base + header->index_offset);
+    g_fileindex.strtab = base + header->strtab_offset;
+    return TINYPKG_SUCCESS;
+}
+
+// Overlay
+static void fileindex_overlay_clear(void)
+{
+    fileindex_overlay_t *overlay = &g_fileindex.overlay;
+
+    for (uint32_t i = 0; i < overlay->count; i++)
+    {
+        TINYPKG_FREE(overlay->entries[i].path);
+    }
+    for (uint32_t i = 0; i < overlay->owner_count; i++)
+    {
+        TINYPKG_FREE(overlay->owners[i]);
+    }
+    TINYPKG_FREE(overlay->entries);
+    TINYPKG_FREE(overlay->table);
+    TINYPKG_FREE(overlay->owners);
+    TINYPKG_FREE(overlay->chains);
+    TINYPKG_FREE(overlay->node_entry);
+    TINYPKG_FREE(overlay->node_next);
+    TINYPKG_FREE(overlay->hidden);
+    memset(overlay, 0, sizeof(*overlay));
+    g_fileindex.journal_paths = 0;
+}
+
+static fileindex_overlay_entry_t *fileindex_overlay_find(const char *path, uint32_t hash)
+{
+    const fileindex_overlay_t *overlay = &g_fileindex.overlay;
+
+    if (overlay->buckets == 0)
+    {
+        return NULL;
+    }
+
+    uint32_t mask = overlay->buckets - 1;
+    for (uint32_t i = hash & mask; overlay->table[i]; i = (i + 1) & mask)
+    {
+        fileindex_overlay_entry_t *entry = &overlay->entries[overlay->table[i] - 1];
+        if (entry->hash == hash && TINYPKG_STREQ(entry->path, path))
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Whether a mapped owner slot was replaced by the journal
+static int fileindex_hidden(uint32_t owner)
+{
+    const fileindex_overlay_t *overlay = &g_fileindex.overlay;
+    return overlay->hidden && owner < g_fileindex.header->owner_count &&
+           overlay->hidden[owner];
+}
+
+// Owner of a path in the mapped file with the journal applied, or NULL
+static const char *fileindex_view_owner(const char *path)
+{
+    uint32_t hash = utils_hash_string(path);
+
+    const fileindex_overlay_entry_t *change = fileindex_overlay_find(path, hash);
+    if (change)
+    {
+        return change->owner == FILEINDEX_NO_OWNER
+                   ? NULL
+                   : g_fileindex.overlay.owners[change->owner];
+    }
+
+    const fileindex_entry_t *entry = fileindex_find(path, hash);
+    return (entry && !fileindex_hidden(entry->owner)) ? fileindex_owner(entry->owner)
+                                                      : NULL;
+}
+
+static int fileindex_overlay_owner(const char *name, uint32_t *owner)
+{
+    fileindex_overlay_t *overlay = &g_fileindex.overlay;
+    const fileindex_header_t *header = g_fileindex.header;
+
+    for (uint32_t i = 0; i < overlay->owner_count; i++)
+    {
+        if (TINYPKG_STREQ(overlay->owners[i], name))
+        {
+            *owner = i;
+            return TINYPKG_SUCCESS;
+        }
+    }
+
+    if (overlay->owner_count == overlay->owner_capacity)
+    {
+        uint32_t capacity = overlay->owner_capacity ? overlay->owner_capacity * 2 : 16;
+        char **owners = TINYPKG_REALLOC(overlay->owners, capacity * sizeof(char *));
+        if (!owners)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        overlay->owners = owners;
+
+        uint32_t *chains = TINYPKG_REALLOC(overlay->chains, capacity * sizeof(uint32_t));
+        if (!chains)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        overlay->chains = chains;
+        overlay->owner_capacity = capacity;
+    }
+
+    if (header && header->owner_count > 0 && !overlay->hidden)
+    {
+        overlay->hidden = TINYPKG_CALLOC(header->owner_count, sizeof(uint8_t));
+        if (!overlay->hidden)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+    }
+
+    char *copy = TINYPKG_STRDUP(name);
+    if (!copy)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    for (uint32_t i = 0; header && i < header->owner_count; i++)
+    {
+        if (TINYPKG_STREQ(fileindex_owner(i), name))
+        {
+            overlay->hidden[i] = 1;
+            break;
+        }
+    }
+
+    overlay->owners[overlay->owner_count] = copy;
+    overlay->chains[overlay->owner_count] = FILEINDEX_NO_OWNER;
+    *owner = overlay->owner_count++;
+    return TINYPKG_SUCCESS;
+}
+
+static int fileindex_overlay_grow_table(fileindex_overlay_t *overlay)
+{
+    uint32_t buckets = overlay->buckets ? overlay->buckets * 2 : 1024;
+    uint32_t *table = TINYPKG_CALLOC(buckets, sizeof(uint32_t));
+    if (!table)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    for (uint32_t i = 0; i < overlay->count; i++)
+    {
+        uint32_t j = overlay->entries[i].hash & (buckets - 1);
+        while (table[j])
+        {
+            j = (j + 1) & (buckets - 1);
+        }
+        table[j] = i + 1;
+    }
+
+    TINYPKG_FREE(overlay->table);
+    overlay->table = table;
+    overlay->buckets = buckets;
+    return TINYPKG_SUCCESS;
+}
+
+// Give a path to an owner, taking it over from any other
+static int fileindex_overlay_set(const char *path, uint32_t owner)
+{
+    fileindex_overlay_t *overlay = &g_fileindex.overlay;
+    uint32_t hash = utils_hash_string(path);
+
+    fileindex_overlay_entry_t *entry = fileindex_overlay_find(path, hash);
+    if (!entry)
+    {
+        if ((overlay->count + 1) * 2 > overlay->buckets &&
+            fileindex_overlay_grow_table(overlay) != TINYPKG_SUCCESS)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        if (overlay->count == overlay->capacity)
+        {
+            uint32_t capacity = overlay->capacity ? overlay->capacity * 2 : 1024;
+            fileindex_overlay_entry_t *entries = TINYPKG_REALLOC(
+                overlay->entries, capacity * sizeof(fileindex_overlay_entry_t));
+            if (!entries)
+            {
+                return TINYPKG_ERROR_MEMORY;
+            }
+            overlay->entries = entries;
+            overlay->capacity = capacity;
+        }
+
+        char *copy = TINYPKG_STRDUP(path);
+        if (!copy)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+
+        uint32_t mask = overlay->buckets - 1;
+        uint32_t i = hash & mask;
+        while (overlay->table[i])
+        {
+            i = (i + 1) & mask;
+        }
+        entry = &overlay->entries[overlay->count];
+        entry->path = copy;
+        entry->hash = hash;
+        overlay->table[i] = ++overlay->count;
+    }
+
+    if (overlay->node_count == overlay->node_capacity)
+    {
+        uint32_t capacity = overlay->node_capacity ? overlay->node_capacity * 2 : 1024;
+        uint32_t *node_entry =
+            TINYPKG_REALLOC(overlay->node_entry, capacity * sizeof(uint32_t));
+        if (!node_entry)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        overlay->node_entry = node_entry;
+
+        uint32_t *node_next = TINYPKG_REALLOC(overlay->node_next, capacity * sizeof(uint32_t));
+        if (!node_next)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        overlay->node_next = node_next;
+        overlay->node_capacity = capacity;
+    }
+
+    entry->owner = owner;
+    overlay->node_entry[overlay->node_count] = (uint32_t)(entry - overlay->entries);
+    overlay->node_next[overlay->node_count] = overlay->chains[owner];
+    overlay->chains[owner] = overlay->node_count++;
+    return TINYPKG_SUCCESS;
+}
+
+// A package's files are replaced by paths (none: it was removed)
+static int fileindex_overlay_apply(const char *package_name, char **paths, uint32_t count)
+{
+    fileindex_overlay_t *overlay = &g_fileindex.overlay;
+    uint32_t owner;
+
+    if (fileindex_overlay_owner(package_name, &owner) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    // Entries since taken over by another package keep their new owner
+    for (uint32_t node = overlay->chains[owner]; node != FILEINDEX_NO_OWNER;
+         node = overlay->node_next[node])
+    {
+        fileindex_overlay_entry_t *entry = &overlay->entries[overlay->node_entry[node]];
+        if (entry->owner == owner)
+        {
+            entry->owner = FILEINDEX_NO_OWNER;
+        }
+    }
+    overlay->chains[owner] = FILEINDEX_NO_OWNER;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (paths[i] && fileindex_overlay_set(paths[i], owner) != TINYPKG_SUCCESS)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+    }
+    g_fileindex.journal_paths += MAX(count, 1);
+    return TINYPKG_SUCCESS;
+}
+
+// Journal
+static int fileindex_journal_open(void)
+{
+    char path[MAX_PATH];
+
+    if (g_fileindex.journal_fd >= 0)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    utils_create_directory_recursive(LIB_DIR);
+    fileindex_path(path, sizeof(path), FILEINDEX_JOURNAL_FILE);
+    g_fileindex.journal_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (g_fileindex.journal_fd < 0 && (errno == EACCES || errno == EROFS))
+    {
+        // Queries only; updates fail when they try to take the lock
+        g_fileindex.journal_fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (g_fileindex.journal_fd < 0 && errno == ENOENT)
+        {
+            return TINYPKG_SUCCESS;
+        }
+    }
+    if (g_fileindex.journal_fd < 0)
+    {
+        log_error("Failed to open file index journal %s: %s", path, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static int fileindex_journal_lock(int operation)
+{
+    if (g_fileindex.journal_fd < 0)
+    {
+        return TINYPKG_ERROR_FILE;
+    }
+    while (flock(g_fileindex.journal_fd, operation) != 0)
+    {
+        if (errno != EINTR)
+        {
+            log_error("Failed to lock file index journal: %s", strerror(errno));
+            return TINYPKG_ERROR_FILE;
+        }
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static void fileindex_journal_unlock(void)
+{
+    if (g_fileindex.journal_fd >= 0)
+    {
+        flock(g_fileindex.journal_fd, LOCK_UN);
+    }
+}
+
+static uint32_t fileindex_journal_checksum(const fileindex_journal_record_t *record,
+                                           const char *body)
+{
+    fileindex_journal_record_t copy = *record;
+    copy.checksum = 0;
+    return utils_hash_bytes(utils_hash_bytes(UTILS_FNV_SEED, &copy, sizeof(copy)), body,
+                            record->length);
+}
+
+static int fileindex_pread_full(int fd, void *buf, size_t length, off_t offset)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = pread(fd, (char *)buf + done, length - done, offset + (off_t)done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return TINYPKG_ERROR;
+        }
+        done += (size_t)n;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Apply one record body: the package name, then NUL-terminated paths
+static int fileindex_journal_apply(const fileindex_journal_record_t *record, char *body)
+{
+    char name[MAX_NAME];
+    char **paths = NULL;
+    int result;
+
+    memcpy(name, body, record->name_len);
+    name[record->name_len] = '\0';
+
+    if (record->path_count > 0)
+    {
+        paths = TINYPKG_MALLOC(record->path_count * sizeof(char *));
+        if (!paths)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+    }
+
+    char *p = body + record->name_len;
+    char *end = body + record->length;
+    for (uint32_t i = 0; i < record->path_count; i++)
+    {
+        char *nul = memchr(p, '\0', (size_t)(end - p));
+        if (!nul)
+        {
+            TINYPKG_FREE(paths);
+            return TINYPKG_ERROR;
+        }
+        paths[i] = p;
+        p = nul + 1;
+    }
+
+    result = (p == end) ? fileindex_overlay_apply(name, paths, record->path_count)
+                        : TINYPKG_ERROR;
+    TINYPKG_FREE(paths);
+    return result;
+}
+
+// Apply the records appended since journal_end. Stops at a torn record
+// (from a crash mid-append), which the next update cuts off.
+static int fileindex_journal_replay(void)
+{
+    fileindex_journal_record_t record;
+    int fd = g_fileindex.journal_fd;
+
+    if (fd < 0)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    while (fileindex_pread_full(fd, &record, sizeof(record), g_fileindex.journal_end) ==
+           TINYPKG_SUCCESS)
+    {
+        if (record.magic != FILEINDEX_JOURNAL_MAGIC || record.name_len == 0 ||
+            record.name_len >= MAX_NAME || record.length < record.name_len ||
+            record.length > FILEINDEX_JOURNAL_MAX_RECORD ||
+            (record.op == FILEINDEX_OP_REMOVE) != (record.path_count == 0) ||
+            (record.op != FILEINDEX_OP_ADD && record.op != FILEINDEX_OP_REMOVE))
+        {
+            break;
+        }
+
+        char *body = TINYPKG_MALLOC(MAX(record.length, 1));
+        if (!body)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        int result = fileindex_pread_full(fd, body, record.length,
+                                          g_fileindex.journal_end + (off_t)sizeof(record));
+        if (result == TINYPKG_SUCCESS &&
+            fileindex_journal_checksum(&record, body) == record.checksum)
+        {
+            result = fileindex_journal_apply(&record, body);
+        }
+        else
+        {
+            result = TINYPKG_ERROR;
+        }
+        TINYPKG_FREE(body);
+
+        if (result == TINYPKG_ERROR_MEMORY)
+        {
+            return result;
+        }
+        if (result != TINYPKG_SUCCESS)
+        {
+            break;
+        }
+        g_fileindex.journal_end += (off_t)sizeof(record) + record.length;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static int fileindex_write_full(int fd, const void *buf, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = write(fd, (const char *)buf + done, length - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return TINYPKG_ERROR_FILE;
+        }
+        done += (size_t)n;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Append a record. Called with the journal locked and journal_end at its
+// end; paths may contain NULLs, which are skipped.
+static int fileindex_journal_append(fileindex_op_t op, const char *package_name,
+                                    char **paths, int count)
+{
+    fileindex_journal_record_t record;
+    size_t name_len = strlen(package_name);
+    size_t length = name_len;
+
+    memset(&record, 0, sizeof(record));
+    for (int i = 0; i < count; i++)
+    {
+        if (paths[i])
+        {
+            length += strlen(paths[i]) + 1;
+            record.path_count++;
+        }
+    }
+    if (name_len == 0 || name_len >= MAX_NAME || length > FILEINDEX_JOURNAL_MAX_RECORD)
+    {
+        log_error("Cannot journal file index update for %s", package_name);
+        return TINYPKG_ERROR;
+    }
+    // An add without files is a remove
+    op = record.path_count > 0 ? op : FILEINDEX_OP_REMOVE;
+
+    char *buffer = TINYPKG_MALLOC(sizeof(record) + length);
+    if (!buffer)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    char *body = buffer + sizeof(record);
+    memcpy(body, package_name, name_len);
+    size_t offset = name_len;
+    for (int i = 0; i < count; i++)
+    {
+        if (paths[i])
+        {
+            size_t path_len = strlen(paths[i]) + 1;
+            memcpy(body + offset, paths[i], path_len);
+            offset += path_len;
+        }
+    }
+
+    record.magic = FILEINDEX_JOURNAL_MAGIC;
+    record.op = (uint16_t)op;
+    record.name_len = (uint16_t)name_len;
+    record.length = (uint32_t)length;
+    record.checksum = fileindex_journal_checksum(&record, body);
+    memcpy(buffer, &record, sizeof(record));
+
+    int result = TINYPKG_SUCCESS;
+    if (fileindex_write_full(g_fileindex.journal_fd, buffer, sizeof(record) + length) !=
+            TINYPKG_SUCCESS ||
+        fdatasync(g_fileindex.journal_fd) != 0)
+    {
+        log_error("Failed to append to file index journal: %s", strerror(errno));
+        if (ftruncate(g_fileindex.journal_fd, g_fileindex.journal_end) != 0)
+        {
+            log_warn("Failed to truncate file index journal: %s", strerror(errno));
+        }
+        result = TINYPKG_ERROR_FILE;
+    }
+    else
+    {
+        g_fileindex.journal_end += (off_t)(sizeof(record) + length);
+    }
+
+    TINYPKG_FREE(buffer);
+    return result;
+}
+
+// Builder
+static void fileindex_builder_free(fileindex_builder_t *builder)
+{
+    TINYPKG_FREE(builder->paths);
+    TINYPKG_FREE(builder->path_owners);
+    TINYPKG_FREE(builder->hashes);
+    TINYPKG_FREE(builder->table);
+    TINYPKG_FREE(builder->owners);
+}
+
+static int fileindex_builder_grow_table(fileindex_builder_t *builder)
+{
+    uint32_t capacity = builder->table_capacity ? builder->table_capacity * 2 : 1024;
+    uint32_t *table = TINYPKG_CALLOC(capacity, sizeof(uint32_t));
+    if (!table)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    for (uint32_t i = 0; i < builder->count; i++)
+    {
+        uint32_t j = builder->hashes[i] & (capacity - 1);
+        while (table[j])
+        {
+            j = (j + 1) & (capacity - 1);
+        }
+        table[j] = i + 1;
+    }
+
+    TINYPKG_FREE(builder->table);
+    builder->table = table;
+    builder->table_capacity = capacity;
+    return TINYPKG_SUCCESS;
+}
+
+static int fileindex_builder_owner(fileindex_builder_t *builder, const char *name,
+                                   uint32_t *owner)
+{
+    for (uint32_t i = 0; i < builder->owner_count; i++)
+    {
+        if (TINYPKG_STREQ(builder->owners[i], name))
+        {
+            *owner = i;
+            return TINYPKG_SUCCESS;
+        }
+    }
+
+    if (builder->owner_count == builder->owner_capacity)
+    {
+        uint32_t capacity = builder->owner_capacity ? builder->owner_capacity * 2 : 64;
+        const char **owners =
+            TINYPKG_REALLOC(builder->owners, capacity * sizeof(const char *));
+        if (!owners)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        builder->owners = owners;
+        builder->owner_capacity = capacity;
+    }
+
+    builder->owners[builder->owner_count] = name;
+    *owner = builder->owner_count++;
+    return TINYPKG_SUCCESS;
+}
+
+// Add a path unless an earlier add already claimed it
+static int fileindex_builder_add(fileindex_builder_t *builder, const char *path,
+                                 uint32_t owner)
+{
+    if ((builder->count + 1) * 2 > builder->table_capacity &&
+        fileindex_builder_grow_table(builder) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    uint32_t hash = utils_hash_string(path);
+    uint32_t mask = builder->table_capacity - 1;
+    uint32_t i = hash & mask;
+    while (builder->table[i])
+    {
+        uint32_t ref = builder->table[i] - 1;
+        if (builder->hashes[ref] == hash && TINYPKG_STREQ(builder->paths[ref], path))
+        {
+            return TINYPKG_SUCCESS;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (builder->count == builder->capacity)
+    {
+        uint32_t capacity = builder->capacity ? builder->capacity * 2 : 1024;
+        const char **paths = TINYPKG_REALLOC(builder->paths, capacity * sizeof(char *));
+        if (!paths)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        builder->paths = paths;
+
+        uint32_t *owners = TINYPKG_REALLOC(builder->path_owners, capacity * sizeof(uint32_t));
+        if (!owners)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        builder->path_owners = owners;
+
+        uint32_t *hashes = TINYPKG_REALLOC(builder->hashes, capacity * sizeof(uint32_t));
+        if (!hashes)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        builder->hashes = hashes;
+        builder->capacity = capacity;
+    }
+
+    builder->paths[builder->count] = path;
+    builder->path_owners[builder->count] = owner;
+    builder->hashes[builder->count] = hash;
+    builder->table[i] = ++builder->count;
+    return TINYPKG_SUCCESS;
+}
+
+static int fileindex_builder_add_package(fileindex_builder_t *builder,
+                                         const char *package_name, char **paths,
+                                         int count)
+{
+    uint32_t owner;
+
+    if (fileindex_builder_owner(builder, package_name, &owner) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (paths[i] && fileindex_builder_add(builder, paths[i], owner) != TINYPKG_SUCCESS)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Carry over the mapped index with the journal applied
+static int fileindex_builder_add_view(fileindex_builder_t *builder)
+{
+    const fileindex_overlay_t *overlay = &g_fileindex.overlay;
+    const fileindex_header_t *header = g_fileindex.header;
+    uint32_t *owner_map;
+    uint32_t slots = MAX(overlay->owner_count, header ? header->owner_count : 0);
+
+    // Old owner slot -> new owner slot
+    owner_map = TINYPKG_MALLOC((slots + 1) * sizeof(uint32_t));
+    if (!owner_map)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    int result = TINYPKG_SUCCESS;
+    for (uint32_t i = 0; i < overlay->owner_count && result == TINYPKG_SUCCESS; i++)
+    {
+        result = fileindex_builder_owner(builder, overlay->owners[i], &owner_map[i]);
+    }
+
+    // Journaled paths first, so they win over the mapped entries
+    for (uint32_t i = 0; i < overlay->count && result == TINYPKG_SUCCESS; i++)
+    {
+        const fileindex_overlay_entry_t *entry = &overlay->entries[i];
+        if (entry->owner != FILEINDEX_NO_OWNER)
+        {
+            result = fileindex_builder_add(builder, entry->path, owner_map[entry->owner]);
+        }
+    }
+
+    for (uint32_t i = 0; header && i < header->owner_count && result == TINYPKG_SUCCESS; i++)
+    {
+        owner_map[i] = FILEINDEX_NO_OWNER;
+        if (!fileindex_hidden(i))
+        {
+            result = fileindex_builder_owner(builder, fileindex_owner(i), &owner_map[i]);
+        }
+    }
+
+    for (uint32_t i = 0; header && i < header->path_count && result == TINYPKG_SUCCESS; i++)
+    {
+        const fileindex_entry_t *entry = &g_fileindex.entries[i];
+        const char *path = fileindex_string(entry->path);
+        if (entry->owner < header->owner_count &&
+            owner_map[entry->owner] != FILEINDEX_NO_OWNER &&
+            !fileindex_overlay_find(path, entry->hash))
+        {
+            result = fileindex_builder_add(builder, path, owner_map[entry->owner]);
+        }
+    }
+
+    TINYPKG_FREE(owner_map);
+    return result;
+}
+
+// Serialize the builder to a temp file, swap it in and map it
+static int fileindex_builder_write(fileindex_builder_t *builder)
+{
+    char path[MAX_PATH];
+    char temp_path[MAX_PATH];
+    fileindex_header_t header;
+    uint32_t *owner_offsets = NULL;
+    fileindex_entry_t *entries = NULL;
+    uint32_t *index = NULL;
+    char *strtab = NULL;
+    size_t strtab_size = 1;     // Offset 0 is the empty string
+    int result = TINYPKG_ERROR_MEMORY;
+
+    uint32_t buckets = 16;
+    while (buckets < builder->count * 2)
+    {
+        buckets *= 2;
+    }
+
+    for (uint32_t i = 0; i < builder->owner_count; i++)
+    {
+        strtab_size += strlen(builder->owners[i]) + 1;
+    }
+    for (uint32_t i = 0; i < builder->count; i++)
+    {
+        strtab_size += strlen(builder->paths[i]) + 1;
+    }
+    if (strtab_size > UINT32_MAX)
+    {
+        log_error("File index too large");
+        return TINYPKG_ERROR;
+    }
+
+    owner_offsets = TINYPKG_CALLOC(builder->owner_count + 1, sizeof(uint32_t));
+    entries = TINYPKG_CALLOC(builder->count + 1, sizeof(fileindex_entry_t));
+    index = TINYPKG_CALLOC(buckets, sizeof(uint32_t));
+    strtab = TINYPKG_MALLOC(strtab_size);
+    if (!owner_offsets || !entries || !index || !strtab)
+    {
+        goto out;
+    }
+
+    size_t offset = 0;
+    strtab[offset++] = '\0';
+    for (uint32_t i = 0; i < builder->owner_count; i++)
+    {
+        size_t length = strlen(builder->owners[i]) + 1;
+        memcpy(strtab + offset, builder->owners[i], length);
+        owner_offsets[i] = (uint32_t)offset;
+        offset += length;
+    }
+
+    for (uint32_t i = 0; i < builder->count; i++)
+    {
+        size_t length = strlen(builder->paths[i]) + 1;
+        memcpy(strtab + offset, builder->paths[i], length);
+        entries[i].path = (uint32_t)offset;
+        entries[i].owner = builder->path_owners[i];
+        entries[i].hash = builder->hashes[i];
+        offset += length;
+
+        uint32_t j = entries[i].hash & (buckets - 1);
+        while (index[j])
+        {
+            j = (j + 1) & (buckets - 1);
+        }
+        index[j] = i + 1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FILEINDEX_MAGIC, sizeof(FILEINDEX_MAGIC));
+    header.version = FILEINDEX_FORMAT_VERSION;
+    header.path_count = builder->count;
+    header.owner_count = builder->owner_count;
+    header.bucket_count = buckets;
+    header.strtab_size = (uint32_t)strtab_size;
+    header.owners_offset = sizeof(header);
+    header.entries_offset =
+        header.owners_offset + (uint64_t)builder->owner_count * sizeof(uint32_t);
+    header.index_offset =
+        header.entries_offset + (uint64_t)builder->count * sizeof(fileindex_entry_t);
+    header.strtab_offset = header.index_offset + (uint64_t)buckets * sizeof(uint32_t);
+    header.file_size = header.strtab_offset + strtab_size;
+
+    utils_create_directory_recursive(LIB_DIR);
+    fileindex_path(path, sizeof(path), FILEINDEX_FILE);
+    result = TINYPKG_ERROR_FILE;
+    if ((size_t)snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= sizeof(temp_path))
+    {
+        log_error("File index path too long: %s", path);
+        goto out;
+    }
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        log_error("Failed to open file index for writing: %s", temp_path);
+        goto out;
+    }
+
+    if (fileindex_write_full(fd, &header, sizeof(header)) != TINYPKG_SUCCESS ||
+        fileindex_write_full(fd, owner_offsets,
+                             (size_t)builder->owner_count * sizeof(uint32_t)) !=
+            TINYPKG_SUCCESS ||
+        fileindex_write_full(fd, entries,
+                             (size_t)builder->count * sizeof(fileindex_entry_t)) !=
+            TINYPKG_SUCCESS ||
+        fileindex_write_full(fd, index, (size_t)buckets * sizeof(uint32_t)) !=
+            TINYPKG_SUCCESS ||
+        fileindex_write_full(fd, strtab, strtab_size) != TINYPKG_SUCCESS ||
+        fsync(fd) != 0)
+    {
+        log_error("Failed to write file index: %s", strerror(errno));
+        close(fd);
+        unlink(temp_path);
+        goto out;
+    }
+    close(fd);
+
+    if (rename(temp_path, path) != 0)
+    {
+        log_error("Failed to replace file index: %s", strerror(errno));
+        unlink(temp_path);
+        goto out;
+    }
+
+    // The builder may borrow strings from the old mapping; swap last
+    fileindex_unmap();
+    result = fileindex_map(path);
+    g_fileindex.opened = (result == TINYPKG_SUCCESS);
+
+out:
+    TINYPKG_FREE(owner_offsets);
+    TINYPKG_FREE(entries);
+    TINYPKG_FREE(index);
+    TINYPKG_FREE(strtab);
+    return result;
+}
+
+// Start the journal over once the mapped file holds everything. Called
+// with the journal locked exclusively.
+static void fileindex_journal_reset(void)
+{
+    fileindex_overlay_clear();
+    if (g_fileindex.journal_fd >= 0 && ftruncate(g_fileindex.journal_fd, 0) != 0)
+    {
+        // Replaying the records again over the new file is harmless
+        log_warn("Failed to truncate file index journal: %s", strerror(errno));
+    }
+    g_fileindex.journal_end = 0;
+}
+
+// Build the index from every installed package's file list. Called with
+// the lock held and the journal locked exclusively.
+static int fileindex_rebuild_locked(void)
+{
+    fileindex_builder_t builder = {0};
+    char ***lists = NULL;
+    int *counts = NULL;
+    int package_count = 0;
+    int result = TINYPKG_SUCCESS;
+
+    for (package_db_entry_t *entry = package_db_get_all(); entry; entry = entry->next)
+    {
+        package_count++;
+    }
+
+    if (package_count > 0)
+    {
+        lists = TINYPKG_CALLOC(package_count, sizeof(char **));
+        counts = TINYPKG_CALLOC(package_count, sizeof(int));
+        if (!lists || !counts)
+        {
+            TINYPKG_FREE(lists);
+            TINYPKG_FREE(counts);
+            return TINYPKG_ERROR_MEMORY;
+        }
+    }
+
+    int i = 0;
+    for (package_db_entry_t *entry = package_db_get_all();
+         entry && i < package_count && result == TINYPKG_SUCCESS; entry = entry->next, i++)
+    {
+        lists[i] = package_get_file_list(entry->name, &counts[i]);
+        if (lists[i])
+        {
+            result = fileindex_builder_add_package(&builder, entry->name, lists[i],
+                                                   counts[i]);
+        }
+    }
+
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = fileindex_builder_write(&builder);
+        if (result == TINYPKG_SUCCESS)
+        {
+            fileindex_journal_reset();
+            log_info("Indexed %u files from %d installed packages", builder.count,
+                     package_count);
+        }
+    }
+
+    for (i = 0; i < package_count; i++)
+    {
+        utils_string_array_free(lists[i], counts[i]);
+    }
+    TINYPKG_FREE(lists);
+    TINYPKG_FREE(counts);
+    fileindex_builder_free(&builder);
+    return result;
+}
+
+// Fold the journal into a new mapped file once replaying it costs about
+// as much as rewriting the index. Called with the journal locked
+// exclusively.
+static int fileindex_maybe_compact(void)
+{
+    fileindex_builder_t builder = {0};
+    uint32_t mapped = g_fileindex.header ? g_fileindex.header->path_count : 0;
+
+    if (g_fileindex.journal_paths < MAX(FILEINDEX_COMPACT_MIN_PATHS, mapped / 2))
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    // The builder borrows overlay strings; clear it only once written
+    int result = fileindex_builder_add_view(&builder);
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = fileindex_builder_write(&builder);
+    }
+    fileindex_builder_free(&builder);
+
+    if (result != TINYPKG_SUCCESS)
+    {
+        // The journal still holds every update; the next one retries
+        log_warn("Failed to compact file index journal");
+        return TINYPKG_SUCCESS;
+    }
+
+    fileindex_journal_reset();
+    log_debug("Compacted file index journal into %s", FILEINDEX_FILE);
+    return TINYPKG_SUCCESS;
+}
+
+// Bring the mapping and overlay up to date with what other processes
+// wrote. Called with the lock held and the journal locked (exclusively
+// if exclusive is set, which also allows the index to be rebuilt).
+static int fileindex_refresh_locked(int exclusive)
+{
+    char path[MAX_PATH];
+    struct stat index_st;
+    struct stat journal_st;
+
+    fileindex_path(path, sizeof(path), FILEINDEX_FILE);
+    int present = stat(path, &index_st) == 0;
+    off_t journal_size = 0;
+    if (g_fileindex.journal_fd >= 0 && fstat(g_fileindex.journal_fd, &journal_st) == 0)
+    {
+        journal_size = journal_st.st_size;
+    }
+
+    // A rewritten index (compaction or rebuild) truncated the journal
+    if (!g_fileindex.opened || !present || index_st.st_ino != g_fileindex.inode ||
+        journal_size < g_fileindex.journal_end)
+    {
+        fileindex_overlay_clear();
+        fileindex_unmap();
+        g_fileindex.opened = 0;
+        g_fileindex.journal_end = 0;
+
+        if (!present)
+        {
+            // First run with an index: build it from the .files lists
+            return exclusive ? fileindex_rebuild_locked() : TINYPKG_ERROR_FILE;
+        }
+
+        int result = fileindex_map(path);
+        if (result != TINYPKG_SUCCESS)
+        {
+            return result;
+        }
+        g_fileindex.opened = 1;
+    }
+
+    int result = fileindex_journal_replay();
+    if (result != TINYPKG_SUCCESS)
+    {
+        fileindex_overlay_clear();
+        fileindex_unmap();
+        g_fileindex.opened = 0;
+        return result;
+    }
+
+    // Drop a record torn by a crash before appending after it
+    if (exclusive && journal_size > g_fileindex.journal_end &&
+        ftruncate(g_fileindex.journal_fd, g_fileindex.journal_end) != 0)
+    {
+        log_error("Failed to truncate file index journal: %s", strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Map the index and replay its journal. Queries load once; processes
+// that update it reopen through the daemon's freshness checks.
+static int fileindex_open_locked(void)
+{
+    char path[MAX_PATH];
+
+    if (g_fileindex.opened)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    int result = fileindex_journal_open();
+    if (result != TINYPKG_SUCCESS)
+    {
+        return result;
+    }
+
+    // Only the first run needs to write
+    fileindex_path(path, sizeof(path), FILEINDEX_FILE);
+    int exclusive = !utils_file_exists(path);
+    if (g_fileindex.journal_fd < 0)
+    {
+        // Nothing journaled yet and no way to journal; the file alone is it
+        return exclusive ? fileindex_rebuild_locked() : fileindex_refresh_locked(0);
+    }
+
+    result = fileindex_journal_lock(exclusive ? LOCK_EX : LOCK_SH);
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = fileindex_refresh_locked(exclusive);
+        fileindex_journal_unlock();
+    }
+    return result;
+}
+
+// Journal one update, replacing the package's files by paths (count 0:
+// removing it). Paths already owned by another package are taken over
+// (a forced install overwrote them).
+static int fileindex_update(fileindex_op_t op, const char *package_name, char **paths,
+                            int count)
+{
+    pthread_mutex_lock(&g_fileindex_lock);
+    int result = fileindex_journal_open();
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = fileindex_journal_lock(LOCK_EX);
+    }
+    if (result != TINYPKG_SUCCESS)
+    {
+        pthread_mutex_unlock(&g_fileindex_lock);
+        return result;
+    }
+
+    result = fileindex_refresh_locked(1);
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = fileindex_journal_append(op, package_name, paths, count);
+    }
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = fileindex_overlay_apply(package_name, paths, (uint32_t)count);
+        if (result != TINYPKG_SUCCESS)
+        {
+            // The record is durable; replay it from scratch on next use
+            fileindex_overlay_clear();
+            fileindex_unmap();
+            g_fileindex.opened = 0;
+            g_fileindex.journal_end = 0;
+        }
+    }
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = fileindex_maybe_compact();
+    }
+
+    fileindex_journal_unlock();
+    pthread_mutex_unlock(&g_fileindex_lock);
+    return result;
+}
+
+// Index lifecycle
+int fileindex_open(void)
+{
+    pthread_mutex_lock(&g_fileindex_lock);
+    int result = fileindex_open_locked();
+    pthread_mutex_unlock(&g_fileindex_lock);
+    return result;
+}
+
+void fileindex_close(void)
+{
+    pthread_mutex_lock(&g_fileindex_lock);
+    fileindex_overlay_clear();
+    fileindex_unmap();
+    g_fileindex.opened = 0;
+    g_fileindex.journal_end = 0;
+    if (g_fileindex.journal_fd >= 0)
+    {
+        close(g_fileindex.journal_fd);
+        g_fileindex.journal_fd = -1;
+    }
+    pthread_mutex_unlock(&g_fileindex_lock);
+}
+
+int fileindex_rebuild(void)
+{
+    pthread_mutex_lock(&g_fileindex_lock);
+    int result = fileindex_journal_open();
+    int locked = result == TINYPKG_SUCCESS && g_fileindex.journal_fd >= 0 &&
+                 (result = fileindex_journal_lock(LOCK_EX)) == TINYPKG_SUCCESS;
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = fileindex_rebuild_locked();
+    }
+    if (locked)
+    {
+        fileindex_journal_unlock();
+    }
+    pthread_mutex_unlock(&g_fileindex_lock);
+    return result;
+}
+
+// Queries
+int fileindex_lookup(const char *path, char *owner, size_t owner_size)
+{
+    int found = 0;
+
+    if (!path)
+    {
+        return 0;
+    }
+
+    metrics_add(METRICS_FILEINDEX_LOOKUPS, 1);
+    pthread_mutex_lock(&g_fileindex_lock);
+    if (fileindex_open_locked() == TINYPKG_SUCCESS)
+    {
+        const char *name = fileindex_view_owner(path);
+        if (name)
+        {
+            found = 1;
+            if (owner && owner_size > 0)
+            {
+                snprintf(owner, owner_size, "%s", name);
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_fileindex_lock);
+
+    return found;
+}
+
+// Resolve owners for many paths under one lock. owners[i] is set to a
+// newly allocated package name or NULL; returns the number of owned paths.
+int fileindex_lookup_batch(const char **paths, int count, char **owners)
+{
+    int found = 0;
+
+    if (!paths || !owners || count <= 0)
+    {
+        return 0;
+    }
+
+    metrics_add(METRICS_FILEINDEX_LOOKUPS, (uint64_t)count);
+    pthread_mutex_lock(&g_fileindex_lock);
+    int opened = fileindex_open_locked() == TINYPKG_SUCCESS;
+    for (int i = 0; i < count; i++)
+    {
+        const char *name = (opened && paths[i]) ? fileindex_view_owner(paths[i]) : NULL;
+        owners[i] = name ? TINYPKG_STRDUP(name) : NULL;
+        if (owners[i])
+        {
+            found++;
+        }
+    }
+    pthread_mutex_unlock(&g_fileindex_lock);
+
+    return found;
+}
+
+// Incremental updates append to the journal; the mapped file is only
+// rewritten when it is compacted
+int fileindex_add_package(const char *package_name, char **paths, int count)
+{
+    if (!package_name || count < 0 || (count > 0 && !paths))
+    {
+        return TINYPKG_ERROR;
+    }
+    return fileindex_update(FILEINDEX_OP_ADD, package_name, paths, count);
+}
+
+int fileindex_remove_package(const char *package_name)
+{
+    if (!package_name)
+    {
+        return TINYPKG_ERROR;
+    }
+    return fileindex_update(FILEINDEX_OP_REMOVE, package_name, NULL, 0);
+}
@@ -0,0 +1,84 @@
+/*
+ * TinyPkg - File Ownership Index Header
+ * Memory-mapped path -> owning package index for all installed packages
+ */
+
+#ifndef TINYPKG_FILEINDEX_H
+#define TINYPKG_FILEINDEX_H
+
+#include <stdint.h>
+
+// Index file and its update journal inside LIB_DIR
+#define FILEINDEX_FILE "files.idx"
+#define FILEINDEX_JOURNAL_FILE "files.journal"
+
+#define FILEINDEX_MAGIC "TPKGFI1"
+#define FILEINDEX_FORMAT_VERSION 1
+
+// On-disk layout: header, owner table, entry array, hash index, string
+// table. Owners and entries refer to strings by string table offset; the
+// index is an open-addressing table of entry numbers + 1 (0 = empty)
+// probed linearly from the FNV-1a hash of the path.
+typedef struct fileindex_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t path_count;
+    uint32_t owner_count;
+    uint32_t bucket_count;      // Power of two
+    uint32_t strtab_size;
+    uint32_t reserved;
+    uint64_t owners_offset;
+    uint64_t entries_offset;
+    uint64_t index_offset;
+    uint64_t strtab_offset;
+    uint64_t file_size;
+} fileindex_header_t;
+
+typedef struct fileindex_entry {
+    uint32_t path;              // String table offset
+    uint32_t owner;             // Owner table slot
+    uint32_t hash;              // FNV-1a of the path
+    uint32_t reserved;
+} fileindex_entry_t;
+
+// Updates are appended to the journal as records holding a package's
+// complete new file list (none when it was removed) and replayed over the
+// mapped file on open. The journal is folded into a new index once its
+// paths reach half the indexed ones.
+#define FILEINDEX_JOURNAL_MAGIC 0x4649444aU   // "FIDJ"
+#define FILEINDEX_JOURNAL_MAX_RECORD (64u * 1024 * 1024)
+#define FILEINDEX_COMPACT_MIN_PATHS 4096
+
+typedef enum {
+    FILEINDEX_OP_ADD = 1,
+    FILEINDEX_OP_REMOVE = 2
+} fileindex_op_t;
+
+// Followed by length bytes: the package name (name_len bytes, no NUL),
+// then path_count NUL-terminated paths
+typedef struct fileindex_journal_record {
+    uint32_t magic;
+    uint16_t op;
+    uint16_t name_len;
+    uint32_t path_count;
+    uint32_t length;
+    uint32_t checksum;          // FNV-1a of the record (checksum 0) and body
+    uint32_t reserved;
+} fileindex_journal_record_t;
+
+// Function declarations
+
+// Index lifecycle
+int fileindex_open(void);
+void fileindex_close(void);
+int fileindex_rebuild(void);
+
+// Queries; owners are copied out so they stay valid across updates
+int fileindex_lookup(const char *path, char *owner, size_t owner_size);
+int fileindex_lookup_batch(const char **paths, int count, char **owners);
+
+// Incremental updates
+int fileindex_add_package(const char *package_name, char **paths, int count);
+int fileindex_remove_package(const char *package_name);
+
+#endif /* TINYPKG_FILEINDEX_H */
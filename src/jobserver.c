@@ -0,0 +1,288 @@
+/*
+ * TinyPkg - Jobserver Implementation
+ * GNU make jobserver shared by all concurrently running builds
+ */
+
+#include "../include/tinypkg.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Token pool: a named FIFO holding one byte per free job slot. Child
+// builds get their own blocking descriptor (inherited across exec) or the
+// FIFO path; tinypkg reads through a separate non-blocking open so it
+// never waits on a token while holding the scheduler lock.
+typedef struct jobserver
+{
+    int active;
+    int tokens;
+    int client_fd;
+    int server_fd;
+    int fifo_auth;            // Clients understand --jobserver-auth=fifo:
+    char dir[MAX_PATH];
+    char path[MAX_PATH];
+    pthread_mutex_t lock;
+} jobserver_t;
+
+static jobserver_t g_jobserver = {
+    .client_fd = -1,
+    .server_fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Size the pool from the CPUs we may use and the memory behind them
+int jobserver_pool_size(void)
+{
+    int jobs = global_config && global_config->parallel_jobs > 0
+                   ? global_config->parallel_jobs
+                   : config_detect_cpu_count();
+    size_t memory_mb = config_detect_memory_size() / (1024 * 1024);
+
+    if (memory_mb > 0)
+    {
+        jobs = MIN(jobs, (int)(memory_mb / JOBSERVER_MB_PER_JOB));
+    }
+    return MAX(1, jobs);
+}
+
+// Memory in MB that running builds may reserve through memory_estimate
+size_t jobserver_memory_budget(void)
+{
+    size_t memory_mb = config_detect_memory_size() / (1024 * 1024);
+    return memory_mb * JOBSERVER_MEMORY_PERCENT / 100;
+}
+
+// GNU make 4.4 and ninja 1.13 take the FIFO path; older make only
+// understands inherited descriptors
+static int jobserver_detect_fifo_auth(void)
+{
+    char *output = NULL;
+    int exit_code = -1;
+    int major = 0, minor = 0;
+
+    if (utils_run_command_with_output("make --version", NULL, &output,
+                                      &exit_code) != TINYPKG_SUCCESS)
+    {
+        return 0;
+    }
+
+    int parsed = output && sscanf(output, "GNU Make %d.%d", &major, &minor) == 2;
+    TINYPKG_FREE(output);
+    return parsed && (major > 4 || (major == 4 && minor >= 4));
+}
+
+static void jobserver_put_tokens(int count)
+{
+    char tokens[256];
+
+    memset(tokens, '+', sizeof(tokens));
+    while (count > 0)
+    {
+        ssize_t n = write(g_jobserver.server_fd, tokens,
+                          (size_t)MIN(count, (int)sizeof(tokens)));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            log_warn("Failed to add jobserver tokens: %s", strerror(errno));
+            return;
+        }
+        count -= (int)n;
+    }
+}
+
+int jobserver_start(int tokens)
+{
+    int result = TINYPKG_ERROR;
+
+    pthread_mutex_lock(&g_jobserver.lock);
+    if (g_jobserver.active)
+    {
+        pthread_mutex_unlock(&g_jobserver.lock);
+        return TINYPKG_SUCCESS;
+    }
+
+    snprintf(g_jobserver.dir, sizeof(g_jobserver.dir),
+             "/tmp/tinypkg-jobserver-XXXXXX");
+    if (!mkdtemp(g_jobserver.dir))
+    {
+        log_warn("Cannot create jobserver directory: %s", strerror(errno));
+        goto out;
+    }
+    if ((size_t)snprintf(g_jobserver.path, sizeof(g_jobserver.path), "%s/fifo",
+                         g_jobserver.dir) >= sizeof(g_jobserver.path))
+    {
+        log_warn("Jobserver FIFO path too long: %s", g_jobserver.dir);
+        rmdir(g_jobserver.dir);
+        goto out;
+    }
+
+    if (mkfifo(g_jobserver.path, 0600) != 0)
+    {
+        log_warn("Cannot create jobserver FIFO: %s", strerror(errno));
+        rmdir(g_jobserver.dir);
+        goto out;
+    }
+
+    // O_RDWR on a FIFO does not wait for a peer
+    g_jobserver.client_fd = open(g_jobserver.path, O_RDWR);
+    g_jobserver.server_fd =
+        open(g_jobserver.path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (g_jobserver.client_fd < 0 || g_jobserver.server_fd < 0)
+    {
+        log_warn("Cannot open jobserver FIFO: %s", strerror(errno));
+        if (g_jobserver.client_fd >= 0)
+            close(g_jobserver.client_fd);
+        if (g_jobserver.server_fd >= 0)
+            close(g_jobserver.server_fd);
+        g_jobserver.client_fd = g_jobserver.server_fd = -1;
+        unlink(g_jobserver.path);
+        rmdir(g_jobserver.dir);
+        goto out;
+    }
+
+    g_jobserver.tokens = MAX(1, tokens);
+    g_jobserver.fifo_auth = jobserver_detect_fifo_auth();
+    jobserver_put_tokens(g_jobserver.tokens);
+    g_jobserver.active = 1;
+    result = TINYPKG_SUCCESS;
+
+    log_debug("Jobserver started with %d tokens (%s)", g_jobserver.tokens,
+              g_jobserver.path);
+
+out:
+    pthread_mutex_unlock(&g_jobserver.lock);
+    return result;
+}
+
+void jobserver_stop(void)
+{
+    pthread_mutex_lock(&g_jobserver.lock);
+    if (g_jobserver.active)
+    {
+        close(g_jobserver.client_fd);
+        close(g_jobserver.server_fd);
+        g_jobserver.client_fd = g_jobserver.server_fd = -1;
+        unlink(g_jobserver.path);
+        rmdir(g_jobserver.dir);
+        g_jobserver.active = 0;
+    }
+    pthread_mutex_unlock(&g_jobserver.lock);
+}
+
+int jobserver_is_active(void)
+{
+    pthread_mutex_lock(&g_jobserver.lock);
+    int active = g_jobserver.active;
+    pthread_mutex_unlock(&g_jobserver.lock);
+    return active;
+}
+
+// Take a free slot without waiting; 1 if one was available
+int jobserver_try_acquire(void)
+{
+    char token;
+    ssize_t n;
+
+    pthread_mutex_lock(&g_jobserver.lock);
+    if (!g_jobserver.active)
+    {
+        pthread_mutex_unlock(&g_jobserver.lock);
+        return 1;
+    }
+    do
+    {
+        n = read(g_jobserver.server_fd, &token, 1);
+    } while (n < 0 && errno == EINTR);
+    pthread_mutex_unlock(&g_jobserver.lock);
+
+    return n == 1;
+}
+
+void jobserver_release(void)
+{
+    pthread_mutex_lock(&g_jobserver.lock);
+    if (g_jobserver.active)
+    {
+        jobserver_put_tokens(1);
+    }
+    pthread_mutex_unlock(&g_jobserver.lock);
+}
+
+// Reset the pool to its full size. Only valid while no build is running;
+// recovers tokens lost by clients that died holding them.
+void jobserver_refill(void)
+{
+    char buffer[256];
+
+    pthread_mutex_lock(&g_jobserver.lock);
+    if (g_jobserver.active)
+    {
+        while (read(g_jobserver.server_fd, buffer, sizeof(buffer)) > 0)
+            ;
+        jobserver_put_tokens(g_jobserver.tokens);
+    }
+    pthread_mutex_unlock(&g_jobserver.lock);
+}
+
+// Whether MAKEFLAGS carries the FIFO form that ninja can join
+int jobserver_uses_fifo(void)
+{
+    pthread_mutex_lock(&g_jobserver.lock);
+    int fifo = g_jobserver.active && g_jobserver.fifo_auth;
+    pthread_mutex_unlock(&g_jobserver.lock);
+    return fifo;
+}
+
+// Directory holding the FIFO, which builds must be able to reach
+int jobserver_get_directory(char *dir, size_t size)
+{
+    if (!dir || size == 0)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    pthread_mutex_lock(&g_jobserver.lock);
+    int found = g_jobserver.active && g_jobserver.fifo_auth &&
+                snprintf(dir, size, "%s", g_jobserver.dir) < (int)size;
+    pthread_mutex_unlock(&g_jobserver.lock);
+
+    return found ? TINYPKG_SUCCESS : TINYPKG_ERROR;
+}
+
+int jobserver_get_makeflags(char *flags, size_t size)
+{
+    int written;
+
+    if (!flags || size == 0)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    pthread_mutex_lock(&g_jobserver.lock);
+    if (!g_jobserver.active)
+    {
+        pthread_mutex_unlock(&g_jobserver.lock);
+        return TINYPKG_ERROR;
+    }
+
+    if (g_jobserver.fifo_auth)
+    {
+        written = snprintf(flags, size, "-j%d --jobserver-auth=fifo:%s",
+                           g_jobserver.tokens, g_jobserver.path);
+    }
+    else
+    {
+        written = snprintf(flags, size, "-j%d --jobserver-auth=%d,%d",
+                           g_jobserver.tokens, g_jobserver.client_fd,
+                           g_jobserver.client_fd);
+    }
+    pthread_mutex_unlock(&g_jobserver.lock);
+
+    return written < (int)size ? TINYPKG_SUCCESS : TINYPKG_ERROR;
+}
@@ -0,0 +1,39 @@
+/*
+ * TinyPkg - Jobserver Header
+ * GNU make jobserver shared by all concurrently running builds
+ */
+
+#ifndef TINYPKG_JOBSERVER_H
+#define TINYPKG_JOBSERVER_H
+
+#include <stddef.h>
+
+// Memory assumed per compile job when sizing the token pool
+#define JOBSERVER_MB_PER_JOB 512
+
+// Share of physical memory that concurrent builds may reserve
+#define JOBSERVER_MEMORY_PERCENT 75
+
+// Function declarations
+
+// Sizing
+int jobserver_pool_size(void);
+size_t jobserver_memory_budget(void);
+
+// Lifecycle
+int jobserver_start(int tokens);
+void jobserver_stop(void);
+int jobserver_is_active(void);
+
+// Slots held by tinypkg itself: one per running build, standing in for
+// the implicit token every make client owns
+int jobserver_try_acquire(void);
+void jobserver_release(void);
+void jobserver_refill(void);
+
+// MAKEFLAGS value making child builds clients of the pool
+int jobserver_get_makeflags(char *flags, size_t size);
+int jobserver_uses_fifo(void);
+int jobserver_get_directory(char *dir, size_t size);
+
+#endif /* TINYPKG_JOBSERVER_H */
@@ -116,6 +116,8 @@ package_t *json_parser_load_package_file(const char *json_file) {
         pkg->build_system = BUILD_TYPE_MAKE;
     } else if (strcmp(build_system, "custom") == 0) {
         pkg->build_system = BUILD_TYPE_CUSTOM;
+    } else if (strcmp(build_system, "meson") == 0) {
+        pkg->build_system = BUILD_TYPE_MESON;
     } else {
         pkg->build_system = BUILD_TYPE_AUTOTOOLS;
     }
@@ -135,6 +137,8 @@ package_t *json_parser_load_package_file(const char *json_file) {
     // Parse numeric fields
     pkg->size_estimate = (size_t)json_parser_get_int(root, "size_estimate", 0);
     pkg->build_time_estimate = json_parser_get_int(root, "build_time_estimate", 0);
+    pkg->memory_estimate = json_parser_get_int(root, "memory_estimate", 0);
+    pkg->disable_ninja = json_is_false(json_object_get(root, "ninja"));
     
     // Parse arrays
     json_t *dependencies = json_parser_get_array(root, "dependencies");
@@ -398,6 +402,7 @@ int json_parser_save_package(const package_t *pkg, const char *json_file) {
         case BUILD_TYPE_CMAKE: build_system_str = "cmake"; break;
         case BUILD_TYPE_MAKE: build_system_str = "make"; break;
         case BUILD_TYPE_CUSTOM: build_system_str = "custom"; break;
+        case BUILD_TYPE_MESON: build_system_str = "meson"; break;
         default: build_system_str = "autotools"; break;
     }
     json_object_set_new(root, "build_system", json_string(build_system_str));
@@ -423,6 +428,14 @@ int json_parser_save_package(const package_t *pkg, const char *json_file) {
         json_object_set_new(root, "build_time_estimate", json_integer(pkg->build_time_estimate));
     }
     
+    if (pkg->memory_estimate > 0) {
+        json_object_set_new(root, "memory_estimate", json_integer(pkg->memory_estimate));
+    }
+    
+    if (pkg->disable_ninja) {
+        json_object_set_new(root, "ninja", json_false());
+    }
+    
     // Arrays
     if (pkg->dependencies && pkg->dep_count > 0) {
         json_t *deps = json_parser_strings_to_array(pkg->dependencies, pkg->dep_count);
@@ -12,6 +12,9 @@
 #include <errno.h>
 #include <syslog.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 #include "../include/tinypkg.h"
 
 // Global state
@@ -23,7 +26,8 @@ static log_config_t g_log_config = {
     .max_backup_files = 5,
     .use_colors = 1,
     .show_timestamps = 1,
-    .show_thread_id = 0
+    .show_thread_id = 0,
+    .async = 1
 };
 
 static FILE *g_log_file = NULL;
@@ -34,6 +38,53 @@ static pthread_mutex_t g_log_mutex = PTHREAD_MUTEX_INITIALIZER;
 static log_stats_t g_stats = {0};
 static log_filter_func_t g_filters[8] = {0};
 static int g_filter_count = 0;
+static off_t g_file_size = 0;  // Bytes in g_log_file, instead of ftell per line
+
+// Live status line kept at the bottom of a terminal stderr. Console output
+// erases it, is written above it and redraws it, all under g_log_mutex.
+static char g_status[LOG_STATUS_SIZE] = {0};
+static int g_status_drawn = 0;
+
+// Asynchronous backend for the log file. Every thread that logs gets its
+// own single-producer ring: it formats the line, copies it in and publishes
+// the new head, so loggers never wait on each other or on the file. The
+// writer thread gathers whole batches into writev() calls and advances each
+// ring's tail. Console lines stay synchronous to keep their order with
+// command output on the same stream.
+typedef struct log_ring {
+    char data[LOG_RING_SIZE];
+    size_t head;                // Advanced by the owning thread only
+    size_t tail;                // Advanced by the writer thread only
+    int orphaned;               // Owning thread exited; freed once drained
+    struct log_ring *next;
+} log_ring_t;
+
+typedef struct log_record_header {
+    uint32_t length;
+    uint32_t level;
+} log_record_header_t;
+
+// iovecs per destination and writev() call
+#define LOG_BATCH_IOV 256
+
+static struct {
+    int active;
+    int stopping;
+    int sleeping;               // Writer waits for work; producers wake it
+    int key_created;
+    int atfork_registered;
+    unsigned long passes;       // Completed drain passes
+    pthread_t thread;
+    pthread_key_t key;
+    log_ring_t *rings;
+    pthread_mutex_t lock;       // Ring list and wakeups
+    pthread_cond_t wake;
+    pthread_cond_t drained;
+} g_async = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .drained = PTHREAD_COND_INITIALIZER,
+};
 
 // Color codes
 static const char* const LOG_COLORS[] = {
@@ -78,22 +129,61 @@ static void update_stats(log_level_t level, size_t bytes) {
     g_stats.bytes_written += bytes;
 }
 
-static int check_file_size_and_rotate(void) {
+static int rotate_files_locked(void);
+
+static void status_write(const char *text, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(STDERR_FILENO, text, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) break;
+        text += written;
+        length -= (size_t)written;
+    }
+}
+
+// Called with g_log_mutex held before console output
+static void status_erase_locked(void) {
+    if (g_status_drawn) {
+        fflush(stderr);
+        status_write("\r\033[K", 4);
+        g_status_drawn = 0;
+    }
+}
+
+// Called with g_log_mutex held after console output
+static void status_draw_locked(void) {
+    if (g_status[0] && !g_status_drawn) {
+        fflush(stdout);
+        fflush(stderr);
+        status_write(g_status, strlen(g_status));
+        g_status_drawn = 1;
+    }
+}
+
+// Called with g_log_mutex held after bytes were appended to the log file
+static int account_file_bytes(size_t bytes) {
     if (!g_log_file) return 0;
     
-    long size = ftell(g_log_file);
-    if (size >= g_log_config.max_file_size) {
-        return logging_rotate_files();
+    g_file_size += (off_t)bytes;
+    if (g_file_size >= g_log_config.max_file_size) {
+        return rotate_files_locked();
     }
     return 0;
 }
 
+static void reset_file_size(void) {
+    struct stat st;
+    g_file_size = (g_log_file && fstat(fileno(g_log_file), &st) == 0) ? st.st_size : 0;
+}
+
 static void format_timestamp(char *buffer, size_t size) {
     struct timespec ts;
     struct tm *tm_info;
     
+    struct tm tm_buffer;
+    
     clock_gettime(CLOCK_REALTIME, &ts);
-    tm_info = localtime(&ts.tv_sec);
+    tm_info = localtime_r(&ts.tv_sec, &tm_buffer);
     
     strftime(buffer, size, "%Y-%m-%d %H:%M:%S", tm_info);
     
@@ -130,6 +220,17 @@ static void format_log_message(char *output, size_t output_size,
              basename, line, func, message);
 }
 
+static int syslog_priority(log_level_t level) {
+    switch (level) {
+        case LOG_DEBUG: return LOG_DEBUG;
+        case LOG_INFO:  return LOG_INFO;
+        case LOG_WARN:  return LOG_WARNING;
+        case LOG_ERROR: return LOG_ERR;
+        case LOG_FATAL: return LOG_CRIT;
+        default: return LOG_INFO;
+    }
+}
+
 static int apply_filters(log_level_t level, const char *file,
                         int line, const char *func,
                         const char *message) {
@@ -141,6 +242,311 @@ static int apply_filters(log_level_t level, const char *file,
     return 1; // All filters passed
 }
 
+// Async backend helpers
+static void ring_copy_in(log_ring_t *ring, size_t pos, const void *src, size_t length) {
+    size_t offset = pos & (LOG_RING_SIZE - 1);
+    size_t first = LOG_RING_SIZE - offset;
+    
+    if (first >= length) {
+        memcpy(ring->data + offset, src, length);
+    } else {
+        memcpy(ring->data + offset, src, first);
+        memcpy(ring->data, (const char *)src + first, length - first);
+    }
+}
+
+static void ring_copy_out(const log_ring_t *ring, size_t pos, void *dst, size_t length) {
+    size_t offset = pos & (LOG_RING_SIZE - 1);
+    size_t first = LOG_RING_SIZE - offset;
+    
+    if (first >= length) {
+        memcpy(dst, ring->data + offset, length);
+    } else {
+        memcpy(dst, ring->data + offset, first);
+        memcpy((char *)dst + first, ring->data, length - first);
+    }
+}
+
+// Point up to two iovecs at a record's text, which may wrap around
+static int ring_iov(const log_ring_t *ring, size_t pos, size_t length, struct iovec *iov) {
+    size_t offset = pos & (LOG_RING_SIZE - 1);
+    size_t first = LOG_RING_SIZE - offset;
+    
+    iov[0].iov_base = (void *)(ring->data + offset);
+    if (first >= length) {
+        iov[0].iov_len = length;
+        return 1;
+    }
+    iov[0].iov_len = first;
+    iov[1].iov_base = (void *)ring->data;
+    iov[1].iov_len = length - first;
+    return 2;
+}
+
+static void ring_release(void *value) {
+    log_ring_t *ring = value;
+    if (ring) {
+        __atomic_store_n(&ring->orphaned, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static log_ring_t *ring_for_thread(void) {
+    log_ring_t *ring = pthread_getspecific(g_async.key);
+    if (ring) return ring;
+    
+    ring = calloc(1, sizeof(log_ring_t));
+    if (!ring) return NULL;
+    
+    pthread_mutex_lock(&g_async.lock);
+    ring->next = g_async.rings;
+    g_async.rings = ring;
+    pthread_mutex_unlock(&g_async.lock);
+    
+    pthread_setspecific(g_async.key, ring);
+    return ring;
+}
+
+static int rings_pending(void) {
+    for (log_ring_t *ring = g_async.rings; ring; ring = ring->next) {
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Queue a formatted line; 0 if the caller has to write it synchronously
+static int async_push(log_level_t level, const char *text, size_t length) {
+    log_ring_t *ring = ring_for_thread();
+    if (!ring) return 0;
+    
+    // Keep records well below the ring size so a full ring always drains
+    length = MIN(length, (size_t)LOG_RING_SIZE / 4);
+    
+    log_record_header_t header = { (uint32_t)length, (uint32_t)level };
+    size_t needed = sizeof(header) + length;
+    size_t head = ring->head;
+    
+    if (LOG_RING_SIZE - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) < needed) {
+        // Full: wait for the writer to make room
+        pthread_mutex_lock(&g_async.lock);
+        while (LOG_RING_SIZE - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) < needed) {
+            if (!__atomic_load_n(&g_async.active, __ATOMIC_ACQUIRE)) {
+                pthread_mutex_unlock(&g_async.lock);
+                return 0;
+            }
+            pthread_cond_signal(&g_async.wake);
+            pthread_cond_wait(&g_async.drained, &g_async.lock);
+        }
+        pthread_mutex_unlock(&g_async.lock);
+    }
+    
+    ring_copy_in(ring, head, &header, sizeof(header));
+    ring_copy_in(ring, head + sizeof(header), text, length);
+    __atomic_store_n(&ring->head, head + needed, __ATOMIC_SEQ_CST);
+    
+    if (__atomic_load_n(&g_async.sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&g_async.lock);
+        pthread_cond_signal(&g_async.wake);
+        pthread_mutex_unlock(&g_async.lock);
+    }
+    return 1;
+}
+
+static size_t write_iov(int fd, struct iovec *iov, int count) {
+    size_t total = 0;
+    
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) break;
+        
+        total += (size_t)written;
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+    return total;
+}
+
+// Queued lines waiting for one writev() to the log file
+typedef struct log_batch {
+    struct iovec file[LOG_BATCH_IOV];
+    int file_count;
+    unsigned long counts[LOG_FATAL + 1];
+    size_t bytes;
+} log_batch_t;
+
+static void batch_flush(log_batch_t *batch) {
+    lock_if_needed();
+    if (batch->file_count > 0 && g_log_file) {
+        account_file_bytes(write_iov(fileno(g_log_file), batch->file, batch->file_count));
+    }
+    for (int level = LOG_DEBUG; level <= LOG_FATAL; level++) {
+        switch (level) {
+            case LOG_DEBUG: g_stats.debug_count += batch->counts[level]; break;
+            case LOG_INFO:  g_stats.info_count += batch->counts[level]; break;
+            case LOG_WARN:  g_stats.warn_count += batch->counts[level]; break;
+            case LOG_ERROR: g_stats.error_count += batch->counts[level]; break;
+            case LOG_FATAL: g_stats.fatal_count += batch->counts[level]; break;
+        }
+    }
+    g_stats.bytes_written += batch->bytes;
+    unlock_if_needed();
+    
+    memset(batch->counts, 0, sizeof(batch->counts));
+    batch->file_count = 0;
+    batch->bytes = 0;
+}
+
+// Write out everything queued in one ring; returns the bytes consumed
+static size_t drain_ring(log_ring_t *ring, log_batch_t *batch) {
+    static char newline[] = "\n";
+    size_t tail = ring->tail;
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t start = tail;
+    int file = (g_log_config.output_flags & LOG_OUTPUT_FILE) && g_log_file;
+    
+    while (tail != head) {
+        log_record_header_t header;
+        ring_copy_out(ring, tail, &header, sizeof(header));
+        size_t text = tail + sizeof(header);
+        log_level_t level = (log_level_t)MIN(header.level, (uint32_t)LOG_FATAL);
+        
+        if (file) {
+            batch->file_count += ring_iov(ring, text, header.length,
+                                          &batch->file[batch->file_count]);
+            batch->file[batch->file_count].iov_base = newline;
+            batch->file[batch->file_count++].iov_len = 1;
+            batch->bytes += header.length + 1;
+        }
+        batch->counts[level]++;
+        tail = text + header.length;
+        
+        // Room for one more record, or write what we have
+        if (batch->file_count > LOG_BATCH_IOV - 3) {
+            batch_flush(batch);
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+    
+    batch_flush(batch);
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return tail - start;
+}
+
+// Drain every ring once and free those whose threads are gone
+static size_t drain_rings(void) {
+    static log_batch_t batch;
+    size_t total = 0;
+    
+    pthread_mutex_lock(&g_async.lock);
+    log_ring_t *ring = g_async.rings;
+    pthread_mutex_unlock(&g_async.lock);
+    
+    // New rings are only ever pushed in front, so this walk is safe
+    for (; ring; ring = ring->next) {
+        total += drain_ring(ring, &batch);
+    }
+    
+    pthread_mutex_lock(&g_async.lock);
+    for (log_ring_t **link = &g_async.rings; *link;) {
+        log_ring_t *candidate = *link;
+        if (__atomic_load_n(&candidate->orphaned, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&candidate->head, __ATOMIC_ACQUIRE) == candidate->tail) {
+            *link = candidate->next;
+            free(candidate);
+        } else {
+            link = &candidate->next;
+        }
+    }
+    pthread_mutex_unlock(&g_async.lock);
+    return total;
+}
+
+static void *async_writer(void *arg) {
+    (void)arg;
+    
+    pthread_mutex_lock(&g_async.lock);
+    for (;;) {
+        pthread_mutex_unlock(&g_async.lock);
+        size_t drained = drain_rings();
+        pthread_mutex_lock(&g_async.lock);
+        
+        g_async.passes++;
+        pthread_cond_broadcast(&g_async.drained);
+        
+        if (g_async.stopping && !rings_pending()) break;
+        if (drained > 0) continue;
+        
+        // Producers check sleeping after publishing, so either they see
+        // it set or rings_pending() sees their line
+        __atomic_store_n(&g_async.sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!rings_pending() && !g_async.stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_WRITER_INTERVAL_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&g_async.wake, &g_async.lock, &deadline);
+        }
+        __atomic_store_n(&g_async.sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&g_async.lock);
+    return NULL;
+}
+
+// A forked child has no writer thread; it logs synchronously
+static void async_atfork_child(void) {
+    g_async.active = 0;
+    g_async.sleeping = 0;
+    pthread_mutex_init(&g_async.lock, NULL);
+    pthread_mutex_init(&g_log_mutex, NULL);
+}
+
+static int async_start(void) {
+    if (__atomic_load_n(&g_async.active, __ATOMIC_ACQUIRE)) return 0;
+    
+    if (!g_async.key_created) {
+        if (pthread_key_create(&g_async.key, ring_release) != 0) return -1;
+        g_async.key_created = 1;
+    }
+    if (!g_async.atfork_registered) {
+        pthread_atfork(NULL, NULL, async_atfork_child);
+        g_async.atfork_registered = 1;
+    }
+    
+    g_async.stopping = 0;
+    if (pthread_create(&g_async.thread, NULL, async_writer, NULL) != 0) {
+        return -1;
+    }
+    __atomic_store_n(&g_async.active, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Stop the writer after it has written everything queued so far
+static void async_stop(void) {
+    if (!__atomic_load_n(&g_async.active, __ATOMIC_ACQUIRE)) return;
+    
+    __atomic_store_n(&g_async.active, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&g_async.lock);
+    g_async.stopping = 1;
+    pthread_cond_signal(&g_async.wake);
+    pthread_cond_broadcast(&g_async.drained);
+    pthread_mutex_unlock(&g_async.lock);
+    
+    pthread_join(g_async.thread, NULL);
+    
+    // Lines queued by threads that saw the writer active a moment ago
+    drain_rings();
+}
+
 // Public functions
 int logging_init(void) {
     return logging_init_with_config(&g_log_config);
@@ -182,6 +588,7 @@ int logging_init_with_config(const log_config_t *config) {
             return -1;
         }
         setbuf(g_log_file, NULL); // Unbuffered for immediate writes
+        reset_file_size();
     }
     
     // Initialize syslog if enabled
@@ -194,20 +601,35 @@ int logging_init_with_config(const log_config_t *config) {
     
     unlock_if_needed();
     
+    if (g_log_config.async && async_start() != 0) {
+        fprintf(stderr, "Failed to start log writer thread, logging synchronously\n");
+        g_log_config.async = 0;
+    }
+    
     log_info("Logging system initialized");
     return 0;
 }
 
 void logging_cleanup(void) {
+    if (!g_initialized) {
+        return;
+    }
+    
+    log_info("Shutting down logging system");
+    
+    // Everything queued is written before the outputs close
+    async_stop();
+    
     lock_if_needed();
     
+    status_erase_locked();
+    g_status[0] = '\0';
+    
     if (!g_initialized) {
         unlock_if_needed();
         return;
     }
     
-    log_info("Shutting down logging system");
-    
     if (g_log_file) {
         fclose(g_log_file);
         g_log_file = NULL;
@@ -248,49 +670,67 @@ void log_message_va(log_level_t level, const char *file, int line,
         return;
     }
     
-    lock_if_needed();
-    
     // Format the complete log entry
     format_log_message(formatted, sizeof(formatted), 
                       level, file, line, func, message);
     
+    // Only the file sink is queued. Console lines go out right away on
+    // stdio, in order with the command output printed around them.
+    int to_file = (g_log_config.output_flags & LOG_OUTPUT_FILE) && g_log_file;
+    int queued = to_file && __atomic_load_n(&g_async.active, __ATOMIC_ACQUIRE) &&
+                 async_push(level, formatted, strlen(formatted));
+    int console = g_log_config.output_flags & LOG_OUTPUT_CONSOLE;
+    
+    if (queued && !console) {
+        // syslog() does its own locking
+        if ((g_log_config.output_flags & LOG_OUTPUT_SYSLOG) && g_syslog_enabled) {
+            syslog(syslog_priority(level), "%s", message);
+        }
+        if (level == LOG_FATAL) {
+            logging_flush();
+            logging_cleanup();
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    
+    lock_if_needed();
+    
     size_t bytes_written = 0;
     
     // Output to console
     if (g_log_config.output_flags & LOG_OUTPUT_CONSOLE) {
         FILE *output = (level >= LOG_ERROR) ? stderr : stdout;
         
+        status_erase_locked();
         if (g_log_config.use_colors && isatty(fileno(output))) {
             fprintf(output, "%s%s%s\n", 
                    LOG_COLORS[level], formatted, LOG_RESET);
         } else {
             fprintf(output, "%s\n", formatted);
         }
+        status_draw_locked();
         bytes_written += strlen(formatted) + 1;
     }
     
     // Output to file
-    if ((g_log_config.output_flags & LOG_OUTPUT_FILE) && g_log_file) {
+    if (!queued && (g_log_config.output_flags & LOG_OUTPUT_FILE) && g_log_file) {
         fprintf(g_log_file, "%s\n", formatted);
         bytes_written += strlen(formatted) + 1;
-        check_file_size_and_rotate();
+        account_file_bytes(strlen(formatted) + 1);
     }
     
     // Output to syslog
     if ((g_log_config.output_flags & LOG_OUTPUT_SYSLOG) && g_syslog_enabled) {
-        int syslog_priority;
-        switch (level) {
-            case LOG_DEBUG: syslog_priority = LOG_DEBUG; break;
-            case LOG_INFO:  syslog_priority = LOG_INFO; break;
-            case LOG_WARN:  syslog_priority = LOG_WARNING; break;
-            case LOG_ERROR: syslog_priority = LOG_ERR; break;
-            case LOG_FATAL: syslog_priority = LOG_CRIT; break;
-            default: syslog_priority = LOG_INFO; break;
-        }
-        syslog(syslog_priority, "%s", message);
+        syslog(syslog_priority(level), "%s", message);
     }
     
-    update_stats(level, bytes_written);
+    // The writer counts queued lines
+    if (queued) {
+        g_stats.bytes_written += bytes_written;
+    } else {
+        update_stats(level, bytes_written);
+    }
     
     unlock_if_needed();
     
@@ -339,6 +779,8 @@ int logging_set_file(const char *filename) {
         unlock_if_needed();
         return -1;
     }
+    setbuf(g_log_file, NULL);
+    reset_file_size();
     
     g_log_config.output_flags |= LOG_OUTPUT_FILE;
     
@@ -347,9 +789,14 @@ int logging_set_file(const char *filename) {
 }
 
 int logging_rotate_files(void) {
-    if (!g_log_file) return 0;
-    
     lock_if_needed();
+    int result = rotate_files_locked();
+    unlock_if_needed();
+    return result;
+}
+
+static int rotate_files_locked(void) {
+    if (!g_log_file) return 0;
     
     fclose(g_log_file);
     g_log_file = NULL;
@@ -377,12 +824,66 @@ int logging_rotate_files(void) {
     
     // Open new log file
     g_log_file = fopen(g_log_config.log_file, "w");
-    
-    unlock_if_needed();
+    if (g_log_file) {
+        setbuf(g_log_file, NULL);
+    }
+    g_file_size = 0;
     
     return (g_log_file != NULL) ? 0 : -1;
 }
 
+// Switch between the background writer and writing on the calling thread
+int logging_set_async(int enabled) {
+    if (enabled) {
+        if (g_initialized && async_start() != 0) return -1;
+    } else {
+        async_stop();
+    }
+    g_log_config.async = enabled ? 1 : 0;
+    return 0;
+}
+
+int logging_is_async(void) {
+    return __atomic_load_n(&g_async.active, __ATOMIC_ACQUIRE);
+}
+
+// Wait until everything logged so far has been written
+void logging_flush(void) {
+    if (!__atomic_load_n(&g_async.active, __ATOMIC_ACQUIRE)) return;
+    
+    pthread_mutex_lock(&g_async.lock);
+    // The pass running now may have started before our last line
+    unsigned long target = g_async.passes + 2;
+    while (g_async.passes < target && g_async.active) {
+        pthread_cond_signal(&g_async.wake);
+        pthread_cond_wait(&g_async.drained, &g_async.lock);
+    }
+    pthread_mutex_unlock(&g_async.lock);
+}
+
+// Replace the status line; NULL or "" removes it. Only shown when stderr
+// is a terminal, cut to its width so it never wraps.
+void logging_set_status(const char *text) {
+    if (!isatty(STDERR_FILENO)) return;
+    
+    size_t width = sizeof(g_status) - 1;
+    struct winsize ws;
+    if (ioctl(STDERR_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 1) {
+        width = MIN(width, (size_t)ws.ws_col - 1);
+    }
+    
+    lock_if_needed();
+    status_erase_locked();
+    if (text) {
+        strncpy(g_status, text, width);
+        g_status[width] = '\0';
+    } else {
+        g_status[0] = '\0';
+    }
+    status_draw_locked();
+    unlock_if_needed();
+}
+
 const log_stats_t *logging_get_stats(void) {
     return &g_stats;
 }
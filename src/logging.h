@@ -53,8 +53,17 @@ typedef struct {
     int use_colors;
     int show_timestamps;
     int show_thread_id;
+    int async;              // Queue log file lines for a background writer thread
 } log_config_t;
 
+// Asynchronous backend: each logging thread owns a ring of this many bytes
+// (a power of two) that the writer thread drains
+#define LOG_RING_SIZE (64 * 1024)
+#define LOG_WRITER_INTERVAL_MS 100
+
+// Longest status line shown below the console output
+#define LOG_STATUS_SIZE 512
+
 // Function declarations
 
 // System initialization
@@ -69,6 +78,10 @@ int logging_set_output(int output_flags);
 int logging_set_file(const char *filename);
 int logging_enable_syslog(const char *ident);
 void logging_disable_syslog(void);
+int logging_set_async(int enabled);
+int logging_is_async(void);
+void logging_flush(void);
+void logging_set_status(const char *text);
 
 // Core logging functions
 void log_message(log_level_t level, const char *file, int line, 
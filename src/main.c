@@ -50,6 +50,11 @@ static void print_usage(const char *prog_name) {
     printf("  -q, --query PACKAGE      Show package information\n");
     printf("  -S, --search PATTERN     Search for packages\n");
     printf("  -c, --clean              Clean build cache\n");
+    printf("      --verify-cache       Verify cached sources against their checksums\n");
+    printf("      --verify[=PACKAGE]   Check the installed files of a package or all\n");
+    printf("      --profile PACKAGE    Show build timings of a package over time\n");
+    printf("      --owns FILE          Show which installed package owns FILE\n");
+    printf("      --daemon             Serve commands from memory on a local socket\n");
     
     printf("\nOptions:\n");
     printf("  -v, --verbose            Enable verbose output\n");
@@ -57,6 +62,11 @@ static void print_usage(const char *prog_name) {
     printf("  -f, --force              Force operation\n");
     printf("  -y, --yes                Assume yes to all prompts\n");
     printf("  -n, --no-deps            Skip dependency resolution\n");
+    printf("      --json               Print search results as JSON\n");
+    printf("      --checksums          With --verify, also compare file contents\n");
+    printf("      --recursive          With --remove, also remove packages depending on it\n");
+    printf("      --metrics FILE       Write Prometheus metrics of the run to FILE\n");
+    printf("      --trace FILE         Write a Chrome trace of the run to FILE\n");
     printf("  -j, --parallel N         Use N parallel build jobs\n");
     printf("      --config FILE        Use alternative config file\n");
     printf("      --root DIR           Use alternative root directory\n");
@@ -98,6 +108,11 @@ static int initialize_system(void) {
         return result;
     }
     
+    // Debug output is written as it happens, in order with any crash
+    if (debug_mode) {
+        logging_set_async(0);
+    }
+    
     log_info("TinyPkg %s starting up", TINYPKG_VERSION);
     
     // Load configuration
@@ -125,6 +140,11 @@ static int initialize_system(void) {
         return result;
     }
     
+    // Mirror scores are optional; failures only disable mirrors
+    if (mirror_init() != TINYPKG_SUCCESS) {
+        log_warn("Failed to initialize mirrors, using upstream sources only");
+    }
+    
     log_info("System initialization completed successfully");
     return TINYPKG_SUCCESS;
 }
@@ -132,34 +152,52 @@ static int initialize_system(void) {
 static void cleanup_system(void) {
     log_info("Shutting down TinyPkg");
     
+    fileindex_close();
+    repoindex_close();
+    pkgdb_close();
+    mirror_cleanup();
     download_cleanup();
     config_free(global_config);
     logging_cleanup();
 }
 
-int main(int argc, char *argv[]) {
-    int opt, option_index = 0;
-    int result = TINYPKG_SUCCESS;
-    
+// Parsed command line
+typedef struct cli_options {
     // Command flags
-    int install_flag = 0;
-    int remove_flag = 0;
-    int sync_flag = 0;
-    int update_flag = 0;
-    int list_flag = 0;
-    int query_flag = 0;
-    int search_flag = 0;
-    int clean_flag = 0;
-    int force_flag = 0;
-    int yes_flag = 0;
-    int no_deps_flag = 0;
+    int install_flag;
+    int remove_flag;
+    int sync_flag;
+    int update_flag;
+    int list_flag;
+    int query_flag;
+    int search_flag;
+    int clean_flag;
+    int verify_cache_flag;
+    int profile_flag;
+    int force_flag;
+    int yes_flag;
+    int no_deps_flag;
+    int json_flag;
+    int verify_flag;
+    int checksums_flag;
+    int recursive_flag;
+    int owns_flag;
+    int daemon_flag;
     
     // Command arguments
-    char *package_name = NULL;
-    char *search_pattern = NULL;
-    char *config_file = NULL;
-    char *root_dir = NULL;
-    int parallel_jobs = 0;
+    char *package_name;
+    char *search_pattern;
+    char *owned_file;
+    char *config_file;
+    char *root_dir;
+    char *metrics_file;
+    char *trace_file;
+    int parallel_jobs;
+} cli_options_t;
+
+// Parse argv into opts; returns -1 to go on, or the exit status
+static int parse_options(int argc, char *argv[], cli_options_t *opts) {
+    int opt, option_index = 0;
     
     static struct option long_options[] = {
         {"install",     required_argument, 0, 'i'},
@@ -170,6 +208,16 @@ int main(int argc, char *argv[]) {
         {"query",       required_argument, 0, 'q'},
         {"search",      required_argument, 0, 'S'},
         {"clean",       no_argument,       0, 'c'},
+        {"verify-cache", no_argument,      0, 1003},
+        {"profile",     required_argument, 0, 1004},
+        {"json",        no_argument,       0, 1005},
+        {"metrics",     required_argument, 0, 1006},
+        {"trace",       required_argument, 0, 1007},
+        {"verify",      optional_argument, 0, 1008},
+        {"checksums",   no_argument,       0, 1009},
+        {"recursive",   no_argument,       0, 1010},
+        {"owns",        required_argument, 0, 1011},
+        {"daemon",      no_argument,       0, 1012},
         {"verbose",     no_argument,       0, 'v'},
         {"debug",       no_argument,       0, 'd'},
         {"force",       no_argument,       0, 'f'},
@@ -183,44 +231,44 @@ int main(int argc, char *argv[]) {
         {0, 0, 0, 0}
     };
     
-    if (argc == 1) {
-        print_usage(argv[0]);
-        return 1;
-    }
+    memset(opts, 0, sizeof(*opts));
+    
+    // The daemon parses many command lines in one process
+    optind = 0;
     
     // Parse command line options
     while ((opt = getopt_long(argc, argv, "i:r:su::l::q:S:cvdfynj:h", 
                               long_options, &option_index)) != -1) {
         switch (opt) {
             case 'i':
-                install_flag = 1;
-                package_name = optarg;
+                opts->install_flag = 1;
+                opts->package_name = optarg;
                 break;
             case 'r':
-                remove_flag = 1;
-                package_name = optarg;
+                opts->remove_flag = 1;
+                opts->package_name = optarg;
                 break;
             case 's':
-                sync_flag = 1;
+                opts->sync_flag = 1;
                 break;
             case 'u':
-                update_flag = 1;
-                package_name = optarg; // Can be NULL for update all
+                opts->update_flag = 1;
+                opts->package_name = optarg; // Can be NULL for update all
                 break;
             case 'l':
-                list_flag = 1;
-                search_pattern = optarg; // Can be NULL for list all
+                opts->list_flag = 1;
+                opts->search_pattern = optarg; // Can be NULL for list all
                 break;
             case 'q':
-                query_flag = 1;
-                package_name = optarg;
+                opts->query_flag = 1;
+                opts->package_name = optarg;
                 break;
             case 'S':
-                search_flag = 1;
-                search_pattern = optarg;
+                opts->search_flag = 1;
+                opts->search_pattern = optarg;
                 break;
             case 'c':
-                clean_flag = 1;
+                opts->clean_flag = 1;
                 break;
             case 'v':
                 verbose_mode = 1;
@@ -230,18 +278,18 @@ int main(int argc, char *argv[]) {
                 verbose_mode = 1; // Debug implies verbose
                 break;
             case 'f':
-                force_flag = 1;
+                opts->force_flag = 1;
                 break;
             case 'y':
-                yes_flag = 1;
+                opts->yes_flag = 1;
                 break;
             case 'n':
-                no_deps_flag = 1;
+                opts->no_deps_flag = 1;
                 break;
             case 'j':
-                parallel_jobs = atoi(optarg);
-                if (parallel_jobs <= 0 || parallel_jobs > 32) {
-                    fprintf(stderr, "Invalid parallel jobs count: %d\n", parallel_jobs);
+                opts->parallel_jobs = atoi(optarg);
+                if (opts->parallel_jobs <= 0 || opts->parallel_jobs > 32) {
+                    fprintf(stderr, "Invalid parallel jobs count: %d\n", opts->parallel_jobs);
                     return 1;
                 }
                 break;
@@ -249,10 +297,43 @@ int main(int argc, char *argv[]) {
                 print_version();
                 return 0;
             case 1001: // --config
-                config_file = optarg;
+                opts->config_file = optarg;
                 break;
             case 1002: // --root
-                root_dir = optarg;
+                opts->root_dir = optarg;
+                break;
+            case 1003: // --verify-cache
+                opts->verify_cache_flag = 1;
+                break;
+            case 1004: // --profile
+                opts->profile_flag = 1;
+                opts->package_name = optarg;
+                break;
+            case 1005: // --json
+                opts->json_flag = 1;
+                break;
+            case 1006: // --metrics
+                opts->metrics_file = optarg;
+                break;
+            case 1007: // --trace
+                opts->trace_file = optarg;
+                break;
+            case 1008: // --verify
+                opts->verify_flag = 1;
+                opts->package_name = optarg; // Can be NULL for verify all
+                break;
+            case 1009: // --checksums
+                opts->checksums_flag = 1;
+                break;
+            case 1010: // --recursive
+                opts->recursive_flag = 1;
+                break;
+            case 1011: // --owns
+                opts->owns_flag = 1;
+                opts->owned_file = optarg;
+                break;
+            case 1012: // --daemon
+                opts->daemon_flag = 1;
                 break;
             case 'h':
                 print_usage(argv[0]);
@@ -263,39 +344,45 @@ int main(int argc, char *argv[]) {
         }
     }
     
-    // Setup signal handlers
-    setup_signal_handlers();
-    
-    // Check for root privileges (except for query operations)
-    if (install_flag || remove_flag || sync_flag || update_flag || clean_flag) {
-        if (check_privileges() != TINYPKG_SUCCESS) {
-            return 1;
-        }
-    }
-    
-    // Initialize system
-    result = initialize_system();
-    if (result != TINYPKG_SUCCESS) {
-        cleanup_system();
-        return 1;
-    }
-    
-    // Override configuration with command line options
-    if (parallel_jobs > 0) {
-        global_config->parallel_jobs = parallel_jobs;
+    return -1;
+}
+
+static int needs_privileges(const cli_options_t *opts) {
+    return opts->install_flag || opts->remove_flag || opts->sync_flag ||
+           opts->update_flag || opts->clean_flag || opts->verify_cache_flag ||
+           opts->daemon_flag;
+}
+
+// Per-run files and alternative roots only mean something in-process
+static int can_use_daemon(const cli_options_t *opts) {
+    return !opts->daemon_flag && !opts->metrics_file && !opts->trace_file &&
+           !opts->config_file && !opts->root_dir;
+}
+
+// Override configuration with command line options
+static void apply_options(const cli_options_t *opts) {
+    if (opts->parallel_jobs > 0) {
+        global_config->parallel_jobs = opts->parallel_jobs;
     }
-    if (force_flag) {
+    if (opts->force_flag) {
         global_config->force_mode = 1;
     }
-    if (yes_flag) {
+    if (opts->yes_flag) {
         global_config->assume_yes = 1;
     }
-    if (no_deps_flag) {
+    if (opts->no_deps_flag) {
         global_config->skip_dependencies = 1;
     }
+}
+
+// Execute the requested commands against the initialized system
+static int run_commands(const cli_options_t *opts) {
+    int result = TINYPKG_SUCCESS;
+    
+    apply_options(opts);
     
     // Execute commands
-    if (sync_flag) {
+    if (opts->sync_flag) {
         log_info("Synchronizing package repository");
         result = repository_sync();
         if (result != TINYPKG_SUCCESS) {
@@ -305,53 +392,63 @@ int main(int argc, char *argv[]) {
         }
     }
     
-    if (install_flag && package_name) {
-        if (interrupted) goto cleanup;
-        log_info("Installing package: %s", package_name);
-        result = package_install(package_name);
+    if (opts->install_flag && opts->package_name) {
+        if (interrupted) return result;
+        log_info("Installing package: %s", opts->package_name);
+        result = package_install(opts->package_name);
         if (result != TINYPKG_SUCCESS) {
-            log_error("Package installation failed: %s", package_name);
+            log_error("Package installation failed: %s", opts->package_name);
         } else {
-            log_info("Package installed successfully: %s", package_name);
+            log_info("Package installed successfully: %s", opts->package_name);
         }
     }
     
-    if (remove_flag && package_name) {
-        if (interrupted) goto cleanup;
-        log_info("Removing package: %s", package_name);
-        result = package_remove(package_name);
+    if (opts->remove_flag && opts->package_name) {
+        if (interrupted) return result;
+        log_info("Removing package: %s", opts->package_name);
+        result = opts->recursive_flag ? package_remove_recursive(opts->package_name)
+                                      : package_remove(opts->package_name);
         if (result != TINYPKG_SUCCESS) {
-            log_error("Package removal failed: %s", package_name);
+            log_error("Package removal failed: %s", opts->package_name);
         } else {
-            log_info("Package removed successfully: %s", package_name);
+            log_info("Package removed successfully: %s", opts->package_name);
         }
     }
     
-    if (update_flag) {
-        if (interrupted) goto cleanup;
-        if (package_name) {
-            log_info("Updating package: %s", package_name);
-            result = package_update(package_name);
+    if (opts->update_flag) {
+        if (interrupted) return result;
+        if (opts->package_name) {
+            log_info("Updating package: %s", opts->package_name);
+            result = package_update(opts->package_name);
         } else {
             log_info("Updating all packages");
             result = package_update_all();
         }
     }
     
-    if (query_flag && package_name) {
-        result = package_query(package_name);
+    if (opts->query_flag && opts->package_name) {
+        result = package_query(opts->package_name);
+    }
+    
+    if (opts->owns_flag && opts->owned_file) {
+        result = package_query_owner(opts->owned_file);
     }
     
-    if (search_flag && search_pattern) {
-        result = package_search(search_pattern);
+    if (opts->profile_flag && opts->package_name) {
+        result = profile_report(opts->package_name);
     }
     
-    if (list_flag) {
-        result = package_list(search_pattern);
+    if (opts->search_flag && opts->search_pattern) {
+        result = package_search_format(opts->search_pattern,
+                                       opts->json_flag ? SEARCH_OUTPUT_JSON : SEARCH_OUTPUT_TEXT);
     }
     
-    if (clean_flag) {
-        if (interrupted) goto cleanup;
+    if (opts->list_flag) {
+        result = package_list(opts->search_pattern);
+    }
+    
+    if (opts->clean_flag) {
+        if (interrupted) return result;
         log_info("Cleaning build cache");
         result = utils_clean_cache();
         if (result != TINYPKG_SUCCESS) {
@@ -360,8 +457,108 @@ int main(int argc, char *argv[]) {
             log_info("Cache cleaned successfully");
         }
     }
+    
+    if (opts->verify_flag) {
+        if (interrupted) return result;
+        result = verify_installed(opts->package_name, opts->checksums_flag);
+        if (result != TINYPKG_SUCCESS) {
+            log_error("Installed file verification found problems");
+        }
+    }
+    
+    if (opts->verify_cache_flag) {
+        if (interrupted) return result;
+        result = security_verify_cache();
+        if (result != TINYPKG_SUCCESS) {
+            log_error("Cache verification found corrupt sources");
+        }
+    }
+    
+    return result;
+}
 
-cleanup:
+// One client command line inside the daemon. It runs in a child of the
+// daemon, so its options end with the request.
+static int daemon_handle_request(int argc, char **argv, uid_t uid) {
+    cli_options_t opts;
+    
+    int status = parse_options(argc, argv, &opts);
+    if (status < 0) {
+        if (!can_use_daemon(&opts)) {
+            log_error("Option not supported through the daemon");
+            status = 1;
+        } else if (uid != 0 && needs_privileges(&opts)) {
+            log_error("TinyPkg requires root privileges for system operations");
+            status = 1;
+        } else {
+            status = (run_commands(&opts) == TINYPKG_SUCCESS) ? 0 : 1;
+        }
+    }
+    
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    cli_options_t opts;
+    int result = TINYPKG_SUCCESS;
+    
+    if (argc == 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    int status = parse_options(argc, argv, &opts);
+    if (status >= 0) {
+        return status;
+    }
+    
+    // Installed as tinypkgd, the binary is the daemon
+    const char *prog = strrchr(argv[0], '/');
+    if (TINYPKG_STREQ(prog ? prog + 1 : argv[0], "tinypkgd")) {
+        opts.daemon_flag = 1;
+    }
+    
+    // Setup signal handlers
+    setup_signal_handlers();
+    
+    // Check for root privileges (except for query operations)
+    if (needs_privileges(&opts)) {
+        if (check_privileges() != TINYPKG_SUCCESS) {
+            return 1;
+        }
+    }
+    
+    // A running daemon has everything loaded already
+    if (can_use_daemon(&opts) && daemon_client_run(argc - 1, argv + 1, &status) ==
+                                     TINYPKG_SUCCESS) {
+        return status;
+    }
+    
+    // Start recording before any worker threads exist so they get named
+    metrics_init();
+    metrics_set_prometheus_file(opts.metrics_file);
+    if (opts.trace_file) {
+        metrics_trace_start(opts.trace_file);
+    }
+    
+    // Initialize system
+    result = initialize_system();
+    if (result != TINYPKG_SUCCESS) {
+        metrics_finish(result);
+        cleanup_system();
+        return 1;
+    }
+    
+    if (opts.daemon_flag) {
+        // Options given to the daemon are the defaults for its requests
+        apply_options(&opts);
+        result = daemon_run(daemon_handle_request, &interrupted);
+        interrupted = 0;
+    } else {
+        result = run_commands(&opts);
+    }
+    
+    metrics_finish(interrupted ? TINYPKG_ERROR : result);
     cleanup_system();
     
     if (interrupted) {
@@ -0,0 +1,516 @@
+/*
+ * TinyPkg - Metrics
+ * Process-wide counters and histograms, exported for the Prometheus
+ * textfile collector, and a Chrome trace-event recorder
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/tinypkg.h"
+
+typedef struct metrics_histogram_data
+{
+    uint64_t buckets[METRICS_BUCKETS + 1];  // Last one is +Inf
+    uint64_t count;
+    uint64_t sum_us;
+} metrics_histogram_data_t;
+
+typedef struct metrics_trace_event
+{
+    int64_t ts;
+    int64_t dur;
+    int tid;
+    char ph;                        // 'X' complete event, 'M' metadata
+    char category[16];
+    char name[METRICS_TRACE_NAME_SIZE];
+    char detail[METRICS_TRACE_DETAIL_SIZE];
+} metrics_trace_event_t;
+
+static const double metrics_bounds[METRICS_BUCKETS] = {
+    0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300, 900, 3600,
+};
+
+// Exported names; counters sharing a name follow each other and differ
+// in their label
+static const struct
+{
+    const char *name;
+    const char *label;
+    const char *help;
+} metrics_counters[METRICS_COUNTER_COUNT] = {
+    [METRICS_DOWNLOADS] = {"tinypkg_downloads_total", NULL, "Completed transfers"},
+    [METRICS_DOWNLOAD_FAILURES] = {"tinypkg_download_failures_total", NULL,
+                                   "Transfer attempts that failed"},
+    [METRICS_DOWNLOAD_BYTES] = {"tinypkg_download_bytes_total", NULL,
+                                "Bytes received by transfers"},
+    [METRICS_SOURCE_CACHE_HITS] = {"tinypkg_cache_hits_total", "cache=\"source\"",
+                                   "Cache lookups answered from the cache"},
+    [METRICS_BINARY_CACHE_HITS] = {"tinypkg_cache_hits_total", "cache=\"binary\"", NULL},
+    [METRICS_COMPILER_CACHE_HITS] = {"tinypkg_cache_hits_total", "cache=\"compiler\"", NULL},
+    [METRICS_SOURCE_CACHE_MISSES] = {"tinypkg_cache_misses_total", "cache=\"source\"",
+                                     "Cache lookups that missed"},
+    [METRICS_BINARY_CACHE_MISSES] = {"tinypkg_cache_misses_total", "cache=\"binary\"", NULL},
+    [METRICS_COMPILER_CACHE_MISSES] = {"tinypkg_cache_misses_total", "cache=\"compiler\"",
+                                       NULL},
+    [METRICS_BUILDS] = {"tinypkg_builds_total", NULL,
+                        "Package builds, including binary cache restores"},
+    [METRICS_BUILD_FAILURES] = {"tinypkg_build_failures_total", NULL, "Package builds that failed"},
+    [METRICS_RESOLVER_RUNS] = {"tinypkg_resolver_runs_total", NULL, "Dependency resolutions"},
+    [METRICS_RESOLVER_NODES] = {"tinypkg_resolver_nodes_total", NULL,
+                                "Packages in resolved dependency graphs"},
+    [METRICS_RESOLVER_EDGES] = {"tinypkg_resolver_edges_total", NULL,
+                                "Dependencies in resolved dependency graphs"},
+    [METRICS_PKGDB_LOOKUPS] = {"tinypkg_db_lookups_total", "db=\"installed\"",
+                               "Lookups in the on-disk databases"},
+    [METRICS_FILEINDEX_LOOKUPS] = {"tinypkg_db_lookups_total", "db=\"files\"", NULL},
+    [METRICS_REPOINDEX_LOOKUPS] = {"tinypkg_db_lookups_total", "db=\"repository\"", NULL},
+    [METRICS_DEPINDEX_LOOKUPS] = {"tinypkg_db_lookups_total", "db=\"dependents\"", NULL},
+    [METRICS_PROCESS_SPAWNS] = {"tinypkg_process_spawns_total", NULL,
+                                "Commands run by utils_run_command()"},
+    [METRICS_PROCESS_FAILURES] = {"tinypkg_process_failures_total", NULL,
+                                  "Commands that did not exit successfully"},
+};
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} metrics_histograms[METRICS_HISTOGRAM_COUNT] = {
+    [METRICS_DOWNLOAD_SECONDS] = {"tinypkg_download_duration_seconds",
+                                  "Wall time of transfer attempts"},
+    [METRICS_DOWNLOAD_FIRST_BYTE_SECONDS] = {"tinypkg_download_first_byte_seconds",
+                                             "Time to the first byte of transfer attempts"},
+    [METRICS_RESOLVE_SECONDS] = {"tinypkg_resolve_duration_seconds",
+                                 "Wall time of dependency resolutions"},
+    [METRICS_PROCESS_SECONDS] = {"tinypkg_process_duration_seconds",
+                                 "Wall time of commands run by utils_run_command()"},
+};
+
+static struct
+{
+    uint64_t counters[METRICS_COUNTER_COUNT];
+    metrics_histogram_data_t histograms[METRICS_HISTOGRAM_COUNT];
+    metrics_histogram_data_t phases[PROFILE_PHASE_COUNT];
+    int64_t start_us;
+    int success;                    // Outcome of the run, once finished
+    char prometheus_file[MAX_PATH];
+
+    // Trace buffer
+    int tracing;
+    char trace_file[MAX_PATH];
+    pthread_mutex_t trace_lock;
+    metrics_trace_event_t *events;
+    int event_count;
+    int event_capacity;
+    uint64_t dropped;
+} g_metrics = {.trace_lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Lifecycle
+void metrics_init(void)
+{
+    g_metrics.start_us = metrics_now_us();
+}
+
+int metrics_trace_start(const char *path)
+{
+    if (!path || !*path)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    pthread_mutex_lock(&g_metrics.trace_lock);
+    snprintf(g_metrics.trace_file, sizeof(g_metrics.trace_file), "%s", path);
+    __atomic_store_n(&g_metrics.tracing, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_metrics.trace_lock);
+
+    metrics_trace_thread_name("main");
+    return TINYPKG_SUCCESS;
+}
+
+void metrics_set_prometheus_file(const char *path)
+{
+    snprintf(g_metrics.prometheus_file, sizeof(g_metrics.prometheus_file), "%s",
+             path ? path : "");
+}
+
+// Write the configured outputs and stop tracing; result is that of the run
+int metrics_finish(int result)
+{
+    int status = TINYPKG_SUCCESS;
+
+    if (metrics_tracing())
+    {
+        metrics_trace_span("tinypkg", "tinypkg", NULL, g_metrics.start_us, metrics_now_us());
+        __atomic_store_n(&g_metrics.tracing, 0, __ATOMIC_RELEASE);
+
+        if (metrics_write_trace(g_metrics.trace_file) != TINYPKG_SUCCESS)
+        {
+            status = TINYPKG_ERROR_FILE;
+        }
+        else
+        {
+            log_info("Wrote trace of %d events to %s", g_metrics.event_count,
+                     g_metrics.trace_file);
+        }
+    }
+
+    if (g_metrics.prometheus_file[0])
+    {
+        g_metrics.success = result == TINYPKG_SUCCESS;
+        if (metrics_write_prometheus(g_metrics.prometheus_file) != TINYPKG_SUCCESS)
+        {
+            status = TINYPKG_ERROR_FILE;
+        }
+    }
+
+    pthread_mutex_lock(&g_metrics.trace_lock);
+    TINYPKG_FREE(g_metrics.events);
+    g_metrics.events = NULL;
+    g_metrics.event_count = g_metrics.event_capacity = 0;
+    pthread_mutex_unlock(&g_metrics.trace_lock);
+    return status;
+}
+
+// Recording
+void metrics_add(metrics_counter_t counter, uint64_t value)
+{
+    if (counter < METRICS_COUNTER_COUNT)
+    {
+        __atomic_add_fetch(&g_metrics.counters[counter], value, __ATOMIC_RELAXED);
+    }
+}
+
+static void metrics_histogram_add(metrics_histogram_data_t *histogram, double seconds)
+{
+    int bucket = 0;
+
+    seconds = MAX(seconds, 0.0);
+    while (bucket < METRICS_BUCKETS && seconds > metrics_bounds[bucket])
+    {
+        bucket++;
+    }
+
+    __atomic_add_fetch(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->sum_us, (uint64_t)(seconds * 1e6), __ATOMIC_RELAXED);
+}
+
+void metrics_observe(metrics_histogram_t histogram, double seconds)
+{
+    if (histogram < METRICS_HISTOGRAM_COUNT)
+    {
+        metrics_histogram_add(&g_metrics.histograms[histogram], seconds);
+    }
+}
+
+void metrics_observe_phase(int phase, double seconds)
+{
+    if (phase >= 0 && phase < PROFILE_PHASE_COUNT)
+    {
+        metrics_histogram_add(&g_metrics.phases[phase], seconds);
+    }
+}
+
+// Tracing
+int metrics_tracing(void)
+{
+    return __atomic_load_n(&g_metrics.tracing, __ATOMIC_ACQUIRE);
+}
+
+int64_t metrics_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void metrics_trace_add(char ph, const char *category, const char *name,
+                              const char *detail, int64_t start_us, int64_t end_us)
+{
+    metrics_trace_event_t *event;
+
+    pthread_mutex_lock(&g_metrics.trace_lock);
+    if (!g_metrics.tracing)
+    {
+        pthread_mutex_unlock(&g_metrics.trace_lock);
+        return;
+    }
+
+    if (g_metrics.event_count == g_metrics.event_capacity)
+    {
+        int capacity = g_metrics.event_capacity ? g_metrics.event_capacity * 2 : 1024;
+        metrics_trace_event_t *events = NULL;
+
+        if (capacity <= METRICS_TRACE_MAX_EVENTS)
+        {
+            events = TINYPKG_REALLOC(g_metrics.events,
+                                     (size_t)capacity * sizeof(metrics_trace_event_t));
+        }
+        if (!events)
+        {
+            g_metrics.dropped++;
+            pthread_mutex_unlock(&g_metrics.trace_lock);
+            return;
+        }
+        g_metrics.events = events;
+        g_metrics.event_capacity = capacity;
+    }
+
+    event = &g_metrics.events[g_metrics.event_count++];
+    event->ph = ph;
+    event->ts = start_us;
+    event->dur = MAX(end_us - start_us, 0);
+    event->tid = (int)syscall(SYS_gettid);
+    snprintf(event->category, sizeof(event->category), "%s", category ? category : "");
+    snprintf(event->name, sizeof(event->name), "%s", name ? name : "");
+    snprintf(event->detail, sizeof(event->detail), "%s", detail ? detail : "");
+    pthread_mutex_unlock(&g_metrics.trace_lock);
+}
+
+void metrics_trace_span(const char *category, const char *name, const char *detail,
+                        int64_t start_us, int64_t end_us)
+{
+    if (metrics_tracing())
+    {
+        metrics_trace_add('X', category, name, detail, start_us, end_us);
+    }
+}
+
+// Perfetto shows the calling thread's track under this name
+void metrics_trace_thread_name(const char *name)
+{
+    if (metrics_tracing())
+    {
+        metrics_trace_add('M', NULL, "thread_name", name, 0, 0);
+    }
+}
+
+// Exporters
+static void metrics_json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+        {
+            fprintf(fp, "\\%c", *p);
+        }
+        else if (*p < 0x20)
+        {
+            fprintf(fp, "\\u%04x", *p);
+        }
+        else
+        {
+            fputc(*p, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+int metrics_write_trace(const char *path)
+{
+    FILE *fp;
+    int pid = (int)getpid();
+
+    if (!path)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    fp = fopen(path, "w");
+    if (!fp)
+    {
+        log_error("Cannot write trace %s: %s", path, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+
+    pthread_mutex_lock(&g_metrics.trace_lock);
+    fprintf(fp, "{\"traceEvents\": [\n");
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                "\"args\": {\"name\": \"tinypkg\"}}",
+            pid, pid);
+
+    for (int i = 0; i < g_metrics.event_count; i++)
+    {
+        const metrics_trace_event_t *event = &g_metrics.events[i];
+
+        fprintf(fp, ",\n{\"name\": ");
+        metrics_json_string(fp, event->name);
+        if (event->ph == 'M')
+        {
+            fprintf(fp, ", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": ",
+                    pid, event->tid);
+            metrics_json_string(fp, event->detail);
+            fprintf(fp, "}}");
+            continue;
+        }
+
+        fprintf(fp, ", \"cat\": ");
+        metrics_json_string(fp, event->category);
+        fprintf(fp, ", \"ph\": \"X\", \"ts\": %lld, \"dur\": %lld, \"pid\": %d, \"tid\": %d",
+                (long long)event->ts, (long long)event->dur, pid, event->tid);
+        if (event->detail[0])
+        {
+            fprintf(fp, ", \"args\": {\"detail\": ");
+            metrics_json_string(fp, event->detail);
+            fprintf(fp, "}");
+        }
+        fprintf(fp, "}");
+    }
+
+    fprintf(fp, "\n],\n\"displayTimeUnit\": \"ms\",\n"
+                "\"otherData\": {\"version\": \"%s\", \"dropped_events\": %llu}}\n",
+            TINYPKG_VERSION, (unsigned long long)g_metrics.dropped);
+    pthread_mutex_unlock(&g_metrics.trace_lock);
+
+    if (fclose(fp) != 0)
+    {
+        log_error("Failed to write trace %s: %s", path, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static void metrics_print_histogram(FILE *fp, const char *name, const char *label,
+                                    const metrics_histogram_data_t *histogram)
+{
+    uint64_t cumulative = 0;
+    const char *separator = label ? "," : "";
+
+    label = label ? label : "";
+    for (int i = 0; i <= METRICS_BUCKETS; i++)
+    {
+        cumulative += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        if (i < METRICS_BUCKETS)
+        {
+            fprintf(fp, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, label, separator,
+                    metrics_bounds[i], (unsigned long long)cumulative);
+        }
+        else
+        {
+            fprintf(fp, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, label, separator,
+                    (unsigned long long)cumulative);
+        }
+    }
+
+    if (*label)
+    {
+        fprintf(fp, "%s_sum{%s} %.6f\n%s_count{%s} %llu\n", name, label,
+                __atomic_load_n(&histogram->sum_us, __ATOMIC_RELAXED) / 1e6, name, label,
+                (unsigned long long)__atomic_load_n(&histogram->count, __ATOMIC_RELAXED));
+    }
+    else
+    {
+        fprintf(fp, "%s_sum %.6f\n%s_count %llu\n", name,
+                __atomic_load_n(&histogram->sum_us, __ATOMIC_RELAXED) / 1e6, name,
+                (unsigned long long)__atomic_load_n(&histogram->count, __ATOMIC_RELAXED));
+    }
+}
+
+// Textfile collector format; written to a temporary file and renamed so
+// the collector never reads a partial file
+int metrics_write_prometheus(const char *path)
+{
+    static const char *levels[] = {"debug", "info", "warn", "error", "fatal"};
+    const log_stats_t *log_stats = logging_get_stats();
+    char temp_path[MAX_PATH];
+    FILE *fp;
+
+    if (!path)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    if (snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)getpid()) >=
+        (int)sizeof(temp_path))
+    {
+        log_error("Metrics path too long: %s", path);
+        return TINYPKG_ERROR;
+    }
+
+    fp = fopen(temp_path, "w");
+    if (!fp)
+    {
+        log_error("Cannot write metrics %s: %s", temp_path, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+
+    for (int i = 0; i < METRICS_COUNTER_COUNT; i++)
+    {
+        uint64_t value = __atomic_load_n(&g_metrics.counters[i], __ATOMIC_RELAXED);
+
+        if (metrics_counters[i].help)
+        {
+            fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n", metrics_counters[i].name,
+                    metrics_counters[i].help, metrics_counters[i].name);
+        }
+        if (metrics_counters[i].label)
+        {
+            fprintf(fp, "%s{%s} %llu\n", metrics_counters[i].name, metrics_counters[i].label,
+                    (unsigned long long)value);
+        }
+        else
+        {
+            fprintf(fp, "%s %llu\n", metrics_counters[i].name, (unsigned long long)value);
+        }
+    }
+
+    for (int i = 0; i < METRICS_HISTOGRAM_COUNT; i++)
+    {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s histogram\n", metrics_histograms[i].name,
+                metrics_histograms[i].help, metrics_histograms[i].name);
+        metrics_print_histogram(fp, metrics_histograms[i].name, NULL,
+                                &g_metrics.histograms[i]);
+    }
+
+    fprintf(fp, "# HELP tinypkg_build_phase_duration_seconds Wall time of build phases\n"
+                "# TYPE tinypkg_build_phase_duration_seconds histogram\n");
+    for (int i = 0; i < PROFILE_PHASE_COUNT; i++)
+    {
+        char label[64];
+        snprintf(label, sizeof(label), "phase=\"%s\"",
+                 profile_phase_to_string((profile_phase_t)i));
+        metrics_print_histogram(fp, "tinypkg_build_phase_duration_seconds", label,
+                                &g_metrics.phases[i]);
+    }
+
+    if (log_stats)
+    {
+        const unsigned long counts[] = {log_stats->debug_count, log_stats->info_count,
+                                        log_stats->warn_count, log_stats->error_count,
+                                        log_stats->fatal_count};
+
+        fprintf(fp, "# HELP tinypkg_log_messages_total Log messages by level\n"
+                    "# TYPE tinypkg_log_messages_total counter\n");
+        for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+        {
+            fprintf(fp, "tinypkg_log_messages_total{level=\"%s\"} %lu\n", levels[i], counts[i]);
+        }
+    }
+
+    fprintf(fp, "# HELP tinypkg_run_duration_seconds Wall time of the last run\n"
+                "# TYPE tinypkg_run_duration_seconds gauge\n"
+                "tinypkg_run_duration_seconds %.6f\n",
+            (metrics_now_us() - g_metrics.start_us) / 1e6);
+    fprintf(fp, "# HELP tinypkg_last_run_timestamp_seconds End of the last run\n"
+                "# TYPE tinypkg_last_run_timestamp_seconds gauge\n"
+                "tinypkg_last_run_timestamp_seconds %ld\n",
+            (long)time(NULL));
+    fprintf(fp, "# HELP tinypkg_last_run_success Whether the last run succeeded\n"
+                "# TYPE tinypkg_last_run_success gauge\n"
+                "tinypkg_last_run_success %d\n",
+            g_metrics.success);
+
+    if (fclose(fp) != 0 || rename(temp_path, path) != 0)
+    {
+        log_error("Failed to write metrics %s: %s", path, strerror(errno));
+        unlink(temp_path);
+        return TINYPKG_ERROR_FILE;
+    }
+    return TINYPKG_SUCCESS;
+}
@@ -0,0 +1,79 @@
+/*
+ * TinyPkg - Metrics Header
+ * Process-wide counters and histograms, exported for the Prometheus
+ * textfile collector, and a Chrome trace-event recorder
+ */
+
+#ifndef TINYPKG_METRICS_H
+#define TINYPKG_METRICS_H
+
+#include <stdint.h>
+
+// Histogram bucket upper bounds in seconds, plus +Inf
+#define METRICS_BUCKETS 14
+
+// Trace events kept in memory; later events are dropped and counted
+#define METRICS_TRACE_MAX_EVENTS 262144
+#define METRICS_TRACE_NAME_SIZE 64
+#define METRICS_TRACE_DETAIL_SIZE 160
+
+// Counters; several share a metric name and differ in a label
+typedef enum {
+    METRICS_DOWNLOADS = 0,
+    METRICS_DOWNLOAD_FAILURES,
+    METRICS_DOWNLOAD_BYTES,
+    METRICS_SOURCE_CACHE_HITS,
+    METRICS_BINARY_CACHE_HITS,
+    METRICS_COMPILER_CACHE_HITS,
+    METRICS_SOURCE_CACHE_MISSES,
+    METRICS_BINARY_CACHE_MISSES,
+    METRICS_COMPILER_CACHE_MISSES,
+    METRICS_BUILDS,
+    METRICS_BUILD_FAILURES,
+    METRICS_RESOLVER_RUNS,
+    METRICS_RESOLVER_NODES,
+    METRICS_RESOLVER_EDGES,
+    METRICS_PKGDB_LOOKUPS,
+    METRICS_FILEINDEX_LOOKUPS,
+    METRICS_REPOINDEX_LOOKUPS,
+    METRICS_DEPINDEX_LOOKUPS,
+    METRICS_PROCESS_SPAWNS,
+    METRICS_PROCESS_FAILURES,
+    METRICS_COUNTER_COUNT
+} metrics_counter_t;
+
+// Duration histograms in seconds
+typedef enum {
+    METRICS_DOWNLOAD_SECONDS = 0,
+    METRICS_DOWNLOAD_FIRST_BYTE_SECONDS,
+    METRICS_RESOLVE_SECONDS,
+    METRICS_PROCESS_SECONDS,
+    METRICS_HISTOGRAM_COUNT
+} metrics_histogram_t;
+
+// Function declarations
+
+// Lifecycle. Tracing is off until metrics_trace_start(); metrics_finish()
+// writes whichever outputs were configured.
+void metrics_init(void);
+int metrics_trace_start(const char *path);
+void metrics_set_prometheus_file(const char *path);
+int metrics_finish(int result);
+
+// Recording; safe from any thread
+void metrics_add(metrics_counter_t counter, uint64_t value);
+void metrics_observe(metrics_histogram_t histogram, double seconds);
+void metrics_observe_phase(int phase, double seconds);
+
+// Trace events on a CLOCK_MONOTONIC microsecond timeline
+int metrics_tracing(void);
+int64_t metrics_now_us(void);
+void metrics_trace_span(const char *category, const char *name, const char *detail,
+                        int64_t start_us, int64_t end_us);
+void metrics_trace_thread_name(const char *name);
+
+// Exporters
+int metrics_write_prometheus(const char *path);
+int metrics_write_trace(const char *path);
+
+#endif /* TINYPKG_METRICS_H */
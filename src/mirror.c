@@ -0,0 +1,556 @@
+/*
+ * TinyPkg - Mirror Selection Implementation
+ * Latency/throughput scored mirrors with racing and upstream failover
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "../include/tinypkg.h"
+
+// Smoothing factor for latency/throughput averages
+#define MIRROR_EWMA_ALPHA 0.3
+
+// Reference download size used to combine latency and throughput
+#define MIRROR_REFERENCE_SIZE (8.0 * 1024 * 1024)
+
+// Global state
+static mirror_score_t *g_scores = NULL;
+static int g_score_count = 0;
+static int g_mirror_initialized = 0;
+static int g_mirror_probed = 0;
+static pthread_mutex_t g_mirror_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Race bookkeeping; progress callbacks all run on the download engine thread
+typedef struct mirror_race {
+    int winner;
+} mirror_race_t;
+
+typedef struct mirror_racer {
+    mirror_race_t *race;
+    int index;
+} mirror_racer_t;
+
+// Helper functions
+static void mirror_score_path(char *path, size_t size) {
+    snprintf(path, size, "%s/mirrors.score", LIB_DIR);
+}
+
+// Find a score entry. Called with g_mirror_lock held.
+static mirror_score_t *mirror_find(const char *mirror_url) {
+    for (int i = 0; i < g_score_count; i++) {
+        if (TINYPKG_STREQ(g_scores[i].url, mirror_url)) {
+            return &g_scores[i];
+        }
+    }
+    return NULL;
+}
+
+static int mirror_compare_cost(const void *a, const void *b) {
+    double cost_a = mirror_estimate_cost((const mirror_score_t *)a);
+    double cost_b = mirror_estimate_cost((const mirror_score_t *)b);
+    return (cost_a > cost_b) - (cost_a < cost_b);
+}
+
+static double mirror_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static size_t mirror_file_size(const char *path) {
+    struct stat st;
+    return (stat(path, &st) == 0) ? (size_t)st.st_size : 0;
+}
+
+// Mirror subsystem lifecycle
+int mirror_init(void) {
+    if (g_mirror_initialized) {
+        return TINYPKG_SUCCESS;
+    }
+
+    if (!global_config || !global_config->use_mirrors ||
+        global_config->mirror_count == 0) {
+        g_mirror_initialized = 1;
+        return TINYPKG_SUCCESS;
+    }
+
+    g_scores = TINYPKG_CALLOC(global_config->mirror_count, sizeof(mirror_score_t));
+    if (!g_scores) {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    for (int i = 0; i < global_config->mirror_count; i++) {
+        strncpy(g_scores[i].url, global_config->mirrors[i], sizeof(g_scores[i].url) - 1);
+    }
+    g_score_count = global_config->mirror_count;
+
+    mirror_load_scores();
+
+    log_debug("Mirror subsystem initialized with %d mirrors", g_score_count);
+    g_mirror_initialized = 1;
+    return TINYPKG_SUCCESS;
+}
+
+void mirror_cleanup(void) {
+    if (!g_mirror_initialized) {
+        return;
+    }
+
+    if (g_score_count > 0) {
+        mirror_save_scores();
+    }
+
+    TINYPKG_FREE(g_scores);
+    g_score_count = 0;
+    g_mirror_probed = 0;
+    g_mirror_initialized = 0;
+}
+
+// Load persisted scores for the configured mirrors
+int mirror_load_scores(void) {
+    char path[MAX_PATH];
+    char line[MAX_URL + 256];
+    char url[MAX_URL + 256];
+
+    mirror_score_path(path, sizeof(path));
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return TINYPKG_ERROR_FILE;
+    }
+
+    pthread_mutex_lock(&g_mirror_lock);
+    while (fgets(line, sizeof(line), fp)) {
+        mirror_score_t loaded;
+        long last_probe, last_used;
+
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%s %lf %lf %d %d %ld %ld", url, &loaded.latency,
+                   &loaded.throughput, &loaded.successes, &loaded.failures,
+                   &last_probe, &last_used) != 7) {
+            continue;
+        }
+
+        // Scores for mirrors no longer configured are dropped
+        mirror_score_t *score = mirror_find(url);
+        if (score) {
+            score->latency = loaded.latency;
+            score->throughput = loaded.throughput;
+            score->successes = loaded.successes;
+            score->failures = loaded.failures;
+            score->last_probe = (time_t)last_probe;
+            score->last_used = (time_t)last_used;
+        }
+    }
+    pthread_mutex_unlock(&g_mirror_lock);
+
+    fclose(fp);
+    return TINYPKG_SUCCESS;
+}
+
+// Persist scores atomically
+int mirror_save_scores(void) {
+    char path[MAX_PATH];
+    char tmp_path[MAX_PATH];
+
+    mirror_score_path(path, sizeof(path));
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        return TINYPKG_ERROR;
+    }
+
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) {
+        log_debug("Cannot write mirror scores: %s", tmp_path);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    fprintf(fp, "# url latency throughput successes failures last_probe last_used\n");
+    pthread_mutex_lock(&g_mirror_lock);
+    for (int i = 0; i < g_score_count; i++) {
+        fprintf(fp, "%s %.6f %.0f %d %d %ld %ld\n", g_scores[i].url,
+                g_scores[i].latency, g_scores[i].throughput,
+                g_scores[i].successes, g_scores[i].failures,
+                (long)g_scores[i].last_probe, (long)g_scores[i].last_used);
+    }
+    pthread_mutex_unlock(&g_mirror_lock);
+
+    if (fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return TINYPKG_ERROR_FILE;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Probe every mirror concurrently with a HEAD request
+int mirror_probe_all(void) {
+    download_context_t **probes;
+    int count;
+
+    pthread_mutex_lock(&g_mirror_lock);
+    count = g_score_count;
+    pthread_mutex_unlock(&g_mirror_lock);
+
+    if (count == 0) {
+        return TINYPKG_SUCCESS;
+    }
+
+    probes = TINYPKG_CALLOC(count, sizeof(download_context_t *));
+    if (!probes) {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    log_info("Probing %d mirrors", count);
+
+    for (int i = 0; i < count; i++) {
+        probes[i] = download_context_create(g_scores[i].url, "");
+        if (!probes[i]) continue;
+
+        probes[i]->mode = DOWNLOAD_MODE_HEAD;
+        probes[i]->low_speed_time = global_config->mirror_timeout;
+        if (download_submit(probes[i]) != TINYPKG_SUCCESS) {
+            download_context_free(probes[i]);
+            probes[i] = NULL;
+        }
+    }
+
+    time_t now = time(NULL);
+    for (int i = 0; i < count; i++) {
+        if (!probes[i]) {
+            mirror_record(g_scores[i].url, -1, 0, 0);
+            continue;
+        }
+
+        download_wait(probes[i]);
+
+        // Any HTTP answer means the mirror is reachable
+        int reachable = probes[i]->http_code > 0;
+        mirror_record(probes[i]->url, reachable ? probes[i]->first_byte_time : -1,
+                      0, reachable);
+        log_debug("Mirror %s: %s, %.0f ms", probes[i]->url,
+                  reachable ? "reachable" : "unreachable",
+                  probes[i]->first_byte_time * 1000.0);
+
+        pthread_mutex_lock(&g_mirror_lock);
+        g_scores[i].last_probe = now;
+        pthread_mutex_unlock(&g_mirror_lock);
+
+        download_context_free(probes[i]);
+    }
+
+    TINYPKG_FREE(probes);
+    mirror_save_scores();
+    return TINYPKG_SUCCESS;
+}
+
+// Fold one observation into a mirror's score. Negative latency or zero
+// throughput means "not measured".
+void mirror_record(const char *mirror_url, double latency, double throughput, int success) {
+    if (!mirror_url) return;
+
+    pthread_mutex_lock(&g_mirror_lock);
+    mirror_score_t *score = mirror_find(mirror_url);
+    if (score) {
+        if (latency >= 0) {
+            score->latency = (score->latency > 0) ?
+                MIRROR_EWMA_ALPHA * latency + (1 - MIRROR_EWMA_ALPHA) * score->latency :
+                latency;
+        }
+        if (throughput > 0) {
+            score->throughput = (score->throughput > 0) ?
+                MIRROR_EWMA_ALPHA * throughput + (1 - MIRROR_EWMA_ALPHA) * score->throughput :
+                throughput;
+        }
+        if (success) {
+            score->successes++;
+        } else {
+            score->failures++;
+        }
+        score->last_used = time(NULL);
+    }
+    pthread_mutex_unlock(&g_mirror_lock);
+}
+
+// Estimated seconds to fetch a reference-sized file, penalised by failures
+double mirror_estimate_cost(const mirror_score_t *score) {
+    if (!score) return 1e9;
+
+    double latency = score->latency > 0 ? score->latency : 1.0;
+    double throughput = score->throughput > 0 ? score->throughput : 1024.0 * 1024.0;
+    double failure_ratio = (double)score->failures /
+                           (double)(score->successes + score->failures + 1);
+
+    return (latency + MIRROR_REFERENCE_SIZE / throughput) * (1.0 + 4.0 * failure_ratio);
+}
+
+// Copy mirrors into ranked, best first
+int mirror_rank(mirror_score_t *ranked, int max_count) {
+    if (!ranked || max_count <= 0) return 0;
+
+    pthread_mutex_lock(&g_mirror_lock);
+    int count = MIN(g_score_count, max_count);
+    memcpy(ranked, g_scores, sizeof(mirror_score_t) * count);
+    pthread_mutex_unlock(&g_mirror_lock);
+
+    qsort(ranked, count, sizeof(mirror_score_t), mirror_compare_cost);
+    return count;
+}
+
+// Mirrors carry sources as <mirror>/<filename>
+int mirror_build_url(const char *mirror_url, const char *source_url,
+                     char *out, size_t out_size) {
+    if (!mirror_url || !source_url || !out) return TINYPKG_ERROR;
+
+    char *filename = utils_get_basename(source_url);
+    if (!filename) return TINYPKG_ERROR;
+
+    size_t base_len = strlen(mirror_url);
+    while (base_len > 0 && mirror_url[base_len - 1] == '/') base_len--;
+
+    int needed = snprintf(out, out_size, "%.*s/%s", (int)base_len, mirror_url, filename);
+    TINYPKG_FREE(filename);
+
+    return (needed > 0 && needed < (int)out_size) ? TINYPKG_SUCCESS : TINYPKG_ERROR;
+}
+
+// Race progress: the first racer to deliver MIRROR_RACE_BYTES wins and
+// every other racer aborts
+static int mirror_race_progress(void *clientp, double dltotal, double dlnow,
+                                double ultotal, double ulnow) {
+    mirror_racer_t *racer = (mirror_racer_t *)clientp;
+    UNUSED(dltotal);
+    UNUSED(ultotal);
+    UNUSED(ulnow);
+
+    if (racer->race->winner < 0 && dlnow >= MIRROR_RACE_BYTES) {
+        racer->race->winner = racer->index;
+    }
+    return racer->race->winner >= 0 && racer->race->winner != racer->index;
+}
+
+// Race two mirrors for the first bytes of a file. The winner keeps
+// downloading into part_path; returns the winner index or -1.
+static int mirror_race(const char *url_a, const char *url_b,
+                       const char *part_path, int *complete) {
+    mirror_race_t race = { .winner = -1 };
+    mirror_racer_t racers[2] = { { &race, 0 }, { &race, 1 } };
+    download_context_t *ctx[2];
+    char race_path[2][MAX_PATH];
+    const char *urls[2] = { url_a, url_b };
+    int winner;
+
+    *complete = 0;
+
+    for (int i = 0; i < 2; i++) {
+        if (snprintf(race_path[i], sizeof(race_path[i]), "%s.race%d", part_path, i) >=
+            (int)sizeof(race_path[i])) {
+            ctx[i] = NULL;
+        } else {
+            ctx[i] = download_context_create(urls[i], race_path[i]);
+        }
+        if (!ctx[i]) {
+            if (i == 1) download_context_free(ctx[0]);
+            return -1;
+        }
+        ctx[i]->progress_callback = mirror_race_progress;
+        ctx[i]->progress_data = &racers[i];
+        ctx[i]->low_speed_limit = (long)global_config->mirror_min_speed * 1024;
+        ctx[i]->low_speed_time = global_config->mirror_timeout;
+    }
+
+    log_debug("Racing mirrors %s and %s", url_a, url_b);
+
+    int submitted[2];
+    for (int i = 0; i < 2; i++) {
+        submitted[i] = download_submit(ctx[i]) == TINYPKG_SUCCESS;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (submitted[i]) download_wait(ctx[i]);
+    }
+
+    // Files smaller than the race threshold may finish without a winner
+    winner = race.winner;
+    if (winner < 0) {
+        if (submitted[0] && ctx[0]->result == TINYPKG_SUCCESS) {
+            winner = 0;
+        } else if (submitted[1] && ctx[1]->result == TINYPKG_SUCCESS) {
+            winner = 1;
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (i == winner) {
+            mirror_record(urls[i], ctx[i]->first_byte_time, ctx[i]->transfer_speed,
+                          ctx[i]->result == TINYPKG_SUCCESS);
+        } else if (winner >= 0 && race.winner >= 0 && submitted[i] &&
+                   ctx[i]->first_byte_time > 0) {
+            // Lost the race but answered: only the latency is informative
+            mirror_record(urls[i], ctx[i]->first_byte_time, 0, 1);
+        } else if (winner < 0 || ctx[i]->result != TINYPKG_SUCCESS) {
+            mirror_record(urls[i], -1, 0, 0);
+        }
+    }
+
+    if (winner >= 0) {
+        if (rename(race_path[winner], part_path) != 0) {
+            winner = -1;
+        } else {
+            *complete = ctx[winner]->result == TINYPKG_SUCCESS;
+            log_info("Mirror %s won the race", urls[winner]);
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        unlink(race_path[i]);
+        download_context_free(ctx[i]);
+    }
+
+    return winner;
+}
+
+// Download a source through the best mirrors, falling back to upstream
+int mirror_download_file(const char *source_url, const char *dest_path,
+                         const char *checksum) {
+    download_options_t options = { .max_retries = -1, .checksum = checksum };
+    return mirror_download_with_options(source_url, dest_path, &options);
+}
+
+// As mirror_download_file; options supplies the checksum and body sink.
+// Raced downloads are not streamed to the sink.
+int mirror_download_with_options(const char *source_url, const char *dest_path,
+                                 const download_options_t *options) {
+    const char *checksum = options ? options->checksum : NULL;
+    char part_path[MAX_PATH];
+    char url[MAX_URL];
+    mirror_score_t *ranked;
+    int count;
+    int start = 0;
+
+    if (!source_url || !dest_path) {
+        return TINYPKG_ERROR;
+    }
+
+    if (!g_mirror_initialized) {
+        mirror_init();
+    }
+
+    if (g_score_count == 0) {
+        return download_file_with_options(source_url, dest_path, options);
+    }
+
+    if (snprintf(part_path, sizeof(part_path), "%s.part", dest_path) >= (int)sizeof(part_path)) {
+        return TINYPKG_ERROR;
+    }
+
+    // Refresh stale scores once per run
+    pthread_mutex_lock(&g_mirror_lock);
+    int probe = !g_mirror_probed;
+    g_mirror_probed = 1;
+    time_t now = time(NULL);
+    int stale = 0;
+    for (int i = 0; i < g_score_count; i++) {
+        if (now - g_scores[i].last_probe > MIRROR_PROBE_INTERVAL) stale = 1;
+    }
+    pthread_mutex_unlock(&g_mirror_lock);
+    if (probe && stale) {
+        mirror_probe_all();
+    }
+
+    ranked = TINYPKG_CALLOC(g_score_count, sizeof(mirror_score_t));
+    if (!ranked) {
+        return TINYPKG_ERROR_MEMORY;
+    }
+    count = mirror_rank(ranked, g_score_count);
+
+    // Race the two best mirrors unless we are resuming a partial download
+    if (global_config->mirror_race && count >= 2 && !utils_file_exists(part_path)) {
+        char url_b[MAX_URL];
+        int complete = 0;
+
+        if (mirror_build_url(ranked[0].url, source_url, url, sizeof(url)) == TINYPKG_SUCCESS &&
+            mirror_build_url(ranked[1].url, source_url, url_b, sizeof(url_b)) == TINYPKG_SUCCESS) {
+            int winner = mirror_race(url, url_b, part_path, &complete);
+            if (winner == 1) {
+                mirror_score_t tmp = ranked[0];
+                ranked[0] = ranked[1];
+                ranked[1] = tmp;
+            }
+
+            if (winner >= 0 && complete) {
+                if (download_promote(part_path, dest_path, checksum, NULL) == TINYPKG_SUCCESS) {
+                    TINYPKG_FREE(ranked);
+                    mirror_save_scores();
+                    return TINYPKG_SUCCESS;
+                }
+                mirror_record(ranked[0].url, -1, 0, 0);
+                start = 1;
+            } else if (winner < 0) {
+                start = 2;
+            }
+        }
+    }
+
+    // Try mirrors in rank order; slow or failing mirrors are abandoned
+    download_options_t ranked_options = {
+        .max_retries = 1,
+        .segments = 0,
+        .low_speed_limit = (long)global_config->mirror_min_speed * 1024,
+        .low_speed_time = global_config->mirror_timeout,
+        .checksum = checksum,
+        .sink = options ? options->sink : NULL,
+        .sink_data = options ? options->sink_data : NULL,
+    };
+    char digest[256];
+
+    for (int i = start; i < count; i++) {
+        if (mirror_build_url(ranked[i].url, source_url, url, sizeof(url)) != TINYPKG_SUCCESS) {
+            continue;
+        }
+
+        size_t before = mirror_file_size(part_path);
+        double started = mirror_now();
+
+        log_info("Downloading from mirror: %s", url);
+        int result = download_fetch_part(url, part_path, &ranked_options, digest,
+                                         sizeof(digest));
+        if (result == TINYPKG_SUCCESS) {
+            double elapsed = mirror_now() - started;
+            size_t fetched = mirror_file_size(part_path) - MIN(before, mirror_file_size(part_path));
+
+            result = download_promote(part_path, dest_path, checksum, digest);
+            mirror_record(ranked[i].url, -1,
+                          elapsed > 0 ? (double)fetched / elapsed : 0,
+                          result == TINYPKG_SUCCESS);
+            if (result == TINYPKG_SUCCESS) {
+                TINYPKG_FREE(ranked);
+                mirror_save_scores();
+                return TINYPKG_SUCCESS;
+            }
+        } else {
+            mirror_record(ranked[i].url, -1, 0, 0);
+        }
+
+        log_warn("Mirror %s failed, trying next source", ranked[i].url);
+    }
+
+    TINYPKG_FREE(ranked);
+    mirror_save_scores();
+
+    // Upstream keeps whatever partial data the mirrors delivered
+    log_warn("All mirrors failed, falling back to upstream: %s", source_url);
+    download_options_t upstream = {
+        .max_retries = -1,
+        .checksum = checksum,
+        .sink = ranked_options.sink,
+        .sink_data = ranked_options.sink_data,
+    };
+    int result = download_fetch_part(source_url, part_path, &upstream, digest, sizeof(digest));
+    if (result != TINYPKG_SUCCESS) {
+        log_error("Download failed: %s", source_url);
+        return result;
+    }
+    return download_promote(part_path, dest_path, checksum, digest);
+}
@@ -0,0 +1,50 @@
+/*
+ * TinyPkg - Mirror Selection Header
+ * Mirror scoring, probing and racing for source downloads
+ */
+
+#ifndef TINYPKG_MIRROR_H
+#define TINYPKG_MIRROR_H
+
+#include <time.h>
+
+// Bytes a racing mirror must deliver first to win the race
+#define MIRROR_RACE_BYTES (64 * 1024)
+
+// Re-probe mirrors whose score is older than this (seconds)
+#define MIRROR_PROBE_INTERVAL (24 * 3600)
+
+// Persistent per-mirror score
+typedef struct mirror_score {
+    char url[MAX_URL];
+    double latency;           // Smoothed seconds to first byte
+    double throughput;        // Smoothed bytes per second (0 = unknown)
+    int successes;
+    int failures;
+    time_t last_probe;
+    time_t last_used;
+} mirror_score_t;
+
+// Function declarations
+
+// Mirror subsystem lifecycle
+int mirror_init(void);
+void mirror_cleanup(void);
+int mirror_load_scores(void);
+int mirror_save_scores(void);
+
+// Scoring
+int mirror_probe_all(void);
+void mirror_record(const char *mirror_url, double latency, double throughput, int success);
+double mirror_estimate_cost(const mirror_score_t *score);
+int mirror_rank(mirror_score_t *ranked, int max_count);
+
+// Downloads
+int mirror_build_url(const char *mirror_url, const char *source_url,
+                     char *out, size_t out_size);
+int mirror_download_file(const char *source_url, const char *dest_path,
+                         const char *checksum);
+int mirror_download_with_options(const char *source_url, const char *dest_path,
+                                 const download_options_t *options);
+
+#endif /* TINYPKG_MIRROR_H */
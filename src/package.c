@@ -5,10 +5,6 @@
 
 #include "../include/tinypkg.h"
 
-// Global package database
-static package_db_entry_t *package_db_head = NULL;
-static int package_db_loaded = 0;
-
 // Package installation function
 int package_install(const char *package_name)
 {
@@ -60,106 +56,132 @@ int package_install(const char *package_name)
         return result;
     }
 
-    // Set package state
-    package_set_state(package_name, PKG_STATE_DOWNLOADING);
-
-    // Install dependencies first
+    // Install dependencies and the package itself through the scheduler
     if (!global_config->skip_dependencies && pkg->dependencies)
     {
         log_info("Resolving dependencies for %s", package_name);
+        package_free(pkg);
 
-        char **install_order = NULL;
-        int install_count = 0;
-
-        result =
-            dependency_resolve(package_name, &install_order, &install_count);
-        if (result != TINYPKG_SUCCESS)
-        {
-            log_error("Dependency resolution failed for %s", package_name);
-            package_set_state(package_name, PKG_STATE_FAILED);
-            package_free(pkg);
-            return result;
-        }
-
-        // Install dependencies in order
-        for (int i = 0; i < install_count - 1; i++)
-        { // -1 to skip the package itself
-            if (!package_is_installed(install_order[i]))
-            {
-                log_info("Installing dependency: %s", install_order[i]);
-                result = package_install(install_order[i]);
-                if (result != TINYPKG_SUCCESS)
-                {
-                    log_error("Failed to install dependency: %s",
-                              install_order[i]);
-                    package_set_state(package_name, PKG_STATE_FAILED);
-                    // Free install_order
-                    for (int j = 0; j < install_count; j++)
-                    {
-                        TINYPKG_FREE(install_order[j]);
-                    }
-                    TINYPKG_FREE(install_order);
-                    package_free(pkg);
-                    return result;
-                }
-            }
-        }
-
-        // Free install_order
-        for (int i = 0; i < install_count; i++)
-        {
-            TINYPKG_FREE(install_order[i]);
-        }
-        TINYPKG_FREE(install_order);
+        char *targets[1] = {(char *)package_name};
+        return scheduler_install_packages(targets, 1);
     }
 
-    // Build and install the package
+    // Build and install the package; its state changes and database
+    // entry are written together once it is done
+    package_db_begin();
     package_set_state(package_name, PKG_STATE_BUILDING);
 
-    result = build_package(pkg);
+    result = package_build_and_stage(pkg, 0);
     if (result != TINYPKG_SUCCESS)
     {
-        log_error("Package build failed: %s", package_name);
         package_set_state(package_name, PKG_STATE_FAILED);
+        package_db_commit();
         package_free(pkg);
         return result;
     }
 
-    package_set_state(package_name, PKG_STATE_INSTALLING);
+    package_register_install(pkg);
+    package_free(pkg);
+    return package_db_commit();
+}
+
+// Build a package and install its files. Touches neither the package
+// database nor package state, so it is safe to call from build workers.
+// Every attempt ends up in the build history.
+int package_build_and_stage(package_t *pkg, int parallel_jobs)
+{
+    char artifact[MAX_PATH];
+    profile_t profile;
+    int result;
+
+    if (!pkg)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    profile_begin(&profile, pkg,
+                  parallel_jobs > 0 ? parallel_jobs
+                                    : (global_config ? global_config->parallel_jobs : 0));
+    pkg->profile = &profile;
+
+    // A cached build with the same inputs replaces the build
+    profile_phase_begin(&profile, PROFILE_PHASE_DOWNLOAD);
+    int cached = bincache_fetch(pkg, artifact, sizeof(artifact)) == TINYPKG_SUCCESS;
+    profile_phase_end(&profile, PROFILE_PHASE_DOWNLOAD);
+
+    if (cached && build_restore_package(pkg, artifact) == TINYPKG_SUCCESS)
+    {
+        profile_set_flag(&profile, PROFILE_FLAG_BINCACHE);
+        prefetch_cancel(pkg->name);
+        prefetch_release(pkg->name);
+    }
+    else
+    {
+        if (parallel_jobs > 0)
+        {
+            result = build_package_with_jobs(pkg, parallel_jobs);
+        }
+        else
+        {
+            result = build_package(pkg);
+        }
+
+        if (result != TINYPKG_SUCCESS)
+        {
+            log_error("Package build failed: %s", pkg->name);
+            goto out;
+        }
+    }
 
     // Install the built package
     result = build_install_package(pkg);
     if (result != TINYPKG_SUCCESS)
     {
-        log_error("Package installation failed: %s", package_name);
-        package_set_state(package_name, PKG_STATE_FAILED);
-        package_free(pkg);
-        return result;
+        log_error("Package installation failed: %s", pkg->name);
     }
 
-    // Update package database
-    pkg->install_time = time(NULL);
-    package_set_state(package_name, PKG_STATE_INSTALLED);
+out:
+    pkg->profile = NULL;
+    profile_finish(&profile, result);
+    return result;
+}
+
+// Record a successfully built package and run its post-install commands.
+// Must be called from the main thread.
+int package_register_install(package_t *pkg)
+{
+    int result;
 
+    if (!pkg)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    // Update package database; the new entry is in the installed state
+    pkg->install_time = time(NULL);
     result = package_db_add(pkg);
     if (result != TINYPKG_SUCCESS)
     {
-        log_warn("Failed to update package database for %s", package_name);
+        log_warn("Failed to update package database for %s", pkg->name);
+    }
+    if (depindex_add_package(pkg->name, pkg->dependencies, pkg->dep_count) !=
+        TINYPKG_SUCCESS)
+    {
+        log_warn("Failed to update dependency index for %s", pkg->name);
     }
 
     // Run post-install commands
     if (strlen(pkg->post_install_cmd) > 0)
     {
-        log_info("Running post-install commands for %s", package_name);
+        log_info("Running post-install commands for %s", pkg->name);
         result = utils_run_command(pkg->post_install_cmd, NULL);
         if (result != TINYPKG_SUCCESS)
         {
-            log_warn("Post-install commands failed for %s", package_name);
+            log_warn("Post-install commands failed for %s", pkg->name);
         }
     }
 
-    log_info("Package '%s' installed successfully", package_name);
-    package_free(pkg);
+    log_info("Package '%s' installed successfully", pkg->name);
     return TINYPKG_SUCCESS;
 }
 
@@ -226,19 +248,39 @@ int package_remove(const char *package_name)
     {
         log_info("Removing %d files for package %s", file_count, package_name);
 
-        // Remove files in reverse order (deepest first)
-        for (int i = file_count - 1; i >= 0; i--)
+        // The list holds files and symlinks only, so any order will do
+        int failed = verify_remove_files(file_list, file_count, 0);
+        if (failed != 0)
+        {
+            log_warn("Failed to remove %d files of %s", failed < 0 ? file_count : failed,
+                     package_name);
+        }
+
+        for (int i = 0; i < file_count; i++)
         {
-            if (unlink(file_list[i]) != 0 && errno != ENOENT)
-            {
-                log_warn("Failed to remove file: %s (%s)", file_list[i],
-                         strerror(errno));
-            }
             TINYPKG_FREE(file_list[i]);
         }
         TINYPKG_FREE(file_list);
     }
 
+    // Drop the package's files from the ownership index
+    if (fileindex_remove_package(package_name) != TINYPKG_SUCCESS)
+    {
+        log_warn("Failed to update file index for %s", package_name);
+    }
+    if (depindex_remove_package(package_name) != TINYPKG_SUCCESS)
+    {
+        log_warn("Failed to update dependency index for %s", package_name);
+    }
+
+    char file_list_path[MAX_PATH];
+    snprintf(file_list_path, sizeof(file_list_path), "%s/%s.files", LIB_DIR,
+             package_name);
+    unlink(file_list_path);
+    snprintf(file_list_path, sizeof(file_list_path), "%s/%s%s", LIB_DIR,
+             package_name, VERIFY_SUMS_SUFFIX);
+    unlink(file_list_path);
+
     // Remove from package database
     result = package_db_remove(package_name);
     if (result != TINYPKG_SUCCESS)
@@ -250,11 +292,11 @@ int package_remove(const char *package_name)
     return TINYPKG_SUCCESS;
 }
 
-int package_update(const char *package_name)
+// Remove a package together with everything that depends on it
+int package_remove_recursive(const char *package_name)
 {
-    package_t *current_pkg = NULL;
-    package_t *new_pkg = NULL;
-    version_t current_version, new_version;
+    char **dependents = NULL;
+    int dependent_count = 0;
     int result;
 
     if (!package_name)
@@ -262,132 +304,72 @@ int package_update(const char *package_name)
         return TINYPKG_ERROR;
     }
 
-    log_info("Updating package: %s", package_name);
-
-    // Check if installed
     if (!package_is_installed(package_name))
     {
-        log_info("Package '%s' not installed, installing instead",
-                 package_name);
-        return package_install(package_name);
-    }
-
-    // Get current version
-    package_db_entry_t *db_entry = package_db_find(package_name);
-    if (!db_entry)
-    {
-        log_error("Package '%s' not found in database", package_name);
-        return TINYPKG_ERROR;
-    }
-
-    // Load new package information
-    new_pkg = package_load_info(package_name);
-    if (!new_pkg)
-    {
-        log_error("Failed to load package information: %s", package_name);
-        return TINYPKG_ERROR;
-    }
-
-    // Compare versions
-    result = version_parse(db_entry->version, &current_version);
-    if (result != TINYPKG_SUCCESS)
-    {
-        log_error("Failed to parse current version: %s", db_entry->version);
-        package_free(new_pkg);
-        return result;
+        log_warn("Package '%s' is not installed", package_name);
+        return TINYPKG_SUCCESS;
     }
 
-    result = version_parse(new_pkg->version, &new_version);
+    result = dependency_find_all_dependents(package_name, &dependents,
+                                            &dependent_count);
     if (result != TINYPKG_SUCCESS)
     {
-        log_error("Failed to parse new version: %s", new_pkg->version);
-        package_free(new_pkg);
+        log_error("Failed to find packages depending on %s", package_name);
         return result;
     }
 
-    int version_cmp = version_compare(&current_version, &new_version);
-    if (version_cmp >= 0 && !global_config->force_mode)
+    if (dependent_count > 0)
     {
-        log_info("Package '%s' is already up to date (version %s)",
-                 package_name, db_entry->version);
-        package_free(new_pkg);
-        return TINYPKG_SUCCESS;
+        log_info("Removing %s and %d package(s) that depend on it",
+                 package_name, dependent_count);
     }
 
-    log_info("Updating package '%s' from version %s to %s", package_name,
-             db_entry->version, new_pkg->version);
-
-    // Backup config files
-    package_backup_config_files(new_pkg);
-
-    // Remove old version
-    result = package_remove(package_name);
-    if (result != TINYPKG_SUCCESS)
+    // Dependents come first, so every removal leaves nothing broken. Each
+    // package_remove() records its removal as soon as its files are gone.
+    for (int i = 0; i < dependent_count && result == TINYPKG_SUCCESS; i++)
     {
-        log_error("Failed to remove old version of %s", package_name);
-        package_free(new_pkg);
-        return result;
+        result = package_remove(dependents[i]);
     }
-
-    // Install new version
-    result = package_install(package_name);
-    if (result != TINYPKG_SUCCESS)
+    if (result == TINYPKG_SUCCESS)
     {
-        log_error("Failed to install new version of %s", package_name);
-        // Try to restore old version if possible
-        log_info("Attempting to restore previous version...");
-        package_free(new_pkg);
-        return result;
+        result = package_remove(package_name);
     }
 
-    // Restore config files
-    package_restore_config_files(new_pkg);
-
-    package_free(new_pkg);
-    log_info("Package '%s' updated successfully", package_name);
-    return TINYPKG_SUCCESS;
+    utils_string_array_free(dependents, dependent_count);
+    return result;
 }
 
-int package_update_all(void)
+int package_update(const char *package_name)
 {
-    package_db_entry_t *entry;
-    int updated_count = 0;
-    int failed_count = 0;
+    char *names[1];
 
-    log_info("Updating all installed packages");
-
-    // Ensure database is loaded
-    if (package_db_load() != TINYPKG_SUCCESS)
+    if (!package_name)
     {
-        log_error("Failed to load package database");
         return TINYPKG_ERROR;
     }
 
-    entry = package_db_head;
-    while (entry)
+    log_info("Updating package: %s", package_name);
+
+    // Check if installed
+    if (!package_is_installed(package_name))
     {
-        int result = package_update(entry->name);
-        if (result == TINYPKG_SUCCESS)
-        {
-            updated_count++;
-        }
-        else
-        {
-            failed_count++;
-            log_warn("Failed to update package: %s", entry->name);
-        }
-        entry = entry->next;
+        log_info("Package '%s' not installed, installing instead",
+                 package_name);
+        return package_install(package_name);
     }
 
-    log_info("Package update completed: %d updated, %d failed", updated_count,
-             failed_count);
+    // The new version is built over the installed one, along with any
+    // dependents it breaks
+    names[0] = (char *)package_name;
+    return planner_update(names, 1);
+}
 
-    if (failed_count > 0)
-    {
-        return TINYPKG_ERROR;
-    }
+int package_update_all(void)
+{
+    log_info("Updating all installed packages");
 
-    return TINYPKG_SUCCESS;
+    // Only packages touched by a sync since the last update are compared
+    return planner_update(NULL, 0);
 }
 
 int package_query(const char *package_name)
@@ -432,6 +414,11 @@ int package_query(const char *package_name)
         printf("Build Time: %d seconds\n", pkg->build_time_estimate);
     }
 
+    if (pkg->memory_estimate > 0)
+    {
+        printf("Build Memory: %d MB\n", pkg->memory_estimate);
+    }
+
     printf("Status: ");
     if (db_entry)
     {
@@ -509,11 +496,11 @@ int package_list(const char *pattern)
     printf("%.80s\n", "--------------------------------------------------------"
                       "------------------------");
 
-    entry = package_db_head;
+    entry = package_db_get_all();
     while (entry)
     {
-        if (!pattern || strstr(entry->name, pattern) ||
-            strstr(entry->description, pattern))
+        if (!pattern || strcasestr(entry->name, pattern) ||
+            strcasestr(entry->description, pattern))
         {
             printf("%-20s %-12s %-50.50s ", entry->name, entry->version,
                    entry->description);
@@ -530,26 +517,36 @@ int package_list(const char *pattern)
 
 int package_search(const char *pattern)
 {
-    // This would search through the repository
-    // For now, simplified implementation
-    printf("Searching for packages matching: %s\n", pattern);
+    return package_search_format(pattern, SEARCH_OUTPUT_TEXT);
+}
 
-    // Search through repository files
-    char search_cmd[MAX_CMD];
-    snprintf(search_cmd, sizeof(search_cmd),
-             "find %s -name '*.json' -exec grep -l '%s' {} \\;", REPO_DIR,
-             pattern);
+int package_search_format(const char *pattern, search_output_t format)
+{
+    if (!pattern)
+    {
+        return TINYPKG_ERROR;
+    }
 
-    return utils_run_command(search_cmd, NULL);
+    return search_print(pattern, format);
 }
 
 package_t *package_load_info(const char *package_name)
 {
+    package_t *pkg;
+
     if (!package_name)
     {
         return NULL;
     }
 
+    // The precompiled index answers without parsing JSON while it matches
+    // the checked out repositories
+    pkg = repoindex_load_package(package_name);
+    if (pkg)
+    {
+        return pkg;
+    }
+
     return json_parser_load_package(package_name);
 }
 
@@ -564,25 +561,9 @@ int package_is_installed(const char *package_name)
 }
 
 // Package database operations
-int package_db_add(const package_t *pkg)
+static void package_db_fill_entry(package_db_entry_t *entry, const package_t *pkg)
 {
-    package_db_entry_t *entry;
-
-    if (!pkg)
-    {
-        return TINYPKG_ERROR;
-    }
-
-    // Remove existing entry if present
-    package_db_remove(pkg->name);
-
-    // Create new entry
-    entry = TINYPKG_CALLOC(1, sizeof(package_db_entry_t));
-    if (!entry)
-    {
-        return TINYPKG_ERROR_MEMORY;
-    }
-
+    memset(entry, 0, sizeof(*entry));
     strncpy(entry->name, pkg->name, sizeof(entry->name) - 1);
     strncpy(entry->version, pkg->version, sizeof(entry->version) - 1);
     strncpy(entry->description, pkg->description,
@@ -590,170 +571,75 @@ int package_db_add(const package_t *pkg)
     entry->install_time = pkg->install_time;
     entry->installed_size = pkg->size_estimate; // This should be calculated
     entry->state = PKG_STATE_INSTALLED;
-
-    // Add to linked list
-    entry->next = package_db_head;
-    package_db_head = entry;
-
-    // Save database
-    return package_db_save();
 }
 
-int package_db_remove(const char *package_name)
+int package_db_add(const package_t *pkg)
 {
-    package_db_entry_t *entry, *prev = NULL;
+    package_db_entry_t entry;
 
-    if (!package_name)
+    if (!pkg)
     {
         return TINYPKG_ERROR;
     }
 
-    entry = package_db_head;
-    while (entry)
-    {
-        if (TINYPKG_STREQ(entry->name, package_name))
-        {
-            if (prev)
-            {
-                prev->next = entry->next;
-            }
-            else
-            {
-                package_db_head = entry->next;
-            }
-
-            package_db_entry_free(entry);
-            return package_db_save();
-        }
-        prev = entry;
-        entry = entry->next;
-    }
-
-    return TINYPKG_SUCCESS; // Not found, but not an error
+    package_db_fill_entry(&entry, pkg);
+    return pkgdb_put(&entry);
 }
 
-package_db_entry_t *package_db_find(const char *package_name)
+int package_db_update(const package_t *pkg)
 {
-    package_db_entry_t *entry;
+    package_db_entry_t entry;
+    package_db_entry_t *existing;
 
-    if (!package_name)
+    if (!pkg)
     {
-        return NULL;
+        return TINYPKG_ERROR;
     }
 
-    entry = package_db_head;
-    while (entry)
+    existing = package_db_find(pkg->name);
+    if (!existing)
     {
-        if (TINYPKG_STREQ(entry->name, package_name))
-        {
-            return entry;
-        }
-        entry = entry->next;
+        return package_db_add(pkg);
     }
 
-    return NULL;
-}
-
-package_db_entry_t *package_db_get_all(void)
-{
-    if (package_db_load() != TINYPKG_SUCCESS)
-    {
-        return NULL;
-    }
-    return package_db_head;
+    // Keep the recorded install time and state
+    package_db_fill_entry(&entry, pkg);
+    entry.install_time = existing->install_time;
+    entry.state = existing->state;
+    return pkgdb_put(&entry);
 }
 
-int package_db_save(void)
+int package_db_remove(const char *package_name)
 {
-    char db_file[MAX_PATH];
-    FILE *fp;
-    package_db_entry_t *entry;
-
-    snprintf(db_file, sizeof(db_file), "%s/installed.txt", LIB_DIR);
-
-    fp = fopen(db_file, "w");
-    if (!fp)
-    {
-        log_error("Failed to open database file for writing: %s", db_file);
-        return TINYPKG_ERROR_FILE;
-    }
-
-    fprintf(fp, "# TinyPkg Installed Packages Database\n");
-    fprintf(
-        fp,
-        "# Format: "
-        "name\tversion\tdescription\tinstall_time\tinstalled_size\tstate\n");
-
-    entry = package_db_head;
-    while (entry)
+    if (!package_name)
     {
-        fprintf(fp, "%s\t%s\t%s\t%ld\t%zu\t%d\n", entry->name, entry->version,
-                entry->description, entry->install_time, entry->installed_size,
-                entry->state);
-        entry = entry->next;
+        return TINYPKG_ERROR;
     }
 
-    fclose(fp);
-    return TINYPKG_SUCCESS;
+    return pkgdb_delete(package_name);
 }
 
-int package_db_load(void)
+package_db_entry_t *package_db_find(const char *package_name)
 {
-    char db_file[MAX_PATH];
-    FILE *fp;
-    char line[1024];
-    package_db_entry_t *entry;
-
-    if (package_db_loaded)
+    if (!package_name)
     {
-        return TINYPKG_SUCCESS;
+        return NULL;
     }
 
-    snprintf(db_file, sizeof(db_file), "%s/installed.txt", LIB_DIR);
+    return pkgdb_find(package_name);
+}
 
-    fp = fopen(db_file, "r");
-    if (!fp)
-    {
-        // Database doesn't exist yet, not an error
-        package_db_loaded = 1;
-        return TINYPKG_SUCCESS;
-    }
+package_db_entry_t *package_db_get_all(void) { return pkgdb_list(); }
 
-    while (fgets(line, sizeof(line), fp))
-    {
-        // Skip comments and empty lines
-        if (line[0] == '#' || line[0] == '\n')
-        {
-            continue;
-        }
+int package_db_save(void) { return pkgdb_compact(); }
 
-        entry = TINYPKG_CALLOC(1, sizeof(package_db_entry_t));
-        if (!entry)
-        {
-            fclose(fp);
-            return TINYPKG_ERROR_MEMORY;
-        }
+int package_db_load(void) { return pkgdb_open(); }
 
-        int fields =
-            sscanf(line, "%255s\t%63s\t%511[^\t]\t%ld\t%zu\t%d", entry->name,
-                   entry->version, entry->description, &entry->install_time,
-                   &entry->installed_size, (int *)&entry->state);
+int package_db_begin(void) { return pkgdb_begin(); }
 
-        if (fields >= 3)
-        { // Minimum required fields
-            entry->next = package_db_head;
-            package_db_head = entry;
-        }
-        else
-        {
-            package_db_entry_free(entry);
-        }
-    }
+int package_db_commit(void) { return pkgdb_commit(); }
 
-    fclose(fp);
-    package_db_loaded = 1;
-    return TINYPKG_SUCCESS;
-}
+void package_db_rollback(void) { pkgdb_rollback(); }
 
 // Memory management functions
 package_t *package_create(void)
@@ -850,7 +736,18 @@ int package_validate(const package_t *pkg)
 
 int package_check_conflicts(const package_t *pkg)
 {
-    if (!pkg || !pkg->conflicts)
+    if (!pkg)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    // Make sure the file index exists before builds start querying it
+    if (fileindex_open() != TINYPKG_SUCCESS)
+    {
+        log_warn("File ownership index unavailable");
+    }
+
+    if (!pkg->conflicts)
     {
         return TINYPKG_SUCCESS;
     }
@@ -868,6 +765,56 @@ int package_check_conflicts(const package_t *pkg)
     return TINYPKG_SUCCESS;
 }
 
+// File-level conflicts: staged files owned by another installed package
+int package_check_file_conflicts(const package_t *pkg, char **files, int count)
+{
+    char **owners;
+    int conflicts = 0;
+
+    if (!pkg || !files || count <= 0)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    owners = TINYPKG_CALLOC(count, sizeof(char *));
+    if (!owners)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    if (package_owns_files((const char **)files, count, owners) > 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (owners[i] && !TINYPKG_STREQ(owners[i], pkg->name))
+            {
+                if (conflicts < 10)
+                {
+                    log_error("File %s from '%s' is owned by installed package '%s'",
+                              files[i], pkg->name, owners[i]);
+                }
+                conflicts++;
+            }
+        }
+    }
+    utils_string_array_free(owners, count);
+
+    if (conflicts == 0)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    if (global_config && global_config->force_mode)
+    {
+        log_warn("Overwriting %d files owned by other packages (force mode)",
+                 conflicts);
+        return TINYPKG_SUCCESS;
+    }
+
+    log_error("Package '%s' has %d file conflicts", pkg->name, conflicts);
+    return TINYPKG_ERROR_DEPENDENCY;
+}
+
 // State management
 const char *package_state_to_string(package_state_t state)
 {
@@ -922,8 +869,9 @@ int package_set_state(const char *package_name, package_state_t state)
     package_db_entry_t *entry = package_db_find(package_name);
     if (entry)
     {
-        entry->state = state;
-        return package_db_save();
+        package_db_entry_t updated = *entry;
+        updated.state = state;
+        return pkgdb_put(&updated);
     }
 
     // Package not in database yet, just log the state change
@@ -1100,8 +1048,18 @@ int version_is_compatible(const version_t *required, const version_t *available)
         return 0;
     }
 
-    // For now, simple compatibility: available >= required
-    return version_compare(available, required) >= 0;
+    if (version_compare(available, required) < 0)
+    {
+        return 0;
+    }
+
+    // Caret semantics: the major version is the interface, or the minor
+    // one while still below 1.0
+    if (available->major != required->major)
+    {
+        return 0;
+    }
+    return required->major != 0 || available->minor == required->minor;
 }
 
 // Package utilities
@@ -1155,7 +1113,7 @@ char **package_get_file_list(const char *package_name, int *count)
         return NULL;
     }
 
-    while (fgets(line, sizeof(line), fp) && *count < allocated)
+    while (fgets(line, sizeof(line), fp))
     {
         // Remove newline
         size_t len = strlen(line);
@@ -1216,50 +1174,102 @@ int package_owns_file(const char *file_path, char *owner_package,
         return 0;
     }
 
-    // Ensure database is loaded
-    if (package_db_load() != TINYPKG_SUCCESS)
+    return fileindex_lookup(file_path, owner_package, owner_size);
+}
+
+// Batch ownership query: owners[i] is set to an allocated package name or
+// NULL. Returns the number of paths owned by installed packages.
+int package_owns_files(const char **file_paths, int count, char **owners)
+{
+    if (!file_paths || !owners || count <= 0)
     {
         return 0;
     }
 
-    // Check each installed package's file list
-    package_db_entry_t *entry = package_db_head;
-    while (entry)
+    return fileindex_lookup_batch(file_paths, count, owners);
+}
+
+// Print the package that installed a file. Paths are recorded as
+// installed, so a symlinked path is only resolved when not found as given.
+int package_query_owner(const char *file_path)
+{
+    char path[MAX_PATH];
+    char resolved[MAX_PATH];
+    char owner[MAX_NAME];
+    char cwd[MAX_PATH];
+
+    if (!file_path)
     {
-        int file_count = 0;
-        char **files = package_get_file_list(entry->name, &file_count);
+        return TINYPKG_ERROR;
+    }
 
-        if (files)
-        {
-            for (int i = 0; i < file_count; i++)
-            {
-                if (strcmp(files[i], file_path) == 0)
-                {
-                    strncpy(owner_package, entry->name, owner_size - 1);
-                    owner_package[owner_size - 1] = '\0';
+    int length;
+    if (file_path[0] != '/' && getcwd(cwd, sizeof(cwd)))
+    {
+        length = snprintf(path, sizeof(path), "%s/%s", cwd, file_path);
+    }
+    else
+    {
+        length = snprintf(path, sizeof(path), "%s", file_path);
+    }
+    if (length < 0 || (size_t)length >= sizeof(path))
+    {
+        log_error("Query path too long: %s", file_path);
+        return TINYPKG_ERROR;
+    }
 
-                    // Free file list
-                    for (int j = 0; j < file_count; j++)
-                    {
-                        TINYPKG_FREE(files[j]);
-                    }
-                    TINYPKG_FREE(files);
-                    return 1;
-                }
-            }
+    if (package_owns_file(path, owner, sizeof(owner)) ||
+        (realpath(path, resolved) && package_owns_file(resolved, owner, sizeof(owner))))
+    {
+        printf("%s is owned by %s\n", file_path, owner);
+        return TINYPKG_SUCCESS;
+    }
 
-            // Free file list
-            for (int i = 0; i < file_count; i++)
-            {
-                TINYPKG_FREE(files[i]);
-            }
-            TINYPKG_FREE(files);
-        }
+    printf("No installed package owns %s\n", file_path);
+    return TINYPKG_ERROR;
+}
 
-        entry = entry->next;
+// Record the files a package installed, one absolute path per line
+int package_write_file_list(const char *package_name, char **files, int count)
+{
+    char file_list_path[MAX_PATH];
+    char temp_path[MAX_PATH];
+    FILE *fp;
+
+    if (!package_name || (count > 0 && !files))
+    {
+        return TINYPKG_ERROR;
+    }
+
+    snprintf(file_list_path, sizeof(file_list_path), "%s/%s.files", LIB_DIR,
+             package_name);
+    if ((size_t)snprintf(temp_path, sizeof(temp_path), "%s.tmp", file_list_path) >=
+        sizeof(temp_path))
+    {
+        log_error("File list path too long: %s", file_list_path);
+        return TINYPKG_ERROR;
+    }
+
+    utils_create_directory_recursive(LIB_DIR);
+    fp = fopen(temp_path, "w");
+    if (!fp)
+    {
+        log_error("Failed to write file list: %s", temp_path);
+        return TINYPKG_ERROR_FILE;
     }
 
-    return 0;
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(fp, "%s\n", files[i]);
+    }
+
+    if (fclose(fp) != 0 || rename(temp_path, file_list_path) != 0)
+    {
+        unlink(temp_path);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    return TINYPKG_SUCCESS;
 }
 
 int package_backup_config_files(const package_t *pkg)
@@ -1306,38 +1316,18 @@ int package_verify_integrity(const char *package_name)
         return TINYPKG_ERROR;
     }
 
-    package_t *pkg = package_load_info(package_name);
-    if (!pkg)
-    {
-        log_error("Failed to load package information: %s", package_name);
-        return TINYPKG_ERROR;
-    }
-
     // Basic integrity check - verify package files exist
-    int file_count = 0;
-    char **files = package_get_file_list(package_name, &file_count);
-    int missing_files = 0;
-
-    if (files)
+    verify_result_t check;
+    int result = verify_packages(&package_name, 1, VERIFY_MODE_EXISTS, 0, &check);
+    if (result != TINYPKG_SUCCESS)
     {
-        for (int i = 0; i < file_count; i++)
-        {
-            if (!utils_file_exists(files[i]))
-            {
-                log_warn("Missing file: %s", files[i]);
-                missing_files++;
-            }
-            TINYPKG_FREE(files[i]);
-        }
-        TINYPKG_FREE(files);
+        return result;
     }
 
-    package_free(pkg);
-
-    if (missing_files > 0)
+    if (check.missing > 0)
     {
         log_error("Package '%s' has %d missing files", package_name,
-                  missing_files);
+                  check.missing);
         return TINYPKG_ERROR;
     }
 
@@ -1360,7 +1350,7 @@ int package_get_stats(package_stats_t *stats)
         return TINYPKG_ERROR;
     }
 
-    package_db_entry_t *entry = package_db_head;
+    package_db_entry_t *entry = package_db_get_all();
     while (entry)
     {
         stats->total_packages++;
@@ -35,6 +35,7 @@ typedef struct package {
     
     // Build information
     build_type_t build_system;
+    int disable_ninja;          // "ninja": false keeps CMake on Makefiles
     char build_cmd[MAX_CMD];
     char install_cmd[MAX_CMD];
     char pre_build_cmd[MAX_CMD];
@@ -55,6 +56,7 @@ typedef struct package {
     char category[64];
     size_t size_estimate;       // Estimated installed size in bytes
     int build_time_estimate;    // Estimated build time in seconds
+    int memory_estimate;        // Estimated peak build memory in MB
     package_state_t state;
     time_t install_time;
     version_t parsed_version;
@@ -62,6 +64,7 @@ typedef struct package {
     // Internal fields
     char json_file[MAX_PATH];
     int ref_count;
+    struct profile *profile;    // Set while package_build_and_stage() runs
 } package_t;
 
 // Package database entry
@@ -89,13 +92,19 @@ typedef struct package_search_result {
 // Package lifecycle management
 int package_install(const char *package_name);
 int package_remove(const char *package_name);
+int package_remove_recursive(const char *package_name);
 int package_update(const char *package_name);
 int package_update_all(void);
 
+// Installation steps (build_and_stage is safe to run on build workers)
+int package_build_and_stage(package_t *pkg, int parallel_jobs);
+int package_register_install(package_t *pkg);
+
 // Package information
 int package_query(const char *package_name);
 int package_list(const char *pattern);
 int package_search(const char *pattern);
+int package_search_format(const char *pattern, search_output_t format);
 package_t *package_load_info(const char *package_name);
 int package_is_installed(const char *package_name);
 
@@ -108,9 +117,15 @@ package_db_entry_t *package_db_get_all(void);
 int package_db_save(void);
 int package_db_load(void);
 
+// Batch database updates into one commit; see pkgdb_begin()
+int package_db_begin(void);
+int package_db_commit(void);
+void package_db_rollback(void);
+
 // Package validation
 int package_validate(const package_t *pkg);
 int package_check_conflicts(const package_t *pkg);
+int package_check_file_conflicts(const package_t *pkg, char **files, int count);
 int package_verify_integrity(const char *package_name);
 
 // Version handling
@@ -134,7 +149,10 @@ package_state_t package_get_state(const char *package_name);
 // Package utilities
 int package_get_installed_size(const char *package_name);
 char **package_get_file_list(const char *package_name, int *count);
+int package_write_file_list(const char *package_name, char **files, int count);
 int package_owns_file(const char *file_path, char *owner_package, size_t owner_size);
+int package_owns_files(const char **file_paths, int count, char **owners);
+int package_query_owner(const char *file_path);
 int package_backup_config_files(const package_t *pkg);
 int package_restore_config_files(const package_t *pkg);
 
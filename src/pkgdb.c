@@ -0,0 +1,1549 @@
+/*
+ * TinyPkg - Installed Package Database Implementation
+ * Memory-mapped binary database with a hashed name index and a journal
+ */
+
+#include "../include/tinypkg.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+// Cached entry. Entries are never freed before pkgdb_close(), so pointers
+// handed out by pkgdb_find()/pkgdb_list() survive later updates.
+typedef struct pkgdb_slot
+{
+    package_db_entry_t entry;
+    uint32_t hash;
+    int removed;
+    uint32_t txn;               // Last transaction that saved an undo copy
+} pkgdb_slot_t;
+
+// State of an entry before the open transaction first touched it
+typedef struct pkgdb_undo
+{
+    pkgdb_slot_t *slot;
+    package_db_entry_t before;
+    int removed;
+} pkgdb_undo_t;
+
+// Open database: the mapped file plus an in-memory overlay holding
+// journal records and entries already looked up. Before writing, the
+// overlay catches up with whatever other processes wrote meanwhile.
+typedef struct pkgdb
+{
+    int opened;
+    void *map;
+    size_t map_size;
+    ino_t inode;                // Of the mapped file, to notice replacements
+    dev_t device;
+    const pkgdb_header_t *header;
+    const pkgdb_record_t *records;
+    const uint32_t *index;
+    const char *strtab;
+
+    pkgdb_slot_t **table;
+    uint32_t capacity;
+    uint32_t used;
+
+    int journal_fd;
+    off_t journal_end;          // Records up to here are in the overlay
+    int journal_records;
+    int all_loaded;
+    int list_dirty;
+    package_db_entry_t *head;
+
+    // Open transaction
+    int txn_depth;
+    int txn_aborted;
+    uint32_t txn_id;
+    pkgdb_undo_t *undo;
+    int undo_count;
+    int undo_capacity;
+} pkgdb_t;
+
+static pkgdb_t g_pkgdb = {.journal_fd = -1};
+
+// File lock, kept apart from g_pkgdb so closing the database after a
+// failed open does not forget it
+static int g_pkgdb_lock_fd = -1;
+static int g_pkgdb_lock_depth = 0;
+
+static void pkgdb_path(char *path, size_t size, const char *file)
+{
+    snprintf(path, size, "%s/%s", LIB_DIR, file);
+}
+
+static void pkgdb_copy(char *dest, size_t size, const char *src, size_t length)
+{
+    length = MIN(length, size - 1);
+    memcpy(dest, src, length);
+    dest[length] = '\0';
+}
+
+// Overlay table
+static pkgdb_slot_t *pkgdb_overlay_find(const char *name, uint32_t hash)
+{
+    if (g_pkgdb.capacity == 0)
+    {
+        return NULL;
+    }
+
+    uint32_t mask = g_pkgdb.capacity - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        pkgdb_slot_t *slot = g_pkgdb.table[i];
+        if (!slot)
+        {
+            return NULL;
+        }
+        if (slot->hash == hash && TINYPKG_STREQ(slot->entry.name, name))
+        {
+            return slot;
+        }
+    }
+}
+
+static int pkgdb_overlay_insert(pkgdb_slot_t *slot)
+{
+    // Keep the load factor below 3/4
+    if ((g_pkgdb.used + 1) * 4 > g_pkgdb.capacity * 3)
+    {
+        uint32_t capacity = g_pkgdb.capacity ? g_pkgdb.capacity * 2 : 64;
+        pkgdb_slot_t **table = TINYPKG_CALLOC(capacity, sizeof(pkgdb_slot_t *));
+        if (!table)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+
+        for (uint32_t i = 0; i < g_pkgdb.capacity; i++)
+        {
+            pkgdb_slot_t *old = g_pkgdb.table[i];
+            if (old)
+            {
+                uint32_t j = old->hash & (capacity - 1);
+                while (table[j])
+                {
+                    j = (j + 1) & (capacity - 1);
+                }
+                table[j] = old;
+            }
+        }
+
+        TINYPKG_FREE(g_pkgdb.table);
+        g_pkgdb.table = table;
+        g_pkgdb.capacity = capacity;
+    }
+
+    uint32_t mask = g_pkgdb.capacity - 1;
+    uint32_t i = slot->hash & mask;
+    while (g_pkgdb.table[i])
+    {
+        i = (i + 1) & mask;
+    }
+    g_pkgdb.table[i] = slot;
+    g_pkgdb.used++;
+    return TINYPKG_SUCCESS;
+}
+
+static pkgdb_slot_t *pkgdb_slot_create(const char *name, uint32_t hash)
+{
+    pkgdb_slot_t *slot = TINYPKG_CALLOC(1, sizeof(pkgdb_slot_t));
+    if (!slot)
+    {
+        return NULL;
+    }
+
+    strncpy(slot->entry.name, name, sizeof(slot->entry.name) - 1);
+    slot->hash = hash;
+    if (pkgdb_overlay_insert(slot) != TINYPKG_SUCCESS)
+    {
+        TINYPKG_FREE(slot);
+        return NULL;
+    }
+    return slot;
+}
+
+// Mapped file
+static const char *pkgdb_string(uint32_t offset)
+{
+    return offset < g_pkgdb.header->strtab_size ? g_pkgdb.strtab + offset : "";
+}
+
+static const pkgdb_record_t *pkgdb_disk_find(const char *name, uint32_t hash)
+{
+    const pkgdb_header_t *header = g_pkgdb.header;
+
+    if (!header || header->record_count == 0)
+    {
+        return NULL;
+    }
+
+    uint32_t mask = header->bucket_count - 1;
+    for (uint32_t i = hash & mask, probes = 0; probes < header->bucket_count;
+         i = (i + 1) & mask, probes++)
+    {
+        uint32_t ref = g_pkgdb.index[i];
+        if (ref == 0 || ref > header->record_count)
+        {
+            return NULL;
+        }
+
+        const pkgdb_record_t *record = &g_pkgdb.records[ref - 1];
+        if (record->hash == hash && TINYPKG_STREQ(pkgdb_string(record->name), name))
+        {
+            return record;
+        }
+    }
+    return NULL;
+}
+
+static pkgdb_slot_t *pkgdb_slot_from_record(const pkgdb_record_t *record)
+{
+    pkgdb_slot_t *slot = pkgdb_slot_create(pkgdb_string(record->name), record->hash);
+    if (!slot)
+    {
+        return NULL;
+    }
+
+    const char *version = pkgdb_string(record->version);
+    const char *description = pkgdb_string(record->description);
+    pkgdb_copy(slot->entry.version, sizeof(slot->entry.version), version,
+               strlen(version));
+    pkgdb_copy(slot->entry.description, sizeof(slot->entry.description),
+               description, strlen(description));
+    slot->entry.install_time = (time_t)record->install_time;
+    slot->entry.installed_size = (size_t)record->installed_size;
+    slot->entry.state = (package_state_t)record->state;
+    return slot;
+}
+
+// Find a cached entry, pulling it in from the mapped file on first use
+static pkgdb_slot_t *pkgdb_lookup(const char *name)
+{
+    uint32_t hash = utils_hash_string(name);
+    pkgdb_slot_t *slot = pkgdb_overlay_find(name, hash);
+
+    if (!slot && !g_pkgdb.all_loaded)
+    {
+        const pkgdb_record_t *record = pkgdb_disk_find(name, hash);
+        if (record)
+        {
+            slot = pkgdb_slot_from_record(record);
+        }
+    }
+    return slot;
+}
+
+static void pkgdb_unmap(void)
+{
+    if (g_pkgdb.map)
+    {
+        munmap(g_pkgdb.map, g_pkgdb.map_size);
+    }
+    g_pkgdb.map = NULL;
+    g_pkgdb.map_size = 0;
+    g_pkgdb.inode = 0;
+    g_pkgdb.device = 0;
+    g_pkgdb.header = NULL;
+    g_pkgdb.records = NULL;
+    g_pkgdb.index = NULL;
+    g_pkgdb.strtab = NULL;
+}
+
+static int pkgdb_map(const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return errno == ENOENT ? TINYPKG_SUCCESS : TINYPKG_ERROR_FILE;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(pkgdb_header_t))
+    {
+        close(fd);
+        log_error("Package database is truncated: %s", path);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        log_error("Failed to map package database: %s", strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+
+    const pkgdb_header_t *header = (const pkgdb_header_t *)map;
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t records_end =
+        header->records_offset + (uint64_t)header->record_count * sizeof(pkgdb_record_t);
+    uint64_t index_end =
+        header->index_offset + (uint64_t)header->bucket_count * sizeof(uint32_t);
+
+    if (memcmp(header->magic, PKGDB_MAGIC, sizeof(PKGDB_MAGIC)) != 0 ||
+        header->version != PKGDB_FORMAT_VERSION || header->file_size != size ||
+        header->bucket_count == 0 ||
+        (header->bucket_count & (header->bucket_count - 1)) != 0 ||
+        header->bucket_count <= header->record_count || records_end > size ||
+        index_end > size || header->strtab_size == 0 ||
+        header->strtab_offset + header->strtab_size > size ||
+        ((const char *)map)[header->strtab_offset + header->strtab_size - 1] != '\0')
+    {
+        munmap(map, (size_t)st.st_size);
+        log_error("Package database is corrupt: %s", path);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    g_pkgdb.map = map;
+    g_pkgdb.map_size = (size_t)st.st_size;
+    g_pkgdb.inode = st.st_ino;
+    g_pkgdb.device = st.st_dev;
+    g_pkgdb.header = header;
+    g_pkgdb.records = (const pkgdb_record_t *)((const char *)map + header->records_offset);
+    g_pkgdb.index = (const uint32_t *)((const char *)map + header->index_offset);
+    g_pkgdb.strtab = (const char *)map + header->strtab_offset;
+    return TINYPKG_SUCCESS;
+}
+
+// Apply an update to the overlay
+static int pkgdb_apply_put(const package_db_entry_t *entry)
+{
+    pkgdb_slot_t *slot = pkgdb_lookup(entry->name);
+    if (!slot)
+    {
+        slot = pkgdb_slot_create(entry->name, utils_hash_string(entry->name));
+        if (!slot)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+    }
+
+    if (&slot->entry != entry)
+    {
+        pkgdb_copy(slot->entry.version, sizeof(slot->entry.version), entry->version,
+                   strlen(entry->version));
+        pkgdb_copy(slot->entry.description, sizeof(slot->entry.description),
+                   entry->description, strlen(entry->description));
+        slot->entry.install_time = entry->install_time;
+        slot->entry.installed_size = entry->installed_size;
+        slot->entry.state = entry->state;
+    }
+    slot->removed = 0;
+    g_pkgdb.list_dirty = 1;
+    return TINYPKG_SUCCESS;
+}
+
+static void pkgdb_apply_delete(const char *name)
+{
+    pkgdb_slot_t *slot = pkgdb_lookup(name);
+    if (slot)
+    {
+        slot->removed = 1;
+        g_pkgdb.list_dirty = 1;
+    }
+}
+
+// Journal
+static int pkgdb_journal_open(void)
+{
+    char path[MAX_PATH];
+
+    if (g_pkgdb.journal_fd >= 0)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    utils_create_directory_recursive(LIB_DIR);
+    pkgdb_path(path, sizeof(path), PKGDB_JOURNAL_FILE);
+    g_pkgdb.journal_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (g_pkgdb.journal_fd < 0)
+    {
+        log_error("Failed to open package journal %s: %s", path, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static uint32_t pkgdb_journal_checksum(const pkgdb_journal_record_t *record,
+                                       const char *strings, size_t length)
+{
+    pkgdb_journal_record_t copy = *record;
+    copy.checksum = 0;
+    return utils_hash_bytes(utils_hash_bytes(UTILS_FNV_SEED, &copy, sizeof(copy)),
+                            strings, length);
+}
+
+static int pkgdb_read_full(int fd, void *buf, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = read(fd, (char *)buf + done, length - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return TINYPKG_ERROR;
+        }
+        done += (size_t)n;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static int pkgdb_write_full(int fd, const void *buf, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = write(fd, (const char *)buf + done, length - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return TINYPKG_ERROR_FILE;
+        }
+        done += (size_t)n;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Replay the journal into the overlay. A torn record at the end (from a
+// crash mid-append) is cut off, and so is a batch missing any record.
+static int pkgdb_journal_read(int fd, pkgdb_journal_record_t *record, char *strings,
+                              size_t *length)
+{
+    if (pkgdb_read_full(fd, record, sizeof(*record)) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    *length = (size_t)record->name_len + record->version_len + record->description_len;
+    if (record->magic != PKGDB_JOURNAL_MAGIC ||
+        (record->name_len == 0) != (record->op == PKGDB_OP_BATCH) ||
+        record->name_len >= MAX_NAME || record->version_len >= MAX_VERSION ||
+        record->description_len >= MAX_DESCRIPTION ||
+        pkgdb_read_full(fd, strings, *length) != TINYPKG_SUCCESS ||
+        pkgdb_journal_checksum(record, strings, *length) != record->checksum)
+    {
+        return TINYPKG_ERROR;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// The undo copy of a slot the open transaction has changed, or NULL
+static pkgdb_undo_t *pkgdb_txn_undo(const pkgdb_slot_t *slot)
+{
+    if (g_pkgdb.txn_depth == 0 || slot->txn != g_pkgdb.txn_id)
+    {
+        return NULL;
+    }
+    for (int i = 0; i < g_pkgdb.undo_count; i++)
+    {
+        if (g_pkgdb.undo[i].slot == slot)
+        {
+            return &g_pkgdb.undo[i];
+        }
+    }
+    return NULL;
+}
+
+// Set what is on disk for a slot (entry NULL: not installed). An entry
+// the open transaction changed keeps its new value and rolls back to this.
+static void pkgdb_slot_set_stored(pkgdb_slot_t *slot, const package_db_entry_t *entry)
+{
+    pkgdb_undo_t *undo = pkgdb_txn_undo(slot);
+    package_db_entry_t *target = undo ? &undo->before : &slot->entry;
+    int *removed = undo ? &undo->removed : &slot->removed;
+
+    *removed = entry == NULL;
+    if (entry)
+    {
+        pkgdb_copy(target->version, sizeof(target->version), entry->version,
+                   strlen(entry->version));
+        pkgdb_copy(target->description, sizeof(target->description), entry->description,
+                   strlen(entry->description));
+        target->install_time = entry->install_time;
+        target->installed_size = entry->installed_size;
+        target->state = entry->state;
+    }
+    g_pkgdb.list_dirty = 1;
+}
+
+static int pkgdb_journal_apply(const pkgdb_journal_record_t *record, const char *strings)
+{
+    package_db_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    pkgdb_copy(entry.name, sizeof(entry.name), strings, record->name_len);
+
+    pkgdb_slot_t *slot = pkgdb_lookup(entry.name);
+    if (record->op == PKGDB_OP_DELETE)
+    {
+        if (slot)
+        {
+            pkgdb_slot_set_stored(slot, NULL);
+        }
+        return TINYPKG_SUCCESS;
+    }
+
+    pkgdb_copy(entry.version, sizeof(entry.version), strings + record->name_len,
+               record->version_len);
+    pkgdb_copy(entry.description, sizeof(entry.description),
+               strings + record->name_len + record->version_len, record->description_len);
+    entry.install_time = (time_t)record->install_time;
+    entry.installed_size = (size_t)record->installed_size;
+    entry.state = (package_state_t)record->state;
+    if (!slot)
+    {
+        slot = pkgdb_slot_create(entry.name, utils_hash_string(entry.name));
+        if (!slot)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+    }
+    pkgdb_slot_set_stored(slot, &entry);
+    return TINYPKG_SUCCESS;
+}
+
+// Read a batch body; it is applied only once every record checks out
+static int pkgdb_journal_replay_batch(int fd, uint32_t count, off_t *length)
+{
+    size_t record_size = sizeof(pkgdb_journal_record_t) + MAX_NAME + MAX_VERSION +
+                         MAX_DESCRIPTION;
+    char *buffer = TINYPKG_MALLOC(MAX((size_t)count, 1) * record_size);
+    int result = TINYPKG_ERROR;
+    uint32_t i;
+
+    if (!buffer)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    *length = 0;
+    for (i = 0; i < count; i++)
+    {
+        pkgdb_journal_record_t *record = (pkgdb_journal_record_t *)(buffer + i * record_size);
+        size_t strings_length;
+
+        if (pkgdb_journal_read(fd, record, (char *)(record + 1), &strings_length) !=
+                TINYPKG_SUCCESS ||
+            record->op == PKGDB_OP_BATCH)
+        {
+            break;
+        }
+        *length += (off_t)(sizeof(*record) + strings_length);
+    }
+
+    if (i == count)
+    {
+        result = TINYPKG_SUCCESS;
+        for (i = 0; i < count && result == TINYPKG_SUCCESS; i++)
+        {
+            pkgdb_journal_record_t *record =
+                (pkgdb_journal_record_t *)(buffer + i * record_size);
+            result = pkgdb_journal_apply(record, (const char *)(record + 1));
+        }
+    }
+
+    TINYPKG_FREE(buffer);
+    return result;
+}
+
+// Apply the records appended since journal_end. Called with the file lock
+// held, so a torn tail can be cut off.
+static int pkgdb_journal_replay(void)
+{
+    char path[MAX_PATH];
+    char strings[MAX_NAME + MAX_VERSION + MAX_DESCRIPTION];
+    pkgdb_journal_record_t record;
+    off_t valid_end = g_pkgdb.journal_end;
+    size_t length;
+
+    pkgdb_path(path, sizeof(path), PKGDB_JOURNAL_FILE);
+    if (!utils_file_exists(path))
+    {
+        return TINYPKG_SUCCESS;
+    }
+    if (pkgdb_journal_open() != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR_FILE;
+    }
+
+    int fd = g_pkgdb.journal_fd;
+    lseek(fd, valid_end, SEEK_SET);
+
+    while (pkgdb_journal_read(fd, &record, strings, &length) == TINYPKG_SUCCESS)
+    {
+        off_t batch_length = 0;
+        int result;
+
+        if (record.op == PKGDB_OP_BATCH)
+        {
+            result = pkgdb_journal_replay_batch(fd, record.state, &batch_length);
+        }
+        else
+        {
+            result = pkgdb_journal_apply(&record, strings);
+        }
+
+        if (result == TINYPKG_ERROR_MEMORY)
+        {
+            return result;
+        }
+        if (result != TINYPKG_SUCCESS)
+        {
+            break;
+        }
+        g_pkgdb.journal_records += record.op == PKGDB_OP_BATCH ? (int)record.state : 1;
+        valid_end += (off_t)(sizeof(record) + length) + batch_length;
+    }
+
+    g_pkgdb.journal_end = valid_end;
+    if (lseek(fd, 0, SEEK_END) != valid_end)
+    {
+        log_warn("Discarding incomplete package journal record");
+        if (ftruncate(fd, valid_end) != 0)
+        {
+            return TINYPKG_ERROR_FILE;
+        }
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Take the file lock; nested calls only count. Readers that cannot create
+// the lock file go without, as no writer has used it yet.
+static int pkgdb_lock(void)
+{
+    char path[MAX_PATH];
+
+    if (g_pkgdb_lock_depth++ > 0)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    utils_create_directory_recursive(LIB_DIR);
+    pkgdb_path(path, sizeof(path), PKGDB_LOCK_FILE);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0)
+    {
+        if (errno == ENOENT || errno == EACCES)
+        {
+            return TINYPKG_SUCCESS;
+        }
+        log_error("Cannot open package database lock %s: %s", path, strerror(errno));
+        g_pkgdb_lock_depth--;
+        return TINYPKG_ERROR_FILE;
+    }
+    while (flock(fd, LOCK_EX) != 0)
+    {
+        if (errno != EINTR)
+        {
+            log_error("Failed to lock package database: %s", strerror(errno));
+            close(fd);
+            g_pkgdb_lock_depth--;
+            return TINYPKG_ERROR_FILE;
+        }
+    }
+    g_pkgdb_lock_fd = fd;
+    return TINYPKG_SUCCESS;
+}
+
+static void pkgdb_unlock(void)
+{
+    if (g_pkgdb_lock_depth == 0 || --g_pkgdb_lock_depth > 0)
+    {
+        return;
+    }
+    if (g_pkgdb_lock_fd >= 0)
+    {
+        close(g_pkgdb_lock_fd);
+        g_pkgdb_lock_fd = -1;
+    }
+}
+
+// Reset every cached entry to what the newly mapped file holds
+static int pkgdb_reload_slots(void)
+{
+    for (uint32_t i = 0; i < g_pkgdb.capacity; i++)
+    {
+        pkgdb_slot_t *slot = g_pkgdb.table[i];
+        if (!slot)
+        {
+            continue;
+        }
+
+        const pkgdb_record_t *record = pkgdb_disk_find(slot->entry.name, slot->hash);
+        if (!record)
+        {
+            pkgdb_slot_set_stored(slot, NULL);
+            continue;
+        }
+
+        package_db_entry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        const char *version = pkgdb_string(record->version);
+        const char *description = pkgdb_string(record->description);
+        pkgdb_copy(entry.version, sizeof(entry.version), version, strlen(version));
+        pkgdb_copy(entry.description, sizeof(entry.description), description,
+                   strlen(description));
+        entry.install_time = (time_t)record->install_time;
+        entry.installed_size = (size_t)record->installed_size;
+        entry.state = (package_state_t)record->state;
+        pkgdb_slot_set_stored(slot, &entry);
+    }
+
+    // Packages only the new file has are looked up there again
+    g_pkgdb.all_loaded = 0;
+    g_pkgdb.list_dirty = 1;
+    return TINYPKG_SUCCESS;
+}
+
+// Catch up with what other processes wrote since we last looked: their
+// journal records, or the file a compaction of theirs swapped in. Called
+// with the file lock held.
+static int pkgdb_sync_locked(void)
+{
+    char path[MAX_PATH];
+    struct stat st;
+    struct stat journal_st;
+
+    pkgdb_path(path, sizeof(path), PKGDB_FILE);
+    int present = stat(path, &st) == 0;
+    int replaced = present ? !g_pkgdb.header || st.st_ino != g_pkgdb.inode ||
+                                 st.st_dev != g_pkgdb.device
+                           : g_pkgdb.header != NULL;
+    if (g_pkgdb.journal_fd >= 0 && fstat(g_pkgdb.journal_fd, &journal_st) == 0 &&
+        journal_st.st_size < g_pkgdb.journal_end)
+    {
+        replaced = 1;
+    }
+
+    if (replaced)
+    {
+        log_debug("Package database changed on disk, reloading");
+        pkgdb_unmap();
+        int result = pkgdb_map(path);
+        if (result != TINYPKG_SUCCESS)
+        {
+            return result;
+        }
+        pkgdb_reload_slots();
+        g_pkgdb.journal_end = 0;
+        g_pkgdb.journal_records = 0;
+    }
+    return pkgdb_journal_replay();
+}
+
+// Encode a record into buffer; returns its length
+static size_t pkgdb_journal_encode(pkgdb_op_t op, const package_db_entry_t *entry,
+                                   uint32_t batch_count, char *buffer)
+{
+    pkgdb_journal_record_t record;
+
+    memset(&record, 0, sizeof(record));
+    record.magic = PKGDB_JOURNAL_MAGIC;
+    record.op = (uint16_t)op;
+    if (op == PKGDB_OP_BATCH)
+    {
+        record.state = batch_count;
+    }
+    else
+    {
+        record.name_len = (uint16_t)strnlen(entry->name, MAX_NAME - 1);
+    }
+    if (op == PKGDB_OP_PUT)
+    {
+        record.version_len = (uint16_t)strnlen(entry->version, MAX_VERSION - 1);
+        record.description_len =
+            (uint16_t)strnlen(entry->description, MAX_DESCRIPTION - 1);
+        record.state = (uint32_t)entry->state;
+        record.install_time = (int64_t)entry->install_time;
+        record.installed_size = (uint64_t)entry->installed_size;
+    }
+
+    char *strings = buffer + sizeof(record);
+    if (entry)
+    {
+        memcpy(strings, entry->name, record.name_len);
+        memcpy(strings + record.name_len, entry->version, record.version_len);
+        memcpy(strings + record.name_len + record.version_len, entry->description,
+               record.description_len);
+    }
+
+    size_t length = (size_t)record.name_len + record.version_len +
+                    record.description_len;
+    record.checksum = pkgdb_journal_checksum(&record, strings, length);
+    memcpy(buffer, &record, sizeof(record));
+    return sizeof(record) + length;
+}
+
+static int pkgdb_journal_write(const char *buffer, size_t length, int records)
+{
+    if (pkgdb_journal_open() != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR_FILE;
+    }
+
+    // A failed append is cut off again so later records stay reachable
+    off_t end = lseek(g_pkgdb.journal_fd, 0, SEEK_END);
+    if (pkgdb_write_full(g_pkgdb.journal_fd, buffer, length) != TINYPKG_SUCCESS ||
+        fdatasync(g_pkgdb.journal_fd) != 0)
+    {
+        log_error("Failed to append to package journal: %s", strerror(errno));
+        if (end >= 0 && ftruncate(g_pkgdb.journal_fd, end) != 0)
+        {
+            log_warn("Failed to truncate package journal: %s", strerror(errno));
+        }
+        return TINYPKG_ERROR_FILE;
+    }
+
+    g_pkgdb.journal_end = end + (off_t)length;
+    g_pkgdb.journal_records += records;
+    return TINYPKG_SUCCESS;
+}
+
+static int pkgdb_journal_append(pkgdb_op_t op, const package_db_entry_t *entry)
+{
+    char buffer[sizeof(pkgdb_journal_record_t) + MAX_NAME + MAX_VERSION +
+                MAX_DESCRIPTION];
+
+    size_t length = pkgdb_journal_encode(op, entry, 0, buffer);
+    return pkgdb_journal_write(buffer, length, 1);
+}
+
+static int pkgdb_compact_locked(void);
+
+// Fold the journal into a new database file once it grows. Called with
+// the file lock held.
+static int pkgdb_maybe_compact(void)
+{
+    int threshold = PKGDB_COMPACT_MIN_RECORDS;
+
+    // Compaction would write out uncommitted entries
+    if (g_pkgdb.txn_depth > 0)
+    {
+        return TINYPKG_SUCCESS;
+    }
+    if (g_pkgdb.header)
+    {
+        threshold = MAX(threshold, (int)(g_pkgdb.header->record_count / 4));
+    }
+
+    if (g_pkgdb.journal_records < threshold)
+    {
+        return TINYPKG_SUCCESS;
+    }
+    return pkgdb_compact_locked();
+}
+
+// Database lifecycle
+int pkgdb_open(void)
+{
+    char path[MAX_PATH];
+    char legacy[MAX_PATH];
+    int result;
+
+    if (g_pkgdb.opened)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    pkgdb_path(path, sizeof(path), PKGDB_FILE);
+    pkgdb_path(legacy, sizeof(legacy), PKGDB_LEGACY_FILE);
+    g_pkgdb.opened = 1;
+
+    result = pkgdb_lock();
+    if (result != TINYPKG_SUCCESS)
+    {
+        pkgdb_close();
+        return result;
+    }
+
+    result = pkgdb_map(path);
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = pkgdb_journal_replay();
+    }
+
+    if (result == TINYPKG_SUCCESS && !g_pkgdb.header && utils_file_exists(legacy))
+    {
+        result = pkgdb_migrate_legacy(legacy);
+    }
+    pkgdb_unlock();
+
+    if (result != TINYPKG_SUCCESS)
+    {
+        log_error("Failed to open package database");
+        pkgdb_close();
+    }
+    return result;
+}
+
+void pkgdb_close(void)
+{
+    if (g_pkgdb.txn_depth > 0)
+    {
+        log_warn("Discarding uncommitted package database changes");
+    }
+    pkgdb_unmap();
+
+    if (g_pkgdb.journal_fd >= 0)
+    {
+        close(g_pkgdb.journal_fd);
+    }
+
+    for (uint32_t i = 0; i < g_pkgdb.capacity; i++)
+    {
+        TINYPKG_FREE(g_pkgdb.table[i]);
+    }
+    TINYPKG_FREE(g_pkgdb.table);
+    TINYPKG_FREE(g_pkgdb.undo);
+
+    memset(&g_pkgdb, 0, sizeof(g_pkgdb));
+    g_pkgdb.journal_fd = -1;
+}
+
+// Lookups
+package_db_entry_t *pkgdb_find(const char *package_name)
+{
+    if (!package_name || pkgdb_open() != TINYPKG_SUCCESS)
+    {
+        return NULL;
+    }
+
+    metrics_add(METRICS_PKGDB_LOOKUPS, 1);
+    pkgdb_slot_t *slot = pkgdb_lookup(package_name);
+    return (slot && !slot->removed) ? &slot->entry : NULL;
+}
+
+static int pkgdb_compare_slots(const void *a, const void *b)
+{
+    const pkgdb_slot_t *sa = *(const pkgdb_slot_t *const *)a;
+    const pkgdb_slot_t *sb = *(const pkgdb_slot_t *const *)b;
+    return strcmp(sa->entry.name, sb->entry.name);
+}
+
+// Collect live entries sorted by name. Returns the count or -1.
+static int pkgdb_collect(pkgdb_slot_t ***out)
+{
+    if (!g_pkgdb.all_loaded && g_pkgdb.header)
+    {
+        for (uint32_t i = 0; i < g_pkgdb.header->record_count; i++)
+        {
+            const pkgdb_record_t *record = &g_pkgdb.records[i];
+            if (!pkgdb_overlay_find(pkgdb_string(record->name), record->hash) &&
+                !pkgdb_slot_from_record(record))
+            {
+                return -1;
+            }
+        }
+    }
+    g_pkgdb.all_loaded = 1;
+
+    pkgdb_slot_t **slots = TINYPKG_MALLOC((g_pkgdb.used + 1) * sizeof(pkgdb_slot_t *));
+    if (!slots)
+    {
+        return -1;
+    }
+
+    int count = 0;
+    for (uint32_t i = 0; i < g_pkgdb.capacity; i++)
+    {
+        if (g_pkgdb.table[i] && !g_pkgdb.table[i]->removed)
+        {
+            slots[count++] = g_pkgdb.table[i];
+        }
+    }
+    qsort(slots, count, sizeof(pkgdb_slot_t *), pkgdb_compare_slots);
+
+    *out = slots;
+    return count;
+}
+
+// All installed packages as a list sorted by name. Removed entries keep
+// their next pointer, so a caller walking the list while packages are
+// removed still reaches the end.
+package_db_entry_t *pkgdb_list(void)
+{
+    pkgdb_slot_t **slots;
+
+    if (pkgdb_open() != TINYPKG_SUCCESS)
+    {
+        return NULL;
+    }
+
+    if (g_pkgdb.all_loaded && !g_pkgdb.list_dirty)
+    {
+        return g_pkgdb.head;
+    }
+
+    int count = pkgdb_collect(&slots);
+    if (count < 0)
+    {
+        return NULL;
+    }
+
+    g_pkgdb.head = NULL;
+    for (int i = count - 1; i >= 0; i--)
+    {
+        slots[i]->entry.next = g_pkgdb.head;
+        g_pkgdb.head = &slots[i]->entry;
+    }
+    g_pkgdb.list_dirty = 0;
+
+    TINYPKG_FREE(slots);
+    return g_pkgdb.head;
+}
+
+int pkgdb_count(void)
+{
+    int count = 0;
+    for (package_db_entry_t *entry = pkgdb_list(); entry; entry = entry->next)
+    {
+        count++;
+    }
+    return count;
+}
+
+// Transactions
+static int pkgdb_txn_save(const char *name)
+{
+    pkgdb_slot_t *slot = pkgdb_lookup(name);
+    int existed = slot != NULL;
+
+    if (!slot)
+    {
+        slot = pkgdb_slot_create(name, utils_hash_string(name));
+        if (!slot)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+    }
+    if (slot->txn == g_pkgdb.txn_id)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    if (g_pkgdb.undo_count == g_pkgdb.undo_capacity)
+    {
+        int capacity = g_pkgdb.undo_capacity ? g_pkgdb.undo_capacity * 2 : 32;
+        pkgdb_undo_t *undo = TINYPKG_REALLOC(g_pkgdb.undo, capacity * sizeof(pkgdb_undo_t));
+        if (!undo)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        g_pkgdb.undo = undo;
+        g_pkgdb.undo_capacity = capacity;
+    }
+
+    pkgdb_undo_t *undo = &g_pkgdb.undo[g_pkgdb.undo_count++];
+    undo->slot = slot;
+    undo->before = slot->entry;
+    undo->removed = existed ? slot->removed : 1;
+    slot->removed = undo->removed;
+    slot->txn = g_pkgdb.txn_id;
+    return TINYPKG_SUCCESS;
+}
+
+static void pkgdb_txn_end(void)
+{
+    g_pkgdb.undo_count = 0;
+    g_pkgdb.txn_depth = 0;
+    g_pkgdb.txn_aborted = 0;
+}
+
+int pkgdb_in_transaction(void)
+{
+    return g_pkgdb.txn_depth > 0;
+}
+
+int pkgdb_begin(void)
+{
+    int result = pkgdb_open();
+    if (result != TINYPKG_SUCCESS)
+    {
+        return result;
+    }
+
+    if (g_pkgdb.txn_depth++ == 0)
+    {
+        g_pkgdb.txn_id++;
+        g_pkgdb.undo_count = 0;
+        g_pkgdb.txn_aborted = 0;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Restore every touched entry, newest change first
+void pkgdb_rollback(void)
+{
+    if (g_pkgdb.txn_depth == 0)
+    {
+        return;
+    }
+    if (--g_pkgdb.txn_depth > 0)
+    {
+        g_pkgdb.txn_aborted = 1;
+        return;
+    }
+
+    for (int i = g_pkgdb.undo_count - 1; i >= 0; i--)
+    {
+        pkgdb_undo_t *undo = &g_pkgdb.undo[i];
+        package_db_entry_t *next = undo->slot->entry.next;
+
+        undo->slot->entry = undo->before;
+        undo->slot->entry.next = next;
+        undo->slot->removed = undo->removed;
+    }
+    if (g_pkgdb.undo_count > 0)
+    {
+        log_debug("Rolled back %d package database changes", g_pkgdb.undo_count);
+        g_pkgdb.list_dirty = 1;
+    }
+    pkgdb_txn_end();
+}
+
+// Write the transaction as one journal batch, or as a fresh database file
+// when the batch alone would trigger compaction
+int pkgdb_commit(void)
+{
+    size_t record_size = sizeof(pkgdb_journal_record_t) + MAX_NAME + MAX_VERSION +
+                         MAX_DESCRIPTION;
+    int result;
+
+    if (g_pkgdb.txn_depth == 0)
+    {
+        return TINYPKG_ERROR;
+    }
+    if (g_pkgdb.txn_depth > 1)
+    {
+        g_pkgdb.txn_depth--;
+        return TINYPKG_SUCCESS;
+    }
+    if (g_pkgdb.txn_aborted)
+    {
+        pkgdb_rollback();
+        return TINYPKG_ERROR;
+    }
+    if (g_pkgdb.undo_count == 0)
+    {
+        pkgdb_txn_end();
+        return TINYPKG_SUCCESS;
+    }
+
+    // Pick up other processes' changes first, so they survive a compaction
+    // and a rollback restores what is really on disk
+    result = pkgdb_lock();
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = pkgdb_sync_locked();
+        if (result != TINYPKG_SUCCESS)
+        {
+            pkgdb_unlock();
+        }
+    }
+    if (result != TINYPKG_SUCCESS)
+    {
+        pkgdb_rollback();
+        return result;
+    }
+
+    int count = g_pkgdb.undo_count;
+    int threshold = PKGDB_COMPACT_MIN_RECORDS;
+    if (g_pkgdb.header)
+    {
+        threshold = MAX(threshold, (int)(g_pkgdb.header->record_count / 4));
+    }
+
+    if (g_pkgdb.journal_records + count >= threshold)
+    {
+        g_pkgdb.txn_depth = 0;
+        result = pkgdb_compact_locked();
+    }
+    else
+    {
+        char *buffer = TINYPKG_MALLOC((size_t)(count + 1) * record_size);
+        size_t length;
+
+        if (!buffer)
+        {
+            pkgdb_unlock();
+            pkgdb_rollback();
+            return TINYPKG_ERROR_MEMORY;
+        }
+
+        length = pkgdb_journal_encode(PKGDB_OP_BATCH, NULL, (uint32_t)count, buffer);
+        for (int i = 0; i < count; i++)
+        {
+            const pkgdb_slot_t *slot = g_pkgdb.undo[i].slot;
+            length += pkgdb_journal_encode(slot->removed ? PKGDB_OP_DELETE : PKGDB_OP_PUT,
+                                           &slot->entry, 0, buffer + length);
+        }
+
+        result = pkgdb_journal_write(buffer, length, count);
+        TINYPKG_FREE(buffer);
+    }
+    pkgdb_unlock();
+
+    if (result != TINYPKG_SUCCESS)
+    {
+        log_error("Failed to commit %d package database changes", count);
+        g_pkgdb.txn_depth = 1;
+        pkgdb_rollback();
+        return result;
+    }
+
+    log_debug("Committed %d package database changes", count);
+    pkgdb_txn_end();
+    return TINYPKG_SUCCESS;
+}
+
+// Updates
+int pkgdb_put(const package_db_entry_t *entry)
+{
+    int result;
+
+    if (!entry || strlen(entry->name) == 0)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    result = pkgdb_open();
+    if (result != TINYPKG_SUCCESS)
+    {
+        return result;
+    }
+
+    // Inside a transaction the change waits in the overlay for the commit
+    if (g_pkgdb.txn_depth > 0)
+    {
+        result = pkgdb_txn_save(entry->name);
+        return result == TINYPKG_SUCCESS ? pkgdb_apply_put(entry) : result;
+    }
+
+    // Syncing may rewrite a cached entry the caller passed in
+    package_db_entry_t copy = *entry;
+
+    result = pkgdb_lock();
+    if (result != TINYPKG_SUCCESS)
+    {
+        return result;
+    }
+    result = pkgdb_sync_locked();
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = pkgdb_journal_append(PKGDB_OP_PUT, &copy);
+    }
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = pkgdb_apply_put(&copy);
+    }
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = pkgdb_maybe_compact();
+    }
+    pkgdb_unlock();
+    return result;
+}
+
+int pkgdb_delete(const char *package_name)
+{
+    int result;
+
+    if (!package_name)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    if (!pkgdb_find(package_name))
+    {
+        return TINYPKG_SUCCESS; // Not found, but not an error
+    }
+
+    package_db_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.name, package_name, sizeof(entry.name) - 1);
+
+    if (g_pkgdb.txn_depth > 0)
+    {
+        result = pkgdb_txn_save(entry.name);
+        if (result == TINYPKG_SUCCESS)
+        {
+            pkgdb_apply_delete(entry.name);
+        }
+        return result;
+    }
+
+    result = pkgdb_lock();
+    if (result != TINYPKG_SUCCESS)
+    {
+        return result;
+    }
+    result = pkgdb_sync_locked();
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = pkgdb_journal_append(PKGDB_OP_DELETE, &entry);
+    }
+    if (result == TINYPKG_SUCCESS)
+    {
+        pkgdb_apply_delete(entry.name);
+        result = pkgdb_maybe_compact();
+    }
+    pkgdb_unlock();
+    return result;
+}
+
+// String table builder for compaction
+typedef struct pkgdb_strtab
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+} pkgdb_strtab_t;
+
+static int pkgdb_strtab_add(pkgdb_strtab_t *strtab, const char *str, uint32_t *offset)
+{
+    size_t length = strlen(str) + 1;
+
+    if (strtab->size + length > strtab->capacity)
+    {
+        size_t capacity = MAX(strtab->capacity * 2, strtab->size + length + 4096);
+        char *data = TINYPKG_REALLOC(strtab->data, capacity);
+        if (!data)
+        {
+            return TINYPKG_ERROR_MEMORY;
+        }
+        strtab->data = data;
+        strtab->capacity = capacity;
+    }
+
+    memcpy(strtab->data + strtab->size, str, length);
+    *offset = (uint32_t)strtab->size;
+    strtab->size += length;
+    return TINYPKG_SUCCESS;
+}
+
+// Write every live entry to a fresh database file, swap it in and empty
+// the journal. The file lock is held throughout, so the journal holds
+// nothing the new file lacks and the temporary file is ours alone.
+static int pkgdb_compact_locked(void)
+{
+    char path[MAX_PATH];
+    char temp_path[MAX_PATH];
+    pkgdb_slot_t **slots = NULL;
+    pkgdb_record_t *records = NULL;
+    uint32_t *index = NULL;
+    pkgdb_strtab_t strtab = {0};
+    pkgdb_header_t header;
+    int result = TINYPKG_ERROR_MEMORY;
+
+    int count = pkgdb_collect(&slots);
+    if (count < 0)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    uint32_t buckets = 16;
+    while (buckets < (uint32_t)count * 2)
+    {
+        buckets *= 2;
+    }
+
+    records = TINYPKG_CALLOC(count + 1, sizeof(pkgdb_record_t));
+    index = TINYPKG_CALLOC(buckets, sizeof(uint32_t));
+    if (!records || !index)
+    {
+        goto out;
+    }
+
+    // Offset 0 is the empty string
+    uint32_t empty;
+    if (pkgdb_strtab_add(&strtab, "", &empty) != TINYPKG_SUCCESS)
+    {
+        goto out;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const package_db_entry_t *entry = &slots[i]->entry;
+        pkgdb_record_t *record = &records[i];
+
+        if (pkgdb_strtab_add(&strtab, entry->name, &record->name) != TINYPKG_SUCCESS ||
+            pkgdb_strtab_add(&strtab, entry->version, &record->version) != TINYPKG_SUCCESS ||
+            pkgdb_strtab_add(&strtab, entry->description, &record->description) !=
+                TINYPKG_SUCCESS)
+        {
+            goto out;
+        }
+        record->state = (uint32_t)entry->state;
+        record->install_time = (int64_t)entry->install_time;
+        record->installed_size = (uint64_t)entry->installed_size;
+        record->hash = slots[i]->hash;
+
+        uint32_t j = record->hash & (buckets - 1);
+        while (index[j])
+        {
+            j = (j + 1) & (buckets - 1);
+        }
+        index[j] = (uint32_t)i + 1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PKGDB_MAGIC, sizeof(PKGDB_MAGIC));
+    header.version = PKGDB_FORMAT_VERSION;
+    header.record_count = (uint32_t)count;
+    header.bucket_count = buckets;
+    header.strtab_size = (uint32_t)strtab.size;
+    header.records_offset = sizeof(header);
+    header.index_offset = header.records_offset + (uint64_t)count * sizeof(pkgdb_record_t);
+    header.strtab_offset = header.index_offset + (uint64_t)buckets * sizeof(uint32_t);
+    header.file_size = header.strtab_offset + strtab.size;
+
+    utils_create_directory_recursive(LIB_DIR);
+    pkgdb_path(path, sizeof(path), PKGDB_FILE);
+    result = TINYPKG_ERROR_FILE;
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path))
+    {
+        log_error("Database path too long: %s", path);
+        goto out;
+    }
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        log_error("Failed to open database file for writing: %s", temp_path);
+        goto out;
+    }
+
+    if (pkgdb_write_full(fd, &header, sizeof(header)) != TINYPKG_SUCCESS ||
+        pkgdb_write_full(fd, records, (size_t)count * sizeof(pkgdb_record_t)) !=
+            TINYPKG_SUCCESS ||
+        pkgdb_write_full(fd, index, (size_t)buckets * sizeof(uint32_t)) !=
+            TINYPKG_SUCCESS ||
+        pkgdb_write_full(fd, strtab.data, strtab.size) != TINYPKG_SUCCESS ||
+        fsync(fd) != 0)
+    {
+        log_error("Failed to write package database: %s", strerror(errno));
+        close(fd);
+        unlink(temp_path);
+        goto out;
+    }
+    close(fd);
+
+    if (rename(temp_path, path) != 0)
+    {
+        log_error("Failed to replace package database: %s", strerror(errno));
+        unlink(temp_path);
+        goto out;
+    }
+
+    // Every cached entry is now on disk; the journal can go
+    pkgdb_unmap();
+    result = pkgdb_map(path);
+    if (result == TINYPKG_SUCCESS && g_pkgdb.journal_fd >= 0 &&
+        ftruncate(g_pkgdb.journal_fd, 0) != 0)
+    {
+        result = TINYPKG_ERROR_FILE;
+    }
+    g_pkgdb.journal_end = 0;
+    g_pkgdb.journal_records = 0;
+    log_debug("Compacted package database: %d packages", count);
+
+out:
+    TINYPKG_FREE(slots);
+    TINYPKG_FREE(records);
+    TINYPKG_FREE(index);
+    TINYPKG_FREE(strtab.data);
+    return result;
+}
+
+int pkgdb_compact(void)
+{
+    if (pkgdb_open() != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    int result = pkgdb_lock();
+    if (result != TINYPKG_SUCCESS)
+    {
+        return result;
+    }
+    result = pkgdb_sync_locked();
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = pkgdb_compact_locked();
+    }
+    pkgdb_unlock();
+    return result;
+}
+
+// Import installed.txt and keep it as installed.txt.migrated
+int pkgdb_migrate_legacy(const char *legacy_path)
+{
+    char migrated[MAX_PATH];
+    char line[1024];
+    int count = 0;
+    FILE *fp;
+
+    if (!legacy_path)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    fp = fopen(legacy_path, "r");
+    if (!fp)
+    {
+        return TINYPKG_ERROR_FILE;
+    }
+
+    log_info("Migrating package database from %s", legacy_path);
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        package_db_entry_t entry;
+
+        // Skip comments and empty lines
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+
+        memset(&entry, 0, sizeof(entry));
+        int fields =
+            sscanf(line, "%255s\t%63s\t%511[^\t]\t%ld\t%zu\t%d", entry.name,
+                   entry.version, entry.description, &entry.install_time,
+                   &entry.installed_size, (int *)&entry.state);
+
+        if (fields >= 3 && pkgdb_apply_put(&entry) == TINYPKG_SUCCESS)
+        {
+            count++;
+        }
+    }
+    fclose(fp);
+
+    int result = pkgdb_compact();
+    if (result != TINYPKG_SUCCESS)
+    {
+        return result;
+    }
+
+    snprintf(migrated, sizeof(migrated), "%s.migrated", legacy_path);
+    if (rename(legacy_path, migrated) != 0)
+    {
+        log_warn("Failed to rename %s: %s", legacy_path, strerror(errno));
+    }
+
+    log_info("Migrated %d packages to the binary package database", count);
+    return TINYPKG_SUCCESS;
+}
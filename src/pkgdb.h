@@ -0,0 +1,103 @@
+/*
+ * TinyPkg - Installed Package Database Header
+ * Memory-mapped binary database with a hashed name index and a journal
+ */
+
+#ifndef TINYPKG_PKGDB_H
+#define TINYPKG_PKGDB_H
+
+#include <stdint.h>
+
+// Database files inside LIB_DIR
+#define PKGDB_FILE "installed.db"
+#define PKGDB_JOURNAL_FILE "installed.journal"
+#define PKGDB_LEGACY_FILE "installed.txt"
+
+// Processes sharing the database serialize journal replay, appends and
+// compaction with flock() on this file next to it
+#define PKGDB_LOCK_FILE "installed.lock"
+
+#define PKGDB_MAGIC "TPKGDB1"
+#define PKGDB_FORMAT_VERSION 1
+#define PKGDB_JOURNAL_MAGIC 0x4c4e524aU   // "JRNL"
+
+// Compact once the journal holds this many records (or a quarter of the DB)
+#define PKGDB_COMPACT_MIN_RECORDS 64
+
+// Journal operations. A batch record carries the number of records that
+// follow it in state; replay applies all of them or none.
+typedef enum {
+    PKGDB_OP_PUT = 1,
+    PKGDB_OP_DELETE = 2,
+    PKGDB_OP_BATCH = 3
+} pkgdb_op_t;
+
+// On-disk layout: header, record array, hash index, string table.
+// The index is an open-addressing table of record numbers + 1 (0 = empty)
+// probed linearly from the FNV-1a hash of the package name.
+typedef struct pkgdb_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_count;
+    uint32_t bucket_count;      // Power of two
+    uint32_t strtab_size;
+    uint64_t records_offset;
+    uint64_t index_offset;
+    uint64_t strtab_offset;
+    uint64_t file_size;
+} pkgdb_header_t;
+
+typedef struct pkgdb_record {
+    uint32_t name;              // String table offsets
+    uint32_t version;
+    uint32_t description;
+    uint32_t state;
+    int64_t install_time;
+    uint64_t installed_size;
+    uint32_t hash;              // FNV-1a of the name
+    uint32_t reserved;
+} pkgdb_record_t;
+
+// Journal record, followed by the name, version and description bytes
+typedef struct pkgdb_journal_record {
+    uint32_t magic;
+    uint16_t op;
+    uint16_t name_len;
+    uint16_t version_len;
+    uint16_t description_len;
+    uint32_t state;
+    int64_t install_time;
+    uint64_t installed_size;
+    uint32_t checksum;          // FNV-1a of the record (checksum = 0) and strings
+    uint32_t reserved;
+} pkgdb_journal_record_t;
+
+// Function declarations
+
+// Database lifecycle
+int pkgdb_open(void);
+void pkgdb_close(void);
+
+// Lookups; returned entries stay valid until pkgdb_close()
+package_db_entry_t *pkgdb_find(const char *package_name);
+package_db_entry_t *pkgdb_list(void);
+int pkgdb_count(void);
+
+// Updates are appended to the journal and folded in by compaction
+int pkgdb_put(const package_db_entry_t *entry);
+int pkgdb_delete(const char *package_name);
+int pkgdb_compact(void);
+
+// Transactions. Updates between begin and commit are visible to lookups
+// at once but reach the disk in a single batch at commit; rollback
+// restores the entries they touched. Transactions nest: only the
+// outermost commit writes, and a rollback at any depth aborts the whole.
+int pkgdb_begin(void);
+int pkgdb_commit(void);
+void pkgdb_rollback(void);
+int pkgdb_in_transaction(void);
+
+// One-time import of the old installed.txt format
+int pkgdb_migrate_legacy(const char *legacy_path);
+
+#endif /* TINYPKG_PKGDB_H */
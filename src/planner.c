@@ -0,0 +1,576 @@
+/*
+ * TinyPkg - Update Planner Implementation
+ * Incremental, version-aware planning of updates and the rebuilds they force
+ */
+
+#include "../include/tinypkg.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Pending changes
+static void planner_pending_path(char *path, size_t size)
+{
+    snprintf(path, size, "%s/%s", LIB_DIR, PLANNER_PENDING_FILE);
+}
+
+int planner_record_changes(char **changed_files, int count, int full)
+{
+    char path[MAX_PATH];
+    FILE *fp;
+
+    if (!full && count <= 0)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    utils_create_directory_recursive(LIB_DIR);
+    planner_pending_path(path, sizeof(path));
+    fp = fopen(path, "a");
+    if (!fp)
+    {
+        log_error("Failed to record changed packages in %s: %s", path, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+
+    if (full)
+    {
+        fprintf(fp, "%s\n", PLANNER_PENDING_ALL);
+    }
+
+    // Definitions are named after the package they describe
+    for (int i = 0; i < count && !full; i++)
+    {
+        const char *base = strrchr(changed_files[i], '/');
+        base = base ? base + 1 : changed_files[i];
+
+        size_t length = strlen(base);
+        if (length > 5 && strcmp(base + length - 5, ".json") == 0)
+        {
+            fprintf(fp, "%.*s\n", (int)(length - 5), base);
+        }
+    }
+
+    if (fclose(fp) != 0)
+    {
+        return TINYPKG_ERROR_FILE;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static plan_entry_t *planner_add(update_plan_t *plan, const char *name);
+
+// Read the pending names. *all is set when every installed package has to
+// be checked: changes are unknown, or no sync recorded any yet. Pending
+// rebuilds go to rebuilds either way, with only name and cause set.
+static char **planner_load_pending(int *count, int *all, update_plan_t *rebuilds)
+{
+    char path[MAX_PATH];
+    char line[2 * MAX_NAME + sizeof(PLANNER_PENDING_REBUILD) + 2];
+    char **names = NULL;
+    int capacity = 0;
+    FILE *fp;
+
+    *count = 0;
+    *all = 0;
+    planner_pending_path(path, sizeof(path));
+    fp = fopen(path, "r");
+    if (!fp)
+    {
+        *all = 1;
+        return NULL;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0')
+        {
+            continue;
+        }
+        if (TINYPKG_STREQ(line, PLANNER_PENDING_ALL))
+        {
+            *all = 1;
+            continue;
+        }
+
+        char *action = strchr(line, '\t');
+        if (action)
+        {
+            *action++ = '\0';
+            char *cause = strchr(action, '\t');
+            if (cause)
+            {
+                *cause++ = '\0';
+            }
+            if (!cause || !TINYPKG_STREQ(action, PLANNER_PENDING_REBUILD))
+            {
+                log_warn("Ignoring malformed pending update entry for %s", line);
+                continue;
+            }
+
+            plan_entry_t *entry = planner_add(rebuilds, line);
+            if (!entry)
+            {
+                *all = 1;
+                break;
+            }
+            entry->action = PLAN_ACTION_REBUILD;
+            snprintf(entry->cause, sizeof(entry->cause), "%s", cause);
+            continue;
+        }
+        if (*all)
+        {
+            continue;
+        }
+
+        if (*count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 32;
+            char **grown = TINYPKG_REALLOC(names, capacity * sizeof(char *));
+            if (!grown)
+            {
+                *all = 1;
+                break;
+            }
+            names = grown;
+        }
+        names[*count] = TINYPKG_STRDUP(line);
+        if (!names[*count])
+        {
+            *all = 1;
+            break;
+        }
+        (*count)++;
+    }
+    fclose(fp);
+
+    if (*all)
+    {
+        utils_string_array_free(names, *count);
+        *count = 0;
+        return NULL;
+    }
+    return names;
+}
+
+// Keep only the planned packages that did not get through
+static int planner_save_pending(const update_plan_t *plan)
+{
+    char path[MAX_PATH];
+    char temp_path[MAX_PATH];
+    FILE *fp;
+
+    utils_create_directory_recursive(LIB_DIR);
+    planner_pending_path(path, sizeof(path));
+    if ((size_t)snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= sizeof(temp_path))
+    {
+        log_error("Update plan path too long: %s", path);
+        return TINYPKG_ERROR;
+    }
+
+    fp = fopen(temp_path, "w");
+    if (!fp)
+    {
+        return TINYPKG_ERROR_FILE;
+    }
+    for (int i = 0; plan && i < plan->count; i++)
+    {
+        const plan_entry_t *entry = &plan->entries[i];
+
+        if (entry->done)
+        {
+            continue;
+        }
+        if (entry->action == PLAN_ACTION_REBUILD)
+        {
+            fprintf(fp, "%s\t%s\t%s\n", entry->name, PLANNER_PENDING_REBUILD, entry->cause);
+        }
+        else
+        {
+            fprintf(fp, "%s\n", entry->name);
+        }
+    }
+    if (fclose(fp) != 0 || rename(temp_path, path) != 0)
+    {
+        unlink(temp_path);
+        return TINYPKG_ERROR_FILE;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Plan construction
+static plan_entry_t *planner_add(update_plan_t *plan, const char *name)
+{
+    if (plan->count == plan->capacity)
+    {
+        int capacity = plan->capacity ? plan->capacity * 2 : 16;
+        plan_entry_t *grown = TINYPKG_REALLOC(plan->entries, capacity * sizeof(plan_entry_t));
+        if (!grown)
+        {
+            return NULL;
+        }
+        plan->entries = grown;
+        plan->capacity = capacity;
+    }
+
+    plan_entry_t *entry = &plan->entries[plan->count++];
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    return entry;
+}
+
+// Whether available is newer than installed; *incompatible is set when
+// binaries built against installed may not work with it. Versions that
+// do not parse count as a change of unknown compatibility.
+static int planner_compare(const char *installed, const char *available, int *incompatible)
+{
+    version_t current, next;
+
+    if (version_parse(installed, &current) != TINYPKG_SUCCESS ||
+        version_parse(available, &next) != TINYPKG_SUCCESS)
+    {
+        *incompatible = 1;
+        return !TINYPKG_STREQ(installed, available);
+    }
+
+    *incompatible = !version_is_compatible(&current, &next);
+    return version_compare(&next, &current) > 0;
+}
+
+// Compare one installed package against the index
+static int planner_check(update_plan_t *plan, const package_db_entry_t *installed, int id,
+                         int force, unsigned char *planned)
+{
+    const char *available = repoindex_get_string(id, REPOINDEX_STR_VERSION);
+    int breaks = 0;
+
+    plan->examined++;
+    if (!planner_compare(installed->version, available, &breaks) && !force)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    plan_entry_t *entry = planner_add(plan, installed->name);
+    if (!entry)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+    snprintf(entry->from_version, sizeof(entry->from_version), "%s", installed->version);
+    snprintf(entry->to_version, sizeof(entry->to_version), "%s", available);
+    entry->action = PLAN_ACTION_UPDATE;
+    entry->incompatible = breaks;
+
+    planned[id] = 1;
+    return TINYPKG_SUCCESS;
+}
+
+static int planner_add_rebuild(update_plan_t *plan, const package_db_entry_t *installed,
+                               int id, const char *cause, unsigned char *planned)
+{
+    plan_entry_t *entry = planner_add(plan, installed->name);
+    if (!entry)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+    snprintf(entry->from_version, sizeof(entry->from_version), "%s", installed->version);
+    snprintf(entry->to_version, sizeof(entry->to_version), "%s",
+             repoindex_get_string(id, REPOINDEX_STR_VERSION));
+    snprintf(entry->cause, sizeof(entry->cause), "%s", cause);
+    entry->action = PLAN_ACTION_REBUILD;
+    planned[id] = 1;
+    return TINYPKG_SUCCESS;
+}
+
+// Installed packages that depend directly on an incompatible update are
+// rebuilt against it. Their own interface does not change, so the walk
+// stops there. Dependents come from the dependency index, i.e. what the
+// packages were built with.
+static int planner_add_rebuilds(update_plan_t *plan, unsigned char *planned)
+{
+    int update_count = plan->count;
+
+    for (int u = 0; u < update_count; u++)
+    {
+        char **dependents = NULL;
+        int dependent_count = 0;
+        char cause[MAX_NAME];
+
+        if (!plan->entries[u].incompatible)
+        {
+            continue;
+        }
+        snprintf(cause, sizeof(cause), "%s", plan->entries[u].name);
+
+        int result = depindex_dependents(cause, 0, &dependents, &dependent_count);
+        for (int i = 0; i < dependent_count && result == TINYPKG_SUCCESS; i++)
+        {
+            const package_db_entry_t *installed = package_db_find(dependents[i]);
+            int id = installed ? repoindex_find(dependents[i]) : -1;
+            if (id < 0 || planned[id])
+            {
+                continue;
+            }
+
+            result = planner_add_rebuild(plan, installed, id, cause, planned);
+        }
+
+        utils_string_array_free(dependents, dependent_count);
+        if (result != TINYPKG_SUCCESS)
+        {
+            return result;
+        }
+    }
+    return TINYPKG_SUCCESS;
+}
+
+int planner_create(char **names, int count, update_plan_t **plan_out)
+{
+    struct timespec start, end;
+    unsigned char *planned = NULL;
+    char **pending = NULL;
+    int pending_count = 0;
+    update_plan_t rebuilds = {0};
+    int all = 0;
+    int result = TINYPKG_ERROR_MEMORY;
+
+    if (!plan_out || (count > 0 && !names))
+    {
+        return TINYPKG_ERROR;
+    }
+    *plan_out = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Versions and dependencies come from the index only
+    if (!repoindex_is_current() && repoindex_build() != TINYPKG_SUCCESS)
+    {
+        log_error("No repository index available, run --sync first");
+        return TINYPKG_ERROR;
+    }
+    if (package_db_load() != TINYPKG_SUCCESS)
+    {
+        log_error("Failed to load package database");
+        return TINYPKG_ERROR;
+    }
+
+    update_plan_t *plan = TINYPKG_CALLOC(1, sizeof(update_plan_t));
+    int package_count = repoindex_package_count();
+    planned = TINYPKG_CALLOC(MAX(package_count, 1), 1);
+    if (!plan || !planned)
+    {
+        goto out;
+    }
+
+    int force = global_config && global_config->force_mode;
+    if (!names)
+    {
+        pending = planner_load_pending(&pending_count, &all, &rebuilds);
+        all |= force;
+    }
+
+    result = TINYPKG_SUCCESS;
+    if (names || !all)
+    {
+        // Only the named or changed packages are compared
+        char **candidates = names ? names : pending;
+        int candidate_count = names ? count : pending_count;
+
+        for (int i = 0; i < candidate_count && result == TINYPKG_SUCCESS; i++)
+        {
+            const package_db_entry_t *installed = package_db_find(candidates[i]);
+            int id = installed ? repoindex_find(candidates[i]) : -1;
+            if (id >= 0 && !planned[id])
+            {
+                result = planner_check(plan, installed, id, names && force, planned);
+            }
+        }
+    }
+    else
+    {
+        for (package_db_entry_t *installed = package_db_get_all();
+             installed && result == TINYPKG_SUCCESS; installed = installed->next)
+        {
+            int id = repoindex_find(installed->name);
+            if (id >= 0)
+            {
+                result = planner_check(plan, installed, id, force, planned);
+            }
+        }
+    }
+
+    // Rebuilds that failed last time: their cause is installed already, so
+    // there is no version change to find
+    for (int i = 0; i < rebuilds.count && result == TINYPKG_SUCCESS; i++)
+    {
+        const plan_entry_t *pending_rebuild = &rebuilds.entries[i];
+        const package_db_entry_t *installed = package_db_find(pending_rebuild->name);
+        int id = installed ? repoindex_find(pending_rebuild->name) : -1;
+        if (id >= 0 && !planned[id])
+        {
+            result = planner_add_rebuild(plan, installed, id, pending_rebuild->cause, planned);
+        }
+    }
+
+    if (result == TINYPKG_SUCCESS)
+    {
+        int breaks = 0;
+        for (int i = 0; i < plan->count; i++)
+        {
+            breaks |= plan->entries[i].incompatible;
+        }
+        if (breaks)
+        {
+            result = planner_add_rebuilds(plan, planned);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    plan->elapsed_ms =
+        (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+    log_debug("Update plan: %d packages examined, %d planned in %.2f ms", plan->examined,
+              plan->count, plan->elapsed_ms);
+
+out:
+    utils_string_array_free(pending, pending_count);
+    TINYPKG_FREE(rebuilds.entries);
+    TINYPKG_FREE(planned);
+    if (result != TINYPKG_SUCCESS)
+    {
+        planner_free(plan);
+        return result;
+    }
+    *plan_out = plan;
+    return TINYPKG_SUCCESS;
+}
+
+void planner_free(update_plan_t *plan)
+{
+    if (!plan)
+    {
+        return;
+    }
+    TINYPKG_FREE(plan->entries);
+    TINYPKG_FREE(plan);
+}
+
+void planner_print(const update_plan_t *plan)
+{
+    if (!plan)
+    {
+        return;
+    }
+
+    if (plan->count == 0)
+    {
+        printf("All packages are up to date (%d checked)\n", plan->examined);
+        return;
+    }
+
+    printf("Update plan: %d packages (%d checked in %.2f ms)\n", plan->count, plan->examined,
+           plan->elapsed_ms);
+    for (int i = 0; i < plan->count; i++)
+    {
+        const plan_entry_t *entry = &plan->entries[i];
+
+        if (entry->action == PLAN_ACTION_REBUILD)
+        {
+            printf("  rebuild %s %s (depends on %s)\n", entry->name, entry->from_version,
+                   entry->cause);
+        }
+        else
+        {
+            printf("  update  %s %s -> %s%s\n", entry->name, entry->from_version,
+                   entry->to_version, entry->incompatible ? " (incompatible)" : "");
+        }
+    }
+}
+
+// Execution
+int planner_execute(update_plan_t *plan)
+{
+    dependency_graph_t *graph;
+    scheduler_t *sched;
+    char **names;
+    int result;
+
+    if (!plan)
+    {
+        return TINYPKG_ERROR;
+    }
+    if (plan->count == 0)
+    {
+        return TINYPKG_SUCCESS;
+    }
+
+    names = TINYPKG_CALLOC(plan->count, sizeof(char *));
+    if (!names)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+    for (int i = 0; i < plan->count; i++)
+    {
+        names[i] = plan->entries[i].name;
+    }
+
+    // One graph for the whole plan: rebuilds wait for the updates they
+    // depend on, and independent ones run side by side
+    graph = dependency_resolve_graph(names, plan->count);
+    if (!graph)
+    {
+        log_error("Dependency resolution failed");
+        TINYPKG_FREE(names);
+        return TINYPKG_ERROR_DEPENDENCY;
+    }
+
+    sched = scheduler_create_rebuild(graph, names, plan->count);
+    dependency_graph_free(graph);
+    TINYPKG_FREE(names);
+    if (!sched)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    result = scheduler_run(sched);
+
+    for (int i = 0; i < plan->count; i++)
+    {
+        for (int n = 0; n < sched->node_count; n++)
+        {
+            if (TINYPKG_STREQ(sched->nodes[n].package_name, plan->entries[i].name))
+            {
+                plan->entries[i].done = sched->nodes[n].state == SCHED_NODE_DONE;
+                break;
+            }
+        }
+    }
+
+    scheduler_free(sched);
+    return result;
+}
+
+int planner_update(char **names, int count)
+{
+    update_plan_t *plan = NULL;
+    int result;
+
+    result = planner_create(names, count, &plan);
+    if (result != TINYPKG_SUCCESS)
+    {
+        return result;
+    }
+
+    planner_print(plan);
+    result = planner_execute(plan);
+
+    // Whatever failed stays pending for the next run
+    if (!names && planner_save_pending(plan) != TINYPKG_SUCCESS)
+    {
+        log_warn("Failed to update the list of pending package changes");
+    }
+
+    planner_free(plan);
+    return result;
+}
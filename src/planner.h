@@ -0,0 +1,58 @@
+/*
+ * TinyPkg - Update Planner Header
+ * Incremental, version-aware planning of updates and the rebuilds they force
+ */
+
+#ifndef TINYPKG_PLANNER_H
+#define TINYPKG_PLANNER_H
+
+// Packages whose definitions changed in syncs since the last update, one
+// name per line inside LIB_DIR. A line of PLANNER_PENDING_ALL means the
+// changes are unknown; without the file every installed package is checked.
+// Rebuilds that did not get through are kept as
+// "name<TAB>PLANNER_PENDING_REBUILD<TAB>cause", as their versions match.
+#define PLANNER_PENDING_FILE "updates.pending"
+#define PLANNER_PENDING_ALL "*"
+#define PLANNER_PENDING_REBUILD "rebuild"
+
+typedef enum {
+    PLAN_ACTION_UPDATE = 0,     // A newer version is available
+    PLAN_ACTION_REBUILD         // Links against an incompatible update
+} plan_action_t;
+
+typedef struct plan_entry {
+    char name[MAX_NAME];
+    char from_version[MAX_VERSION];
+    char to_version[MAX_VERSION];
+    plan_action_t action;
+    int incompatible;           // Updates: dependents have to be rebuilt
+    char cause[MAX_NAME];       // Rebuilds: the update that forces it
+    int done;                   // Set by planner_execute once installed
+} plan_entry_t;
+
+typedef struct update_plan {
+    plan_entry_t *entries;
+    int count;
+    int capacity;
+    int examined;               // Installed packages whose versions were compared
+    double elapsed_ms;
+} update_plan_t;
+
+// Function declarations
+
+// Record the definition files a sync changed (full: all may have)
+int planner_record_changes(char **changed_files, int count, int full);
+
+// Plan updates of the given installed packages, or with names NULL of
+// every installed package the pending changes touch
+int planner_create(char **names, int count, update_plan_t **plan);
+void planner_free(update_plan_t *plan);
+void planner_print(const update_plan_t *plan);
+
+// Build the whole plan in one scheduler run
+int planner_execute(update_plan_t *plan);
+
+// Plan, print and execute; a full run also clears the pending changes
+int planner_update(char **names, int count);
+
+#endif /* TINYPKG_PLANNER_H */
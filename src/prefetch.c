@@ -0,0 +1,322 @@
+/*
+ * TinyPkg - Source Prefetch Implementation
+ * Overlaps source download/extraction with the compilation of other packages
+ */
+
+#include "../include/tinypkg.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Active prefetch run (one per scheduled install)
+static prefetch_queue_t *g_prefetch = NULL;
+
+// Find an item by package name. Called with the queue lock held.
+static prefetch_item_t *prefetch_find(prefetch_queue_t *queue,
+                                      const char *package_name)
+{
+    for (int i = 0; i < queue->item_count; i++)
+    {
+        if (TINYPKG_STREQ(queue->items[i].package_name, package_name))
+        {
+            return &queue->items[i];
+        }
+    }
+    return NULL;
+}
+
+// Pick the next queued item the disk budget allows.
+// Called with the queue lock held; returns NULL when there is nothing to do.
+static prefetch_item_t *prefetch_next(prefetch_queue_t *queue)
+{
+    while (!queue->stopping)
+    {
+        while (queue->next < queue->item_count &&
+               queue->items[queue->next].state != PREFETCH_QUEUED)
+        {
+            queue->next++;
+        }
+
+        if (queue->next >= queue->item_count)
+        {
+            return NULL;
+        }
+
+        // Keep at most disk_budget bytes of unpacked sources waiting
+        if (queue->disk_budget == 0 || queue->disk_used < queue->disk_budget)
+        {
+            prefetch_item_t *item = &queue->items[queue->next++];
+            item->state = PREFETCH_RUNNING;
+            return item;
+        }
+
+        pthread_cond_wait(&queue->cond, &queue->lock);
+    }
+    return NULL;
+}
+
+// Fetcher thread: download and extract sources in build order
+static void *prefetch_worker(void *arg)
+{
+    prefetch_queue_t *queue = (prefetch_queue_t *)arg;
+    prefetch_item_t *item;
+
+    metrics_trace_thread_name("prefetch");
+
+    pthread_mutex_lock(&queue->lock);
+    while ((item = prefetch_next(queue)) != NULL)
+    {
+        pthread_mutex_unlock(&queue->lock);
+
+        int result = TINYPKG_ERROR;
+        size_t usage = 0;
+        build_context_t *ctx = build_context_create(item->package);
+        if (ctx)
+        {
+            log_debug("Prefetching source for %s", item->package_name);
+            result = build_download_source(ctx);
+            if (result == TINYPKG_SUCCESS)
+            {
+                result = build_extract_source(ctx);
+            }
+            if (result == TINYPKG_SUCCESS)
+            {
+                utils_get_directory_size(ctx->build_dir, &usage);
+            }
+            else
+            {
+                log_warn("Prefetch failed for %s, will retry at build time",
+                         item->package_name);
+                build_context_cleanup(ctx);
+            }
+            build_context_free(ctx);
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        if (result == TINYPKG_SUCCESS)
+        {
+            item->state = PREFETCH_READY;
+            item->disk_usage = usage;
+            queue->disk_used += usage;
+        }
+        else
+        {
+            item->state = PREFETCH_FAILED;
+        }
+        pthread_cond_broadcast(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+// Start fetching sources ahead of their builds
+int prefetch_start(package_t **packages, int count)
+{
+    prefetch_queue_t *queue;
+    int workers;
+
+    if (!packages || count <= 0 || g_prefetch)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    workers = global_config ? global_config->max_concurrent_downloads : 4;
+    if (workers <= 0)
+    {
+        log_debug("Source prefetch disabled");
+        return TINYPKG_SUCCESS;
+    }
+    workers = MIN(workers, count);
+
+    queue = TINYPKG_CALLOC(1, sizeof(prefetch_queue_t));
+    if (!queue)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    queue->items = TINYPKG_CALLOC(count, sizeof(prefetch_item_t));
+    queue->workers = TINYPKG_CALLOC(workers, sizeof(pthread_t));
+    if (!queue->items || !queue->workers)
+    {
+        TINYPKG_FREE(queue->items);
+        TINYPKG_FREE(queue->workers);
+        TINYPKG_FREE(queue);
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(queue->items[i].package_name, sizeof(queue->items[i].package_name), "%s",
+                 packages[i]->name);
+        queue->items[i].package = packages[i];
+        queue->items[i].state = PREFETCH_QUEUED;
+    }
+    queue->item_count = count;
+    queue->disk_budget =
+        global_config ? (size_t)global_config->prefetch_disk_budget * 1024 * 1024
+                      : 0;
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+
+    for (int i = 0; i < workers; i++)
+    {
+        if (pthread_create(&queue->workers[i], NULL, prefetch_worker, queue) !=
+            0)
+        {
+            log_warn("Failed to start prefetch worker %d", i);
+            break;
+        }
+        queue->worker_count++;
+    }
+
+    log_info("Prefetching %d sources with %d fetchers", count,
+             queue->worker_count);
+    g_prefetch = queue;
+    return TINYPKG_SUCCESS;
+}
+
+// Stop fetchers and drop the prefetch run
+void prefetch_stop(void)
+{
+    prefetch_queue_t *queue = g_prefetch;
+
+    if (!queue)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = 1;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    for (int i = 0; i < queue->worker_count; i++)
+    {
+        pthread_join(queue->workers[i], NULL);
+    }
+
+    // Remove sources that were fetched but never built
+    for (int i = 0; i < queue->item_count; i++)
+    {
+        if (queue->items[i].state == PREFETCH_READY)
+        {
+            build_context_t *ctx = build_context_create(queue->items[i].package);
+            if (ctx)
+            {
+                build_context_cleanup(ctx);
+                build_context_free(ctx);
+            }
+        }
+    }
+
+    g_prefetch = NULL;
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->cond);
+    TINYPKG_FREE(queue->items);
+    TINYPKG_FREE(queue->workers);
+    TINYPKG_FREE(queue);
+}
+
+// Claim a package's source for building. Waits for an in-flight fetch and
+// returns TINYPKG_SUCCESS if the source is already extracted; otherwise
+// the caller downloads and extracts it itself.
+int prefetch_claim(const char *package_name)
+{
+    prefetch_queue_t *queue = g_prefetch;
+    prefetch_item_t *item;
+    int result = TINYPKG_ERROR;
+
+    if (!queue || !package_name)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    item = prefetch_find(queue, package_name);
+    if (item)
+    {
+        while (item->state == PREFETCH_RUNNING)
+        {
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        }
+
+        if (item->state == PREFETCH_READY)
+        {
+            result = TINYPKG_SUCCESS;
+        }
+        item->state = PREFETCH_CLAIMED;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return result;
+}
+
+// Return a claimed package's disk usage to the budget once it is built
+void prefetch_release(const char *package_name)
+{
+    prefetch_queue_t *queue = g_prefetch;
+    prefetch_item_t *item;
+
+    if (!queue || !package_name)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    item = prefetch_find(queue, package_name);
+    if (item && !item->released)
+    {
+        item->released = 1;
+        queue->disk_used -= MIN(queue->disk_used, item->disk_usage);
+        pthread_cond_broadcast(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Drop a package that will no longer be built
+void prefetch_cancel(const char *package_name)
+{
+    prefetch_queue_t *queue = g_prefetch;
+    prefetch_item_t *item;
+
+    if (!queue || !package_name)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    item = prefetch_find(queue, package_name);
+    if (item && item->state == PREFETCH_QUEUED)
+    {
+        item->state = PREFETCH_CLAIMED;
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+int prefetch_is_active(void)
+{
+    return g_prefetch != NULL;
+}
+
+// Prefetch state to string
+const char *prefetch_state_to_string(prefetch_state_t state)
+{
+    switch (state)
+    {
+    case PREFETCH_QUEUED:
+        return "queued";
+    case PREFETCH_RUNNING:
+        return "running";
+    case PREFETCH_READY:
+        return "ready";
+    case PREFETCH_FAILED:
+        return "failed";
+    case PREFETCH_CLAIMED:
+        return "claimed";
+    default:
+        return "unknown";
+    }
+}
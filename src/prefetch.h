@@ -0,0 +1,58 @@
+/*
+ * TinyPkg - Source Prefetch Header
+ * Fetches and extracts sources ahead of the builds that need them
+ */
+
+#ifndef TINYPKG_PREFETCH_H
+#define TINYPKG_PREFETCH_H
+
+#include <pthread.h>
+
+// Prefetch item states
+typedef enum {
+    PREFETCH_QUEUED = 0,      // Waiting for a fetcher
+    PREFETCH_RUNNING = 1,     // Download/extract in progress
+    PREFETCH_READY = 2,       // Source extracted into the build directory
+    PREFETCH_FAILED = 3,      // Fetch failed; the build retries inline
+    PREFETCH_CLAIMED = 4      // Taken by a build (or cancelled)
+} prefetch_state_t;
+
+// One package source to fetch ahead
+typedef struct prefetch_item {
+    char package_name[MAX_NAME];
+    package_t *package;       // Borrowed; must outlive the prefetch run
+    prefetch_state_t state;
+    size_t disk_usage;        // Bytes held in the build directory
+    int released;
+} prefetch_item_t;
+
+// Prefetch queue shared by fetchers and builds
+typedef struct prefetch_queue {
+    prefetch_item_t *items;
+    int item_count;
+    int next;                 // Next item to hand to a fetcher
+    pthread_t *workers;
+    int worker_count;
+    size_t disk_budget;
+    size_t disk_used;
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} prefetch_queue_t;
+
+// Function declarations
+
+// Prefetch lifecycle; packages are given in expected build order
+int prefetch_start(package_t **packages, int count);
+void prefetch_stop(void);
+
+// Build-side hooks
+int prefetch_claim(const char *package_name);
+void prefetch_release(const char *package_name);
+void prefetch_cancel(const char *package_name);
+
+// Utilities
+int prefetch_is_active(void);
+const char *prefetch_state_to_string(prefetch_state_t state);
+
+#endif /* TINYPKG_PREFETCH_H */
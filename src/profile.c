@@ -0,0 +1,513 @@
+/*
+ * TinyPkg - Build Profiler Implementation
+ * Per-phase build timings and the history they are kept in
+ */
+
+#include "../include/tinypkg.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Concurrent builds of this process append one at a time; flock() covers
+// other processes
+static pthread_mutex_t g_history_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *phase_names[PROFILE_PHASE_COUNT] = {
+    "download", "extract", "configure", "compile", "stage", "package", "install",
+};
+
+static uint64_t profile_timeval_ms(const struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * 1000 + (uint64_t)tv->tv_usec / 1000;
+}
+
+static void profile_history_path(char *path, size_t size, const char *file)
+{
+    snprintf(path, size, "%s/%s", LIB_DIR, file);
+}
+
+// Truncating copy into a fixed-size record field
+static void profile_copy(char *dest, size_t size, const char *src)
+{
+    size_t length = MIN(strlen(src), size - 1);
+    memcpy(dest, src, length);
+    dest[length] = '\0';
+}
+
+// Long names share their truncated prefix, so records match by hash too
+static int profile_record_is(const profile_record_t *record, const char *name)
+{
+    return record->name_hash == utils_hash_string(name) &&
+           strncmp(record->name, name, PROFILE_NAME_SIZE - 1) == 0;
+}
+
+// Collecting a profile
+void profile_begin(profile_t *profile, const package_t *pkg, int jobs)
+{
+    if (!profile || !pkg)
+        return;
+
+    memset(profile, 0, sizeof(*profile));
+    profile->record.magic = PROFILE_MAGIC;
+    profile->record.timestamp = (int64_t)time(NULL);
+    profile->record.jobs = (uint32_t)MAX(jobs, 0);
+    profile->record.name_hash = utils_hash_string(pkg->name);
+    profile_copy(profile->record.name, sizeof(profile->record.name), pkg->name);
+    profile_copy(profile->record.version, sizeof(profile->record.version),
+                 pkg->version);
+}
+
+void profile_phase_begin(profile_t *profile, profile_phase_t phase)
+{
+    if (!profile || phase >= PROFILE_PHASE_COUNT)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &profile->phase_start[phase]);
+}
+
+// Phases may run more than once (e.g. a failed fetch retried after a cache
+// miss); their times add up
+void profile_phase_end(profile_t *profile, profile_phase_t phase)
+{
+    struct timespec now;
+
+    if (!profile || phase >= PROFILE_PHASE_COUNT)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const struct timespec *start = &profile->phase_start[phase];
+    int64_t ms = (int64_t)(now.tv_sec - start->tv_sec) * 1000 +
+                 (now.tv_nsec - start->tv_nsec) / 1000000;
+    profile->record.phase_ms[phase] += (uint32_t)MAX(ms, 0);
+
+    // Both clocks are CLOCK_MONOTONIC, so phases line up with other spans
+    int64_t start_us = (int64_t)start->tv_sec * 1000000 + start->tv_nsec / 1000;
+    int64_t end_us = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    metrics_observe_phase(phase, (end_us - start_us) / 1e6);
+    metrics_trace_span("build", phase_names[phase], profile->record.name, start_us, end_us);
+}
+
+void profile_add_usage(profile_t *profile, const struct rusage *usage)
+{
+    if (!profile || !usage)
+        return;
+
+    profile->record.user_ms += profile_timeval_ms(&usage->ru_utime);
+    profile->record.system_ms += profile_timeval_ms(&usage->ru_stime);
+    profile->record.peak_rss_kb =
+        MAX(profile->record.peak_rss_kb, (uint64_t)MAX(usage->ru_maxrss, 0));
+}
+
+void profile_add_download(profile_t *profile, uint64_t bytes)
+{
+    if (profile)
+        profile->record.download_bytes += bytes;
+}
+
+void profile_set_cache_stats(profile_t *profile, long hits, long misses)
+{
+    if (!profile)
+        return;
+    profile->record.cache_hits = (uint32_t)MAX(hits, 0);
+    profile->record.cache_misses = (uint32_t)MAX(misses, 0);
+    metrics_add(METRICS_COMPILER_CACHE_HITS, profile->record.cache_hits);
+    metrics_add(METRICS_COMPILER_CACHE_MISSES, profile->record.cache_misses);
+}
+
+void profile_set_flag(profile_t *profile, uint32_t flag)
+{
+    if (profile)
+        profile->record.flags |= flag;
+}
+
+// Formatting helpers
+static void profile_format_ms(char *buffer, size_t size, uint64_t ms)
+{
+    if (ms < 1000)
+    {
+        snprintf(buffer, size, "%lums", (unsigned long)ms);
+    }
+    else if (ms < 60000)
+    {
+        snprintf(buffer, size, "%.1fs", (double)ms / 1000.0);
+    }
+    else
+    {
+        snprintf(buffer, size, "%lum%02lus", (unsigned long)(ms / 60000),
+                 (unsigned long)(ms / 1000 % 60));
+    }
+}
+
+static uint64_t profile_total_ms(const profile_record_t *record)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < PROFILE_PHASE_COUNT; i++)
+    {
+        total += record->phase_ms[i];
+    }
+    return total;
+}
+
+static void profile_log_summary(const profile_record_t *record)
+{
+    char phases[512];
+    char duration[32];
+    size_t used = 0;
+
+    phases[0] = '\0';
+    for (int i = 0; i < PROFILE_PHASE_COUNT && used < sizeof(phases); i++)
+    {
+        if (record->phase_ms[i] == 0)
+            continue;
+        profile_format_ms(duration, sizeof(duration), record->phase_ms[i]);
+        used += (size_t)snprintf(phases + used, sizeof(phases) - used, "%s%s %s",
+                                 used ? ", " : "", phase_names[i], duration);
+    }
+
+    log_info("Profile of %s: %s", record->name, used ? phases : "no phases");
+
+    if (record->download_bytes > 0 && record->phase_ms[PROFILE_PHASE_DOWNLOAD] > 0)
+    {
+        double seconds = record->phase_ms[PROFILE_PHASE_DOWNLOAD] / 1000.0;
+        log_info("Downloaded %.1f MB at %.1f MB/s",
+                 (double)record->download_bytes / (1024.0 * 1024.0),
+                 (double)record->download_bytes / (1024.0 * 1024.0) / seconds);
+    }
+    if (record->user_ms + record->system_ms > 0)
+    {
+        log_info("CPU time %.1fs user, %.1fs system; peak RSS %lu MB",
+                 record->user_ms / 1000.0, record->system_ms / 1000.0,
+                 (unsigned long)(record->peak_rss_kb / 1024));
+    }
+}
+
+// Rewrite the history with only its newest half. Called with the lock
+// file locked; the replacement gets renamed over the history.
+static void profile_history_compact(int fd, const char *path, off_t size)
+{
+    char temp[MAX_PATH];
+    off_t keep = (off_t)(PROFILE_HISTORY_MAX / 2) * (off_t)sizeof(profile_record_t);
+    off_t skip = size - keep;
+
+    if (skip <= 0)
+        return;
+
+    if ((size_t)snprintf(temp, sizeof(temp), "%s.tmp", path) >= sizeof(temp))
+        return;
+
+    char *data = TINYPKG_MALLOC((size_t)keep);
+    if (!data)
+        return;
+
+    int out = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out >= 0 && pread(fd, data, (size_t)keep, skip) == (ssize_t)keep &&
+        write(out, data, (size_t)keep) == (ssize_t)keep && fsync(out) == 0 &&
+        close(out) == 0)
+    {
+        out = -1;
+        if (rename(temp, path) != 0)
+            unlink(temp);
+    }
+    else
+    {
+        log_warn("Failed to compact build history: %s", strerror(errno));
+        if (out >= 0)
+            close(out);
+        unlink(temp);
+    }
+    TINYPKG_FREE(data);
+}
+
+// Append the finished build to the history
+int profile_finish(profile_t *profile, int result)
+{
+    char path[MAX_PATH];
+    struct stat st;
+
+    if (!profile)
+        return TINYPKG_ERROR;
+
+    if (result != TINYPKG_SUCCESS)
+        profile->record.flags |= PROFILE_FLAG_FAILED;
+    profile_log_summary(&profile->record);
+
+    metrics_add(METRICS_BUILDS, 1);
+    if (result != TINYPKG_SUCCESS)
+        metrics_add(METRICS_BUILD_FAILURES, 1);
+
+    // Compaction renames a new history over the old one, so a lock on the
+    // history itself would not keep out a writer that opened it before
+    profile_history_path(path, sizeof(path), PROFILE_HISTORY_LOCK_FILE);
+    pthread_mutex_lock(&g_history_lock);
+
+    int lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0)
+    {
+        pthread_mutex_unlock(&g_history_lock);
+        log_warn("Cannot open build history lock %s: %s", path, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+    flock(lock_fd, LOCK_EX);
+
+    profile_history_path(path, sizeof(path), PROFILE_HISTORY_FILE);
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        close(lock_fd);
+        pthread_mutex_unlock(&g_history_lock);
+        log_warn("Cannot open build history %s: %s", path, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+
+    // Cut off a record torn by a crash so later ones stay aligned
+    if (fstat(fd, &st) == 0 && st.st_size % (off_t)sizeof(profile_record_t))
+    {
+        st.st_size -= st.st_size % (off_t)sizeof(profile_record_t);
+        if (ftruncate(fd, st.st_size) != 0)
+            log_warn("Failed to repair build history: %s", strerror(errno));
+    }
+
+    int written = write(fd, &profile->record, sizeof(profile->record)) ==
+                  (ssize_t)sizeof(profile->record);
+    if (!written)
+        log_warn("Failed to append to build history: %s", strerror(errno));
+
+    off_t size = st.st_size + (written ? (off_t)sizeof(profile->record) : 0);
+    if (size > (off_t)PROFILE_HISTORY_MAX * (off_t)sizeof(profile_record_t))
+        profile_history_compact(fd, path, size);
+
+    close(fd);
+    close(lock_fd);
+    pthread_mutex_unlock(&g_history_lock);
+
+    return written ? TINYPKG_SUCCESS : TINYPKG_ERROR_FILE;
+}
+
+// Read the history, oldest first; package_name NULL reads every package
+int profile_history_load(const char *package_name, profile_record_t **records,
+                         int *count)
+{
+    char path[MAX_PATH];
+    struct stat st;
+
+    if (!records || !count)
+        return TINYPKG_ERROR;
+
+    *records = NULL;
+    *count = 0;
+
+    // Without a lock file nothing was ever written
+    profile_history_path(path, sizeof(path), PROFILE_HISTORY_LOCK_FILE);
+    int lock_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (lock_fd >= 0)
+        flock(lock_fd, LOCK_SH);
+
+    profile_history_path(path, sizeof(path), PROFILE_HISTORY_FILE);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (lock_fd >= 0)
+            close(lock_fd);
+        return errno == ENOENT ? TINYPKG_SUCCESS : TINYPKG_ERROR_FILE;
+    }
+
+    size_t total = 0;
+    profile_record_t *all = NULL;
+    ssize_t length = 0;
+    int result = TINYPKG_SUCCESS;
+    if (fstat(fd, &st) != 0)
+    {
+        result = TINYPKG_ERROR_FILE;
+    }
+    else if ((total = (size_t)st.st_size / sizeof(profile_record_t)) > 0)
+    {
+        all = TINYPKG_MALLOC(total * sizeof(profile_record_t));
+        if (!all)
+            result = TINYPKG_ERROR_MEMORY;
+        else
+            length = pread(fd, all, total * sizeof(profile_record_t), 0);
+    }
+    close(fd);
+    if (lock_fd >= 0)
+        close(lock_fd);
+
+    if (result != TINYPKG_SUCCESS || total == 0)
+        return result;
+    if (length < 0)
+    {
+        TINYPKG_FREE(all);
+        return TINYPKG_ERROR_FILE;
+    }
+    total = (size_t)length / sizeof(profile_record_t);
+
+    // Filter in place
+    int kept = 0;
+    for (size_t i = 0; i < total; i++)
+    {
+        if (all[i].magic != PROFILE_MAGIC)
+            continue;
+        all[i].name[PROFILE_NAME_SIZE - 1] = '\0';
+        all[i].version[PROFILE_VERSION_SIZE - 1] = '\0';
+        if (package_name && !profile_record_is(&all[i], package_name))
+            continue;
+        all[kept++] = all[i];
+    }
+
+    if (kept == 0)
+    {
+        TINYPKG_FREE(all);
+        return TINYPKG_SUCCESS;
+    }
+
+    *records = all;
+    *count = kept;
+    return TINYPKG_SUCCESS;
+}
+
+// Expected build time in seconds: the mean of the newest successful source
+// builds, else the package's own estimate
+int profile_estimate(const profile_record_t *records, int count,
+                     const package_t *pkg)
+{
+    uint64_t total = 0;
+    int samples = 0;
+
+    if (!pkg)
+        return PROFILE_DEFAULT_ESTIMATE;
+
+    for (int i = count - 1; i >= 0 && samples < PROFILE_ESTIMATE_SAMPLES; i--)
+    {
+        const profile_record_t *record = &records[i];
+        if ((record->flags & (PROFILE_FLAG_FAILED | PROFILE_FLAG_BINCACHE)) ||
+            !profile_record_is(record, pkg->name))
+            continue;
+        total += profile_total_ms(record);
+        samples++;
+    }
+
+    if (samples > 0)
+        return (int)MAX(1, total / (uint64_t)samples / 1000);
+    if (pkg->build_time_estimate > 0)
+        return pkg->build_time_estimate;
+    return PROFILE_DEFAULT_ESTIMATE;
+}
+
+// Print the builds of a package and how their cost developed
+int profile_report(const char *package_name)
+{
+    profile_record_t *records = NULL;
+    int count = 0;
+    char cells[PROFILE_PHASE_COUNT + 2][16];
+    char date[32];
+
+    if (!package_name)
+        return TINYPKG_ERROR;
+
+    int result = profile_history_load(package_name, &records, &count);
+    if (result != TINYPKG_SUCCESS)
+    {
+        log_error("Failed to read build history");
+        return result;
+    }
+    if (count == 0)
+    {
+        printf("No build history for %s\n", package_name);
+        return TINYPKG_SUCCESS;
+    }
+
+    printf("Build history for %s (%d builds)\n\n", package_name, count);
+    printf("%-16s %-12s %4s %7s %7s %7s %7s %7s %7s %7s %7s %8s %7s %6s\n",
+           "Date", "Version", "Jobs", "Total", "Fetch", "Extract", "Config",
+           "Compile", "Stage", "Package", "Install", "CPU", "RSS", "Cache");
+
+    for (int i = MAX(0, count - PROFILE_REPORT_ROWS); i < count; i++)
+    {
+        const profile_record_t *record = &records[i];
+        time_t timestamp = (time_t)record->timestamp;
+        struct tm tm;
+        char rss[24];
+        char cache[16];
+
+        localtime_r(&timestamp, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm);
+
+        profile_format_ms(cells[0], sizeof(cells[0]), profile_total_ms(record));
+        for (int p = 0; p < PROFILE_PHASE_COUNT; p++)
+        {
+            if (record->phase_ms[p] == 0)
+                snprintf(cells[p + 1], sizeof(cells[p + 1]), "-");
+            else
+                profile_format_ms(cells[p + 1], sizeof(cells[p + 1]),
+                                  record->phase_ms[p]);
+        }
+        profile_format_ms(cells[PROFILE_PHASE_COUNT + 1],
+                          sizeof(cells[PROFILE_PHASE_COUNT + 1]),
+                          record->user_ms + record->system_ms);
+        snprintf(rss, sizeof(rss), "%luM",
+                 (unsigned long)(record->peak_rss_kb / 1024));
+
+        uint32_t lookups = record->cache_hits + record->cache_misses;
+        if (lookups > 0)
+            snprintf(cache, sizeof(cache), "%u%%",
+                     (unsigned)(100ULL * record->cache_hits / lookups));
+        else
+            snprintf(cache, sizeof(cache), "-");
+
+        printf("%-16s %-12.12s %4u %7s %7s %7s %7s %7s %7s %7s %7s %8s %7s %6s%s\n",
+               date, record->version, record->jobs, cells[0], cells[1],
+               cells[2], cells[3], cells[4], cells[5], cells[6], cells[7],
+               cells[8], rss, cache,
+               (record->flags & PROFILE_FLAG_FAILED)     ? "  failed"
+               : (record->flags & PROFILE_FLAG_BINCACHE) ? "  cached"
+                                                         : "");
+    }
+
+    // Trend: newest successful source builds against the ones before them
+    uint64_t recent = 0, earlier = 0;
+    int recent_count = 0, earlier_count = 0;
+    for (int i = count - 1; i >= 0; i--)
+    {
+        const profile_record_t *record = &records[i];
+        if (record->flags & (PROFILE_FLAG_FAILED | PROFILE_FLAG_BINCACHE))
+            continue;
+        if (recent_count < PROFILE_ESTIMATE_SAMPLES)
+        {
+            recent += profile_total_ms(record);
+            recent_count++;
+        }
+        else if (earlier_count < PROFILE_ESTIMATE_SAMPLES)
+        {
+            earlier += profile_total_ms(record);
+            earlier_count++;
+        }
+    }
+
+    printf("\n");
+    if (recent_count > 0)
+    {
+        profile_format_ms(cells[0], sizeof(cells[0]), recent / recent_count);
+        printf("Average of the last %d builds: %s", recent_count, cells[0]);
+        if (earlier_count > 0 && earlier > 0)
+        {
+            double before = (double)earlier / earlier_count;
+            double now = (double)recent / recent_count;
+            profile_format_ms(cells[1], sizeof(cells[1]), (uint64_t)before);
+            printf(" (previous %d: %s, %+.1f%%)", earlier_count, cells[1],
+                   100.0 * (now - before) / before);
+        }
+        printf("\n");
+    }
+
+    TINYPKG_FREE(records);
+    return TINYPKG_SUCCESS;
+}
+
+const char *profile_phase_to_string(profile_phase_t phase)
+{
+    return phase < PROFILE_PHASE_COUNT ? phase_names[phase] : "unknown";
+}
@@ -0,0 +1,97 @@
+/*
+ * TinyPkg - Build Profiler Header
+ * Per-phase build timings and the history they are kept in
+ */
+
+#ifndef TINYPKG_PROFILE_H
+#define TINYPKG_PROFILE_H
+
+#include <stdint.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// Append-only history inside LIB_DIR. Writers lock the separate lock
+// file, which compaction never replaces.
+#define PROFILE_HISTORY_FILE "build-history"
+#define PROFILE_HISTORY_LOCK_FILE "build-history.lock"
+
+#define PROFILE_MAGIC 0x32485054U          // "TPH2"
+#define PROFILE_NAME_SIZE 64
+#define PROFILE_VERSION_SIZE 32
+
+// The oldest half is dropped once the history grows past this
+#define PROFILE_HISTORY_MAX 16384
+
+// Builds averaged into a cost estimate, and its fallback
+#define PROFILE_ESTIMATE_SAMPLES 5
+#define PROFILE_DEFAULT_ESTIMATE 60        // Seconds
+
+// Builds shown by profile_report()
+#define PROFILE_REPORT_ROWS 20
+
+// Record flags
+#define PROFILE_FLAG_FAILED 0x1
+#define PROFILE_FLAG_BINCACHE 0x2          // Restored from the binary cache
+#define PROFILE_FLAG_PREFETCHED 0x4        // Sources fetched ahead of the build
+#define PROFILE_FLAG_TMPFS 0x8             // Built in a tmpfs workspace
+
+// Timed phases of a build
+typedef enum {
+    PROFILE_PHASE_DOWNLOAD = 0,
+    PROFILE_PHASE_EXTRACT,
+    PROFILE_PHASE_CONFIGURE,
+    PROFILE_PHASE_COMPILE,
+    PROFILE_PHASE_STAGE,
+    PROFILE_PHASE_PACKAGE,          // Storing the binary cache artifact
+    PROFILE_PHASE_INSTALL,
+    PROFILE_PHASE_COUNT
+} profile_phase_t;
+
+// One build as stored in the history (fixed size, native byte order)
+typedef struct profile_record {
+    uint32_t magic;
+    uint32_t flags;
+    int64_t timestamp;
+    uint32_t name_hash;             // FNV-1a of the full, untruncated name
+    uint32_t reserved;
+    char name[PROFILE_NAME_SIZE];   // Possibly truncated, for display
+    char version[PROFILE_VERSION_SIZE];
+    uint32_t phase_ms[PROFILE_PHASE_COUNT];
+    uint32_t jobs;
+    uint64_t download_bytes;
+    uint64_t user_ms;               // CPU time of all build commands
+    uint64_t system_ms;
+    uint64_t peak_rss_kb;           // Largest single process
+    uint32_t cache_hits;            // Compiler cache
+    uint32_t cache_misses;
+} profile_record_t;
+
+// A build being profiled
+typedef struct profile {
+    profile_record_t record;
+    struct timespec phase_start[PROFILE_PHASE_COUNT];
+} profile_t;
+
+// Function declarations
+
+// Collecting a profile; all take NULL as "not profiling"
+void profile_begin(profile_t *profile, const package_t *pkg, int jobs);
+void profile_phase_begin(profile_t *profile, profile_phase_t phase);
+void profile_phase_end(profile_t *profile, profile_phase_t phase);
+void profile_add_usage(profile_t *profile, const struct rusage *usage);
+void profile_add_download(profile_t *profile, uint64_t bytes);
+void profile_set_cache_stats(profile_t *profile, long hits, long misses);
+void profile_set_flag(profile_t *profile, uint32_t flag);
+int profile_finish(profile_t *profile, int result);
+
+// History
+int profile_history_load(const char *package_name, profile_record_t **records,
+                         int *count);
+int profile_estimate(const profile_record_t *records, int count,
+                     const package_t *pkg);
+int profile_report(const char *package_name);
+
+// Utilities
+const char *profile_phase_to_string(profile_phase_t phase);
+
+#endif /* TINYPKG_PROFILE_H */
@@ -0,0 +1,1114 @@
+/*
+ * TinyPkg - Repository Index Implementation
+ * Precompiled, memory-mapped index of all package metadata in the repositories
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/tinypkg.h"
+
+// Mapped index
+typedef struct repoindex {
+    int opened;
+    int current;                    // Key matched the repositories at open
+    int stale_ok;                   // Used even if not current
+    void *map;
+    size_t map_size;
+    const repoindex_header_t *header;
+    const repoindex_package_t *packages;
+    const uint32_t *refs;
+    const uint32_t *index;
+    const repoindex_trigram_t *trigrams;
+    const uint32_t *postings;
+    const repoindex_repo_t *repos;
+    const char *strtab;
+} repoindex_t;
+
+static repoindex_t g_repoindex;
+static pthread_mutex_t g_repoindex_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Index under construction
+typedef struct repoindex_builder {
+    repoindex_package_t *packages;
+    uint32_t package_count;
+    uint32_t package_capacity;
+
+    uint32_t *refs;
+    uint32_t ref_count;
+    uint32_t ref_capacity;
+
+    char *strtab;
+    size_t strtab_size;
+    size_t strtab_capacity;
+
+    uint32_t *strings;              // Interned string offset + 1
+    uint32_t string_capacity;
+    uint32_t string_count;
+
+    uint32_t *keys;                 // Package number + 1 by key
+    uint32_t key_capacity;
+
+    // Commit of every enabled repository
+    repoindex_repo_t *repos;
+    uint32_t repo_count;
+
+    // Incremental rebuilds take unchanged records from the mapped index
+    int reuse;
+    char **changed;                 // Sorted definition paths to parse again
+    int changed_count;
+    uint32_t parsed;
+    uint32_t copied;
+
+    // Search index: (trigram << 32 | package ID) pairs, then grouped
+    uint64_t *search;
+    size_t search_count;
+    size_t search_capacity;
+    repoindex_trigram_t *trigrams;
+    uint32_t trigram_count;
+    uint32_t *postings;
+    uint32_t posting_count;
+} repoindex_builder_t;
+
+static int repoindex_compare_paths(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static void repoindex_path(char *path, size_t size) {
+    snprintf(path, size, "%s/%s", LIB_DIR, REPOINDEX_FILE);
+}
+
+// Identify the repository state the index describes: a SHA-256 digest of
+// "name:commit;" for every enabled repository. commits, if given, receives
+// each repository's commit, in repository_get_all() order.
+static int repoindex_compute_key(char *key, size_t size, char (*commits)[41]) {
+    repository_t *repos;
+    int count = 0;
+
+    key[0] = '\0';
+    security_hash_t *hash = security_hash_create(HASH_TYPE_SHA256);
+    if (!hash) return TINYPKG_ERROR_MEMORY;
+
+    repos = repository_get_all(&count);
+    for (int i = 0; repos && i < count; i++) {
+        char commit[41];
+
+        if (!repos[i].enabled) continue;
+        if (repository_read_head(repos[i].local_path, commit, sizeof(commit)) != TINYPKG_SUCCESS) {
+            commit[0] = '\0';
+        }
+        if (commits) memcpy(commits[i], commit, sizeof(commit));
+
+        security_hash_update(hash, repos[i].name, strlen(repos[i].name));
+        security_hash_update(hash, ":", 1);
+        security_hash_update(hash, commit, strlen(commit));
+        security_hash_update(hash, ";", 1);
+    }
+
+    int result = security_hash_final(hash, key, size);
+    security_hash_free(hash);
+    if (result != TINYPKG_SUCCESS) key[0] = '\0';
+    return result;
+}
+
+// Mapped file access
+static const char *repoindex_string(uint32_t offset) {
+    return offset < g_repoindex.header->strtab_size ? g_repoindex.strtab + offset : "";
+}
+
+static void repoindex_unmap(void) {
+    if (g_repoindex.map) {
+        munmap(g_repoindex.map, g_repoindex.map_size);
+    }
+    memset(&g_repoindex, 0, sizeof(g_repoindex));
+}
+
+static int repoindex_map(const char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? TINYPKG_SUCCESS : TINYPKG_ERROR_FILE;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(repoindex_header_t)) {
+        close(fd);
+        log_warn("Repository index is truncated: %s", path);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_warn("Failed to map repository index: %s", strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+
+    const repoindex_header_t *header = (const repoindex_header_t *)map;
+    uint64_t size = (uint64_t)st.st_size;
+
+    if (memcmp(header->magic, REPOINDEX_MAGIC, sizeof(REPOINDEX_MAGIC)) != 0 ||
+        header->version != REPOINDEX_FORMAT_VERSION || header->file_size != size ||
+        header->bucket_count == 0 ||
+        (header->bucket_count & (header->bucket_count - 1)) != 0 ||
+        header->bucket_count <= header->package_count ||
+        header->key[REPOINDEX_KEY_SIZE - 1] != '\0' ||
+        header->packages_offset + (uint64_t)header->package_count * sizeof(repoindex_package_t) > size ||
+        header->refs_offset + (uint64_t)header->ref_count * sizeof(uint32_t) > size ||
+        header->index_offset + (uint64_t)header->bucket_count * sizeof(uint32_t) > size ||
+        header->trigrams_offset + (uint64_t)header->trigram_count * sizeof(repoindex_trigram_t) > size ||
+        header->postings_offset + (uint64_t)header->posting_count * sizeof(uint32_t) > size ||
+        header->repos_offset + (uint64_t)header->repo_count * sizeof(repoindex_repo_t) > size ||
+        header->strtab_size == 0 ||
+        header->strtab_offset + header->strtab_size > size ||
+        ((const char *)map)[header->strtab_offset + header->strtab_size - 1] != '\0') {
+        munmap(map, (size_t)st.st_size);
+        log_warn("Repository index is corrupt, ignoring: %s", path);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    const char *base = (const char *)map;
+    g_repoindex.map = map;
+    g_repoindex.map_size = (size_t)st.st_size;
+    g_repoindex.header = header;
+    g_repoindex.packages = (const repoindex_package_t *)(base + header->packages_offset);
+    g_repoindex.refs = (const uint32_t *)(base + header->refs_offset);
+    g_repoindex.index = (const uint32_t *)(base + header->index_offset);
+    g_repoindex.trigrams = (const repoindex_trigram_t *)(base + header->trigrams_offset);
+    g_repoindex.postings = (const uint32_t *)(base + header->postings_offset);
+    g_repoindex.repos = (const repoindex_repo_t *)(base + header->repos_offset);
+    g_repoindex.strtab = base + header->strtab_offset;
+    return TINYPKG_SUCCESS;
+}
+
+// Open and check the key, with the lock held
+static int repoindex_open_locked(void) {
+    char path[MAX_PATH];
+    char key[REPOINDEX_KEY_SIZE];
+
+    if (g_repoindex.opened) {
+        return g_repoindex.current || (g_repoindex.stale_ok && g_repoindex.header) ?
+               TINYPKG_SUCCESS : TINYPKG_ERROR;
+    }
+
+    repoindex_path(path, sizeof(path));
+    g_repoindex.opened = 1;
+    if (repoindex_map(path) != TINYPKG_SUCCESS || !g_repoindex.header) {
+        return TINYPKG_ERROR;
+    }
+
+    g_repoindex.current = repoindex_compute_key(key, sizeof(key), NULL) == TINYPKG_SUCCESS &&
+                          strcmp(key, g_repoindex.header->key) == 0;
+    if (!g_repoindex.current) {
+        log_debug("Repository index is stale, falling back to package JSON");
+        return TINYPKG_ERROR;
+    }
+
+    log_debug("Using repository index: %u packages", g_repoindex.header->package_count);
+    return TINYPKG_SUCCESS;
+}
+
+// Index lifecycle
+int repoindex_open(void) {
+    pthread_mutex_lock(&g_repoindex_lock);
+    int result = repoindex_open_locked();
+    pthread_mutex_unlock(&g_repoindex_lock);
+    return result;
+}
+
+void repoindex_close(void) {
+    pthread_mutex_lock(&g_repoindex_lock);
+    repoindex_unmap();
+    pthread_mutex_unlock(&g_repoindex_lock);
+}
+
+int repoindex_is_current(void) {
+    pthread_mutex_lock(&g_repoindex_lock);
+    int current = repoindex_open_locked() == TINYPKG_SUCCESS && g_repoindex.current;
+    pthread_mutex_unlock(&g_repoindex_lock);
+    return current;
+}
+
+int repoindex_open_stale(void) {
+    pthread_mutex_lock(&g_repoindex_lock);
+    repoindex_open_locked();
+    g_repoindex.stale_ok = 1;
+    int result = g_repoindex.header ? TINYPKG_SUCCESS : TINYPKG_ERROR;
+    pthread_mutex_unlock(&g_repoindex_lock);
+    return result;
+}
+
+// Probe the mapped hash index; the caller makes sure an index is mapped
+static int repoindex_lookup(const char *package_name) {
+    const repoindex_header_t *header = g_repoindex.header;
+    if (header->package_count == 0) return -1;
+
+    uint32_t hash = utils_hash_string(package_name);
+    uint32_t mask = header->bucket_count - 1;
+    for (uint32_t i = hash & mask, probes = 0; probes < header->bucket_count;
+         i = (i + 1) & mask, probes++) {
+        uint32_t ref = g_repoindex.index[i];
+        if (ref == 0 || ref > header->package_count) return -1;
+
+        const repoindex_package_t *pkg = &g_repoindex.packages[ref - 1];
+        if (pkg->hash == hash && strcmp(repoindex_string(pkg->key), package_name) == 0) {
+            return (int)(ref - 1);
+        }
+    }
+    return -1;
+}
+
+// Queries
+int repoindex_find(const char *package_name) {
+    if (!package_name || repoindex_open() != TINYPKG_SUCCESS) {
+        return -1;
+    }
+    metrics_add(METRICS_REPOINDEX_LOOKUPS, 1);
+    return repoindex_lookup(package_name);
+}
+
+int repoindex_package_count(void) {
+    if (repoindex_open() != TINYPKG_SUCCESS) return 0;
+    return (int)g_repoindex.header->package_count;
+}
+
+const char *repoindex_get_string(int id, repoindex_string_t field) {
+    if (id < 0 || field < 0 || field >= REPOINDEX_STR_COUNT ||
+        repoindex_open() != TINYPKG_SUCCESS ||
+        (uint32_t)id >= g_repoindex.header->package_count) {
+        return NULL;
+    }
+    return repoindex_string(g_repoindex.packages[id].strings[field]);
+}
+
+// Get a package's reference list; returns the number of references
+int repoindex_get_list(int id, repoindex_list_t list, const uint32_t **refs) {
+    if (!refs || id < 0 || list < 0 || list >= REPOINDEX_LIST_COUNT ||
+        repoindex_open() != TINYPKG_SUCCESS ||
+        (uint32_t)id >= g_repoindex.header->package_count) {
+        return 0;
+    }
+
+    const repoindex_package_t *pkg = &g_repoindex.packages[id];
+    uint64_t end = (uint64_t)pkg->list_offset[list] + pkg->list_count[list];
+    if (end > g_repoindex.header->ref_count) return 0;
+
+    *refs = g_repoindex.refs + pkg->list_offset[list];
+    return (int)pkg->list_count[list];
+}
+
+// Packages whose searchable text contains the trigram; returns the number
+// of IDs, which are in ascending order
+int repoindex_search_postings(uint32_t trigram, const uint32_t **ids) {
+    if (!ids || repoindex_open() != TINYPKG_SUCCESS) return 0;
+
+    const repoindex_header_t *header = g_repoindex.header;
+    uint32_t low = 0, high = header->trigram_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (g_repoindex.trigrams[mid].trigram < trigram) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == header->trigram_count || g_repoindex.trigrams[low].trigram != trigram) {
+        return 0;
+    }
+
+    const repoindex_trigram_t *entry = &g_repoindex.trigrams[low];
+    if ((uint64_t)entry->offset + entry->count > header->posting_count) return 0;
+
+    *ids = g_repoindex.postings + entry->offset;
+    return (int)entry->count;
+}
+
+// Name behind a list reference
+const char *repoindex_ref_name(uint32_t ref) {
+    if (!g_repoindex.header) return "";
+
+    if (ref & REPOINDEX_REF_NAME) {
+        return repoindex_string(ref & ~REPOINDEX_REF_NAME);
+    }
+    if (ref >= g_repoindex.header->package_count) return "";
+    return repoindex_string(g_repoindex.packages[ref].key);
+}
+
+static char **repoindex_list_to_strings(int id, repoindex_list_t list, int *count) {
+    const uint32_t *refs;
+    int n = repoindex_get_list(id, list, &refs);
+
+    *count = 0;
+    if (n == 0) return NULL;
+
+    char **strings = TINYPKG_CALLOC(n, sizeof(char *));
+    if (!strings) return NULL;
+
+    for (int i = 0; i < n; i++) {
+        strings[i] = TINYPKG_STRDUP(repoindex_ref_name(refs[i]));
+        if (!strings[i]) {
+            utils_string_array_free(strings, i);
+            return NULL;
+        }
+    }
+
+    *count = n;
+    return strings;
+}
+
+#define REPOINDEX_COPY(dest, field) \
+    strncpy((dest), repoindex_get_string(id, (field)), sizeof(dest) - 1)
+
+// Materialize a package_t from the index; NULL if it is not indexed or
+// the index is stale
+package_t *repoindex_load_package(const char *package_name) {
+    int id = repoindex_find(package_name);
+    if (id < 0) return NULL;
+
+    package_t *pkg = package_create();
+    if (!pkg) return NULL;
+
+    const repoindex_package_t *record = &g_repoindex.packages[id];
+
+    REPOINDEX_COPY(pkg->name, REPOINDEX_STR_NAME);
+    REPOINDEX_COPY(pkg->version, REPOINDEX_STR_VERSION);
+    REPOINDEX_COPY(pkg->description, REPOINDEX_STR_DESCRIPTION);
+    REPOINDEX_COPY(pkg->maintainer, REPOINDEX_STR_MAINTAINER);
+    REPOINDEX_COPY(pkg->homepage, REPOINDEX_STR_HOMEPAGE);
+    REPOINDEX_COPY(pkg->license, REPOINDEX_STR_LICENSE);
+    REPOINDEX_COPY(pkg->category, REPOINDEX_STR_CATEGORY);
+    REPOINDEX_COPY(pkg->source_url, REPOINDEX_STR_SOURCE_URL);
+    REPOINDEX_COPY(pkg->source_type, REPOINDEX_STR_SOURCE_TYPE);
+    REPOINDEX_COPY(pkg->checksum, REPOINDEX_STR_CHECKSUM);
+    REPOINDEX_COPY(pkg->build_cmd, REPOINDEX_STR_BUILD_CMD);
+    REPOINDEX_COPY(pkg->install_cmd, REPOINDEX_STR_INSTALL_CMD);
+    REPOINDEX_COPY(pkg->configure_args, REPOINDEX_STR_CONFIGURE_ARGS);
+    REPOINDEX_COPY(pkg->json_file, REPOINDEX_STR_JSON_FILE);
+
+    pkg->build_system = (build_type_t)record->build_system;
+    pkg->size_estimate = (size_t)record->size_estimate;
+    pkg->build_time_estimate = (int)record->build_time_estimate;
+    pkg->memory_estimate = (int)record->memory_estimate;
+    pkg->disable_ninja = (record->flags & REPOINDEX_FLAG_NO_NINJA) != 0;
+
+    pkg->dependencies = repoindex_list_to_strings(id, REPOINDEX_LIST_DEPENDENCIES,
+                                                  &pkg->dep_count);
+    pkg->build_dependencies = repoindex_list_to_strings(id, REPOINDEX_LIST_BUILD_DEPENDENCIES,
+                                                        &pkg->build_dep_count);
+    pkg->conflicts = repoindex_list_to_strings(id, REPOINDEX_LIST_CONFLICTS,
+                                               &pkg->conflict_count);
+    pkg->provides = repoindex_list_to_strings(id, REPOINDEX_LIST_PROVIDES,
+                                              &pkg->provides_count);
+
+    return pkg;
+}
+
+// Builder
+static void repoindex_builder_free(repoindex_builder_t *b) {
+    TINYPKG_FREE(b->packages);
+    TINYPKG_FREE(b->refs);
+    TINYPKG_FREE(b->strtab);
+    TINYPKG_FREE(b->strings);
+    TINYPKG_FREE(b->keys);
+    TINYPKG_FREE(b->repos);
+    TINYPKG_FREE(b->changed);
+    TINYPKG_FREE(b->search);
+    TINYPKG_FREE(b->trigrams);
+    TINYPKG_FREE(b->postings);
+}
+
+static int repoindex_builder_grow_strings(repoindex_builder_t *b) {
+    uint32_t capacity = b->string_capacity ? b->string_capacity * 2 : 4096;
+    uint32_t *table = TINYPKG_CALLOC(capacity, sizeof(uint32_t));
+    if (!table) return TINYPKG_ERROR_MEMORY;
+
+    for (uint32_t i = 0; i < b->string_capacity; i++) {
+        if (!b->strings[i]) continue;
+
+        uint32_t j = utils_hash_string(b->strtab + b->strings[i] - 1) & (capacity - 1);
+        while (table[j]) j = (j + 1) & (capacity - 1);
+        table[j] = b->strings[i];
+    }
+
+    TINYPKG_FREE(b->strings);
+    b->strings = table;
+    b->string_capacity = capacity;
+    return TINYPKG_SUCCESS;
+}
+
+// Intern a string; licenses, source types and dependency names repeat a lot
+static int repoindex_builder_string(repoindex_builder_t *b, const char *str, uint32_t *offset) {
+    if (!str || !*str) {
+        *offset = 0;
+        return TINYPKG_SUCCESS;
+    }
+
+    if ((b->string_count + 1) * 2 > b->string_capacity &&
+        repoindex_builder_grow_strings(b) != TINYPKG_SUCCESS) {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    uint32_t mask = b->string_capacity - 1;
+    uint32_t i = utils_hash_string(str) & mask;
+    while (b->strings[i]) {
+        if (strcmp(b->strtab + b->strings[i] - 1, str) == 0) {
+            *offset = b->strings[i] - 1;
+            return TINYPKG_SUCCESS;
+        }
+        i = (i + 1) & mask;
+    }
+
+    size_t length = strlen(str) + 1;
+    if (b->strtab_size + length > b->strtab_capacity) {
+        size_t capacity = MAX(b->strtab_capacity * 2, b->strtab_size + length + 65536);
+        char *strtab = TINYPKG_REALLOC(b->strtab, capacity);
+        if (!strtab) return TINYPKG_ERROR_MEMORY;
+        b->strtab = strtab;
+        b->strtab_capacity = capacity;
+    }
+    if (b->strtab_size + length >= REPOINDEX_REF_NAME) {
+        log_error("Repository index string table too large");
+        return TINYPKG_ERROR;
+    }
+
+    memcpy(b->strtab + b->strtab_size, str, length);
+    *offset = (uint32_t)b->strtab_size;
+    b->strings[i] = *offset + 1;
+    b->strtab_size += length;
+    b->string_count++;
+    return TINYPKG_SUCCESS;
+}
+
+static int repoindex_builder_find_key(const repoindex_builder_t *b, const char *key) {
+    if (b->key_capacity == 0) return -1;
+
+    uint32_t mask = b->key_capacity - 1;
+    for (uint32_t i = utils_hash_string(key) & mask; b->keys[i]; i = (i + 1) & mask) {
+        const repoindex_package_t *pkg = &b->packages[b->keys[i] - 1];
+        if (strcmp(b->strtab + pkg->key, key) == 0) {
+            return (int)(b->keys[i] - 1);
+        }
+    }
+    return -1;
+}
+
+static int repoindex_builder_add_key(repoindex_builder_t *b, uint32_t id) {
+    if ((b->package_count + 1) * 2 > b->key_capacity) {
+        uint32_t capacity = b->key_capacity ? b->key_capacity * 2 : 1024;
+        uint32_t *keys = TINYPKG_CALLOC(capacity, sizeof(uint32_t));
+        if (!keys) return TINYPKG_ERROR_MEMORY;
+
+        for (uint32_t i = 0; i < b->key_capacity; i++) {
+            if (!b->keys[i]) continue;
+            uint32_t j = b->packages[b->keys[i] - 1].hash & (capacity - 1);
+            while (keys[j]) j = (j + 1) & (capacity - 1);
+            keys[j] = b->keys[i];
+        }
+
+        TINYPKG_FREE(b->keys);
+        b->keys = keys;
+        b->key_capacity = capacity;
+    }
+
+    uint32_t j = b->packages[id].hash & (b->key_capacity - 1);
+    while (b->keys[j]) j = (j + 1) & (b->key_capacity - 1);
+    b->keys[j] = id + 1;
+    return TINYPKG_SUCCESS;
+}
+
+// Append a name to the record's list; names are resolved to package IDs
+// once all packages are known
+static int repoindex_builder_ref(repoindex_builder_t *b, repoindex_package_t *record,
+                                 repoindex_list_t list, const char *name) {
+    uint32_t offset;
+
+    if (!name || !*name) return TINYPKG_SUCCESS;
+    if (repoindex_builder_string(b, name, &offset) != TINYPKG_SUCCESS) {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    if (b->ref_count == b->ref_capacity) {
+        uint32_t capacity = b->ref_capacity ? b->ref_capacity * 2 : 4096;
+        uint32_t *refs = TINYPKG_REALLOC(b->refs, capacity * sizeof(uint32_t));
+        if (!refs) return TINYPKG_ERROR_MEMORY;
+        b->refs = refs;
+        b->ref_capacity = capacity;
+    }
+
+    b->refs[b->ref_count++] = REPOINDEX_REF_NAME | offset;
+    record->list_count[list]++;
+    return TINYPKG_SUCCESS;
+}
+
+static int repoindex_builder_list(repoindex_builder_t *b, repoindex_package_t *record,
+                                  repoindex_list_t list, char **names, int count) {
+    record->list_offset[list] = b->ref_count;
+    record->list_count[list] = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (repoindex_builder_ref(b, record, list, names[i]) != TINYPKG_SUCCESS) {
+            return TINYPKG_ERROR_MEMORY;
+        }
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Room for one more record, cleared
+static repoindex_package_t *repoindex_builder_next(repoindex_builder_t *b) {
+    if (b->package_count == b->package_capacity) {
+        uint32_t capacity = b->package_capacity ? b->package_capacity * 2 : 256;
+        repoindex_package_t *packages =
+            TINYPKG_REALLOC(b->packages, capacity * sizeof(repoindex_package_t));
+        if (!packages) return NULL;
+        b->packages = packages;
+        b->package_capacity = capacity;
+    }
+
+    repoindex_package_t *record = &b->packages[b->package_count];
+    memset(record, 0, sizeof(*record));
+    return record;
+}
+
+// Key the filled in record and make it part of the index
+static int repoindex_builder_commit(repoindex_builder_t *b, repoindex_package_t *record,
+                                    const char *key) {
+    int result = repoindex_builder_string(b, key, &record->key);
+    if (result != TINYPKG_SUCCESS) return result;
+
+    record->hash = utils_hash_string(key);
+    result = repoindex_builder_add_key(b, b->package_count);
+    if (result == TINYPKG_SUCCESS) b->package_count++;
+    return result;
+}
+
+// Take a package over from the mapped index without parsing its JSON
+static int repoindex_builder_copy(repoindex_builder_t *b, const char *key, int id) {
+    const repoindex_package_t *old = &g_repoindex.packages[id];
+    repoindex_package_t *record = repoindex_builder_next(b);
+    if (!record) return TINYPKG_ERROR_MEMORY;
+
+    int result = TINYPKG_SUCCESS;
+    for (int i = 0; i < REPOINDEX_STR_COUNT && result == TINYPKG_SUCCESS; i++) {
+        result = repoindex_builder_string(b, repoindex_string(old->strings[i]),
+                                          &record->strings[i]);
+    }
+
+    for (int list = 0; list < REPOINDEX_LIST_COUNT && result == TINYPKG_SUCCESS; list++) {
+        uint64_t end = (uint64_t)old->list_offset[list] + old->list_count[list];
+        uint32_t count = end <= g_repoindex.header->ref_count ? old->list_count[list] : 0;
+
+        record->list_offset[list] = b->ref_count;
+        record->list_count[list] = 0;
+        for (uint32_t i = 0; i < count && result == TINYPKG_SUCCESS; i++) {
+            const char *name = repoindex_ref_name(g_repoindex.refs[old->list_offset[list] + i]);
+            result = repoindex_builder_ref(b, record, (repoindex_list_t)list, name);
+        }
+    }
+
+    record->build_system = old->build_system;
+    record->build_time_estimate = old->build_time_estimate;
+    record->size_estimate = old->size_estimate;
+    record->memory_estimate = old->memory_estimate;
+    record->flags = old->flags;
+
+    if (result != TINYPKG_SUCCESS) return result;
+    b->copied++;
+    return repoindex_builder_commit(b, record, key);
+}
+
+// Whether the mapped index holds an up to date record for this definition
+static int repoindex_builder_reusable(const repoindex_builder_t *b, const char *key,
+                                      const char *json_file) {
+    if (!b->reuse || !g_repoindex.header || g_repoindex.header->package_count == 0) {
+        return -1;
+    }
+
+    int id = repoindex_lookup(key);
+    if (id < 0 || strcmp(repoindex_string(g_repoindex.packages[id].strings[REPOINDEX_STR_JSON_FILE]),
+                         json_file) != 0) {
+        return -1;
+    }
+
+    if (b->changed_count > 0 &&
+        bsearch(&json_file, b->changed, b->changed_count, sizeof(char *),
+                repoindex_compare_paths)) {
+        return -1;
+    }
+    return id;
+}
+
+static int repoindex_builder_add(repoindex_builder_t *b, const char *key, const char *json_file) {
+    if (repoindex_builder_find_key(b, key) >= 0) {
+        return TINYPKG_SUCCESS;     // Shadowed by a higher priority repository
+    }
+
+    int id = repoindex_builder_reusable(b, key, json_file);
+    if (id >= 0) {
+        return repoindex_builder_copy(b, key, id);
+    }
+
+    package_t *pkg = json_parser_load_package_file(json_file);
+    if (!pkg) {
+        log_warn("Skipping invalid package definition: %s", json_file);
+        return TINYPKG_SUCCESS;
+    }
+
+    repoindex_package_t *record = repoindex_builder_next(b);
+    if (!record) {
+        package_free(pkg);
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    const char *strings[REPOINDEX_STR_COUNT] = {
+        [REPOINDEX_STR_NAME] = pkg->name,
+        [REPOINDEX_STR_VERSION] = pkg->version,
+        [REPOINDEX_STR_DESCRIPTION] = pkg->description,
+        [REPOINDEX_STR_MAINTAINER] = pkg->maintainer,
+        [REPOINDEX_STR_HOMEPAGE] = pkg->homepage,
+        [REPOINDEX_STR_LICENSE] = pkg->license,
+        [REPOINDEX_STR_CATEGORY] = pkg->category,
+        [REPOINDEX_STR_SOURCE_URL] = pkg->source_url,
+        [REPOINDEX_STR_SOURCE_TYPE] = pkg->source_type,
+        [REPOINDEX_STR_CHECKSUM] = pkg->checksum,
+        [REPOINDEX_STR_BUILD_CMD] = pkg->build_cmd,
+        [REPOINDEX_STR_INSTALL_CMD] = pkg->install_cmd,
+        [REPOINDEX_STR_CONFIGURE_ARGS] = pkg->configure_args,
+        [REPOINDEX_STR_JSON_FILE] = pkg->json_file,
+    };
+
+    int result = TINYPKG_SUCCESS;
+    for (int i = 0; i < REPOINDEX_STR_COUNT && result == TINYPKG_SUCCESS; i++) {
+        result = repoindex_builder_string(b, strings[i], &record->strings[i]);
+    }
+
+    if (result == TINYPKG_SUCCESS) {
+        result = repoindex_builder_list(b, record, REPOINDEX_LIST_DEPENDENCIES,
+                                        pkg->dependencies, pkg->dep_count);
+    }
+    if (result == TINYPKG_SUCCESS) {
+        result = repoindex_builder_list(b, record, REPOINDEX_LIST_BUILD_DEPENDENCIES,
+                                        pkg->build_dependencies, pkg->build_dep_count);
+    }
+    if (result == TINYPKG_SUCCESS) {
+        result = repoindex_builder_list(b, record, REPOINDEX_LIST_CONFLICTS,
+                                        pkg->conflicts, pkg->conflict_count);
+    }
+    if (result == TINYPKG_SUCCESS) {
+        result = repoindex_builder_list(b, record, REPOINDEX_LIST_PROVIDES,
+                                        pkg->provides, pkg->provides_count);
+    }
+
+    record->build_system = (uint32_t)pkg->build_system;
+    record->build_time_estimate = (uint32_t)MAX(pkg->build_time_estimate, 0);
+    record->size_estimate = (uint64_t)pkg->size_estimate;
+    record->memory_estimate = (uint32_t)MAX(pkg->memory_estimate, 0);
+    record->flags = pkg->disable_ninja ? REPOINDEX_FLAG_NO_NINJA : 0;
+    package_free(pkg);
+
+    if (result != TINYPKG_SUCCESS) return result;
+    b->parsed++;
+    return repoindex_builder_commit(b, record, key);
+}
+
+// Add every package of one repository, in repository_get_package_path()
+// order: "<name>/<name>.json" first, then "<name>.json"
+static int repoindex_builder_scan(repoindex_builder_t *b, const char *repo_path) {
+    int result = TINYPKG_SUCCESS;
+
+    for (int pass = 0; pass < 2 && result == TINYPKG_SUCCESS; pass++) {
+        DIR *dir = opendir(repo_path);
+        struct dirent *entry;
+
+        if (!dir) return TINYPKG_SUCCESS;
+
+        while (result == TINYPKG_SUCCESS && (entry = readdir(dir))) {
+            char json_file[MAX_PATH];
+            char key[MAX_NAME];
+
+            if (entry->d_name[0] == '.') continue;
+
+            if (pass == 0) {
+                if (snprintf(json_file, sizeof(json_file), "%s/%s/%s.json", repo_path,
+                             entry->d_name, entry->d_name) >= (int)sizeof(json_file)) {
+                    continue;
+                }
+                strncpy(key, entry->d_name, sizeof(key) - 1);
+                key[sizeof(key) - 1] = '\0';
+            } else {
+                size_t len = strlen(entry->d_name);
+                if (len <= 5 || len - 5 >= sizeof(key) ||
+                    strcmp(entry->d_name + len - 5, ".json") != 0) {
+                    continue;
+                }
+                snprintf(json_file, sizeof(json_file), "%s/%s", repo_path, entry->d_name);
+                memcpy(key, entry->d_name, len - 5);
+                key[len - 5] = '\0';
+            }
+
+            if (utils_file_exists(json_file)) {
+                result = repoindex_builder_add(b, key, json_file);
+            }
+        }
+        closedir(dir);
+    }
+
+    return result;
+}
+
+// Turn name references into package IDs where the name is indexed
+static void repoindex_builder_resolve(repoindex_builder_t *b) {
+    for (uint32_t i = 0; i < b->ref_count; i++) {
+        const char *name = b->strtab + (b->refs[i] & ~REPOINDEX_REF_NAME);
+        int id = repoindex_builder_find_key(b, name);
+        if (id >= 0) b->refs[i] = (uint32_t)id;
+    }
+}
+
+// Record every trigram of one searchable string
+static int repoindex_builder_search_text(repoindex_builder_t *b, uint32_t id, const char *text) {
+    size_t length = strlen(text);
+
+    for (size_t i = 0; i + 3 <= length; i++) {
+        if (b->search_count == b->search_capacity) {
+            size_t capacity = b->search_capacity ? b->search_capacity * 2 : 65536;
+            uint64_t *search = TINYPKG_REALLOC(b->search, capacity * sizeof(uint64_t));
+            if (!search) return TINYPKG_ERROR_MEMORY;
+            b->search = search;
+            b->search_capacity = capacity;
+        }
+
+        uint32_t trigram = REPOINDEX_TRIGRAM(tolower((unsigned char)text[i]),
+                                             tolower((unsigned char)text[i + 1]),
+                                             tolower((unsigned char)text[i + 2]));
+        b->search[b->search_count++] = ((uint64_t)trigram << 32) | id;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static int repoindex_compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Build the trigram table and postings; runs after name resolution
+static int repoindex_builder_search(repoindex_builder_t *b) {
+    static const repoindex_string_t fields[] = {
+        REPOINDEX_STR_NAME, REPOINDEX_STR_DESCRIPTION,
+        REPOINDEX_STR_CATEGORY, REPOINDEX_STR_MAINTAINER,
+    };
+    int result = TINYPKG_SUCCESS;
+
+    for (uint32_t id = 0; id < b->package_count && result == TINYPKG_SUCCESS; id++) {
+        const repoindex_package_t *pkg = &b->packages[id];
+
+        for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]) && result == TINYPKG_SUCCESS; f++) {
+            result = repoindex_builder_search_text(b, id, b->strtab + pkg->strings[fields[f]]);
+        }
+
+        const uint32_t *refs = b->refs + pkg->list_offset[REPOINDEX_LIST_PROVIDES];
+        for (uint32_t i = 0; i < pkg->list_count[REPOINDEX_LIST_PROVIDES] &&
+                             result == TINYPKG_SUCCESS; i++) {
+            const char *name = (refs[i] & REPOINDEX_REF_NAME) ?
+                               b->strtab + (refs[i] & ~REPOINDEX_REF_NAME) :
+                               b->strtab + b->packages[refs[i]].key;
+            result = repoindex_builder_search_text(b, id, name);
+        }
+    }
+    if (result != TINYPKG_SUCCESS) return result;
+
+    // Sorting groups postings by trigram with IDs ascending; duplicates
+    // (a trigram seen twice in one package) sit next to each other
+    if (b->search_count > 0) {
+        qsort(b->search, b->search_count, sizeof(uint64_t), repoindex_compare_u64);
+    }
+
+    b->postings = TINYPKG_MALLOC(MAX(b->search_count, 1) * sizeof(uint32_t));
+    b->trigrams = TINYPKG_MALLOC(MAX(b->search_count, 1) * sizeof(repoindex_trigram_t));
+    if (!b->postings || !b->trigrams) return TINYPKG_ERROR_MEMORY;
+
+    for (size_t i = 0; i < b->search_count; i++) {
+        if (i > 0 && b->search[i] == b->search[i - 1]) continue;
+
+        uint32_t trigram = (uint32_t)(b->search[i] >> 32);
+        if (b->trigram_count == 0 || b->trigrams[b->trigram_count - 1].trigram != trigram) {
+            repoindex_trigram_t *entry = &b->trigrams[b->trigram_count++];
+            entry->trigram = trigram;
+            entry->offset = b->posting_count;
+            entry->count = 0;
+        }
+        b->postings[b->posting_count++] = (uint32_t)b->search[i];
+        b->trigrams[b->trigram_count - 1].count++;
+    }
+
+    TINYPKG_FREE(b->search);
+    b->search = NULL;
+    b->search_count = b->search_capacity = 0;
+    return TINYPKG_SUCCESS;
+}
+
+static int repoindex_write_full(int fd, const void *buf, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = write(fd, (const char *)buf + done, length - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return TINYPKG_ERROR_FILE;
+        done += (size_t)n;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static int repoindex_builder_write(repoindex_builder_t *b, const char *key) {
+    char path[MAX_PATH];
+    char temp_path[MAX_PATH];
+    repoindex_header_t header;
+
+    uint32_t buckets = 16;
+    while (buckets < b->package_count * 2) buckets *= 2;
+
+    uint32_t *index = TINYPKG_CALLOC(buckets, sizeof(uint32_t));
+    if (!index) return TINYPKG_ERROR_MEMORY;
+
+    for (uint32_t i = 0; i < b->package_count; i++) {
+        uint32_t j = b->packages[i].hash & (buckets - 1);
+        while (index[j]) j = (j + 1) & (buckets - 1);
+        index[j] = i + 1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REPOINDEX_MAGIC, sizeof(REPOINDEX_MAGIC));
+    header.version = REPOINDEX_FORMAT_VERSION;
+    header.package_count = b->package_count;
+    header.ref_count = b->ref_count;
+    header.bucket_count = buckets;
+    header.strtab_size = (uint32_t)b->strtab_size;
+    header.trigram_count = b->trigram_count;
+    header.posting_count = b->posting_count;
+    header.repo_count = b->repo_count;
+    snprintf(header.key, sizeof(header.key), "%s", key);
+    header.packages_offset = sizeof(header);
+    header.refs_offset = header.packages_offset +
+                         (uint64_t)b->package_count * sizeof(repoindex_package_t);
+    header.index_offset = header.refs_offset + (uint64_t)b->ref_count * sizeof(uint32_t);
+    header.trigrams_offset = header.index_offset + (uint64_t)buckets * sizeof(uint32_t);
+    header.postings_offset = header.trigrams_offset +
+                             (uint64_t)b->trigram_count * sizeof(repoindex_trigram_t);
+    header.repos_offset = header.postings_offset + (uint64_t)b->posting_count * sizeof(uint32_t);
+    header.strtab_offset = header.repos_offset + (uint64_t)b->repo_count * sizeof(repoindex_repo_t);
+    header.file_size = header.strtab_offset + b->strtab_size;
+
+    utils_create_directory_recursive(LIB_DIR);
+    repoindex_path(path, sizeof(path));
+    if ((size_t)snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= sizeof(temp_path)) {
+        log_error("Repository index path too long: %s", path);
+        TINYPKG_FREE(index);
+        return TINYPKG_ERROR;
+    }
+
+    int result = TINYPKG_ERROR_FILE;
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_error("Failed to open repository index for writing: %s", temp_path);
+        TINYPKG_FREE(index);
+        return result;
+    }
+
+    if (repoindex_write_full(fd, &header, sizeof(header)) == TINYPKG_SUCCESS &&
+        repoindex_write_full(fd, b->packages,
+                             (size_t)b->package_count * sizeof(repoindex_package_t)) == TINYPKG_SUCCESS &&
+        repoindex_write_full(fd, b->refs, (size_t)b->ref_count * sizeof(uint32_t)) == TINYPKG_SUCCESS &&
+        repoindex_write_full(fd, index, (size_t)buckets * sizeof(uint32_t)) == TINYPKG_SUCCESS &&
+        repoindex_write_full(fd, b->trigrams,
+                             (size_t)b->trigram_count * sizeof(repoindex_trigram_t)) == TINYPKG_SUCCESS &&
+        repoindex_write_full(fd, b->postings, (size_t)b->posting_count * sizeof(uint32_t)) == TINYPKG_SUCCESS &&
+        repoindex_write_full(fd, b->repos,
+                             (size_t)b->repo_count * sizeof(repoindex_repo_t)) == TINYPKG_SUCCESS &&
+        repoindex_write_full(fd, b->strtab, b->strtab_size) == TINYPKG_SUCCESS &&
+        fsync(fd) == 0) {
+        result = TINYPKG_SUCCESS;
+    }
+    close(fd);
+    TINYPKG_FREE(index);
+
+    if (result == TINYPKG_SUCCESS && rename(temp_path, path) != 0) {
+        result = TINYPKG_ERROR_FILE;
+    }
+    if (result != TINYPKG_SUCCESS) {
+        log_error("Failed to write repository index: %s", strerror(errno));
+        unlink(temp_path);
+    }
+    return result;
+}
+
+// Whether the mapped index may lend its records to a rebuild. Every enabled
+// repository must be at the commit the index saw, or have been pulled from
+// that commit with its changed definitions listed; anything else (a
+// repository the index lacks, a pull the index missed, a commit that could
+// not be read) means the old records can be stale without being listed.
+static int repoindex_builder_may_reuse(const repository_t *repos, int count,
+                                       char (*commits)[41],
+                                       const repository_changes_t *changes) {
+    if (changes && changes->full) return 0;
+
+    for (int i = 0; i < count; i++) {
+        const char *commit = NULL;
+
+        if (!repos[i].enabled) continue;
+        for (uint32_t j = 0; j < g_repoindex.header->repo_count; j++) {
+            if (strcmp(repoindex_string(g_repoindex.repos[j].path), repos[i].local_path) == 0) {
+                commit = repoindex_string(g_repoindex.repos[j].commit);
+                break;
+            }
+        }
+        if (!commit || !commit[0] || !commits[i][0]) {
+            log_debug("Repository index does not know the commit of %s", repos[i].name);
+            return 0;
+        }
+        if (strcmp(commit, commits[i]) == 0) continue;
+
+        int listed = 0;
+        for (int j = 0; changes && j < changes->base_count && !listed; j++) {
+            listed = strcmp(changes->bases[j].path, repos[i].local_path) == 0 &&
+                     strcmp(changes->bases[j].commit, commit) == 0;
+        }
+        if (!listed) {
+            log_debug("Changes to %s since the repository index are not known", repos[i].name);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Record the commit of every enabled repository
+static int repoindex_builder_repos(repoindex_builder_t *b, const repository_t *repos, int count,
+                                   char (*commits)[41]) {
+    if (count == 0) return TINYPKG_SUCCESS;
+
+    b->repos = TINYPKG_CALLOC(count, sizeof(repoindex_repo_t));
+    if (!b->repos) return TINYPKG_ERROR_MEMORY;
+
+    for (int i = 0; i < count; i++) {
+        if (!repos[i].enabled) continue;
+
+        repoindex_repo_t *repo = &b->repos[b->repo_count];
+        int result = repoindex_builder_string(b, repos[i].local_path, &repo->path);
+        if (result == TINYPKG_SUCCESS) {
+            result = repoindex_builder_string(b, commits[i], &repo->commit);
+        }
+        if (result != TINYPKG_SUCCESS) return result;
+        b->repo_count++;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Compile every package definition of the enabled repositories into
+// LIB_DIR/repo.idx, keyed by the repositories' current commits. With reuse
+// set, definitions the old index already holds are copied from it unless
+// changes lists them, provided the index is known to differ from the
+// checkouts only where changes says.
+static int repoindex_rebuild(int reuse, const repository_changes_t *changes) {
+    repoindex_builder_t builder;
+    char key[REPOINDEX_KEY_SIZE];
+    char path[MAX_PATH];
+    char (*commits)[41] = NULL;
+    repository_t *repos;
+    int count = 0;
+    int result = TINYPKG_SUCCESS;
+
+    memset(&builder, 0, sizeof(builder));
+
+    repos = repository_get_all(&count);
+    if (!repos) return TINYPKG_ERROR;
+
+    if (count > 0) {
+        commits = TINYPKG_CALLOC(count, sizeof(*commits));
+        if (!commits) return TINYPKG_ERROR_MEMORY;
+    }
+    if (repoindex_compute_key(key, sizeof(key), commits) != TINYPKG_SUCCESS) {
+        log_error("Failed to compute repository index key");
+        TINYPKG_FREE(commits);
+        return TINYPKG_ERROR;
+    }
+
+    // Offset 0 of the string table is the empty string
+    builder.strtab = TINYPKG_MALLOC(65536);
+    if (!builder.strtab) {
+        TINYPKG_FREE(commits);
+        return TINYPKG_ERROR_MEMORY;
+    }
+    builder.strtab[0] = '\0';
+    builder.strtab_size = 1;
+    builder.strtab_capacity = 65536;
+
+    if (changes && changes->count > 0) {
+        builder.changed = TINYPKG_MALLOC(changes->count * sizeof(char *));
+        if (!builder.changed) {
+            repoindex_builder_free(&builder);
+            TINYPKG_FREE(commits);
+            return TINYPKG_ERROR_MEMORY;
+        }
+        memcpy(builder.changed, changes->files, changes->count * sizeof(char *));
+        qsort(builder.changed, changes->count, sizeof(char *), repoindex_compare_paths);
+        builder.changed_count = changes->count;
+    }
+
+    // The old index stays mapped, whatever its key, until the new one is
+    // written; lookups wait on the lock meanwhile
+    pthread_mutex_lock(&g_repoindex_lock);
+    repoindex_unmap();
+    if (reuse) {
+        repoindex_path(path, sizeof(path));
+        builder.reuse = repoindex_map(path) == TINYPKG_SUCCESS && g_repoindex.header &&
+                        repoindex_builder_may_reuse(repos, count, commits, changes);
+    }
+    log_info(builder.reuse ? "Updating repository index" : "Building repository index");
+
+    for (int i = 0; i < count && result == TINYPKG_SUCCESS; i++) {
+        if (repos[i].enabled) {
+            result = repoindex_builder_scan(&builder, repos[i].local_path);
+        }
+    }
+
+    if (result == TINYPKG_SUCCESS) {
+        repoindex_builder_resolve(&builder);
+        result = repoindex_builder_search(&builder);
+    }
+    if (result == TINYPKG_SUCCESS) {
+        result = repoindex_builder_repos(&builder, repos, count, commits);
+    }
+    if (result == TINYPKG_SUCCESS) {
+        repoindex_unmap();
+        result = repoindex_builder_write(&builder, key);
+    }
+    repoindex_unmap();
+    pthread_mutex_unlock(&g_repoindex_lock);
+
+    if (result == TINYPKG_SUCCESS) {
+        log_info("Indexed %u packages (%u parsed, %u unchanged, %u dependency references, "
+                 "%u search trigrams)", builder.package_count, builder.parsed, builder.copied,
+                 builder.ref_count, builder.trigram_count);
+    }
+
+    repoindex_builder_free(&builder);
+    TINYPKG_FREE(commits);
+    return result;
+}
+
+int repoindex_build(void) {
+    return repoindex_rebuild(0, NULL);
+}
+
+// Bring the index up to date after a sync: only the definitions changes
+// lists (absolute paths, added, changed or removed) and ones the current
+// index lacks are parsed. If a repository is not at the commit the index
+// saw and changes does not start from that commit (changes may be NULL),
+// everything is parsed again.
+int repoindex_update(const repository_changes_t *changes) {
+    return repoindex_rebuild(1, changes);
+}
@@ -0,0 +1,134 @@
+/*
+ * TinyPkg - Repository Index Header
+ * Precompiled, memory-mapped index of all package metadata in the repositories
+ */
+
+#ifndef TINYPKG_REPOINDEX_H
+#define TINYPKG_REPOINDEX_H
+
+#include <stdint.h>
+
+// Index file inside LIB_DIR
+#define REPOINDEX_FILE "repo.idx"
+
+#define REPOINDEX_MAGIC "TPKGRI1"
+#define REPOINDEX_FORMAT_VERSION 6
+#define REPOINDEX_KEY_SIZE 72       // SHA-256 hex digest, padded
+
+// References in dependency lists: a package ID, or a string table offset
+// with this bit set for names that are not in any repository
+#define REPOINDEX_REF_NAME 0x80000000U
+
+// Package record flags
+#define REPOINDEX_FLAG_NO_NINJA 0x1
+
+// String fields of an indexed package
+typedef enum {
+    REPOINDEX_STR_NAME = 0,
+    REPOINDEX_STR_VERSION,
+    REPOINDEX_STR_DESCRIPTION,
+    REPOINDEX_STR_MAINTAINER,
+    REPOINDEX_STR_HOMEPAGE,
+    REPOINDEX_STR_LICENSE,
+    REPOINDEX_STR_CATEGORY,
+    REPOINDEX_STR_SOURCE_URL,
+    REPOINDEX_STR_SOURCE_TYPE,
+    REPOINDEX_STR_CHECKSUM,
+    REPOINDEX_STR_BUILD_CMD,
+    REPOINDEX_STR_INSTALL_CMD,
+    REPOINDEX_STR_CONFIGURE_ARGS,
+    REPOINDEX_STR_JSON_FILE,
+    REPOINDEX_STR_COUNT
+} repoindex_string_t;
+
+// Name lists of an indexed package
+typedef enum {
+    REPOINDEX_LIST_DEPENDENCIES = 0,
+    REPOINDEX_LIST_BUILD_DEPENDENCIES,
+    REPOINDEX_LIST_CONFLICTS,
+    REPOINDEX_LIST_PROVIDES,
+    REPOINDEX_LIST_COUNT
+} repoindex_list_t;
+
+// Pack three lower-cased bytes into a search trigram
+#define REPOINDEX_TRIGRAM(a, b, c) \
+    (((uint32_t)(unsigned char)(a) << 16) | ((uint32_t)(unsigned char)(b) << 8) | \
+     (uint32_t)(unsigned char)(c))
+
+// On-disk layout: header, package records, reference array, hash index by
+// name, trigram table, postings, repository table, string table. The key is
+// a digest of the repository commits the index was built from.
+typedef struct repoindex_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t package_count;
+    uint32_t ref_count;
+    uint32_t bucket_count;      // Power of two
+    uint32_t strtab_size;
+    uint32_t trigram_count;
+    uint32_t posting_count;
+    uint32_t repo_count;
+    char key[REPOINDEX_KEY_SIZE];
+    uint64_t packages_offset;
+    uint64_t refs_offset;
+    uint64_t index_offset;
+    uint64_t trigrams_offset;
+    uint64_t postings_offset;
+    uint64_t repos_offset;
+    uint64_t strtab_offset;
+    uint64_t file_size;
+} repoindex_header_t;
+
+// Search index: every trigram of the lower-cased name, description,
+// category, maintainer and provides names, sorted, each with a run of
+// ascending package IDs in the posting array
+typedef struct repoindex_trigram {
+    uint32_t trigram;
+    uint32_t offset;            // First posting
+    uint32_t count;
+} repoindex_trigram_t;
+
+// Commit each enabled repository was at, so an update can tell which
+// ones changed since; both are string table offsets
+typedef struct repoindex_repo {
+    uint32_t path;              // Local checkout
+    uint32_t commit;            // Empty when it could not be read
+} repoindex_repo_t;
+
+typedef struct repoindex_package {
+    uint32_t strings[REPOINDEX_STR_COUNT];
+    uint32_t list_offset[REPOINDEX_LIST_COUNT];
+    uint32_t list_count[REPOINDEX_LIST_COUNT];
+    uint32_t build_system;
+    uint32_t build_time_estimate;
+    uint64_t size_estimate;
+    uint32_t memory_estimate;
+    uint32_t flags;             // REPOINDEX_FLAG_*
+    uint32_t key;               // Lookup name (definition file name)
+    uint32_t hash;              // FNV-1a of the key
+} repoindex_package_t;
+
+// Function declarations
+
+// Index lifecycle
+int repoindex_build(void);
+int repoindex_update(const repository_changes_t *changes);
+int repoindex_open(void);
+void repoindex_close(void);
+int repoindex_is_current(void);
+
+// Accept the index on disk even if the repositories have moved on, for
+// callers such as search that would rather show old results than none.
+// Holds until the index is closed or rebuilt.
+int repoindex_open_stale(void);
+
+// Queries (IDs are valid until the next build or close)
+int repoindex_find(const char *package_name);
+int repoindex_package_count(void);
+const char *repoindex_get_string(int id, repoindex_string_t field);
+int repoindex_get_list(int id, repoindex_list_t list, const uint32_t **refs);
+const char *repoindex_ref_name(uint32_t ref);
+int repoindex_search_postings(uint32_t trigram, const uint32_t **ids);
+package_t *repoindex_load_package(const char *package_name);
+
+#endif /* TINYPKG_REPOINDEX_H */
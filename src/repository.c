@@ -10,8 +10,17 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
+#include <git2.h>
 #include "../include/tinypkg.h"
 
+// Shallow clones and fetches need libgit2 1.7
+#if LIBGIT2_VER_MAJOR > 1 || (LIBGIT2_VER_MAJOR == 1 && LIBGIT2_VER_MINOR >= 7)
+#define REPOSITORY_SHALLOW 1
+#else
+#define REPOSITORY_SHALLOW 0
+#endif
+
 // Global repository list
 static repository_t *repositories = NULL;
 static int repository_count = 0;
@@ -46,15 +55,112 @@ static int load_repositories(void) {
     return TINYPKG_SUCCESS;
 }
 
-static int is_git_command_available(void) {
-    int exit_code;
-    char *output = NULL;
+// libgit2 is set up on first use and shut down by repository_cleanup()
+static pthread_mutex_t git_lock = PTHREAD_MUTEX_INITIALIZER;
+static int git_initialized = 0;
+
+static int git_ready(void) {
+    pthread_mutex_lock(&git_lock);
+    if (!git_initialized && git_libgit2_init() > 0) {
+        git_initialized = 1;
+    }
+    int ready = git_initialized;
+    pthread_mutex_unlock(&git_lock);
     
-    int result = utils_run_command_with_output("git --version", NULL, &output, &exit_code);
+    if (!ready) log_error("Failed to initialize libgit2");
+    return ready;
+}
+
+static void log_git_error(const char *what, const char *target) {
+    const git_error *error = git_error_last();
+    log_error("%s %s: %s", what, target,
+              error && error->message ? error->message : "unknown error");
+}
+
+// Remember a changed package definition; other files do not matter to the index
+static int changes_add(repository_changes_t *changes, const char *repo_path, const char *path) {
+    if (!changes || !path) return TINYPKG_SUCCESS;
+    
+    size_t length = strlen(path);
+    if (length <= 5 || strcmp(path + length - 5, ".json") != 0) return TINYPKG_SUCCESS;
+    
+    if (changes->count == changes->capacity) {
+        int capacity = changes->capacity ? changes->capacity * 2 : 32;
+        char **files = TINYPKG_REALLOC(changes->files, capacity * sizeof(char *));
+        if (!files) return TINYPKG_ERROR_MEMORY;
+        changes->files = files;
+        changes->capacity = capacity;
+    }
     
-    if (output) TINYPKG_FREE(output);
+    char *file = TINYPKG_MALLOC(strlen(repo_path) + length + 2);
+    if (!file) return TINYPKG_ERROR_MEMORY;
+    sprintf(file, "%s/%s", repo_path, path);
+    changes->files[changes->count++] = file;
+    return TINYPKG_SUCCESS;
+}
+
+// Remember which commit the files listed for a repository were diffed from
+static int changes_add_base(repository_changes_t *changes, const char *repo_path, const git_oid *id) {
+    if (changes->base_count == changes->base_capacity) {
+        int capacity = changes->base_capacity ? changes->base_capacity * 2 : 8;
+        repository_base_t *bases = TINYPKG_REALLOC(changes->bases, capacity * sizeof(repository_base_t));
+        if (!bases) return TINYPKG_ERROR_MEMORY;
+        changes->bases = bases;
+        changes->base_capacity = capacity;
+    }
+    
+    repository_base_t *base = &changes->bases[changes->base_count];
+    base->path = utils_string_duplicate(repo_path);
+    if (!base->path) return TINYPKG_ERROR_MEMORY;
+    git_oid_tostr(base->commit, sizeof(base->commit), id);
+    changes->base_count++;
+    return TINYPKG_SUCCESS;
+}
+
+// Move src's files into dest
+static int changes_merge(repository_changes_t *dest, repository_changes_t *src) {
+    dest->full |= src->full;
+    
+    if (src->base_count > 0) {
+        if (dest->base_count + src->base_count > dest->base_capacity) {
+            int capacity = MAX(dest->base_capacity * 2, dest->base_count + src->base_count);
+            repository_base_t *bases = TINYPKG_REALLOC(dest->bases, capacity * sizeof(repository_base_t));
+            if (!bases) return TINYPKG_ERROR_MEMORY;
+            dest->bases = bases;
+            dest->base_capacity = capacity;
+        }
+        memcpy(dest->bases + dest->base_count, src->bases, src->base_count * sizeof(repository_base_t));
+        dest->base_count += src->base_count;
+        src->base_count = 0;
+    }
+    if (src->count == 0) return TINYPKG_SUCCESS;
+    
+    if (dest->count + src->count > dest->capacity) {
+        int capacity = MAX(dest->capacity * 2, dest->count + src->count);
+        char **files = TINYPKG_REALLOC(dest->files, capacity * sizeof(char *));
+        if (!files) return TINYPKG_ERROR_MEMORY;
+        dest->files = files;
+        dest->capacity = capacity;
+    }
+    
+    memcpy(dest->files + dest->count, src->files, src->count * sizeof(char *));
+    dest->count += src->count;
+    src->count = 0;
+    return TINYPKG_SUCCESS;
+}
+
+void repository_changes_free(repository_changes_t *changes) {
+    if (!changes) return;
     
-    return (result == TINYPKG_SUCCESS && exit_code == 0);
+    for (int i = 0; i < changes->count; i++) {
+        TINYPKG_FREE(changes->files[i]);
+    }
+    TINYPKG_FREE(changes->files);
+    for (int i = 0; i < changes->base_count; i++) {
+        TINYPKG_FREE(changes->bases[i].path);
+    }
+    TINYPKG_FREE(changes->bases);
+    memset(changes, 0, sizeof(*changes));
 }
 
 static int create_directory_for_repo(const char *path) {
@@ -71,9 +177,7 @@ static int create_directory_for_repo(const char *path) {
 int repository_init(void) {
     log_debug("Initializing repository system");
     
-    // Check if git is available
-    if (!is_git_command_available()) {
-        log_error("Git command not available. Please install git.");
+    if (!git_ready()) {
         return TINYPKG_ERROR;
     }
     
@@ -87,31 +191,151 @@ void repository_cleanup(void) {
         repository_count = 0;
         repositories_loaded = 0;
     }
+    
+    pthread_mutex_lock(&git_lock);
+    if (git_initialized) {
+        git_libgit2_shutdown();
+        git_initialized = 0;
+    }
+    pthread_mutex_unlock(&git_lock);
 }
 
-int repository_sync(void) {
-    log_info("Synchronizing package repositories");
+// Clone or update one repository, collecting the definitions it changed
+static int sync_repository(repository_t *repo, repository_changes_t *changes) {
+    const char *branch = repo->branch[0] ? repo->branch : REPO_BRANCH;
+    struct stat st;
+    int result;
     
-    if (load_repositories() != TINYPKG_SUCCESS) {
-        return TINYPKG_ERROR;
+    if (stat(repo->local_path, &st) == 0) {
+        // Repository exists, try to update it
+        if (repository_is_git_repo(repo->local_path)) {
+            log_debug("Pulling updates for repository: %s", repo->name);
+            result = repository_pull(repo->local_path, branch, changes);
+        } else {
+            log_warn("Local path exists but is not a git repository: %s", repo->local_path);
+            log_info("Removing and re-cloning repository");
+            utils_remove_directory_recursive(repo->local_path);
+            result = repository_clone(repo->url, branch, repo->local_path);
+            if (changes) changes->full = 1;
+        }
+    } else {
+        // Repository doesn't exist, clone it
+        log_debug("Cloning repository: %s from %s", repo->name, repo->url);
+        create_directory_for_repo(repo->local_path);
+        result = repository_clone(repo->url, branch, repo->local_path);
+        if (changes) changes->full = 1;
     }
     
-    int success_count = 0;
-    int total_count = 0;
+    if (result == TINYPKG_SUCCESS) {
+        repo->last_sync = time(NULL);
+        repository_get_commit_hash(repo->local_path, repo->last_commit, sizeof(repo->last_commit));
+        log_info("Successfully synced repository: %s", repo->name);
+    } else {
+        log_error("Failed to sync repository: %s", repo->name);
+    }
     
-    for (int i = 0; i < repository_count; i++) {
+    return result;
+}
+
+// Repositories are handed out to up to REPOSITORY_SYNC_THREADS workers
+typedef struct sync_job {
+    int next;
+    int success_count;
+    repository_changes_t changes;
+    pthread_mutex_t lock;
+} sync_job_t;
+
+static void *sync_worker(void *arg) {
+    sync_job_t *job = arg;
+    
+    metrics_trace_thread_name("repository sync");
+    
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        
+        if (i >= repository_count) break;
         if (!repositories[i].enabled) continue;
         
-        total_count++;
+        repository_changes_t changes = {0};
         log_info("Syncing repository: %s", repositories[i].name);
+        int result = sync_repository(&repositories[i], &changes);
         
-        if (repository_sync_specific(repositories[i].name) == TINYPKG_SUCCESS) {
-            success_count++;
+        pthread_mutex_lock(&job->lock);
+        if (result == TINYPKG_SUCCESS) {
+            job->success_count++;
+            if (changes_merge(&job->changes, &changes) != TINYPKG_SUCCESS) {
+                job->changes.full = 1;
+            }
         }
+        pthread_mutex_unlock(&job->lock);
+        repository_changes_free(&changes);
+    }
+    
+    return NULL;
+}
+
+// Recompile the package index against whatever is now checked out; only
+// the definitions the sync touched need parsing again
+static void update_index(const repository_changes_t *changes) {
+    int result;
+    
+    if (changes->full) {
+        result = repoindex_build();
+    } else if (changes->count == 0 && repoindex_is_current()) {
+        log_debug("Repository index is up to date");
+        result = TINYPKG_SUCCESS;
+    } else {
+        result = repoindex_update(changes);
+    }
+    if (result != TINYPKG_SUCCESS) {
+        log_warn("Failed to build repository index, package lookups will parse JSON");
+    }
+}
+
+int repository_sync(void) {
+    log_info("Synchronizing package repositories");
+    
+    if (load_repositories() != TINYPKG_SUCCESS || !git_ready()) {
+        return TINYPKG_ERROR;
+    }
+    
+    int total_count = 0;
+    for (int i = 0; i < repository_count; i++) {
+        if (repositories[i].enabled) total_count++;
     }
     
+    sync_job_t job;
+    memset(&job, 0, sizeof(job));
+    pthread_mutex_init(&job.lock, NULL);
+    
+    pthread_t workers[REPOSITORY_SYNC_THREADS];
+    int threads = MAX(1, MIN(total_count, REPOSITORY_SYNC_THREADS));
+    int started = 0;
+    while (started < threads &&
+           pthread_create(&workers[started], NULL, sync_worker, &job) == 0) {
+        started++;
+    }
+    if (started == 0) {
+        sync_worker(&job);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+    
+    int success_count = job.success_count;
     log_info("Repository sync completed: %d/%d successful", success_count, total_count);
     
+    if (success_count > 0) {
+        update_index(&job.changes);
+
+        // The next update only compares the packages that changed
+        planner_record_changes(job.changes.files, job.changes.count, job.changes.full);
+    }
+    repository_changes_free(&job.changes);
+    
     return (success_count == total_count) ? TINYPKG_SUCCESS : TINYPKG_ERROR;
 }
 
@@ -129,35 +353,18 @@ int repository_sync_specific(const char *repo_name) {
         return TINYPKG_SUCCESS;
     }
     
-    struct stat st;
-    int result;
-    
-    if (stat(repo->local_path, &st) == 0) {
-        // Repository exists, try to update it
-        if (repository_is_git_repo(repo->local_path)) {
-            log_debug("Pulling updates for repository: %s", repo->name);
-            result = repository_pull(repo->local_path);
-        } else {
-            log_warn("Local path exists but is not a git repository: %s", repo->local_path);
-            log_info("Removing and re-cloning repository");
-            utils_remove_directory_recursive(repo->local_path);
-            result = repository_clone(repo->url, repo->branch, repo->local_path);
-        }
-    } else {
-        // Repository doesn't exist, clone it
-        log_debug("Cloning repository: %s from %s", repo->name, repo->url);
-        create_directory_for_repo(repo->local_path);
-        result = repository_clone(repo->url, repo->branch, repo->local_path);
-    }
+    if (!git_ready()) return TINYPKG_ERROR;
     
+    repository_changes_t changes = {0};
+    int result = sync_repository(repo, &changes);
     if (result == TINYPKG_SUCCESS) {
-        repo->last_sync = time(NULL);
-        repository_get_commit_hash(repo->local_path, repo->last_commit, sizeof(repo->last_commit));
-        log_info("Successfully synced repository: %s", repo->name);
-    } else {
-        log_error("Failed to sync repository: %s", repo->name);
+        update_index(&changes);
+        
+        // The planner does not track changes here, so the next update
+        // checks everything
+        planner_record_changes(NULL, 0, 1);
     }
-    
+    repository_changes_free(&changes);
     return result;
 }
 
@@ -190,6 +397,10 @@ repository_t *repository_get_all(int *count) {
 int repository_is_available(const char *package_name) {
     if (!package_name) return 0;
     
+    if (repoindex_is_current()) {
+        return repoindex_find(package_name) >= 0;
+    }
+    
     char *package_path = repository_get_package_path(package_name);
     if (!package_path) return 0;
     
@@ -307,80 +518,239 @@ int repository_needs_sync(const char *repo_name) {
 // Low-level Git operations
 int repository_clone(const char *url, const char *branch, const char *dest_path) {
     if (!url || !dest_path) return TINYPKG_ERROR;
+    if (!git_ready()) return TINYPKG_ERROR;
     
-    char cmd[MAX_CMD];
-    const char *branch_arg = branch ? branch : "main";
-    
-    snprintf(cmd, sizeof(cmd), 
-             "git clone --depth=1 --branch=%s '%s' '%s'", 
-             branch_arg, url, dest_path);
+    git_clone_options options = GIT_CLONE_OPTIONS_INIT;
+    options.checkout_branch = branch ? branch : "main";
+#if REPOSITORY_SHALLOW
+    options.fetch_opts.depth = 1;
+#endif
     
-    log_debug("Cloning repository: %s", cmd);
+    log_debug("Cloning repository: %s (%s) into %s", url, options.checkout_branch, dest_path);
     
-    int result = utils_run_command(cmd, NULL);
-    if (result != TINYPKG_SUCCESS) {
-        log_error("Failed to clone repository from %s", url);
+    git_repository *repo = NULL;
+    if (git_clone(&repo, url, dest_path, &options) != 0) {
+        log_git_error("Failed to clone repository from", url);
         return TINYPKG_ERROR_NETWORK;
     }
     
+    git_repository_free(repo);
     return TINYPKG_SUCCESS;
 }
 
-int repository_pull(const char *repo_path) {
+// Definitions that differ between two commits' trees
+static int collect_changes(git_repository *repo, const char *repo_path,
+                           const git_oid *old_id, const git_oid *new_id,
+                           repository_changes_t *changes) {
+    git_commit *old_commit = NULL, *new_commit = NULL;
+    git_tree *old_tree = NULL, *new_tree = NULL;
+    git_diff *diff = NULL;
+    int result = TINYPKG_ERROR;
+    
+    if (git_commit_lookup(&old_commit, repo, old_id) == 0 &&
+        git_commit_lookup(&new_commit, repo, new_id) == 0 &&
+        git_commit_tree(&old_tree, old_commit) == 0 &&
+        git_commit_tree(&new_tree, new_commit) == 0 &&
+        git_diff_tree_to_tree(&diff, repo, old_tree, new_tree, NULL) == 0) {
+        size_t deltas = git_diff_num_deltas(diff);
+        
+        result = TINYPKG_SUCCESS;
+        for (size_t i = 0; i < deltas && result == TINYPKG_SUCCESS; i++) {
+            const git_diff_delta *delta = git_diff_get_delta(diff, i);
+            
+            result = changes_add(changes, repo_path, delta->old_file.path);
+            if (result == TINYPKG_SUCCESS && delta->new_file.path &&
+                (!delta->old_file.path || strcmp(delta->old_file.path, delta->new_file.path) != 0)) {
+                result = changes_add(changes, repo_path, delta->new_file.path);
+            }
+        }
+        log_debug("%zu files changed in %s", deltas, repo_path);
+    }
+    
+    git_diff_free(diff);
+    git_tree_free(old_tree);
+    git_tree_free(new_tree);
+    git_commit_free(old_commit);
+    git_commit_free(new_commit);
+    return result;
+}
+
+// Fetch origin and move to origin/<branch>: a fast-forward when possible,
+// else a hard reset (history rewritten upstream, or local edits in the way).
+// changes (if given) receives the package definitions that changed.
+int repository_pull(const char *repo_path, const char *branch, repository_changes_t *changes) {
     if (!repo_path) return TINYPKG_ERROR;
     
     if (!repository_is_git_repo(repo_path)) {
         log_error("Not a git repository: %s", repo_path);
         return TINYPKG_ERROR;
     }
+    if (!git_ready()) return TINYPKG_ERROR;
+    
+    git_repository *repo = NULL;
+    git_remote *remote = NULL;
+    git_commit *target = NULL;
+    git_reference *head = NULL;
+    git_reference *moved = NULL;
+    git_oid old_id, new_id;
+    char ref[MAX_PATH];
+    int result = TINYPKG_ERROR;
+    
+    if (git_repository_open(&repo, repo_path) != 0) {
+        log_git_error("Failed to open repository", repo_path);
+        return TINYPKG_ERROR;
+    }
     
-    char cmd[MAX_CMD];
-    snprintf(cmd, sizeof(cmd), "git pull --ff-only");
+    log_debug("Fetching repository updates in: %s", repo_path);
     
-    log_debug("Pulling repository updates in: %s", repo_path);
+    git_fetch_options fetch_options = GIT_FETCH_OPTIONS_INIT;
+#if REPOSITORY_SHALLOW
+    if (git_repository_is_shallow(repo)) {
+        fetch_options.depth = 1;
+    }
+#endif
+    if (git_remote_lookup(&remote, repo, "origin") != 0 ||
+        git_remote_fetch(remote, NULL, &fetch_options, NULL) != 0) {
+        log_git_error("Failed to fetch", repo_path);
+        result = TINYPKG_ERROR_NETWORK;
+        goto out;
+    }
     
-    int result = utils_run_command(cmd, repo_path);
-    if (result != TINYPKG_SUCCESS) {
-        log_warn("Git pull failed, trying reset to origin");
-        
-        // Try to reset to origin if pull failed
-        snprintf(cmd, sizeof(cmd), "git fetch origin && git reset --hard origin/HEAD");
-        result = utils_run_command(cmd, repo_path);
-        
-        if (result != TINYPKG_SUCCESS) {
-            log_error("Failed to update repository: %s", repo_path);
-            return TINYPKG_ERROR_NETWORK;
+    snprintf(ref, sizeof(ref), "refs/remotes/origin/%s", branch ? branch : "main");
+    if (git_reference_name_to_id(&new_id, repo, ref) != 0 ||
+        git_commit_lookup(&target, repo, &new_id) != 0) {
+        log_git_error("Missing upstream branch in", repo_path);
+        goto out;
+    }
+    
+    int have_old = git_reference_name_to_id(&old_id, repo, "HEAD") == 0;
+    if (have_old && git_oid_cmp(&old_id, &new_id) == 0) {
+        log_debug("Repository is up to date: %s", repo_path);
+        result = TINYPKG_SUCCESS;
+        goto out;
+    }
+    
+    git_checkout_options checkout_options = GIT_CHECKOUT_OPTIONS_INIT;
+    checkout_options.checkout_strategy = GIT_CHECKOUT_SAFE;
+    
+    // A depth 1 fetch leaves no history linking the two commits, so a
+    // shallow clone moves on with a safe checkout; local edits in the way
+    // still make it fall back to the reset
+    int shallow = git_repository_is_shallow(repo) == 1;
+    int forwarded = have_old &&
+        (shallow || git_graph_descendant_of(repo, &new_id, &old_id) == 1) &&
+        git_checkout_tree(repo, (const git_object *)target, &checkout_options) == 0 &&
+        git_repository_head(&head, repo) == 0 &&
+        git_reference_set_target(&moved, head, &new_id, "tinypkg: fast-forward") == 0;
+    
+    if (!forwarded) {
+        log_warn("Cannot fast-forward %s, resetting to origin/%s", repo_path, branch ? branch : "main");
+        checkout_options.checkout_strategy = GIT_CHECKOUT_FORCE;
+        if (git_reset(repo, (const git_object *)target, GIT_RESET_HARD, &checkout_options) != 0) {
+            log_git_error("Failed to update repository", repo_path);
+            goto out;
         }
     }
     
-    return TINYPKG_SUCCESS;
+    // Without the old tree every definition has to be treated as changed
+    if (changes && (!have_old ||
+                    collect_changes(repo, repo_path, &old_id, &new_id, changes) != TINYPKG_SUCCESS ||
+                    changes_add_base(changes, repo_path, &old_id) != TINYPKG_SUCCESS)) {
+        changes->full = 1;
+    }
+    result = TINYPKG_SUCCESS;
+    
+out:
+    git_reference_free(moved);
+    git_reference_free(head);
+    git_commit_free(target);
+    git_remote_free(remote);
+    git_repository_free(repo);
+    return result;
 }
 
 int repository_get_commit_hash(const char *repo_path, char *hash, size_t hash_size) {
     if (!repo_path || !hash || hash_size < 41) return TINYPKG_ERROR;
     
-    char cmd[MAX_CMD];
-    snprintf(cmd, sizeof(cmd), "git rev-parse HEAD");
+    hash[0] = '\0';
+    if (!git_ready()) return TINYPKG_ERROR;
     
-    char *output = NULL;
-    int exit_code;
+    git_repository *repo = NULL;
+    git_oid id;
+    int result = TINYPKG_ERROR;
     
-    int result = utils_run_command_with_output(cmd, repo_path, &output, &exit_code);
+    if (git_repository_open(&repo, repo_path) == 0 &&
+        git_reference_name_to_id(&id, repo, "HEAD") == 0) {
+        git_oid_tostr(hash, hash_size, &id);
+        result = TINYPKG_SUCCESS;
+    }
     
-    if (result == TINYPKG_SUCCESS && exit_code == 0 && output) {
-        // Trim whitespace and copy hash
-        char *trimmed = utils_string_trim(output);
-        strncpy(hash, trimmed, hash_size - 1);
-        hash[hash_size - 1] = '\0';
+    git_repository_free(repo);
+    return result;
+}
+
+// Read the checked out commit straight from .git without forking git
+static int read_hash_line(const char *path, const char *ref, char *hash) {
+    FILE *file = fopen(path, "r");
+    if (!file) return TINYPKG_ERROR;
+    
+    char line[MAX_PATH];
+    int result = TINYPKG_ERROR;
+    
+    while (fgets(line, sizeof(line), file)) {
+        char *trimmed = utils_string_trim(line);
+        if (strlen(trimmed) < 40) continue;
         
-        TINYPKG_FREE(output);
-        return TINYPKG_SUCCESS;
+        // Loose refs hold just the hash; packed-refs lines are "<hash> <ref>"
+        if (ref && (trimmed[40] != ' ' || strcmp(trimmed + 41, ref) != 0)) continue;
+        if (!ref && trimmed[40] != '\0') break;
+        
+        memcpy(hash, trimmed, 40);
+        hash[40] = '\0';
+        result = TINYPKG_SUCCESS;
+        break;
     }
     
-    if (output) TINYPKG_FREE(output);
+    fclose(file);
+    return result;
+}
+
+int repository_read_head(const char *repo_path, char *hash, size_t hash_size) {
+    if (!repo_path || !hash || hash_size < 41) return TINYPKG_ERROR;
     
     hash[0] = '\0';
-    return TINYPKG_ERROR;
+    if (!repository_is_git_repo(repo_path)) return TINYPKG_ERROR;
+    
+    char path[MAX_PATH];
+    char head[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/.git/HEAD", repo_path);
+    
+    FILE *file = fopen(path, "r");
+    if (!file || !fgets(head, sizeof(head), file)) {
+        if (file) fclose(file);
+        return repository_get_commit_hash(repo_path, hash, hash_size);
+    }
+    fclose(file);
+    
+    char *ref = utils_string_trim(head);
+    if (strncmp(ref, "ref: ", 5) != 0) {
+        // Detached HEAD
+        return read_hash_line(path, NULL, hash) == TINYPKG_SUCCESS ?
+               TINYPKG_SUCCESS : repository_get_commit_hash(repo_path, hash, hash_size);
+    }
+    ref += 5;
+    
+    snprintf(path, sizeof(path), "%s/.git/%s", repo_path, ref);
+    if (read_hash_line(path, NULL, hash) == TINYPKG_SUCCESS) {
+        return TINYPKG_SUCCESS;
+    }
+    
+    snprintf(path, sizeof(path), "%s/.git/packed-refs", repo_path);
+    if (read_hash_line(path, ref, hash) == TINYPKG_SUCCESS) {
+        return TINYPKG_SUCCESS;
+    }
+    
+    return repository_get_commit_hash(repo_path, hash, hash_size);
 }
 
 int repository_is_git_repo(const char *path) {
@@ -29,6 +29,28 @@ typedef enum {
     SYNC_STATUS_AUTH_ERROR = -3
 } sync_status_t;
 
+// A repository whose changed definitions are listed, and the commit the
+// list starts from
+typedef struct repository_base {
+    char *path;
+    char commit[41];
+} repository_base_t;
+
+// Package definitions a sync added, changed or removed, as absolute paths.
+// full is set when they are not known, e.g. after a fresh clone.
+typedef struct repository_changes {
+    char **files;
+    int count;
+    int capacity;
+    int full;
+    repository_base_t *bases;
+    int base_count;
+    int base_capacity;
+} repository_changes_t;
+
+// Repositories synced at once
+#define REPOSITORY_SYNC_THREADS 4
+
 // Function declarations
 
 // Repository management
@@ -53,8 +75,10 @@ int repository_needs_sync(const char *repo_name);
 
 // Low-level Git operations
 int repository_clone(const char *url, const char *branch, const char *dest_path);
-int repository_pull(const char *repo_path);
+int repository_pull(const char *repo_path, const char *branch, repository_changes_t *changes);
 int repository_get_commit_hash(const char *repo_path, char *hash, size_t hash_size);
+int repository_read_head(const char *repo_path, char *hash, size_t hash_size);
 int repository_is_git_repo(const char *path);
+void repository_changes_free(repository_changes_t *changes);
 
 #endif /* TINYPKG_REPOSITORY_H */
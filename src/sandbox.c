@@ -0,0 +1,844 @@
+/*
+ * TinyPkg - Build Sandbox
+ * Build steps in their own namespaces, launched without copying tinypkg
+ */
+
+#include "../include/tinypkg.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/capability.h>
+#include <linux/magic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The child only needs room for a path or two
+#define SANDBOX_STACK_SIZE (256 * 1024)
+
+// mount_setattr(2), which restricts a whole tree at once
+#ifndef MOUNT_ATTR_RDONLY
+#define MOUNT_ATTR_RDONLY 0x00000001
+#endif
+#ifndef MOUNT_ATTR_NOSUID
+#define MOUNT_ATTR_NOSUID 0x00000002
+#endif
+#ifndef MOUNT_ATTR_NODEV
+#define MOUNT_ATTR_NODEV 0x00000004
+#endif
+#ifndef MOUNT_ATTR_NOEXEC
+#define MOUNT_ATTR_NOEXEC 0x00000008
+#endif
+#ifndef AT_RECURSIVE
+#define AT_RECURSIVE 0x8000
+#endif
+
+struct sandbox_mount_attr
+{
+    uint64_t attr_set;
+    uint64_t attr_clr;
+    uint64_t propagation;
+    uint64_t userns_fd;
+};
+
+typedef struct sandbox_mount
+{
+    char source[MAX_PATH];
+    char target[MAX_PATH];      // Below SANDBOX_ROOT
+    const char *fstype;
+    const char *data;
+    unsigned long flags;
+    uint64_t attrs;             // MOUNT_ATTR_*, set on everything below it
+    int file;                   // Mounted on a file rather than a directory
+    int optional;               // Left out when it cannot be mounted
+    int parent;                 // Only mounted when this one was, or -1
+} sandbox_mount_t;
+
+struct sandbox
+{
+    char name[MAX_NAME];
+    sandbox_mount_t mounts[SANDBOX_MAX_MOUNTS];
+    int mount_count;
+    int user_namespace;         // Not root: map ourselves to root instead
+    char uid_map[32];
+    char gid_map[32];
+    char cgroup[MAX_PATH];      // Empty without resource limits
+    int cgroup_fd;              // Its cgroup.procs, or -1
+};
+
+// Shared with the child, which runs on our memory until it execs
+typedef struct sandbox_child
+{
+    const sandbox_t *sandbox;
+    const char *cmd;
+    const char *work_dir;
+    int output_fd;
+    sigset_t mask;              // Ours, restored in the child before exec
+    const char *failed;         // Setup step that failed, NULL after exec
+    const char *path;
+    int error;
+    int fallback;               // Failure means namespaces are unusable here
+} sandbox_child_t;
+
+// Capabilities no build step needs, removed from the bounding set so not
+// even root inside the sandbox gets them back. CAP_SETPCAP goes last as
+// dropping the others requires it.
+static const int sandbox_dropped_caps[] = {
+    CAP_SYS_ADMIN,   CAP_SYS_MODULE,   CAP_SYS_RAWIO,     CAP_SYS_BOOT,
+    CAP_SYS_TIME,    CAP_SYS_PTRACE,   CAP_SYS_RESOURCE,  CAP_SYSLOG,
+    CAP_NET_ADMIN,   CAP_NET_RAW,      CAP_MAC_ADMIN,     CAP_MAC_OVERRIDE,
+    CAP_AUDIT_CONTROL, CAP_WAKE_ALARM, CAP_BLOCK_SUSPEND, CAP_MKNOD,
+#ifdef CAP_PERFMON
+    CAP_PERFMON,
+#endif
+#ifdef CAP_BPF
+    CAP_BPF,
+#endif
+    CAP_SETPCAP,
+};
+
+// Host devices a build step may use; the rest of /dev, disks included,
+// stays out of the sandbox
+static const char *sandbox_devices[] = {"null", "zero", "full", "random", "urandom", "tty"};
+
+// Set once namespaces turned out to be unavailable and building
+// unisolated is allowed
+static int g_sandbox_unavailable = 0;
+static unsigned int g_sandbox_counter = 0;
+
+// Write a short string to a kernel interface file without allocating;
+// safe in the child
+static int sandbox_write_file(const char *path, const char *data)
+{
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    size_t length = strlen(data);
+    ssize_t written = write(fd, data, length);
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return written == (ssize_t)length ? 0 : -1;
+}
+
+// Builds fail when they cannot be isolated, unless sandbox_fallback
+// allows running them without
+static int sandbox_disable(const char *what, int error)
+{
+    if (!global_config || !global_config->sandbox_fallback)
+    {
+        log_error("Build sandbox unavailable (cannot %s: %s); set sandbox_fallback = true "
+                  "to build unisolated", what, strerror(error));
+        return TINYPKG_ERROR;
+    }
+    if (!__atomic_exchange_n(&g_sandbox_unavailable, 1, __ATOMIC_ACQ_REL))
+    {
+        log_warn("Build sandbox unavailable (cannot %s: %s); build steps run "
+                 "unisolated", what, strerror(error));
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Mount table
+
+static int sandbox_add_mount(sandbox_t *sb, const char *source, const char *path,
+                             const char *fstype, const char *data, unsigned long flags,
+                             uint64_t attrs, int optional)
+{
+    if (sb->mount_count >= SANDBOX_MAX_MOUNTS)
+    {
+        log_error("Too many writable paths for the build sandbox");
+        return TINYPKG_ERROR;
+    }
+
+    sandbox_mount_t *mount = &sb->mounts[sb->mount_count];
+    if (snprintf(mount->source, sizeof(mount->source), "%s", source) >=
+            (int)sizeof(mount->source) ||
+        snprintf(mount->target, sizeof(mount->target), "%s%s", SANDBOX_ROOT,
+                 TINYPKG_STREQ(path, "/") ? "" : path) >= (int)sizeof(mount->target))
+    {
+        log_error("Sandbox path too long: %s", path);
+        return TINYPKG_ERROR;
+    }
+    mount->fstype = fstype;
+    mount->data = data;
+    mount->flags = flags;
+    mount->attrs = attrs;
+    mount->file = 0;
+    mount->optional = optional;
+    mount->parent = -1;
+    sb->mount_count++;
+    return TINYPKG_SUCCESS;
+}
+
+// Make an existing directory writable inside the sandbox
+static int sandbox_add_writable(sandbox_t *sb, const char *path)
+{
+    struct stat st;
+
+    if (path[0] != '/')
+    {
+        log_warn("Ignoring relative sandbox path: %s", path);
+        return TINYPKG_SUCCESS;
+    }
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        log_debug("Not exposing missing directory %s to the sandbox", path);
+        return TINYPKG_SUCCESS;
+    }
+    return sandbox_add_mount(sb, path, path, NULL, NULL, MS_BIND | MS_REC,
+                             MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV, 0);
+}
+
+static int sandbox_add_allowed_paths(sandbox_t *sb, const char *paths)
+{
+    char *copy = TINYPKG_STRDUP(paths);
+    if (!copy)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    int result = TINYPKG_SUCCESS;
+    char *saveptr = NULL;
+    for (char *path = strtok_r(copy, ":", &saveptr); path && result == TINYPKG_SUCCESS;
+         path = strtok_r(NULL, ":", &saveptr))
+    {
+        result = sandbox_add_writable(sb, path);
+    }
+
+    TINYPKG_FREE(copy);
+    return result;
+}
+
+// A private /dev: an empty tmpfs with the harmless host devices bound
+// in, as they cannot be created in a user namespace
+static int sandbox_add_devices(sandbox_t *sb)
+{
+    char path[32];
+
+    if (sandbox_add_mount(sb, "tmpfs", "/dev", "tmpfs", "mode=755",
+                          MS_NOSUID | MS_NODEV | MS_NOEXEC, 0, 0) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+    for (size_t i = 0; i < sizeof(sandbox_devices) / sizeof(sandbox_devices[0]); i++)
+    {
+        snprintf(path, sizeof(path), "/dev/%s", sandbox_devices[i]);
+        if (sandbox_add_mount(sb, path, path, NULL, NULL, MS_BIND, 0, 1) != TINYPKG_SUCCESS)
+        {
+            return TINYPKG_ERROR;
+        }
+        sb->mounts[sb->mount_count - 1].file = 1;
+    }
+    return sandbox_add_mount(sb, "tmpfs", "/dev/shm", "tmpfs", "mode=1777",
+                             MS_NOSUID | MS_NODEV, 0, 1);
+}
+
+// A /proc of the new PID namespace, with kernel settings and the SysRq
+// trigger read-only on top
+static int sandbox_add_proc(sandbox_t *sb)
+{
+    static const uint64_t readonly =
+        MOUNT_ATTR_RDONLY | MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV | MOUNT_ATTR_NOEXEC;
+
+    if (sandbox_add_mount(sb, "proc", "/proc", "proc", NULL, MS_NOSUID | MS_NODEV | MS_NOEXEC,
+                          0, 1) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+    int proc = sb->mount_count - 1;
+
+    // Without a /proc of its own the step sees the host's, read-only
+    // like the rest of it
+    if (sandbox_add_mount(sb, SANDBOX_ROOT "/proc/sys", "/proc/sys", NULL, NULL,
+                          MS_BIND | MS_REC, readonly, 0) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+    sb->mounts[sb->mount_count - 1].parent = proc;
+    // Kernels built without SysRq have no trigger to protect
+    if (sandbox_add_mount(sb, SANDBOX_ROOT "/proc/sysrq-trigger", "/proc/sysrq-trigger", NULL,
+                          NULL, MS_BIND, readonly, 1) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+    sb->mounts[sb->mount_count - 1].file = 1;
+    sb->mounts[sb->mount_count - 1].parent = proc;
+    return TINYPKG_SUCCESS;
+}
+
+// Read-only view of the host with private /tmp and /dev, a /proc of the
+// new PID namespace and the writable paths bound on top, none of them
+// honouring device nodes or setuid bits
+static int sandbox_build_mounts(sandbox_t *sb, const char *build_dir)
+{
+    char jobserver_dir[MAX_PATH];
+
+    if (sandbox_add_mount(sb, "/", "/", NULL, NULL, MS_BIND | MS_REC, MOUNT_ATTR_RDONLY, 0) !=
+            TINYPKG_SUCCESS ||
+        sandbox_add_mount(sb, "tmpfs", "/tmp", "tmpfs", "mode=1777", MS_NOSUID | MS_NODEV, 0,
+                          0) != TINYPKG_SUCCESS ||
+        sandbox_add_devices(sb) != TINYPKG_SUCCESS || sandbox_add_proc(sb) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    if (sandbox_add_writable(sb, build_dir) != TINYPKG_SUCCESS ||
+        sandbox_add_writable(sb, COMPCACHE_DIR) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+    if (jobserver_get_directory(jobserver_dir, sizeof(jobserver_dir)) == TINYPKG_SUCCESS &&
+        sandbox_add_writable(sb, jobserver_dir) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+    if (global_config && global_config->allowed_build_paths[0])
+    {
+        return sandbox_add_allowed_paths(sb, global_config->allowed_build_paths);
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Resource limits
+
+static void sandbox_cgroup_set(const sandbox_t *sb, const char *file, const char *value)
+{
+    char path[MAX_PATH];
+
+    if (snprintf(path, sizeof(path), "%s/%s", sb->cgroup, file) >= (int)sizeof(path) ||
+        sandbox_write_file(path, value) != 0)
+    {
+        log_debug("Cannot set %s for %s: %s", file, sb->name, strerror(errno));
+    }
+}
+
+// Controllers have to be enabled in every ancestor's subtree_control
+static void sandbox_cgroup_enable(const char *cgroup)
+{
+    static const char *controllers[] = {"+cpu", "+memory", "+io"};
+    char path[MAX_PATH];
+
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgroup);
+    for (size_t i = 0; i < sizeof(controllers) / sizeof(controllers[0]); i++)
+    {
+        if (sandbox_write_file(path, controllers[i]) != 0)
+        {
+            log_debug("Cannot enable %s in %s: %s", controllers[i] + 1, cgroup,
+                      strerror(errno));
+        }
+    }
+}
+
+// A cgroup per build so a runaway one cannot starve the others: CPU time
+// capped at its job slots, memory at what the scheduler plans with, and
+// CPU and IO weighted by slots. Builds run without limits when cgroup v2
+// cannot be managed here.
+static void sandbox_setup_cgroup(sandbox_t *sb, const package_t *pkg, int parallel_jobs)
+{
+    char parent[MAX_PATH];
+    char value[64];
+    struct statfs fs;
+
+    if (geteuid() != 0)
+    {
+        return;
+    }
+    if (statfs(SANDBOX_CGROUP_MOUNT, &fs) != 0 || fs.f_type != CGROUP2_SUPER_MAGIC)
+    {
+        log_debug("No cgroup v2 hierarchy at %s, builds run without limits",
+                  SANDBOX_CGROUP_MOUNT);
+        return;
+    }
+
+    snprintf(parent, sizeof(parent), "%s/%s", SANDBOX_CGROUP_MOUNT, SANDBOX_CGROUP_NAME);
+    if (mkdir(parent, 0755) != 0 && errno != EEXIST)
+    {
+        log_debug("No cgroup for build limits: %s", strerror(errno));
+        return;
+    }
+    sandbox_cgroup_enable(SANDBOX_CGROUP_MOUNT);
+    sandbox_cgroup_enable(parent);
+
+    unsigned int serial = __atomic_fetch_add(&g_sandbox_counter, 1, __ATOMIC_RELAXED);
+    if (snprintf(sb->cgroup, sizeof(sb->cgroup), "%s/%s-%d-%u", parent, pkg->name,
+                 (int)getpid(), serial) >= (int)sizeof(sb->cgroup) ||
+        mkdir(sb->cgroup, 0755) != 0)
+    {
+        log_debug("Cannot create cgroup for %s: %s", pkg->name, strerror(errno));
+        sb->cgroup[0] = '\0';
+        return;
+    }
+
+    int jobs = MAX(parallel_jobs, 1);
+    int weight = MIN(jobs * SANDBOX_WEIGHT_PER_JOB, 10000);
+
+    snprintf(value, sizeof(value), "%ld %d", (long)jobs * SANDBOX_CPU_PERIOD,
+             SANDBOX_CPU_PERIOD);
+    sandbox_cgroup_set(sb, "cpu.max", value);
+    snprintf(value, sizeof(value), "%d", weight);
+    sandbox_cgroup_set(sb, "cpu.weight", value);
+    snprintf(value, sizeof(value), "default %d", weight);
+    sandbox_cgroup_set(sb, "io.weight", value);
+
+    size_t budget_mb = jobserver_memory_budget();
+    if (budget_mb > 0)
+    {
+        snprintf(value, sizeof(value), "%zu", budget_mb * 1024 * 1024);
+        sandbox_cgroup_set(sb, "memory.max", value);
+    }
+    if (pkg->memory_estimate > 0)
+    {
+        size_t high_mb = (size_t)pkg->memory_estimate * SANDBOX_MEMORY_HIGH_FACTOR;
+        if (budget_mb > 0)
+        {
+            high_mb = MIN(high_mb, budget_mb);
+        }
+        snprintf(value, sizeof(value), "%zu", high_mb * 1024 * 1024);
+        sandbox_cgroup_set(sb, "memory.high", value);
+    }
+
+    if (snprintf(parent, sizeof(parent), "%s/cgroup.procs", sb->cgroup) >= (int)sizeof(parent))
+    {
+        errno = ENAMETOOLONG;
+    }
+    else
+    {
+        sb->cgroup_fd = open(parent, O_WRONLY | O_CLOEXEC);
+    }
+    if (sb->cgroup_fd < 0)
+    {
+        log_debug("Cannot open cgroup of %s: %s", pkg->name, strerror(errno));
+        rmdir(sb->cgroup);
+        sb->cgroup[0] = '\0';
+    }
+}
+
+static void sandbox_remove_cgroup(sandbox_t *sb)
+{
+    char path[MAX_PATH];
+
+    if (!sb->cgroup[0])
+    {
+        return;
+    }
+
+    // Stragglers a step left behind would keep the cgroup busy
+    if (snprintf(path, sizeof(path), "%s/cgroup.kill", sb->cgroup) < (int)sizeof(path))
+    {
+        sandbox_write_file(path, "1");
+    }
+    for (int attempt = 0; rmdir(sb->cgroup) != 0; attempt++)
+    {
+        if (errno != EBUSY || attempt >= 100)
+        {
+            log_debug("Cannot remove cgroup %s: %s", sb->cgroup, strerror(errno));
+            break;
+        }
+        usleep(10000);
+    }
+}
+
+// Lifecycle
+
+sandbox_t *sandbox_create(const package_t *pkg, const char *build_dir, int parallel_jobs)
+{
+    if (!pkg || !build_dir)
+    {
+        return NULL;
+    }
+    if (__atomic_load_n(&g_sandbox_unavailable, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+
+    if (utils_create_directory_recursive(SANDBOX_ROOT) != TINYPKG_SUCCESS)
+    {
+        log_warn("Cannot create sandbox root %s", SANDBOX_ROOT);
+        return NULL;
+    }
+
+    sandbox_t *sb = TINYPKG_CALLOC(1, sizeof(sandbox_t));
+    if (!sb)
+    {
+        return NULL;
+    }
+    snprintf(sb->name, sizeof(sb->name), "%s", pkg->name);
+    sb->cgroup_fd = -1;
+
+    // Steps keep our identity: as root they install root-owned files,
+    // otherwise the user namespace maps us to root for the same effect
+    sb->user_namespace = geteuid() != 0;
+    snprintf(sb->uid_map, sizeof(sb->uid_map), "0 %u 1\n", (unsigned)geteuid());
+    snprintf(sb->gid_map, sizeof(sb->gid_map), "0 %u 1\n", (unsigned)getegid());
+
+    if (sandbox_build_mounts(sb, build_dir) != TINYPKG_SUCCESS)
+    {
+        TINYPKG_FREE(sb);
+        return NULL;
+    }
+    sandbox_setup_cgroup(sb, pkg, parallel_jobs);
+
+    log_debug("Sandbox for %s: %d mounts, cgroup %s", pkg->name, sb->mount_count,
+              sb->cgroup[0] ? sb->cgroup : "none");
+    return sb;
+}
+
+void sandbox_free(sandbox_t *sb)
+{
+    if (!sb)
+    {
+        return;
+    }
+
+    if (sb->cgroup_fd >= 0)
+    {
+        close(sb->cgroup_fd);
+    }
+    sandbox_remove_cgroup(sb);
+    TINYPKG_FREE(sb);
+}
+
+// Child side. Runs on a borrowed stack sharing our memory, so it sticks
+// to system calls: no allocation, locks or logging.
+
+static int sandbox_child_fail(sandbox_child_t *child, const char *failed, const char *path,
+                              int fallback)
+{
+    child->error = errno;
+    child->failed = failed;
+    child->path = path;
+    child->fallback = fallback;
+    return 127;
+}
+
+// Handlers are ours and must not run in the child
+static void sandbox_child_reset_signals(void)
+{
+    struct sigaction action;
+
+    for (int sig = 1; sig < NSIG; sig++)
+    {
+        if (sigaction(sig, NULL, &action) == 0 && action.sa_handler != SIG_IGN &&
+            action.sa_handler != SIG_DFL)
+        {
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = SIG_DFL;
+            sigaction(sig, &action, NULL);
+        }
+    }
+}
+
+// Mount points under a fresh tmpfs do not exist yet
+static void sandbox_child_make_path(const char *target, int file)
+{
+    char path[MAX_PATH];
+    size_t length = strlen(target);
+
+    if (length >= sizeof(path))
+    {
+        return;
+    }
+    memcpy(path, target, length + 1);
+    for (char *p = path + strlen(SANDBOX_ROOT) + 1; *p; p++)
+    {
+        if (*p == '/')
+        {
+            *p = '\0';
+            mkdir(path, 0755);
+            *p = '/';
+        }
+    }
+    if (!file)
+    {
+        mkdir(path, 0755);
+        return;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+static int sandbox_child_set_attrs(const char *target, uint64_t attrs)
+{
+#ifdef SYS_mount_setattr
+    struct sandbox_mount_attr attr = {.attr_set = attrs};
+    if (syscall(SYS_mount_setattr, AT_FDCWD, target, AT_RECURSIVE, &attr, sizeof(attr)) == 0)
+    {
+        return 0;
+    }
+    if (errno != ENOSYS)
+    {
+        return -1;
+    }
+#endif
+    // Older kernels can only do this for the top mount, which has to keep
+    // the flags it already has
+    static const struct
+    {
+        unsigned long st;
+        unsigned long ms;
+    } kept[] = {
+        {ST_RDONLY, MS_RDONLY},   {ST_NOSUID, MS_NOSUID},         {ST_NODEV, MS_NODEV},
+        {ST_NOEXEC, MS_NOEXEC},   {ST_NOATIME, MS_NOATIME},       {ST_NODIRATIME, MS_NODIRATIME},
+        {ST_RELATIME, MS_RELATIME},
+    };
+    unsigned long flags = MS_BIND | MS_REMOUNT;
+    struct statfs fs;
+
+    if (statfs(target, &fs) == 0)
+    {
+        for (size_t i = 0; i < sizeof(kept) / sizeof(kept[0]); i++)
+        {
+            if ((unsigned long)fs.f_flags & kept[i].st)
+            {
+                flags |= kept[i].ms;
+            }
+        }
+    }
+    flags |= ((attrs & MOUNT_ATTR_RDONLY) ? MS_RDONLY : 0) |
+             ((attrs & MOUNT_ATTR_NOSUID) ? MS_NOSUID : 0) |
+             ((attrs & MOUNT_ATTR_NODEV) ? MS_NODEV : 0) |
+             ((attrs & MOUNT_ATTR_NOEXEC) ? MS_NOEXEC : 0);
+    return mount(NULL, target, NULL, flags, NULL);
+}
+
+// The usual links into /proc next to the private devices
+static int sandbox_child_link_devices(void)
+{
+    static const char *const links[][2] = {
+        {"/proc/self/fd", SANDBOX_ROOT "/dev/fd"},
+        {"/proc/self/fd/0", SANDBOX_ROOT "/dev/stdin"},
+        {"/proc/self/fd/1", SANDBOX_ROOT "/dev/stdout"},
+        {"/proc/self/fd/2", SANDBOX_ROOT "/dev/stderr"},
+    };
+
+    for (size_t i = 0; i < sizeof(links) / sizeof(links[0]); i++)
+    {
+        if (symlink(links[i][0], links[i][1]) != 0 && errno != EEXIST)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int sandbox_child_drop_capabilities(void)
+{
+    for (size_t i = 0; i < sizeof(sandbox_dropped_caps) / sizeof(sandbox_dropped_caps[0]); i++)
+    {
+        // EINVAL: the running kernel does not know the capability
+        if (prctl(PR_CAPBSET_DROP, sandbox_dropped_caps[i], 0, 0, 0) != 0 && errno != EINVAL)
+        {
+            return -1;
+        }
+    }
+    return prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+}
+
+static int sandbox_child_main(void *arg)
+{
+    sandbox_child_t *child = arg;
+    const sandbox_t *sb = child->sandbox;
+    char *argv[] = {"sh", "-c", (char *)child->cmd, NULL};
+
+    sandbox_child_reset_signals();
+
+    // Joined first so every process of the step is accounted to the build
+    if (sb->cgroup_fd >= 0 && write(sb->cgroup_fd, "0", 1) != 1)
+    {
+        return sandbox_child_fail(child, "join cgroup", sb->cgroup, 0);
+    }
+
+    if (sb->user_namespace &&
+        (sandbox_write_file("/proc/self/setgroups", "deny") != 0 ||
+         sandbox_write_file("/proc/self/uid_map", sb->uid_map) != 0 ||
+         sandbox_write_file("/proc/self/gid_map", sb->gid_map) != 0))
+    {
+        return sandbox_child_fail(child, "map user ids", NULL, 1);
+    }
+
+    if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0)
+    {
+        return sandbox_child_fail(child, "make mounts private", NULL, 1);
+    }
+    int mounted[SANDBOX_MAX_MOUNTS] = {0};
+    for (int i = 0; i < sb->mount_count; i++)
+    {
+        const sandbox_mount_t *m = &sb->mounts[i];
+
+        if (m->parent >= 0 && !mounted[m->parent])
+        {
+            continue;
+        }
+        if (i > 0)
+        {
+            sandbox_child_make_path(m->target, m->file);
+        }
+        if (mount(m->source, m->target, m->fstype, m->flags, m->data) != 0)
+        {
+            if (m->optional)
+            {
+                continue;
+            }
+            return sandbox_child_fail(child, "mount", m->target, i == 0);
+        }
+        mounted[i] = 1;
+        if (m->attrs && sandbox_child_set_attrs(m->target, m->attrs) != 0)
+        {
+            return sandbox_child_fail(child,
+                                      (m->attrs & MOUNT_ATTR_RDONLY) ? "make read-only"
+                                                                     : "restrict",
+                                      m->target, 1);
+        }
+    }
+    if (sandbox_child_link_devices() != 0)
+    {
+        return sandbox_child_fail(child, "link devices in", SANDBOX_ROOT "/dev", 0);
+    }
+
+    // The old root is stacked over the new one by pivot_root and detached
+    if (chdir(SANDBOX_ROOT) != 0 || syscall(SYS_pivot_root, ".", ".") != 0 ||
+        umount2(".", MNT_DETACH) != 0)
+    {
+        return sandbox_child_fail(child, "switch root to", SANDBOX_ROOT, 1);
+    }
+    if (chdir(child->work_dir ? child->work_dir : "/") != 0)
+    {
+        return sandbox_child_fail(child, "change directory to", child->work_dir, 0);
+    }
+
+    if (sandbox_child_drop_capabilities() != 0)
+    {
+        return sandbox_child_fail(child, "drop capabilities", NULL, 0);
+    }
+
+    if (child->output_fd >= 0)
+    {
+        int null_fd = open("/dev/null", O_RDONLY);
+        if (null_fd >= 0 && null_fd != STDIN_FILENO)
+        {
+            dup2(null_fd, STDIN_FILENO);
+            close(null_fd);
+        }
+        if (dup2(child->output_fd, STDOUT_FILENO) < 0 ||
+            dup2(child->output_fd, STDERR_FILENO) < 0)
+        {
+            return sandbox_child_fail(child, "redirect output", NULL, 0);
+        }
+    }
+
+    sigprocmask(SIG_SETMASK, &child->mask, NULL);
+    execve("/bin/sh", argv, environ);
+    return sandbox_child_fail(child, "execute", "/bin/sh", 0);
+}
+
+// Parent side
+
+// Like posix_spawn, the child borrows our memory and we wait until it
+// has exec'd, so nothing is copied however large tinypkg has grown.
+// Signals stay blocked meanwhile so none of our handlers run on its stack.
+static pid_t sandbox_spawn(const sandbox_t *sb, sandbox_child_t *child)
+{
+    int flags = CLONE_VM | CLONE_VFORK | CLONE_NEWNS | CLONE_NEWPID | CLONE_NEWIPC |
+                CLONE_NEWUTS | SIGCHLD;
+    if (sb->user_namespace)
+    {
+        flags |= CLONE_NEWUSER;
+    }
+
+    void *stack = mmap(NULL, SANDBOX_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &child->mask);
+    pid_t pid = clone(sandbox_child_main, (char *)stack + SANDBOX_STACK_SIZE, flags, child);
+    int saved = errno;
+    pthread_sigmask(SIG_SETMASK, &child->mask, NULL);
+
+    munmap(stack, SANDBOX_STACK_SIZE);
+    errno = saved;
+    return pid;
+}
+
+int sandbox_run(sandbox_t *sb, const char *cmd, const char *work_dir, int output_fd,
+                struct rusage *usage)
+{
+    if (!sb || !cmd)
+    {
+        return TINYPKG_ERROR;
+    }
+    if (__atomic_load_n(&g_sandbox_unavailable, __ATOMIC_ACQUIRE))
+    {
+        return utils_run_command_redirect(cmd, work_dir, output_fd, usage);
+    }
+
+    log_debug("Executing sandboxed command: %s", cmd);
+
+    sandbox_child_t child = {
+        .sandbox = sb, .cmd = cmd, .work_dir = work_dir, .output_fd = output_fd};
+    int64_t start_us = metrics_now_us();
+    pid_t pid = sandbox_spawn(sb, &child);
+    if (pid < 0)
+    {
+        int error = errno;
+        // Namespaces disabled, not permitted or exhausted on this host
+        if (error == EPERM || error == EINVAL || error == ENOSPC || error == EUSERS)
+        {
+            if (sandbox_disable("create namespaces", error) != TINYPKG_SUCCESS)
+            {
+                return TINYPKG_ERROR;
+            }
+            return utils_run_command_redirect(cmd, work_dir, output_fd, usage);
+        }
+        log_error("Failed to start sandboxed command: %s", strerror(error));
+        return TINYPKG_ERROR;
+    }
+
+    int exit_code;
+    int result = utils_wait_command(cmd, pid, start_us, &exit_code, usage);
+    if (child.failed)
+    {
+        if (child.fallback)
+        {
+            if (sandbox_disable(child.failed, child.error) != TINYPKG_SUCCESS)
+            {
+                return TINYPKG_ERROR;
+            }
+            return utils_run_command_redirect(cmd, work_dir, output_fd, usage);
+        }
+        log_error("Cannot %s%s%s in the build sandbox: %s", child.failed,
+                  child.path ? " " : "", child.path ? child.path : "",
+                  strerror(child.error));
+        return TINYPKG_ERROR;
+    }
+    if (result != TINYPKG_SUCCESS)
+    {
+        log_error("Command terminated abnormally");
+        return TINYPKG_ERROR;
+    }
+
+    log_debug("Command exited with code: %d", exit_code);
+    return (exit_code == 0) ? TINYPKG_SUCCESS : TINYPKG_ERROR;
+}
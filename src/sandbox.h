@@ -0,0 +1,47 @@
+/*
+ * TinyPkg - Build Sandbox Header
+ * Namespace-isolated build steps with per-build cgroup limits
+ */
+
+#ifndef TINYPKG_SANDBOX_H
+#define TINYPKG_SANDBOX_H
+
+#include <sys/resource.h>
+
+// Empty directory the read-only view of / is assembled on. Each step
+// mounts it in its own mount namespace, so concurrent builds share it.
+#define SANDBOX_ROOT CACHE_DIR "/sandbox"
+
+// Per-build cgroups: SANDBOX_CGROUP_MOUNT/SANDBOX_CGROUP_NAME/<package>-<n>
+#define SANDBOX_CGROUP_MOUNT "/sys/fs/cgroup"
+#define SANDBOX_CGROUP_NAME "tinypkg"
+
+// Resource shares. CPU time is capped at the jobs a build was granted;
+// CPU and IO weights grow with them so concurrent builds share fairly.
+#define SANDBOX_CPU_PERIOD 100000       // Microseconds
+#define SANDBOX_WEIGHT_PER_JOB 100      // cgroup default weight is 100
+#define SANDBOX_MEMORY_HIGH_FACTOR 2    // Throttled above this x estimate
+
+// Writable paths besides the build directory; further ones come from
+// the colon-separated allowed_build_paths setting
+#define SANDBOX_MAX_MOUNTS 32
+
+typedef struct sandbox sandbox_t;
+
+// Function declarations
+
+// Lifecycle; the cgroup of the build and anything left in it is removed
+// when the sandbox is freed. NULL also once sandboxing was found not to
+// work and sandbox_fallback allows building without it.
+sandbox_t *sandbox_create(const package_t *pkg, const char *build_dir, int parallel_jobs);
+void sandbox_free(sandbox_t *sb);
+
+// As utils_run_command_redirect, with the command in new mount, PID, IPC
+// and UTS namespaces (and a user namespace when not run as root), seeing
+// a read-only root and a private /dev with only the build and allowed
+// paths writable. Where namespaces are unavailable the step fails, or
+// runs directly when sandbox_fallback is set.
+int sandbox_run(sandbox_t *sb, const char *cmd, const char *work_dir, int output_fd,
+                struct rusage *usage);
+
+#endif /* TINYPKG_SANDBOX_H */
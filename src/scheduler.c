@@ -0,0 +1,698 @@
+/*
+ * TinyPkg - Build Scheduler Implementation
+ * Builds independent packages of a dependency DAG concurrently
+ */
+
+#include "../include/tinypkg.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Check whether a package was explicitly requested
+static int scheduler_is_target(const char *package_name, char **targets,
+                               int target_count)
+{
+    for (int i = 0; i < target_count; i++)
+    {
+        if (targets[i] && TINYPKG_STREQ(targets[i], package_name))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Longest chain of expected build time from a node to the end of the
+// DAG; building those first keeps the critical path moving
+static long scheduler_priority(scheduler_t *sched, int index)
+{
+    sched_node_t *node = &sched->nodes[index];
+    long longest = 0;
+
+    if (node->priority >= 0)
+    {
+        return node->priority;
+    }
+
+    for (int i = 0; i < node->dependent_count; i++)
+    {
+        longest = MAX(longest, scheduler_priority(sched, node->dependents[i]));
+    }
+    node->priority = node->cost + longest;
+    return node->priority;
+}
+
+static int scheduler_compare_priority(const void *a, const void *b)
+{
+    const long *left = a;
+    const long *right = b;
+
+    // Pairs of (priority, index): highest priority, then graph order
+    if (left[0] != right[0])
+    {
+        return left[0] > right[0] ? -1 : 1;
+    }
+    return left[1] < right[1] ? -1 : (left[1] > right[1]);
+}
+
+// Rank nodes by their critical path, with costs measured by earlier builds
+static int scheduler_rank_nodes(scheduler_t *sched)
+{
+    profile_record_t *history = NULL;
+    int history_count = 0;
+
+    if (profile_history_load(NULL, &history, &history_count) != TINYPKG_SUCCESS)
+    {
+        log_debug("No build history, using static build time estimates");
+    }
+
+    for (int i = 0; i < sched->node_count; i++)
+    {
+        sched_node_t *node = &sched->nodes[i];
+        node->cost = node->package
+                         ? profile_estimate(history, history_count, node->package)
+                         : 0;
+        node->priority = -1;
+    }
+    TINYPKG_FREE(history);
+
+    long *ranked = TINYPKG_CALLOC(sched->node_count, 2 * sizeof(long));
+    if (!ranked)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+    for (int i = 0; i < sched->node_count; i++)
+    {
+        ranked[2 * i] = scheduler_priority(sched, i);
+        ranked[2 * i + 1] = i;
+    }
+    qsort(ranked, sched->node_count, 2 * sizeof(long),
+          scheduler_compare_priority);
+    for (int i = 0; i < sched->node_count; i++)
+    {
+        sched->order[i] = (int)ranked[2 * i + 1];
+    }
+
+    TINYPKG_FREE(ranked);
+    return TINYPKG_SUCCESS;
+}
+
+// Create scheduler from a resolved dependency graph; with rebuild set the
+// targets are built even when installed
+static scheduler_t *scheduler_create_internal(dependency_graph_t *graph, char **targets,
+                                              int target_count, int rebuild)
+{
+    scheduler_t *sched;
+    int i;
+
+    if (!graph || graph->node_count <= 0)
+    {
+        return NULL;
+    }
+
+    sched = TINYPKG_CALLOC(1, sizeof(scheduler_t));
+    if (!sched)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&sched->lock, NULL);
+    pthread_cond_init(&sched->cond, NULL);
+
+    sched->nodes = TINYPKG_CALLOC(graph->node_count, sizeof(sched_node_t));
+    sched->completed = TINYPKG_CALLOC(graph->node_count, sizeof(int));
+    sched->order = TINYPKG_CALLOC(graph->node_count, sizeof(int));
+    if (!sched->nodes || !sched->completed || !sched->order)
+    {
+        scheduler_free(sched);
+        return NULL;
+    }
+
+    // One token per job the machine can run, limited by its memory
+    sched->job_budget = jobserver_pool_size();
+    sched->memory_budget = jobserver_memory_budget();
+    sched->max_builds = MAX(1, MIN(BUILD_MAX_ACTIVE, sched->job_budget));
+
+    // Create one node per package, indexed by graph node ID; load the ones
+    // that need building
+    for (i = 0; i < graph->node_count; i++)
+    {
+        dependency_node_t *dnode = &graph->nodes[i];
+        sched_node_t *node = &sched->nodes[i];
+        int needs_install;
+
+        strncpy(node->package_name, dnode->package_name, MAX_NAME - 1);
+        node->sched = sched;
+        node->state = SCHED_NODE_PENDING;
+        sched->node_count++;
+
+        needs_install = !package_is_installed(dnode->package_name) ||
+                        (rebuild &&
+                         scheduler_is_target(dnode->package_name, targets,
+                                             target_count));
+        if (!needs_install)
+        {
+            node->state = SCHED_NODE_DONE;
+            sched->finished++;
+            continue;
+        }
+
+        node->package = package_load_info(dnode->package_name);
+        if (!node->package)
+        {
+            log_error("Failed to load package information: %s",
+                      dnode->package_name);
+            scheduler_free(sched);
+            return NULL;
+        }
+
+        if (package_validate(node->package) != TINYPKG_SUCCESS)
+        {
+            log_error("Package validation failed: %s", dnode->package_name);
+            scheduler_free(sched);
+            return NULL;
+        }
+
+        if (package_check_conflicts(node->package) != TINYPKG_SUCCESS)
+        {
+            log_error("Package conflicts detected: %s", dnode->package_name);
+            scheduler_free(sched);
+            return NULL;
+        }
+    }
+
+    // Wire dependency edges
+    for (i = 0; i < graph->node_count; i++)
+    {
+        int dep_count;
+        const int *deps = dependency_graph_get_deps(graph, i, &dep_count);
+
+        for (int d = 0; d < dep_count; d++)
+        {
+            int dep = deps[d];
+            if (dep == i)
+            {
+                continue;
+            }
+
+            sched_node_t *dep_node = &sched->nodes[dep];
+            int *dependents = TINYPKG_REALLOC(
+                dep_node->dependents,
+                (dep_node->dependent_count + 1) * sizeof(int));
+            if (!dependents)
+            {
+                scheduler_free(sched);
+                return NULL;
+            }
+            dependents[dep_node->dependent_count++] = i;
+            dep_node->dependents = dependents;
+
+            if (dep_node->state != SCHED_NODE_DONE)
+            {
+                sched->nodes[i].pending_deps++;
+            }
+        }
+    }
+
+    for (i = 0; i < sched->node_count; i++)
+    {
+        if (sched->nodes[i].state == SCHED_NODE_PENDING &&
+            sched->nodes[i].pending_deps == 0)
+        {
+            sched->nodes[i].state = SCHED_NODE_READY;
+        }
+    }
+
+    if (scheduler_rank_nodes(sched) != TINYPKG_SUCCESS)
+    {
+        scheduler_free(sched);
+        return NULL;
+    }
+
+    return sched;
+}
+
+scheduler_t *scheduler_create(dependency_graph_t *graph, char **targets,
+                              int target_count)
+{
+    return scheduler_create_internal(graph, targets, target_count,
+                                     global_config->force_mode);
+}
+
+scheduler_t *scheduler_create_rebuild(dependency_graph_t *graph, char **targets,
+                                      int target_count)
+{
+    return scheduler_create_internal(graph, targets, target_count, 1);
+}
+
+// Free scheduler
+void scheduler_free(scheduler_t *sched)
+{
+    if (!sched)
+    {
+        return;
+    }
+
+    if (sched->nodes)
+    {
+        for (int i = 0; i < sched->node_count; i++)
+        {
+            if (sched->nodes[i].package)
+            {
+                package_free(sched->nodes[i].package);
+            }
+            TINYPKG_FREE(sched->nodes[i].dependents);
+        }
+    }
+
+    pthread_mutex_destroy(&sched->lock);
+    pthread_cond_destroy(&sched->cond);
+
+    TINYPKG_FREE(sched->nodes);
+    TINYPKG_FREE(sched->completed);
+    TINYPKG_FREE(sched->order);
+    TINYPKG_FREE(sched);
+}
+
+// Build worker; runs without touching the package database
+static void *scheduler_worker(void *arg)
+{
+    sched_node_t *node = (sched_node_t *)arg;
+    scheduler_t *sched = node->sched;
+    char thread_name[METRICS_TRACE_NAME_SIZE];
+    int result;
+
+    // Trace names are short; a long package name is cut to fit
+    snprintf(thread_name, sizeof(thread_name), "build %.*s",
+             (int)sizeof(thread_name) - 7, node->package->name);
+    metrics_trace_thread_name(thread_name);
+
+    result = package_build_and_stage(node->package, node->parallel_jobs);
+
+    pthread_mutex_lock(&sched->lock);
+    node->result = result;
+    sched->completed[sched->completed_count++] =
+        (int)(node - sched->nodes);
+    pthread_cond_signal(&sched->cond);
+    pthread_mutex_unlock(&sched->lock);
+
+    return NULL;
+}
+
+// Mark all transitive dependents of a failed node as skipped
+static void scheduler_skip_dependents(scheduler_t *sched, int index)
+{
+    sched_node_t *node = &sched->nodes[index];
+
+    for (int i = 0; i < node->dependent_count; i++)
+    {
+        sched_node_t *dependent = &sched->nodes[node->dependents[i]];
+        if (dependent->state != SCHED_NODE_PENDING &&
+            dependent->state != SCHED_NODE_READY)
+        {
+            continue;
+        }
+
+        log_warn("Skipping %s: dependency %s failed",
+                 dependent->package_name, node->package_name);
+        dependent->state = SCHED_NODE_SKIPPED;
+        sched->finished++;
+        sched->skipped++;
+        package_set_state(dependent->package_name, PKG_STATE_FAILED);
+        prefetch_cancel(dependent->package_name);
+        scheduler_skip_dependents(sched, node->dependents[i]);
+    }
+}
+
+// Return the token and memory a build held. Called with sched->lock held.
+static void scheduler_release_slot(scheduler_t *sched, sched_node_t *node)
+{
+    if (node->holds_token)
+    {
+        jobserver_release();
+        node->holds_token = 0;
+    }
+    sched->memory_reserved -= (size_t)node->memory_reserved;
+    node->memory_reserved = 0;
+}
+
+// Check whether a build fits next to the running ones in memory. The
+// first build always runs, however large its estimate.
+static int scheduler_fits_memory(scheduler_t *sched, sched_node_t *node)
+{
+    size_t needed = (size_t)MAX(node->package->memory_estimate, 0);
+
+    if (sched->running == 0 || sched->memory_budget == 0 || needed == 0)
+    {
+        return 1;
+    }
+    return sched->memory_reserved + needed <= sched->memory_budget;
+}
+
+// Start as many ready builds as the concurrency limit allows. With the
+// jobserver each build holds one token while it runs and its make draws
+// any further jobs from the shared pool, so slots move between builds as
+// they start and finish. Called with sched->lock held.
+static void scheduler_start_ready(scheduler_t *sched)
+{
+    int ready = 0;
+    int slots;
+    int jobs;
+
+    for (int i = 0; i < sched->node_count; i++)
+    {
+        if (sched->nodes[i].state == SCHED_NODE_READY)
+        {
+            ready++;
+        }
+    }
+
+    if (ready == 0 || sched->running >= sched->max_builds)
+    {
+        return;
+    }
+
+    // Split the job budget across the builds that will be running
+    slots = MIN(sched->max_builds, sched->running + ready);
+    jobs = MAX(1, sched->job_budget / slots);
+
+    // The state changes of every build started here go out in one write
+    int in_transaction = package_db_begin() == TINYPKG_SUCCESS;
+
+    // Most critical first
+    for (int n = 0; n < sched->node_count && sched->running < sched->max_builds;
+         n++)
+    {
+        int i = sched->order[n];
+        sched_node_t *node = &sched->nodes[i];
+        if (node->state != SCHED_NODE_READY)
+        {
+            continue;
+        }
+
+        // Larger builds wait for memory; smaller ready ones may still go
+        if (!scheduler_fits_memory(sched, node))
+        {
+            log_debug("Deferring %s: needs %d MB, %zu of %zu MB reserved",
+                      node->package_name, node->package->memory_estimate,
+                      sched->memory_reserved, sched->memory_budget);
+            continue;
+        }
+
+        // No free token: every slot is busy compiling
+        int token = jobserver_try_acquire();
+        if (!token && sched->running > 0)
+        {
+            break;
+        }
+        node->holds_token = token;
+        node->memory_reserved = MAX(node->package->memory_estimate, 0);
+        sched->memory_reserved += (size_t)node->memory_reserved;
+
+        node->parallel_jobs = jobs;
+        node->state = SCHED_NODE_RUNNING;
+        package_set_state(node->package_name, PKG_STATE_BUILDING);
+
+        if (pthread_create(&node->thread, NULL, scheduler_worker, node) != 0)
+        {
+            log_error("Failed to start build worker for %s",
+                      node->package_name);
+            scheduler_release_slot(sched, node);
+            node->state = SCHED_NODE_FAILED;
+            sched->finished++;
+            sched->failed++;
+            package_set_state(node->package_name, PKG_STATE_FAILED);
+            scheduler_skip_dependents(sched, i);
+            continue;
+        }
+
+        log_info("Scheduled build: %s (%d jobs, %d running, ~%ds)",
+                 node->package_name, jobs, sched->running + 1, node->cost);
+        sched->running++;
+    }
+
+    if (in_transaction && package_db_commit() != TINYPKG_SUCCESS)
+    {
+        log_warn("Failed to record build states in the package database");
+    }
+}
+
+// Handle a finished build. Called on the main thread without the lock.
+// The package's entry, or its failure and the skipped dependents, are
+// committed before the next package is handled, so the database never
+// lags behind the files already on disk.
+static void scheduler_reap(scheduler_t *sched, int index)
+{
+    sched_node_t *node = &sched->nodes[index];
+
+    pthread_join(node->thread, NULL);
+
+    int in_transaction = package_db_begin() == TINYPKG_SUCCESS;
+
+    if (node->result == TINYPKG_SUCCESS)
+    {
+        package_register_install(node->package);
+    }
+    else
+    {
+        package_set_state(node->package_name, PKG_STATE_FAILED);
+    }
+
+    pthread_mutex_lock(&sched->lock);
+    scheduler_release_slot(sched, node);
+    sched->running--;
+    sched->finished++;
+
+    // Tokens lost by clients that died holding them come back once idle
+    if (sched->running == 0)
+    {
+        jobserver_refill();
+    }
+
+    if (node->result == TINYPKG_SUCCESS)
+    {
+        node->state = SCHED_NODE_DONE;
+        sched->installed++;
+
+        for (int i = 0; i < node->dependent_count; i++)
+        {
+            sched_node_t *dependent = &sched->nodes[node->dependents[i]];
+            if (--dependent->pending_deps == 0 &&
+                dependent->state == SCHED_NODE_PENDING)
+            {
+                dependent->state = SCHED_NODE_READY;
+            }
+        }
+    }
+    else
+    {
+        log_error("Build failed: %s", node->package_name);
+        node->state = SCHED_NODE_FAILED;
+        sched->failed++;
+        scheduler_skip_dependents(sched, index);
+    }
+    pthread_mutex_unlock(&sched->lock);
+
+    if (in_transaction && package_db_commit() != TINYPKG_SUCCESS)
+    {
+        log_error("Failed to record %s in the package database",
+                  node->package_name);
+        if (node->result == TINYPKG_SUCCESS)
+        {
+            sched->unrecorded++;
+        }
+    }
+}
+
+// Collect packages to build in the order the scheduler will likely start
+// them, so their sources can be fetched ahead of time
+static int scheduler_build_order(scheduler_t *sched, package_t ***order)
+{
+    package_t **packages;
+    int *pending;
+    int *queue;
+    int head = 0, tail = 0, count = 0;
+
+    packages = TINYPKG_CALLOC(sched->node_count, sizeof(package_t *));
+    pending = TINYPKG_CALLOC(sched->node_count, sizeof(int));
+    queue = TINYPKG_CALLOC(sched->node_count, sizeof(int));
+    if (!packages || !pending || !queue)
+    {
+        TINYPKG_FREE(packages);
+        TINYPKG_FREE(pending);
+        TINYPKG_FREE(queue);
+        return 0;
+    }
+
+    for (int i = 0; i < sched->node_count; i++)
+    {
+        pending[i] = sched->nodes[i].pending_deps;
+    }
+    for (int n = 0; n < sched->node_count; n++)
+    {
+        if (sched->nodes[sched->order[n]].state == SCHED_NODE_READY)
+        {
+            queue[tail++] = sched->order[n];
+        }
+    }
+
+    while (head < tail)
+    {
+        sched_node_t *node = &sched->nodes[queue[head++]];
+
+        // Cached builds need no sources
+        if (!bincache_has_local(node->package))
+        {
+            packages[count++] = node->package;
+        }
+
+        for (int i = 0; i < node->dependent_count; i++)
+        {
+            int dep = node->dependents[i];
+            if (--pending[dep] == 0 &&
+                sched->nodes[dep].state == SCHED_NODE_PENDING)
+            {
+                queue[tail++] = dep;
+            }
+        }
+    }
+
+    TINYPKG_FREE(pending);
+    TINYPKG_FREE(queue);
+    *order = packages;
+    return count;
+}
+
+// Run the scheduler until every node reaches a terminal state
+int scheduler_run(scheduler_t *sched)
+{
+    package_t **order = NULL;
+    int order_count;
+
+    if (!sched)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    // Overlap source downloads with the builds ahead of them
+    order_count = scheduler_build_order(sched, &order);
+    if (order_count > 0)
+    {
+        prefetch_start(order, order_count);
+    }
+
+    // Builds share the job pool instead of fixed -j splits
+    if (jobserver_start(sched->job_budget) != TINYPKG_SUCCESS)
+    {
+        log_warn("Jobserver unavailable, splitting jobs statically");
+    }
+
+    log_info("Scheduling %d packages (%d concurrent builds, %d jobs)",
+             sched->node_count - sched->finished, sched->max_builds,
+             sched->job_budget);
+
+    pthread_mutex_lock(&sched->lock);
+    while (sched->finished < sched->node_count)
+    {
+        scheduler_start_ready(sched);
+
+        if (sched->running == 0 && sched->completed_count == 0)
+        {
+            // Nothing runnable; remaining nodes are blocked
+            for (int i = 0; i < sched->node_count; i++)
+            {
+                sched_node_t *node = &sched->nodes[i];
+                if (node->state == SCHED_NODE_PENDING ||
+                    node->state == SCHED_NODE_READY)
+                {
+                    log_error("Unable to schedule %s", node->package_name);
+                    node->state = SCHED_NODE_SKIPPED;
+                    sched->finished++;
+                    sched->skipped++;
+                }
+            }
+            break;
+        }
+
+        while (sched->completed_count == 0)
+        {
+            pthread_cond_wait(&sched->cond, &sched->lock);
+        }
+
+        int index = sched->completed[--sched->completed_count];
+        pthread_mutex_unlock(&sched->lock);
+        scheduler_reap(sched, index);
+        pthread_mutex_lock(&sched->lock);
+    }
+    pthread_mutex_unlock(&sched->lock);
+
+    prefetch_stop();
+    jobserver_stop();
+    TINYPKG_FREE(order);
+
+    log_info("Build summary: %d installed, %d failed, %d skipped",
+             sched->installed, sched->failed, sched->skipped);
+
+    if (sched->unrecorded > 0)
+    {
+        log_error("%d installed package(s) are missing from the database",
+                  sched->unrecorded);
+        return TINYPKG_ERROR_FILE;
+    }
+    return (sched->failed || sched->skipped) ? TINYPKG_ERROR_BUILD
+                                             : TINYPKG_SUCCESS;
+}
+
+// Resolve, schedule and install a set of packages
+int scheduler_install_packages(char **package_names, int count)
+{
+    dependency_graph_t *graph;
+    scheduler_t *sched;
+    int result;
+
+    if (!package_names || count <= 0)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    graph = dependency_resolve_graph(package_names, count);
+    if (!graph)
+    {
+        log_error("Dependency resolution failed");
+        return TINYPKG_ERROR_DEPENDENCY;
+    }
+
+    sched = scheduler_create(graph, package_names, count);
+    dependency_graph_free(graph);
+    if (!sched)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    result = scheduler_run(sched);
+    scheduler_free(sched);
+    return result;
+}
+
+// Node state to string
+const char *scheduler_node_state_to_string(sched_node_state_t state)
+{
+    switch (state)
+    {
+    case SCHED_NODE_PENDING:
+        return "pending";
+    case SCHED_NODE_READY:
+        return "ready";
+    case SCHED_NODE_RUNNING:
+        return "running";
+    case SCHED_NODE_DONE:
+        return "done";
+    case SCHED_NODE_FAILED:
+        return "failed";
+    case SCHED_NODE_SKIPPED:
+        return "skipped";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * TinyPkg - Build Scheduler Header
+ * Concurrent, dependency-ordered building of multiple packages
+ */
+
+#ifndef TINYPKG_SCHEDULER_H
+#define TINYPKG_SCHEDULER_H
+
+#include <pthread.h>
+
+// Scheduler node states
+typedef enum {
+    SCHED_NODE_PENDING = 0,   // Waiting for dependencies
+    SCHED_NODE_READY = 1,     // All dependencies installed
+    SCHED_NODE_RUNNING = 2,   // Build in progress on a worker
+    SCHED_NODE_DONE = 3,      // Installed (or already installed)
+    SCHED_NODE_FAILED = 4,    // Build or installation failed
+    SCHED_NODE_SKIPPED = 5    // A dependency failed
+} sched_node_state_t;
+
+// One package in the build DAG
+typedef struct sched_node {
+    char package_name[MAX_NAME];
+    package_t *package;
+    sched_node_state_t state;
+    int *dependents;          // Indices of nodes depending on this one
+    int dependent_count;
+    int pending_deps;         // Dependencies not yet installed
+    int parallel_jobs;        // Job slots granted when started
+    int memory_reserved;      // MB of the memory budget held while running
+    int holds_token;          // Owns a jobserver slot while running
+    int cost;                 // Expected build seconds (see profile_estimate)
+    long priority;            // Cost of the longest chain this node starts
+    int result;
+    pthread_t thread;
+    struct scheduler *sched;
+} sched_node_t;
+
+// Build scheduler state
+typedef struct scheduler {
+    sched_node_t *nodes;
+    int node_count;
+    int max_builds;           // Concurrent builds (bounded by BUILD_MAX_ACTIVE)
+    int job_budget;           // Jobserver tokens shared by running builds
+    size_t memory_budget;     // MB that running builds may reserve (0 = unknown)
+    size_t memory_reserved;
+    int running;
+    int finished;             // Nodes in a terminal state
+    int installed;
+    int failed;
+    int skipped;
+    int unrecorded;           // Installed, but the database commit failed
+    int *order;               // Node indices, most critical first
+    int *completed;           // Finished worker nodes waiting to be reaped
+    int completed_count;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} scheduler_t;
+
+// Function declarations
+
+// Scheduler lifecycle
+scheduler_t *scheduler_create(dependency_graph_t *graph, char **targets, int target_count);
+// Like scheduler_create, but installed targets are built again
+scheduler_t *scheduler_create_rebuild(dependency_graph_t *graph, char **targets, int target_count);
+void scheduler_free(scheduler_t *sched);
+int scheduler_run(scheduler_t *sched);
+
+// High-level entry point: resolve, schedule and install packages
+int scheduler_install_packages(char **package_names, int count);
+
+// Utilities
+const char *scheduler_node_state_to_string(sched_node_state_t state);
+
+#endif /* TINYPKG_SCHEDULER_H */
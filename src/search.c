@@ -0,0 +1,438 @@
+/*
+ * TinyPkg - Package Search
+ * Ranked full-text search over the trigram index in the repository index
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jansson.h>
+#include "../include/tinypkg.h"
+
+// Relevance of a match per field
+#define SCORE_NAME_EXACT 100
+#define SCORE_NAME_PREFIX 60
+#define SCORE_NAME 40
+#define SCORE_PROVIDES_EXACT 30
+#define SCORE_PROVIDES 20
+#define SCORE_CATEGORY_EXACT 15
+#define SCORE_CATEGORY 10
+#define SCORE_DESCRIPTION 5
+#define SCORE_DESCRIPTION_WORD 3    // Bonus when the term starts a word
+#define SCORE_MAINTAINER 3
+
+typedef struct search_terms
+{
+    char *buffer;
+    const char *terms[SEARCH_MAX_TERMS];
+    int count;
+} search_terms_t;
+
+static const struct
+{
+    unsigned int field;
+    const char *name;
+} search_field_names[] = {
+    {SEARCH_FIELD_NAME, "name"},
+    {SEARCH_FIELD_PROVIDES, "provides"},
+    {SEARCH_FIELD_CATEGORY, "category"},
+    {SEARCH_FIELD_DESCRIPTION, "description"},
+    {SEARCH_FIELD_MAINTAINER, "maintainer"},
+};
+
+// Query parsing
+static int search_split(const char *query, search_terms_t *terms)
+{
+    char *saveptr = NULL;
+
+    memset(terms, 0, sizeof(*terms));
+    terms->buffer = TINYPKG_STRDUP(query);
+    if (!terms->buffer)
+    {
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    for (char *term = strtok_r(terms->buffer, " \t\n", &saveptr); term;
+         term = strtok_r(NULL, " \t\n", &saveptr))
+    {
+        if (terms->count == SEARCH_MAX_TERMS)
+        {
+            log_warn("Search uses only the first %d terms", SEARCH_MAX_TERMS);
+            break;
+        }
+        terms->terms[terms->count++] = term;
+    }
+
+    if (terms->count == 0)
+    {
+        TINYPKG_FREE(terms->buffer);
+        log_error("Empty search query");
+        return TINYPKG_ERROR;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Candidate selection: packages carrying every trigram of every term.
+// Postings are ascending, so each step is a linear merge.
+static int search_intersect(int *candidates, int count, const uint32_t *ids, int id_count)
+{
+    int kept = 0;
+    int i = 0;
+    int j = 0;
+
+    while (i < count && j < id_count)
+    {
+        if ((uint32_t)candidates[i] < ids[j])
+        {
+            i++;
+        }
+        else if ((uint32_t)candidates[i] > ids[j])
+        {
+            j++;
+        }
+        else
+        {
+            candidates[kept++] = candidates[i];
+            i++;
+            j++;
+        }
+    }
+    return kept;
+}
+
+static int search_candidates(const search_terms_t *terms, int **candidates)
+{
+    int total = repoindex_package_count();
+    int count = -1;
+    int *list;
+
+    list = TINYPKG_MALLOC((size_t)MAX(total, 1) * sizeof(int));
+    if (!list)
+    {
+        return -1;
+    }
+
+    for (int t = 0; t < terms->count && count != 0; t++)
+    {
+        const char *term = terms->terms[t];
+        size_t length = strlen(term);
+
+        for (size_t i = 0; i + 3 <= length && count != 0; i++)
+        {
+            const uint32_t *ids = NULL;
+            uint32_t trigram = REPOINDEX_TRIGRAM(tolower((unsigned char)term[i]),
+                                                 tolower((unsigned char)term[i + 1]),
+                                                 tolower((unsigned char)term[i + 2]));
+            int id_count = repoindex_search_postings(trigram, &ids);
+
+            if (count < 0)
+            {
+                for (int k = 0; k < id_count; k++)
+                {
+                    list[k] = (int)ids[k];
+                }
+                count = id_count;
+            }
+            else
+            {
+                count = search_intersect(list, count, ids, id_count);
+            }
+        }
+    }
+
+    // No term was long enough for the index; check every package
+    if (count < 0)
+    {
+        for (int id = 0; id < total; id++)
+        {
+            list[id] = id;
+        }
+        count = total;
+    }
+
+    *candidates = list;
+    return count;
+}
+
+// Scoring
+static int search_word_start(const char *text, const char *match)
+{
+    return match == text || !isalnum((unsigned char)match[-1]);
+}
+
+static int search_score_term(int id, const char *term, unsigned int *fields)
+{
+    const char *name = repoindex_get_string(id, REPOINDEX_STR_NAME);
+    const char *category = repoindex_get_string(id, REPOINDEX_STR_CATEGORY);
+    const char *description = repoindex_get_string(id, REPOINDEX_STR_DESCRIPTION);
+    const char *match;
+    const uint32_t *refs = NULL;
+    int provides_count;
+    int provides_score = 0;
+    int score = 0;
+
+    if (strcasecmp(name, term) == 0)
+    {
+        score += SCORE_NAME_EXACT;
+        *fields |= SEARCH_FIELD_NAME;
+    }
+    else if (strncasecmp(name, term, strlen(term)) == 0)
+    {
+        score += SCORE_NAME_PREFIX;
+        *fields |= SEARCH_FIELD_NAME;
+    }
+    else if (strcasestr(name, term))
+    {
+        score += SCORE_NAME;
+        *fields |= SEARCH_FIELD_NAME;
+    }
+
+    provides_count = repoindex_get_list(id, REPOINDEX_LIST_PROVIDES, &refs);
+    for (int i = 0; i < provides_count && provides_score < SCORE_PROVIDES_EXACT; i++)
+    {
+        const char *provided = repoindex_ref_name(refs[i]);
+
+        if (strcasecmp(provided, term) == 0)
+        {
+            provides_score = SCORE_PROVIDES_EXACT;
+        }
+        else if (strcasestr(provided, term))
+        {
+            provides_score = SCORE_PROVIDES;
+        }
+    }
+    if (provides_score)
+    {
+        score += provides_score;
+        *fields |= SEARCH_FIELD_PROVIDES;
+    }
+
+    if (strcasecmp(category, term) == 0)
+    {
+        score += SCORE_CATEGORY_EXACT;
+        *fields |= SEARCH_FIELD_CATEGORY;
+    }
+    else if (strcasestr(category, term))
+    {
+        score += SCORE_CATEGORY;
+        *fields |= SEARCH_FIELD_CATEGORY;
+    }
+
+    match = strcasestr(description, term);
+    if (match)
+    {
+        score += SCORE_DESCRIPTION;
+        // Prefer a whole-word hit anywhere in the description
+        for (; match; match = strcasestr(match + 1, term))
+        {
+            if (search_word_start(description, match))
+            {
+                score += SCORE_DESCRIPTION_WORD;
+                break;
+            }
+        }
+        *fields |= SEARCH_FIELD_DESCRIPTION;
+    }
+
+    if (strcasestr(repoindex_get_string(id, REPOINDEX_STR_MAINTAINER), term))
+    {
+        score += SCORE_MAINTAINER;
+        *fields |= SEARCH_FIELD_MAINTAINER;
+    }
+
+    return score;
+}
+
+static int search_compare(const void *a, const void *b)
+{
+    const search_result_t *x = a;
+    const search_result_t *y = b;
+
+    if (x->score != y->score)
+    {
+        return y->score - x->score;
+    }
+    return strcmp(repoindex_get_string(x->id, REPOINDEX_STR_NAME),
+                  repoindex_get_string(y->id, REPOINDEX_STR_NAME));
+}
+
+// Queries
+int search_query(const char *query, search_result_t **results, int *count)
+{
+    search_terms_t terms;
+    search_result_t *matches;
+    int *candidates = NULL;
+    int candidate_count;
+    int match_count = 0;
+
+    if (!query || !results || !count)
+    {
+        return TINYPKG_ERROR;
+    }
+    *results = NULL;
+    *count = 0;
+
+    // Search reads only the precompiled index; refresh it if the checked
+    // out repositories have moved on. Users who cannot write it still get
+    // the old one.
+    if (!repoindex_is_current() && repoindex_build() != TINYPKG_SUCCESS)
+    {
+        if (repoindex_open_stale() != TINYPKG_SUCCESS)
+        {
+            log_error("No repository index available, run --sync first");
+            return TINYPKG_ERROR;
+        }
+        log_warn("Repository index is out of date and could not be rebuilt, "
+                 "results may not match the repositories");
+    }
+
+    if (search_split(query, &terms) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    candidate_count = search_candidates(&terms, &candidates);
+    if (candidate_count < 0)
+    {
+        TINYPKG_FREE(terms.buffer);
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    matches = TINYPKG_MALLOC((size_t)MAX(candidate_count, 1) * sizeof(search_result_t));
+    if (!matches)
+    {
+        TINYPKG_FREE(candidates);
+        TINYPKG_FREE(terms.buffer);
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    // Trigrams only narrow the candidates; every term must really occur
+    for (int i = 0; i < candidate_count; i++)
+    {
+        search_result_t result = {candidates[i], 0, 0};
+        int t;
+
+        for (t = 0; t < terms.count; t++)
+        {
+            int score = search_score_term(result.id, terms.terms[t], &result.fields);
+            if (score == 0)
+            {
+                break;
+            }
+            result.score += score;
+        }
+
+        if (t == terms.count)
+        {
+            matches[match_count++] = result;
+        }
+    }
+
+    qsort(matches, match_count, sizeof(search_result_t), search_compare);
+
+    log_debug("Search '%s': %d candidates, %d matches", query, candidate_count, match_count);
+
+    TINYPKG_FREE(candidates);
+    TINYPKG_FREE(terms.buffer);
+    *results = matches;
+    *count = match_count;
+    return TINYPKG_SUCCESS;
+}
+
+// Output
+static json_t *search_result_json(const search_result_t *result)
+{
+    const char *name = repoindex_get_string(result->id, REPOINDEX_STR_NAME);
+    json_t *object = json_object();
+    json_t *fields = json_array();
+
+    if (!object || !fields)
+    {
+        json_decref(object);
+        json_decref(fields);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < sizeof(search_field_names) / sizeof(search_field_names[0]); i++)
+    {
+        if (result->fields & search_field_names[i].field)
+        {
+            json_array_append_new(fields, json_string(search_field_names[i].name));
+        }
+    }
+
+    json_object_set_new(object, "name", json_string(name));
+    json_object_set_new(object, "version",
+                        json_string(repoindex_get_string(result->id, REPOINDEX_STR_VERSION)));
+    json_object_set_new(object, "description",
+                        json_string(repoindex_get_string(result->id, REPOINDEX_STR_DESCRIPTION)));
+    json_object_set_new(object, "category",
+                        json_string(repoindex_get_string(result->id, REPOINDEX_STR_CATEGORY)));
+    json_object_set_new(object, "installed", json_boolean(package_db_find(name) != NULL));
+    json_object_set_new(object, "score", json_integer(result->score));
+    json_object_set_new(object, "matched", fields);
+    return object;
+}
+
+int search_print(const char *query, search_output_t format)
+{
+    search_result_t *results = NULL;
+    struct timespec start, end;
+    int count = 0;
+    int result;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    result = search_query(query, &results, &count);
+    if (result != TINYPKG_SUCCESS)
+    {
+        return result;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // Installed markers come from the database; a missing one marks nothing
+    package_db_load();
+
+    if (format == SEARCH_OUTPUT_JSON)
+    {
+        json_t *array = json_array();
+
+        if (!array)
+        {
+            TINYPKG_FREE(results);
+            return TINYPKG_ERROR_MEMORY;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            json_t *object = search_result_json(&results[i]);
+            if (object)
+            {
+                json_array_append_new(array, object);
+            }
+        }
+        json_dumpf(array, stdout, JSON_INDENT(2));
+        printf("\n");
+        json_decref(array);
+    }
+    else
+    {
+        printf("Searching for packages matching: %s\n", query);
+        for (int i = 0; i < count; i++)
+        {
+            const char *name = repoindex_get_string(results[i].id, REPOINDEX_STR_NAME);
+
+            printf("%s %s%s\n    %s\n", name,
+                   repoindex_get_string(results[i].id, REPOINDEX_STR_VERSION),
+                   package_db_find(name) ? " [installed]" : "",
+                   repoindex_get_string(results[i].id, REPOINDEX_STR_DESCRIPTION));
+        }
+        printf("\nFound %d packages\n", count);
+    }
+
+    log_debug("Search took %.3f ms",
+              (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+
+    TINYPKG_FREE(results);
+    return TINYPKG_SUCCESS;
+}
@@ -0,0 +1,40 @@
+/*
+ * TinyPkg - Package Search Header
+ * Ranked full-text search over the trigram index in the repository index
+ */
+
+#ifndef TINYPKG_SEARCH_H
+#define TINYPKG_SEARCH_H
+
+// Search terms are ANDed together; shorter terms than a trigram scan
+// every package instead of using the index
+#define SEARCH_MAX_TERMS 16
+
+// Fields a result matched in
+#define SEARCH_FIELD_NAME 0x01
+#define SEARCH_FIELD_PROVIDES 0x02
+#define SEARCH_FIELD_CATEGORY 0x04
+#define SEARCH_FIELD_DESCRIPTION 0x08
+#define SEARCH_FIELD_MAINTAINER 0x10
+
+typedef enum {
+    SEARCH_OUTPUT_TEXT = 0,
+    SEARCH_OUTPUT_JSON
+} search_output_t;
+
+// One match: a repository index package ID and its relevance
+typedef struct search_result {
+    int id;
+    int score;
+    unsigned int fields;            // SEARCH_FIELD_*
+} search_result_t;
+
+// Function declarations
+
+// Results are sorted by descending score, then name; free with TINYPKG_FREE
+int search_query(const char *query, search_result_t **results, int *count);
+
+// Run a query and print the results
+int search_print(const char *query, search_output_t format);
+
+#endif /* TINYPKG_SEARCH_H */
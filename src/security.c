@@ -8,37 +8,29 @@
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <openssl/evp.h>
 #include "../include/tinypkg.h"
 
+// Read size for hashing files
+#define SECURITY_HASH_BUFFER (128 * 1024)
+
 // Global security context
 static security_context_t g_security_ctx = {0};
 static int security_initialized = 0;
 
 // Helper functions
-static int run_hash_command(const char *file_path, const char *hash_cmd, 
-                           char *output, size_t output_size) {
-    char cmd[MAX_CMD];
-    snprintf(cmd, sizeof(cmd), "%s '%s'", hash_cmd, file_path);
-    
-    char *result = NULL;
-    int exit_code;
-    
-    if (utils_run_command_with_output(cmd, NULL, &result, &exit_code) == TINYPKG_SUCCESS &&
-        exit_code == 0 && result) {
-        
-        // Extract hash from output (first token)
-        char *token = strtok(result, " \t\n");
-        if (token) {
-            strncpy(output, token, output_size - 1);
-            output[output_size - 1] = '\0';
-            TINYPKG_FREE(result);
-            return TINYPKG_SUCCESS;
-        }
+static const EVP_MD *security_hash_md(hash_type_t type) {
+    switch (type) {
+        case HASH_TYPE_MD5: return EVP_md5();
+        case HASH_TYPE_SHA1: return EVP_sha1();
+        case HASH_TYPE_SHA256: return EVP_sha256();
+        default: return NULL;
     }
-    
-    if (result) TINYPKG_FREE(result);
-    return TINYPKG_ERROR;
 }
 
 // System initialization
@@ -50,7 +42,7 @@ int security_init(void) {
     log_debug("Initializing security system");
     
     // Set default values
-    g_security_ctx.verify_checksums = 1;
+    g_security_ctx.verify_checksums = global_config ? global_config->verify_checksums : 1;
     g_security_ctx.verify_signatures = 0; // Disabled by default
     snprintf(g_security_ctx.keyring_path, sizeof(g_security_ctx.keyring_path), 
              "%s/keyring", CONFIG_DIR);
@@ -78,31 +70,19 @@ int security_calculate_checksum(const char *file_path, char *hash_output,
         return TINYPKG_ERROR;
     }
     
-    const char *hash_cmd;
-    switch (type) {
-        case HASH_TYPE_MD5:
-            hash_cmd = "md5sum";
-            break;
-        case HASH_TYPE_SHA1:
-            hash_cmd = "sha1sum";
-            break;
-        case HASH_TYPE_SHA256:
-            hash_cmd = "sha256sum";
-            break;
-        default:
-            log_error("Unsupported hash type: %d", type);
-            return TINYPKG_ERROR;
+    security_hash_t *hash = security_hash_create(type);
+    if (!hash) {
+        log_error("Unsupported hash type: %d", type);
+        return TINYPKG_ERROR;
     }
     
-    // Check if hash command is available
-    char check_cmd[MAX_CMD];
-    snprintf(check_cmd, sizeof(check_cmd), "which %s >/dev/null 2>&1", hash_cmd);
-    if (system(check_cmd) != 0) {
-        log_error("Hash command not available: %s", hash_cmd);
-        return TINYPKG_ERROR;
+    int result = security_hash_update_file(hash, file_path, -1);
+    if (result == TINYPKG_SUCCESS) {
+        result = security_hash_final(hash, hash_output, hash_size);
     }
     
-    return run_hash_command(file_path, hash_cmd, hash_output, hash_size);
+    security_hash_free(hash);
+    return result;
 }
 
 // Checksum verification
@@ -111,6 +91,10 @@ int security_verify_checksum(const char *file_path, const char *expected_hash, h
         return TINYPKG_ERROR;
     }
     
+    if (!security_initialized) {
+        security_init();
+    }
+    
     if (!g_security_ctx.verify_checksums) {
         log_debug("Checksum verification disabled, skipping");
         return TINYPKG_SUCCESS;
@@ -124,12 +108,30 @@ int security_verify_checksum(const char *file_path, const char *expected_hash, h
         return result;
     }
     
+    return security_verify_digest(file_path, calculated_hash, expected_hash);
+}
+
+// Compare an already computed digest against the expected one
+int security_verify_digest(const char *file_path, const char *calculated_hash,
+                           const char *expected_hash) {
+    if (!calculated_hash || !expected_hash) {
+        return TINYPKG_ERROR;
+    }
+    
+    if (!security_initialized) {
+        security_init();
+    }
+    
+    if (!g_security_ctx.verify_checksums) {
+        return TINYPKG_SUCCESS;
+    }
+    
     // Compare hashes (case-insensitive)
     if (strcasecmp(calculated_hash, expected_hash) == 0) {
-        log_debug("Checksum verification passed for: %s", file_path);
+        log_debug("Checksum verification passed for: %s", TINYPKG_SAFE_STR(file_path));
         return TINYPKG_SUCCESS;
     } else {
-        log_error("Checksum verification failed for: %s", file_path);
+        log_error("Checksum verification failed for: %s", TINYPKG_SAFE_STR(file_path));
         log_error("Expected: %s", expected_hash);
         log_error("Calculated: %s", calculated_hash);
         return TINYPKG_ERROR;
@@ -216,3 +218,336 @@ int security_is_safe_filename(const char *filename) {
     const char *dangerous_chars = ";<>|&/*";
     return TINYPKG_SUCCESS;
 }
+
+// Incremental hashing
+security_hash_t *security_hash_create(hash_type_t type) {
+    const EVP_MD *md = security_hash_md(type);
+    if (!md) return NULL;
+    
+    security_hash_t *hash = TINYPKG_CALLOC(1, sizeof(security_hash_t));
+    if (!hash) return NULL;
+    
+    hash->md_ctx = EVP_MD_CTX_new();
+    hash->type = type;
+    if (!hash->md_ctx || EVP_DigestInit_ex(hash->md_ctx, md, NULL) != 1) {
+        security_hash_free(hash);
+        return NULL;
+    }
+    
+    return hash;
+}
+
+int security_hash_reset(security_hash_t *hash) {
+    if (!hash) return TINYPKG_ERROR;
+    
+    hash->bytes = 0;
+    return EVP_DigestInit_ex(hash->md_ctx, security_hash_md(hash->type), NULL) == 1 ?
+           TINYPKG_SUCCESS : TINYPKG_ERROR;
+}
+
+int security_hash_update(security_hash_t *hash, const void *data, size_t length) {
+    if (!hash) return TINYPKG_ERROR;
+    
+    if (length == 0) return TINYPKG_SUCCESS;
+    if (EVP_DigestUpdate(hash->md_ctx, data, length) != 1) {
+        return TINYPKG_ERROR;
+    }
+    
+    hash->bytes += length;
+    return TINYPKG_SUCCESS;
+}
+
+// Feed the first length bytes of a file (all of it if length < 0)
+int security_hash_update_file(security_hash_t *hash, const char *file_path, off_t length) {
+    if (!hash || !file_path) return TINYPKG_ERROR;
+    
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        log_error("Failed to open %s for hashing: %s", file_path, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+    
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    
+    unsigned char *buffer = TINYPKG_MALLOC(SECURITY_HASH_BUFFER);
+    if (!buffer) {
+        close(fd);
+        return TINYPKG_ERROR_MEMORY;
+    }
+    
+    int result = TINYPKG_SUCCESS;
+    off_t remaining = length;
+    
+    while (length < 0 || remaining > 0) {
+        size_t want = SECURITY_HASH_BUFFER;
+        if (length >= 0 && (off_t)want > remaining) want = (size_t)remaining;
+        
+        ssize_t n = read(fd, buffer, want);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            result = TINYPKG_ERROR_FILE;
+            break;
+        }
+        if (n == 0) {
+            // Shorter than requested
+            if (length >= 0) result = TINYPKG_ERROR_FILE;
+            break;
+        }
+        
+        if (security_hash_update(hash, buffer, (size_t)n) != TINYPKG_SUCCESS) {
+            result = TINYPKG_ERROR;
+            break;
+        }
+        remaining -= n;
+    }
+    
+    TINYPKG_FREE(buffer);
+    close(fd);
+    return result;
+}
+
+int security_hash_final(security_hash_t *hash, char *hash_output, size_t hash_size) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    
+    if (!hash || !hash_output) return TINYPKG_ERROR;
+    
+    if (EVP_DigestFinal_ex(hash->md_ctx, digest, &digest_len) != 1 ||
+        hash_size < digest_len * 2 + 1) {
+        return TINYPKG_ERROR;
+    }
+    
+    for (unsigned int i = 0; i < digest_len; i++) {
+        snprintf(hash_output + i * 2, 3, "%02x", digest[i]);
+    }
+    hash_output[digest_len * 2] = '\0';
+    return TINYPKG_SUCCESS;
+}
+
+void security_hash_free(security_hash_t *hash) {
+    if (!hash) return;
+    
+    if (hash->md_ctx) {
+        EVP_MD_CTX_free(hash->md_ctx);
+    }
+    TINYPKG_FREE(hash);
+}
+
+const char *security_hash_type_to_string(hash_type_t type) {
+    switch (type) {
+        case HASH_TYPE_MD5: return "md5";
+        case HASH_TYPE_SHA1: return "sha1";
+        case HASH_TYPE_SHA256: return "sha256";
+        default: return "unknown";
+    }
+}
+
+// Checksum sidecar files, in sha256sum format: "<hex>  <filename>"
+int security_write_checksum_file(const char *checksum_path, const char *file_path,
+                                 const char *digest) {
+    if (!checksum_path || !file_path || !digest) {
+        return TINYPKG_ERROR;
+    }
+    
+    char *filename = utils_get_basename(file_path);
+    if (!filename) return TINYPKG_ERROR;
+    
+    FILE *fp = fopen(checksum_path, "w");
+    if (!fp) {
+        TINYPKG_FREE(filename);
+        return TINYPKG_ERROR_FILE;
+    }
+    
+    fprintf(fp, "%s  %s\n", digest, filename);
+    TINYPKG_FREE(filename);
+    
+    return fclose(fp) == 0 ? TINYPKG_SUCCESS : TINYPKG_ERROR_FILE;
+}
+
+int security_create_checksum_file(const char *file_path, const char *checksum_path) {
+    char digest[EVP_MAX_MD_SIZE * 2 + 1];
+    
+    if (!file_path || !checksum_path) {
+        return TINYPKG_ERROR;
+    }
+    
+    int result = security_calculate_checksum(file_path, digest, sizeof(digest),
+                                             HASH_TYPE_SHA256);
+    if (result != TINYPKG_SUCCESS) {
+        return result;
+    }
+    
+    return security_write_checksum_file(checksum_path, file_path, digest);
+}
+
+// Batch verification on a thread pool
+typedef struct security_batch {
+    security_verify_job_t *jobs;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+} security_batch_t;
+
+static void *security_batch_worker(void *arg) {
+    security_batch_t *batch = (security_batch_t *)arg;
+    
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        int index = batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+        
+        if (index >= batch->count) break;
+        
+        security_verify_job_t *job = &batch->jobs[index];
+        char calculated[EVP_MAX_MD_SIZE * 2 + 1];
+        
+        job->result = security_calculate_checksum(job->file_path, calculated,
+                                                  sizeof(calculated), job->type);
+        if (job->result == TINYPKG_SUCCESS &&
+            strcasecmp(calculated, job->expected_hash) != 0) {
+            job->result = TINYPKG_ERROR;
+        }
+    }
+    
+    return NULL;
+}
+
+// Verify many files concurrently; returns the number of failed jobs
+int security_verify_checksums_batch(security_verify_job_t *jobs, int count, int threads) {
+    security_batch_t batch;
+    pthread_t *workers;
+    int started = 0;
+    int failed = 0;
+    
+    if (!jobs || count <= 0) return 0;
+    
+    if (threads <= 0) threads = 1;
+    threads = MIN(threads, count);
+    
+    batch.jobs = jobs;
+    batch.count = count;
+    batch.next = 0;
+    pthread_mutex_init(&batch.lock, NULL);
+    
+    workers = TINYPKG_CALLOC(threads, sizeof(pthread_t));
+    if (workers) {
+        for (int i = 0; i < threads; i++) {
+            if (pthread_create(&workers[i], NULL, security_batch_worker, &batch) != 0) {
+                break;
+            }
+            started++;
+        }
+    }
+    
+    // Work on the calling thread too if no worker could be started
+    if (started == 0) {
+        security_batch_worker(&batch);
+    }
+    
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    
+    TINYPKG_FREE(workers);
+    pthread_mutex_destroy(&batch.lock);
+    
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].result != TINYPKG_SUCCESS) failed++;
+    }
+    return failed;
+}
+
+// Verify every cached source against its checksum sidecar. Corrupt
+// sources are removed so the next build fetches them again.
+int security_verify_cache(void) {
+    char sources_dir[MAX_PATH];
+    security_verify_job_t *jobs = NULL;
+    int count = 0, allocated = 0;
+    struct dirent *entry;
+    
+    snprintf(sources_dir, sizeof(sources_dir), "%s/sources", CACHE_DIR);
+    
+    DIR *dir = opendir(sources_dir);
+    if (!dir) {
+        log_info("No cached sources to verify");
+        return TINYPKG_SUCCESS;
+    }
+    
+    while ((entry = readdir(dir))) {
+        const char *ext = strrchr(entry->d_name, '.');
+        hash_type_t type;
+        
+        if (!ext) continue;
+        if (strcmp(ext, ".sha256") == 0) type = HASH_TYPE_SHA256;
+        else if (strcmp(ext, ".sha1") == 0) type = HASH_TYPE_SHA1;
+        else if (strcmp(ext, ".md5") == 0) type = HASH_TYPE_MD5;
+        else continue;
+        
+        char sidecar[MAX_PATH];
+        char line[512];
+        char digest[256];
+        if (snprintf(sidecar, sizeof(sidecar), "%s/%s", sources_dir, entry->d_name) >=
+            (int)sizeof(sidecar)) {
+            continue;
+        }
+        
+        FILE *fp = fopen(sidecar, "r");
+        if (!fp) continue;
+        int ok = fgets(line, sizeof(line), fp) && sscanf(line, "%255s", digest) == 1;
+        fclose(fp);
+        if (!ok) continue;
+        
+        if (count == allocated) {
+            allocated = allocated ? allocated * 2 : 64;
+            security_verify_job_t *grown = TINYPKG_REALLOC(jobs, allocated * sizeof(*jobs));
+            if (!grown) break;
+            jobs = grown;
+        }
+        
+        // The sidecar is "<file>.<type>"
+        size_t path_len = strlen(sidecar) - strlen(ext);
+        security_verify_job_t *job = &jobs[count];
+        memset(job, 0, sizeof(*job));
+        job->file_path = TINYPKG_MALLOC(path_len + 1);
+        job->expected_hash = TINYPKG_STRDUP(digest);
+        if (!job->file_path || !job->expected_hash) {
+            TINYPKG_FREE(job->file_path);
+            TINYPKG_FREE(job->expected_hash);
+            break;
+        }
+        memcpy(job->file_path, sidecar, path_len);
+        job->file_path[path_len] = '\0';
+        job->type = type;
+        count++;
+    }
+    closedir(dir);
+    
+    if (count == 0) {
+        TINYPKG_FREE(jobs);
+        log_info("No cached sources with checksums to verify");
+        return TINYPKG_SUCCESS;
+    }
+    
+    int threads = global_config ? global_config->parallel_jobs : 4;
+    log_info("Verifying %d cached sources with %d threads", count, MIN(threads, count));
+    
+    int failed = security_verify_checksums_batch(jobs, count, threads);
+    
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].result != TINYPKG_SUCCESS) {
+            log_error("Corrupt cached source removed: %s", jobs[i].file_path);
+            unlink(jobs[i].file_path);
+            
+            char sidecar[MAX_PATH];
+            snprintf(sidecar, sizeof(sidecar), "%s.%s", jobs[i].file_path,
+                     security_hash_type_to_string(jobs[i].type));
+            unlink(sidecar);
+        }
+        TINYPKG_FREE(jobs[i].file_path);
+        TINYPKG_FREE(jobs[i].expected_hash);
+    }
+    TINYPKG_FREE(jobs);
+    
+    printf("Verified %d cached sources: %d ok, %d corrupt\n", count, count - failed, failed);
+    return failed == 0 ? TINYPKG_SUCCESS : TINYPKG_ERROR;
+}
@@ -6,6 +6,8 @@
 #ifndef TINYPKG_SECURITY_H
 #define TINYPKG_SECURITY_H
 
+#include <sys/types.h>
+
 // Hash types
 typedef enum {
     HASH_TYPE_MD5 = 0,
@@ -13,6 +15,21 @@ typedef enum {
     HASH_TYPE_SHA256 = 2
 } hash_type_t;
 
+// Incremental hash state
+typedef struct security_hash {
+    void *md_ctx;               // EVP_MD_CTX
+    hash_type_t type;
+    size_t bytes;
+} security_hash_t;
+
+// Batch verification job
+typedef struct security_verify_job {
+    char *file_path;
+    char *expected_hash;
+    hash_type_t type;
+    int result;
+} security_verify_job_t;
+
 // Security context
 typedef struct security_context {
     int verify_checksums;
@@ -29,11 +46,28 @@ void security_cleanup(void);
 // Checksum verification
 int security_verify_checksum(const char *file_path, const char *expected_hash, hash_type_t type);
 int security_calculate_checksum(const char *file_path, char *hash_output, size_t hash_size, hash_type_t type);
+int security_verify_digest(const char *file_path, const char *calculated_hash,
+                           const char *expected_hash);
 hash_type_t security_detect_hash_type(const char *hash_string);
+const char *security_hash_type_to_string(hash_type_t type);
+
+// Incremental hashing
+security_hash_t *security_hash_create(hash_type_t type);
+int security_hash_reset(security_hash_t *hash);
+int security_hash_update(security_hash_t *hash, const void *data, size_t length);
+int security_hash_update_file(security_hash_t *hash, const char *file_path, off_t length);
+int security_hash_final(security_hash_t *hash, char *hash_output, size_t hash_size);
+void security_hash_free(security_hash_t *hash);
+
+// Batch verification
+int security_verify_checksums_batch(security_verify_job_t *jobs, int count, int threads);
+int security_verify_cache(void);
 
 // File integrity
 int security_verify_package_integrity(const package_t *pkg, const char *file_path);
 int security_create_checksum_file(const char *file_path, const char *checksum_path);
+int security_write_checksum_file(const char *checksum_path, const char *file_path,
+                                 const char *digest);
 
 // Basic validation
 int security_validate_path(const char *path);
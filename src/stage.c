@@ -0,0 +1,655 @@
+/*
+ * TinyPkg - Staging Implementation
+ * Merging a package's staged install tree into the live root
+ */
+
+#include "../include/tinypkg.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Inode of a staged file with more than one name
+typedef struct stage_inode
+{
+    dev_t dev;
+    ino_t ino;
+    int index;
+} stage_inode_t;
+
+// Shared state of the copy workers
+typedef struct stage_copy_job
+{
+    stage_plan_t *plan;
+    const char *root;
+    int next;
+    int failed;
+    pthread_mutex_t lock;
+} stage_copy_job_t;
+
+// Plan construction
+static int stage_plan_add(stage_plan_t *plan, const char *path,
+                          const struct stat *st)
+{
+    if (plan->entry_count == plan->entry_capacity)
+    {
+        int capacity = plan->entry_capacity ? plan->entry_capacity * 2 : 128;
+        stage_entry_t *grown =
+            TINYPKG_REALLOC(plan->entries, capacity * sizeof(stage_entry_t));
+        if (!grown)
+            return TINYPKG_ERROR_MEMORY;
+        plan->entries = grown;
+        plan->entry_capacity = capacity;
+    }
+
+    stage_entry_t *entry = &plan->entries[plan->entry_count];
+    memset(entry, 0, sizeof(*entry));
+    entry->path = TINYPKG_STRDUP(path);
+    if (!entry->path)
+        return TINYPKG_ERROR_MEMORY;
+    entry->mode = st->st_mode;
+    entry->uid = st->st_uid;
+    entry->gid = st->st_gid;
+    entry->mtime = st->st_mtim;
+    entry->link_to = -1;
+    plan->entry_count++;
+
+    if (S_ISDIR(st->st_mode))
+        return TINYPKG_SUCCESS;
+
+    if (plan->file_count == plan->file_capacity)
+    {
+        int capacity = plan->file_capacity ? plan->file_capacity * 2 : 128;
+        char **grown = TINYPKG_REALLOC(plan->files, capacity * sizeof(char *));
+        if (!grown)
+            return TINYPKG_ERROR_MEMORY;
+        plan->files = grown;
+        plan->file_capacity = capacity;
+    }
+    plan->files[plan->file_count] = TINYPKG_STRDUP(path);
+    if (!plan->files[plan->file_count])
+        return TINYPKG_ERROR_MEMORY;
+    plan->file_count++;
+    return TINYPKG_SUCCESS;
+}
+
+// Remember hardlinked files so copies keep sharing one inode
+static int stage_plan_link(stage_plan_t *plan, stage_inode_t **inodes,
+                           int *count, int *capacity, const struct stat *st)
+{
+    int index = plan->entry_count - 1;
+
+    for (int i = 0; i < *count; i++)
+    {
+        if ((*inodes)[i].dev == st->st_dev && (*inodes)[i].ino == st->st_ino)
+        {
+            plan->entries[index].link_to = (*inodes)[i].index;
+            return TINYPKG_SUCCESS;
+        }
+    }
+
+    if (*count == *capacity)
+    {
+        int grown_capacity = *capacity ? *capacity * 2 : 16;
+        stage_inode_t *grown =
+            TINYPKG_REALLOC(*inodes, grown_capacity * sizeof(stage_inode_t));
+        if (!grown)
+            return TINYPKG_ERROR_MEMORY;
+        *inodes = grown;
+        *capacity = grown_capacity;
+    }
+    (*inodes)[*count].dev = st->st_dev;
+    (*inodes)[*count].ino = st->st_ino;
+    (*inodes)[*count].index = index;
+    (*count)++;
+    return TINYPKG_SUCCESS;
+}
+
+int stage_plan_create(const char *staging_dir, stage_plan_t **plan)
+{
+    if (!staging_dir || !plan)
+        return TINYPKG_ERROR;
+
+    *plan = NULL;
+    stage_plan_t *new_plan = TINYPKG_CALLOC(1, sizeof(stage_plan_t));
+    if (!new_plan)
+        return TINYPKG_ERROR_MEMORY;
+
+    if (snprintf(new_plan->staging_dir, sizeof(new_plan->staging_dir), "%s",
+                 staging_dir) >= (int)sizeof(new_plan->staging_dir))
+    {
+        log_error("Staging directory path too long");
+        stage_plan_free(new_plan);
+        return TINYPKG_ERROR;
+    }
+
+    char *paths[] = {new_plan->staging_dir, NULL};
+    size_t prefix_len = strlen(new_plan->staging_dir);
+    FTS *tree = fts_open(paths, FTS_NOCHDIR | FTS_PHYSICAL, NULL);
+    if (!tree)
+    {
+        log_error("Cannot read staging directory %s: %s", staging_dir,
+                  strerror(errno));
+        stage_plan_free(new_plan);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    stage_inode_t *inodes = NULL;
+    int inode_count = 0;
+    int inode_capacity = 0;
+    int result = TINYPKG_SUCCESS;
+    FTSENT *node;
+
+    errno = 0;
+    while (result == TINYPKG_SUCCESS && (node = fts_read(tree)))
+    {
+        if (node->fts_level == 0)
+        {
+            if (node->fts_info != FTS_D && node->fts_info != FTS_DP)
+            {
+                log_error("Staging directory %s is not a directory",
+                          staging_dir);
+                result = TINYPKG_ERROR_FILE;
+            }
+            continue;
+        }
+
+        const char *path = node->fts_path + prefix_len;
+        switch (node->fts_info)
+        {
+        case FTS_D:
+        case FTS_SL:
+        case FTS_SLNONE:
+            result = stage_plan_add(new_plan, path, node->fts_statp);
+            break;
+        case FTS_F:
+            result = stage_plan_add(new_plan, path, node->fts_statp);
+            if (result == TINYPKG_SUCCESS && node->fts_statp->st_nlink > 1)
+            {
+                result = stage_plan_link(new_plan, &inodes, &inode_count,
+                                         &inode_capacity, node->fts_statp);
+            }
+            break;
+        case FTS_DP:
+            break;
+        case FTS_DNR:
+        case FTS_ERR:
+        case FTS_NS:
+            log_error("Cannot read staged file %s: %s", path,
+                      strerror(node->fts_errno));
+            result = TINYPKG_ERROR_FILE;
+            break;
+        default:
+            // Sockets, FIFOs and device nodes have no place in a package
+            log_warn("Skipping special file %s", path);
+            break;
+        }
+        errno = 0;
+    }
+
+    if (result == TINYPKG_SUCCESS && errno != 0)
+    {
+        log_error("Failed to walk staging directory %s: %s", staging_dir,
+                  strerror(errno));
+        result = TINYPKG_ERROR_FILE;
+    }
+
+    fts_close(tree);
+    TINYPKG_FREE(inodes);
+
+    if (result != TINYPKG_SUCCESS)
+    {
+        stage_plan_free(new_plan);
+        return result;
+    }
+
+    *plan = new_plan;
+    return TINYPKG_SUCCESS;
+}
+
+void stage_plan_free(stage_plan_t *plan)
+{
+    if (!plan)
+        return;
+
+    for (int i = 0; i < plan->entry_count; i++)
+    {
+        TINYPKG_FREE(plan->entries[i].path);
+    }
+    TINYPKG_FREE(plan->entries);
+    utils_string_array_free(plan->files, plan->file_count);
+    TINYPKG_FREE(plan);
+}
+
+// Path helpers
+static int stage_join(char *dest, size_t size, const char *root,
+                      const char *path)
+{
+    // Entry paths start with '/', so "/" joins to the path itself
+    if (strcmp(root, "/") == 0)
+        root = "";
+    return snprintf(dest, size, "%s%s", root, path) < (int)size
+               ? TINYPKG_SUCCESS
+               : TINYPKG_ERROR;
+}
+
+static int stage_temp_path(char *dest, size_t size, const char *target)
+{
+    return snprintf(dest, size, "%s%s", target, STAGE_TMP_SUFFIX) < (int)size
+               ? TINYPKG_SUCCESS
+               : TINYPKG_ERROR;
+}
+
+// Ownership is only kept when we are allowed to give it away
+static int stage_chown_allowed(int result)
+{
+    return result == 0 || errno == EPERM;
+}
+
+// Directories are merged into whatever already exists, following
+// symlinked directories such as /lib -> usr/lib
+static int stage_make_directory(const stage_entry_t *entry, const char *target)
+{
+    struct stat st;
+
+    if (stat(target, &st) == 0)
+    {
+        if (S_ISDIR(st.st_mode))
+            return TINYPKG_SUCCESS;
+        log_error("Cannot install directory %s: a file is in the way", target);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    if (mkdir(target, entry->mode & 07777) != 0 && errno != EEXIST)
+    {
+        log_error("Cannot create directory %s: %s", target, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+    if (!stage_chown_allowed(lchown(target, entry->uid, entry->gid)) ||
+        chmod(target, entry->mode & 07777) != 0)
+    {
+        log_error("Cannot set permissions of %s: %s", target, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+static int stage_copy_symlink(const stage_entry_t *entry, const char *source,
+                              const char *target)
+{
+    char link_target[MAX_PATH];
+    char temp[MAX_PATH];
+
+    ssize_t length = readlink(source, link_target, sizeof(link_target) - 1);
+    if (length < 0 || stage_temp_path(temp, sizeof(temp), target) != TINYPKG_SUCCESS)
+    {
+        log_error("Cannot read staged symlink %s", source);
+        return TINYPKG_ERROR_FILE;
+    }
+    link_target[length] = '\0';
+
+    unlink(temp);
+    if (symlink(link_target, temp) != 0)
+    {
+        log_error("Cannot create symlink %s: %s", target, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+    if (!stage_chown_allowed(lchown(temp, entry->uid, entry->gid)) ||
+        rename(temp, target) != 0)
+    {
+        log_error("Cannot install symlink %s: %s", target, strerror(errno));
+        unlink(temp);
+        return TINYPKG_ERROR_FILE;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+// Copy file data, sharing extents where the filesystem allows it
+static int stage_copy_data(int in, int out, off_t size, int *cloned)
+{
+    char buffer[128 * 1024];
+    off_t remaining = size;
+
+#ifdef FICLONE
+    if (ioctl(out, FICLONE, in) == 0)
+    {
+        *cloned = 1;
+        return TINYPKG_SUCCESS;
+    }
+#endif
+
+    // In-kernel copy; may still reflink on filesystems without FICLONE
+    while (remaining > 0)
+    {
+        ssize_t n = copy_file_range(in, NULL, out, NULL, (size_t)remaining, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && remaining == size &&
+            (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+             errno == EOPNOTSUPP))
+            break;
+        if (n < 0)
+            return TINYPKG_ERROR_FILE;
+        if (n == 0)
+            return TINYPKG_SUCCESS;
+        remaining -= n;
+    }
+    if (remaining == 0)
+        return TINYPKG_SUCCESS;
+
+    for (;;)
+    {
+        ssize_t n = read(in, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return TINYPKG_ERROR_FILE;
+        if (n == 0)
+            return TINYPKG_SUCCESS;
+
+        for (ssize_t done = 0; done < n;)
+        {
+            ssize_t w = write(out, buffer + done, (size_t)(n - done));
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w < 0)
+                return TINYPKG_ERROR_FILE;
+            done += w;
+        }
+    }
+}
+
+// Write a file under a temporary name next to its target and rename it
+// into place, so nothing ever runs a half-written binary
+static int stage_copy_file(const stage_entry_t *entry, const char *source,
+                           const char *target, int *cloned)
+{
+    char temp[MAX_PATH];
+    struct stat st;
+    int result = TINYPKG_ERROR_FILE;
+
+    *cloned = 0;
+    if (stage_temp_path(temp, sizeof(temp), target) != TINYPKG_SUCCESS)
+    {
+        log_error("Path too long: %s", target);
+        return TINYPKG_ERROR;
+    }
+
+    int in = open(source, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (in < 0 || fstat(in, &st) != 0)
+    {
+        log_error("Cannot read staged file %s: %s", source, strerror(errno));
+        if (in >= 0)
+            close(in);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    unlink(temp);
+    int out = open(temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC | O_NOFOLLOW,
+                   0600);
+    if (out < 0)
+    {
+        log_error("Cannot create %s: %s", temp, strerror(errno));
+        close(in);
+        return TINYPKG_ERROR_FILE;
+    }
+
+    struct timespec times[2] = {{0, UTIME_OMIT}, entry->mtime};
+    if (stage_copy_data(in, out, st.st_size, cloned) != TINYPKG_SUCCESS)
+    {
+        log_error("Cannot copy %s: %s", target, strerror(errno));
+    }
+    // chown clears set-id bits, so the mode goes on afterwards
+    else if (!stage_chown_allowed(fchown(out, entry->uid, entry->gid)) ||
+             fchmod(out, entry->mode & 07777) != 0 ||
+             futimens(out, times) != 0)
+    {
+        log_error("Cannot set attributes of %s: %s", target, strerror(errno));
+    }
+    else
+    {
+        result = TINYPKG_SUCCESS;
+    }
+
+    close(in);
+    if (close(out) != 0 && result == TINYPKG_SUCCESS)
+    {
+        log_error("Cannot write %s: %s", target, strerror(errno));
+        result = TINYPKG_ERROR_FILE;
+    }
+
+    if (result == TINYPKG_SUCCESS && rename(temp, target) != 0)
+    {
+        log_error("Cannot install %s: %s", target, strerror(errno));
+        result = TINYPKG_ERROR_FILE;
+    }
+    if (result != TINYPKG_SUCCESS)
+        unlink(temp);
+    return result;
+}
+
+// Give a hardlinked file the inode its first name was copied to
+static int stage_link_file(const stage_plan_t *plan, const stage_entry_t *entry,
+                           const char *root, const char *source,
+                           const char *target, int *cloned)
+{
+    char first[MAX_PATH];
+    char temp[MAX_PATH];
+
+    *cloned = 0;
+    if (stage_join(first, sizeof(first), root,
+                   plan->entries[entry->link_to].path) == TINYPKG_SUCCESS &&
+        stage_temp_path(temp, sizeof(temp), target) == TINYPKG_SUCCESS)
+    {
+        unlink(temp);
+        if (link(first, temp) == 0)
+        {
+            if (rename(temp, target) == 0)
+                return TINYPKG_SUCCESS;
+            unlink(temp);
+        }
+    }
+
+    // Different filesystems below root; fall back to a separate copy
+    return stage_copy_file(entry, source, target, cloned);
+}
+
+static int stage_install_pending(stage_plan_t *plan, int index,
+                                 const char *root, int *cloned)
+{
+    char source[MAX_PATH];
+    char target[MAX_PATH];
+    const stage_entry_t *entry = &plan->entries[index];
+
+    if (stage_join(source, sizeof(source), plan->staging_dir, entry->path) !=
+            TINYPKG_SUCCESS ||
+        stage_join(target, sizeof(target), root, entry->path) != TINYPKG_SUCCESS)
+    {
+        log_error("Path too long: %s", entry->path);
+        return TINYPKG_ERROR;
+    }
+
+    if (entry->link_to >= 0)
+        return stage_link_file(plan, entry, root, source, target, cloned);
+    return stage_copy_file(entry, source, target, cloned);
+}
+
+static void *stage_copy_worker(void *arg)
+{
+    stage_copy_job_t *job = arg;
+    stage_plan_t *plan = job->plan;
+
+    for (;;)
+    {
+        int index = -1;
+        int cloned = 0;
+
+        pthread_mutex_lock(&job->lock);
+        while (!job->failed && job->next < plan->entry_count)
+        {
+            const stage_entry_t *entry = &plan->entries[job->next++];
+            if (entry->pending && entry->link_to < 0)
+            {
+                index = (int)(entry - plan->entries);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        if (index < 0)
+            break;
+
+        int result = stage_install_pending(plan, index, job->root, &cloned);
+
+        pthread_mutex_lock(&job->lock);
+        if (result != TINYPKG_SUCCESS)
+        {
+            job->failed = 1;
+        }
+        else if (cloned)
+        {
+            plan->cloned++;
+        }
+        else
+        {
+            plan->copied++;
+        }
+        pthread_mutex_unlock(&job->lock);
+    }
+    return NULL;
+}
+
+// Copy the files that could not be moved, first names in parallel and
+// then the hardlinks that point at them
+static int stage_copy_pending(stage_plan_t *plan, const char *root,
+                              int pending, int threads)
+{
+    stage_copy_job_t job = {
+        .plan = plan,
+        .root = root,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+    pthread_t workers[STAGE_MAX_COPY_THREADS];
+    int started = 0;
+
+    threads = MAX(1, MIN(MIN(threads, pending), STAGE_MAX_COPY_THREADS));
+    for (int i = 1; i < threads; i++)
+    {
+        if (pthread_create(&workers[started], NULL, stage_copy_worker, &job) != 0)
+            break;
+        started++;
+    }
+    stage_copy_worker(&job);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+
+    if (job.failed)
+        return TINYPKG_ERROR_FILE;
+
+    for (int i = 0; i < plan->entry_count; i++)
+    {
+        int cloned = 0;
+        if (!plan->entries[i].pending || plan->entries[i].link_to < 0)
+            continue;
+        if (stage_install_pending(plan, i, root, &cloned) != TINYPKG_SUCCESS)
+            return TINYPKG_ERROR_FILE;
+        if (cloned)
+            plan->cloned++;
+        else
+            plan->copied++;
+    }
+    return TINYPKG_SUCCESS;
+}
+
+int stage_plan_commit(stage_plan_t *plan, const char *root, int move,
+                      int threads)
+{
+    char source[MAX_PATH];
+    char target[MAX_PATH];
+    struct stat staging_st;
+    struct stat root_st;
+    int pending = 0;
+
+    if (!plan || !root)
+        return TINYPKG_ERROR;
+
+    if (stat(plan->staging_dir, &staging_st) != 0 || stat(root, &root_st) != 0)
+    {
+        log_error("Cannot access %s: %s", root, strerror(errno));
+        return TINYPKG_ERROR_FILE;
+    }
+
+    // Renaming empties the staging tree, so only do it when both are on
+    // one filesystem; mounts below root still report EXDEV per file
+    move = move && staging_st.st_dev == root_st.st_dev;
+    plan->moved = plan->cloned = plan->copied = 0;
+
+    // Directories and symlinks in order, moving whatever files we can
+    for (int i = 0; i < plan->entry_count; i++)
+    {
+        stage_entry_t *entry = &plan->entries[i];
+
+        entry->pending = 0;
+        if (stage_join(source, sizeof(source), plan->staging_dir, entry->path) !=
+                TINYPKG_SUCCESS ||
+            stage_join(target, sizeof(target), root, entry->path) !=
+                TINYPKG_SUCCESS)
+        {
+            log_error("Path too long: %s", entry->path);
+            return TINYPKG_ERROR;
+        }
+
+        if (S_ISDIR(entry->mode))
+        {
+            if (stage_make_directory(entry, target) != TINYPKG_SUCCESS)
+                return TINYPKG_ERROR_FILE;
+            continue;
+        }
+
+        if (move)
+        {
+            if (rename(source, target) == 0)
+            {
+                plan->moved++;
+                continue;
+            }
+            if (errno != EXDEV)
+            {
+                log_error("Cannot install %s: %s", target, strerror(errno));
+                return TINYPKG_ERROR_FILE;
+            }
+        }
+
+        if (S_ISLNK(entry->mode))
+        {
+            if (stage_copy_symlink(entry, source, target) != TINYPKG_SUCCESS)
+                return TINYPKG_ERROR_FILE;
+            plan->copied++;
+            continue;
+        }
+
+        entry->pending = 1;
+        pending++;
+    }
+
+    if (pending > 0 &&
+        stage_copy_pending(plan, root, pending, threads) != TINYPKG_SUCCESS)
+    {
+        return TINYPKG_ERROR_FILE;
+    }
+
+    log_debug("Installed %d entries from %s: %d moved, %d reflinked, %d copied",
+              plan->entry_count, plan->staging_dir, plan->moved, plan->cloned,
+              plan->copied);
+    return TINYPKG_SUCCESS;
+}
@@ -0,0 +1,59 @@
+/*
+ * TinyPkg - Staging Header
+ * Merging a package's staged install tree into the live root
+ */
+
+#ifndef TINYPKG_STAGE_H
+#define TINYPKG_STAGE_H
+
+#include <sys/types.h>
+#include <time.h>
+
+// Most threads used to copy files across filesystems
+#define STAGE_MAX_COPY_THREADS 8
+
+// Suffix of the temporary name a file is written under before it is
+// renamed over its destination
+#define STAGE_TMP_SUFFIX ".tinypkg-new"
+
+// One directory, file or symlink of the staging tree
+typedef struct stage_entry {
+    char *path;               // Absolute path below the target root
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    struct timespec mtime;
+    int link_to;              // Earlier entry this file is a hardlink of, or -1
+    int pending;              // Still has to be copied
+} stage_entry_t;
+
+// Everything the staging tree installs, in pre-order
+typedef struct stage_plan {
+    char staging_dir[MAX_PATH];
+    stage_entry_t *entries;
+    int entry_count;
+    int entry_capacity;
+
+    // Files and symlinks only; becomes LIB_DIR/<pkg>.files
+    char **files;
+    int file_count;
+    int file_capacity;
+
+    // How the commit went
+    int moved;
+    int cloned;
+    int copied;
+} stage_plan_t;
+
+// Function declarations
+
+// Walk the staging tree once
+int stage_plan_create(const char *staging_dir, stage_plan_t **plan);
+void stage_plan_free(stage_plan_t *plan);
+
+// Install the planned entries below root. With move set, files are
+// renamed out of the staging tree when it shares a filesystem with root;
+// otherwise they are reflinked, or copied on up to threads workers.
+int stage_plan_commit(stage_plan_t *plan, const char *root, int move, int threads);
+
+#endif /* TINYPKG_STAGE_H */
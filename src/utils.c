@@ -8,7 +8,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
+#include <spawn.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
@@ -136,6 +138,27 @@ int utils_remove_directory_recursive(const char *path) {
     return result;
 }
 
+int utils_get_directory_size(const char *path, size_t *total_size) {
+    if (!path || !total_size) return TINYPKG_ERROR;
+    
+    char *paths[] = {(char *)path, NULL};
+    FTS *tree = fts_open(paths, FTS_NOCHDIR | FTS_PHYSICAL, NULL);
+    if (!tree) return TINYPKG_ERROR;
+    
+    FTSENT *node;
+    size_t size = 0;
+    
+    while ((node = fts_read(tree))) {
+        if (node->fts_info == FTS_F && node->fts_statp) {
+            size += (size_t)node->fts_statp->st_size;
+        }
+    }
+    
+    fts_close(tree);
+    *total_size = size;
+    return TINYPKG_SUCCESS;
+}
+
 int utils_directory_exists(const char *path) {
     struct stat st;
     return (stat(path, &st) == 0 && S_ISDIR(st.st_mode));
@@ -146,6 +169,26 @@ int utils_file_exists(const char *path) {
     return (stat(path, &st) == 0 && S_ISREG(st.st_mode));
 }
 
+// Check whether an executable is reachable through PATH
+int utils_find_program(const char *name) {
+    const char *path = getenv("PATH");
+    char candidate[MAX_PATH];
+    
+    if (!name || !*name) return 0;
+    if (!path || !*path) path = "/usr/local/bin:/usr/bin:/bin";
+    
+    while (*path) {
+        size_t length = strcspn(path, ":");
+        if (length > 0 && length + strlen(name) + 2 <= sizeof(candidate)) {
+            snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)length, path, name);
+            if (access(candidate, X_OK) == 0) return 1;
+        }
+        path += length;
+        if (*path == ':') path++;
+    }
+    return 0;
+}
+
 int utils_copy_file(const char *src, const char *dest) {
     if (!src || !dest) return TINYPKG_ERROR;
     
@@ -328,42 +371,123 @@ char *utils_get_dirname(const char *path) {
 }
 
 // Command execution
-int utils_run_command(const char *cmd, const char *work_dir) {
-    if (!cmd) return TINYPKG_ERROR;
+static void utils_record_command(const char *cmd, int64_t start_us, int succeeded) {
+    int64_t end_us = metrics_now_us();
     
-    log_debug("Executing command: %s", cmd);
+    metrics_add(METRICS_PROCESS_SPAWNS, 1);
+    if (!succeeded) {
+        metrics_add(METRICS_PROCESS_FAILURES, 1);
+    }
+    metrics_observe(METRICS_PROCESS_SECONDS, (end_us - start_us) / 1e6);
+    metrics_trace_span("process", "exec", cmd, start_us, end_us);
+}
+
+int utils_run_command(const char *cmd, const char *work_dir) {
+    return utils_run_command_usage(cmd, work_dir, NULL);
+}
+
+// As utils_run_command; usage (if given) receives the resources used by
+// the command and every descendant it waited for
+int utils_run_command_usage(const char *cmd, const char *work_dir,
+                            struct rusage *usage) {
+    return utils_run_command_redirect(cmd, work_dir, -1, usage);
+}
+
+// Start /bin/sh -c cmd in work_dir with posix_spawn, which does not copy
+// our address space the way fork does. stdout and stderr go to output_fd
+// unless it is -1; null_stdin reads stdin from /dev/null.
+static int utils_spawn_shell(const char *cmd, const char *work_dir, int output_fd,
+                             int null_stdin, pid_t *pid) {
+    posix_spawn_file_actions_t actions;
+    char *argv[] = {"sh", "-c", (char *)cmd, NULL};
+    
+    int result = posix_spawn_file_actions_init(&actions);
+    if (result != 0) {
+        log_error("Failed to start command: %s", strerror(result));
+        return TINYPKG_ERROR;
+    }
     
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child process
-        if (work_dir && chdir(work_dir) != 0) {
-            log_error("Failed to change directory to %s: %s", work_dir, strerror(errno));
-            exit(1);
-        }
-        
-        execl("/bin/sh", "sh", "-c", cmd, NULL);
-        log_error("Failed to execute command: %s", strerror(errno));
-        exit(1);
-    } else if (pid > 0) {
-        // Parent process
-        int status;
-        if (waitpid(pid, &status, 0) == -1) {
-            log_error("Failed to wait for child process: %s", strerror(errno));
-            return TINYPKG_ERROR;
+    if (work_dir) {
+        result = posix_spawn_file_actions_addchdir_np(&actions, work_dir);
+    }
+    if (result == 0 && null_stdin) {
+        result = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                                  O_RDONLY, 0);
+    }
+    if (result == 0 && output_fd >= 0) {
+        result = posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+        if (result == 0) {
+            result = posix_spawn_file_actions_adddup2(&actions, output_fd, STDERR_FILENO);
         }
-        
-        if (WIFEXITED(status)) {
-            int exit_code = WEXITSTATUS(status);
-            log_debug("Command exited with code: %d", exit_code);
-            return (exit_code == 0) ? TINYPKG_SUCCESS : TINYPKG_ERROR;
+    }
+    if (result == 0) {
+        result = posix_spawn(pid, "/bin/sh", &actions, NULL, argv, environ);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    
+    if (result != 0) {
+        if (work_dir) {
+            log_error("Failed to execute command in %s: %s", work_dir, strerror(result));
         } else {
-            log_error("Command terminated abnormally");
-            return TINYPKG_ERROR;
+            log_error("Failed to execute command: %s", strerror(result));
         }
-    } else {
-        log_error("Failed to fork process: %s", strerror(errno));
         return TINYPKG_ERROR;
     }
+    return TINYPKG_SUCCESS;
+}
+
+// Reap a command started at start_us and record it. Succeeds with its exit
+// code when it exited normally; usage (if given) receives the resources
+// used by the command and every descendant it waited for.
+int utils_wait_command(const char *cmd, pid_t pid, int64_t start_us,
+                       int *exit_code, struct rusage *usage) {
+    int status;
+    struct rusage child_usage;
+    pid_t waited;
+    
+    *exit_code = -1;
+    do {
+        waited = wait4(pid, &status, 0, &child_usage);
+    } while (waited == -1 && errno == EINTR);
+    if (waited == -1) {
+        log_error("Failed to wait for child process: %s", strerror(errno));
+        utils_record_command(cmd, start_us, 0);
+        return TINYPKG_ERROR;
+    }
+    if (usage) {
+        *usage = child_usage;
+    }
+    
+    if (!WIFEXITED(status)) {
+        utils_record_command(cmd, start_us, 0);
+        return TINYPKG_ERROR;
+    }
+    *exit_code = WEXITSTATUS(status);
+    utils_record_command(cmd, start_us, *exit_code == 0);
+    return TINYPKG_SUCCESS;
+}
+
+// As utils_run_command_usage, with stdout and stderr sent to output_fd and
+// stdin from /dev/null when output_fd is not -1
+int utils_run_command_redirect(const char *cmd, const char *work_dir,
+                               int output_fd, struct rusage *usage) {
+    if (!cmd) return TINYPKG_ERROR;
+    
+    log_debug("Executing command: %s", cmd);
+    
+    int64_t start_us = metrics_now_us();
+    pid_t pid;
+    if (utils_spawn_shell(cmd, work_dir, output_fd, output_fd >= 0, &pid) != TINYPKG_SUCCESS) {
+        return TINYPKG_ERROR;
+    }
+    
+    int exit_code;
+    if (utils_wait_command(cmd, pid, start_us, &exit_code, usage) != TINYPKG_SUCCESS) {
+        log_error("Command terminated abnormally");
+        return TINYPKG_ERROR;
+    }
+    log_debug("Command exited with code: %d", exit_code);
+    return (exit_code == 0) ? TINYPKG_SUCCESS : TINYPKG_ERROR;
 }
 
 int utils_run_command_with_output(const char *cmd, const char *work_dir, 
@@ -374,91 +498,64 @@ int utils_run_command_with_output(const char *cmd, const char *work_dir,
     *exit_code = -1;
     
     int pipefd[2];
-    if (pipe(pipefd) == -1) {
+    if (pipe2(pipefd, O_CLOEXEC) == -1) {
         log_error("Failed to create pipe: %s", strerror(errno));
         return TINYPKG_ERROR;
     }
     
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child process
-        close(pipefd[0]); // Close read end
-        dup2(pipefd[1], STDOUT_FILENO);
-        dup2(pipefd[1], STDERR_FILENO);
-        close(pipefd[1]);
-        
-        if (work_dir && chdir(work_dir) != 0) {
-            fprintf(stderr, "Failed to change directory to %s: %s\n", 
-                    work_dir, strerror(errno));
-            exit(1);
-        }
-        
-        execl("/bin/sh", "sh", "-c", cmd, NULL);
-        fprintf(stderr, "Failed to execute command: %s\n", strerror(errno));
-        exit(1);
-    } else if (pid > 0) {
-        // Parent process
-        close(pipefd[1]); // Close write end
-        
-        // Read output
-        char buffer[4096];
-        size_t total_size = 0;
-        size_t buffer_size = 4096;
-        *output = TINYPKG_MALLOC(buffer_size);
-        
-        if (!*output) {
-            close(pipefd[0]);
-            waitpid(pid, NULL, 0);
-            return TINYPKG_ERROR_MEMORY;
-        }
-        
-        (*output)[0] = '\0';
-        
-        ssize_t bytes_read;
-        while ((bytes_read = read(pipefd[0], buffer, sizeof(buffer) - 1)) > 0) {
-            buffer[bytes_read] = '\0';
-            
-            size_t needed = total_size + bytes_read + 1;
-            if (needed > buffer_size) {
-                buffer_size = needed * 2;
-                char *new_output = TINYPKG_REALLOC(*output, buffer_size);
-                if (!new_output) {
-                    TINYPKG_FREE(*output);
-                    *output = NULL;
-                    close(pipefd[0]);
-                    waitpid(pid, NULL, 0);
-                    return TINYPKG_ERROR_MEMORY;
-                }
-                *output = new_output;
-            }
-            
-            strcat(*output, buffer);
-            total_size += bytes_read;
-        }
-        
+    int64_t start_us = metrics_now_us();
+    pid_t pid;
+    int spawned = utils_spawn_shell(cmd, work_dir, pipefd[1], 0, &pid);
+    close(pipefd[1]); // Only the child writes
+    if (spawned != TINYPKG_SUCCESS) {
         close(pipefd[0]);
+        return TINYPKG_ERROR;
+    }
+    
+    // Read output
+    char buffer[4096];
+    size_t total_size = 0;
+    size_t buffer_size = 4096;
+    *output = TINYPKG_MALLOC(buffer_size);
+    
+    if (!*output) {
+        close(pipefd[0]);
+        waitpid(pid, NULL, 0);
+        return TINYPKG_ERROR_MEMORY;
+    }
+    
+    (*output)[0] = '\0';
+    
+    ssize_t bytes_read;
+    while ((bytes_read = read(pipefd[0], buffer, sizeof(buffer) - 1)) > 0) {
+        buffer[bytes_read] = '\0';
         
-        int status;
-        if (waitpid(pid, &status, 0) == -1) {
-            log_error("Failed to wait for child process: %s", strerror(errno));
-            TINYPKG_FREE(*output);
-            *output = NULL;
-            return TINYPKG_ERROR;
+        size_t needed = total_size + bytes_read + 1;
+        if (needed > buffer_size) {
+            buffer_size = needed * 2;
+            char *new_output = TINYPKG_REALLOC(*output, buffer_size);
+            if (!new_output) {
+                TINYPKG_FREE(*output);
+                *output = NULL;
+                close(pipefd[0]);
+                waitpid(pid, NULL, 0);
+                return TINYPKG_ERROR_MEMORY;
+            }
+            *output = new_output;
         }
         
-        if (WIFEXITED(status)) {
-            *exit_code = WEXITSTATUS(status);
-            return TINYPKG_SUCCESS;
-        } else {
-            *exit_code = -1;
-            return TINYPKG_ERROR;
-        }
-    } else {
-        log_error("Failed to fork process: %s", strerror(errno));
-        close(pipefd[0]);
-        close(pipefd[1]);
+        memcpy(*output + total_size, buffer, bytes_read + 1);
+        total_size += bytes_read;
+    }
+    
+    close(pipefd[0]);
+    
+    if (utils_wait_command(cmd, pid, start_us, exit_code, NULL) != TINYPKG_SUCCESS) {
+        TINYPKG_FREE(*output);
+        *output = NULL;
         return TINYPKG_ERROR;
     }
+    return TINYPKG_SUCCESS;
 }
 
 // Progress display
@@ -601,3 +698,18 @@ char *utils_get_timestamp_string(void) {
     strftime(buffer, 64, "%Y-%m-%d %H:%M:%S", tm_info);
     return buffer;
 }
+
+// FNV-1a hashing
+uint32_t utils_hash_bytes(uint32_t hash, const void *data, size_t length) {
+    const unsigned char *p = (const unsigned char *)data;
+    
+    for (size_t i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+uint32_t utils_hash_string(const char *str) {
+    return str ? utils_hash_bytes(UTILS_FNV_SEED, str, strlen(str)) : UTILS_FNV_SEED;
+}
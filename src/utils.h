@@ -6,9 +6,11 @@
 #ifndef TINYPKG_UTILS_H
 #define TINYPKG_UTILS_H
 
+#include <stdint.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <fts.h>
+#include <sys/resource.h>
 
 // Directory operations
 int utils_init_directories(void);
@@ -22,6 +24,7 @@ int utils_clean_cache(void);
 // File operations
 int utils_file_exists(const char *path);
 int utils_is_file(const char *path);
+int utils_find_program(const char *name);
 int utils_copy_file(const char *src, const char *dest);
 int utils_move_file(const char *src, const char *dest);
 int utils_remove_file(const char *path);
@@ -50,8 +53,14 @@ char *utils_string_join(char **array, int count, const char *separator);
 
 // Command execution
 int utils_run_command(const char *cmd, const char *work_dir);
+int utils_run_command_usage(const char *cmd, const char *work_dir,
+                            struct rusage *usage);
+int utils_run_command_redirect(const char *cmd, const char *work_dir,
+                               int output_fd, struct rusage *usage);
 int utils_run_command_with_output(const char *cmd, const char *work_dir, 
                                  char **output, int *exit_code);
+int utils_wait_command(const char *cmd, pid_t pid, int64_t start_us,
+                       int *exit_code, struct rusage *usage);
 int utils_run_command_async(const char *cmd, const char *work_dir, pid_t *pid);
 int utils_wait_for_process(pid_t pid, int *exit_code);
 int utils_kill_process(pid_t pid, int signal);
@@ -72,6 +81,11 @@ int utils_calculate_sha256(const char *file_path, char *hash_str, size_t hash_si
 int utils_calculate_md5(const char *file_path, char *hash_str, size_t hash_size);
 int utils_verify_checksum(const char *file_path, const char *expected_hash, const char *type);
 
+// FNV-1a for in-memory and on-disk hash tables (pass UTILS_FNV_SEED to start)
+#define UTILS_FNV_SEED 2166136261U
+uint32_t utils_hash_bytes(uint32_t hash, const void *data, size_t length);
+uint32_t utils_hash_string(const char *str);
+
 // System information
 typedef struct system_info {
     char hostname[256];
@@ -0,0 +1,768 @@
+/*
+ * TinyPkg - File Verification Implementation
+ * Parallel integrity checks and removal over installed file manifests
+ */
+
+#include "../include/tinypkg.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define VERIFY_HASH_BUFFER (256 * 1024)
+#define VERIFY_DIGEST_SIZE 65
+
+#define VERIFY_COUNT(result, field) \
+    __atomic_add_fetch(&(result)->field, 1, __ATOMIC_RELAXED)
+
+// One file to check, hash or remove
+typedef struct verify_item
+{
+    const char *path;
+    char *digest;                   // Expected sum, or where to store one
+    int package;                    // Index into the results
+} verify_item_t;
+
+// Recorded sum of one file
+typedef struct verify_sum
+{
+    char *path;
+    char digest[VERIFY_DIGEST_SIZE];
+} verify_sum_t;
+
+// Shared state of the workers
+typedef struct verify_job
+{
+    verify_mode_t mode;
+    int record;                     // Compute sums instead of comparing them
+    verify_item_t *items;
+    int count;
+    int next;
+    verify_result_t *results;
+} verify_job_t;
+
+// Per-worker state; the directory of the previous file stays open
+typedef struct verify_worker
+{
+    verify_job_t *job;
+    int dir_fd;
+    int dir_error;
+    char dir[MAX_PATH];
+    security_hash_t *hash;
+    unsigned char *buffer;
+} verify_worker_t;
+
+// Directory cache
+static const char *verify_enter_dir(verify_worker_t *worker, const char *path, int *error)
+{
+    const char *slash = strrchr(path, '/');
+    size_t length;
+
+    if (!slash)
+    {
+        *error = EINVAL;
+        return NULL;
+    }
+
+    // The root directory keeps its slash
+    length = slash == path ? 1 : (size_t)(slash - path);
+    if (length >= sizeof(worker->dir))
+    {
+        *error = ENAMETOOLONG;
+        return NULL;
+    }
+
+    if (strlen(worker->dir) != length || memcmp(worker->dir, path, length) != 0)
+    {
+        if (worker->dir_fd >= 0)
+        {
+            close(worker->dir_fd);
+        }
+        memcpy(worker->dir, path, length);
+        worker->dir[length] = '\0';
+        worker->dir_fd = open(worker->dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        worker->dir_error = worker->dir_fd < 0 ? errno : 0;
+    }
+
+    if (worker->dir_error)
+    {
+        *error = worker->dir_error;
+        return NULL;
+    }
+    return slash + 1;
+}
+
+static int verify_stat(int dir_fd, const char *name, mode_t *mode)
+{
+#ifdef STATX_TYPE
+    // Only the file type is needed; skip attributes the kernel has to fetch
+    struct statx stx;
+    if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE, &stx) != 0)
+    {
+        return -1;
+    }
+    *mode = stx.stx_mode;
+#else
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        return -1;
+    }
+    *mode = st.st_mode;
+#endif
+    return 0;
+}
+
+static int verify_hash_file(verify_worker_t *worker, const char *name,
+                            char *digest, size_t digest_size)
+{
+    int fd = openat(worker->dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    int result = TINYPKG_SUCCESS;
+    ssize_t n;
+
+    if (fd < 0)
+    {
+        return TINYPKG_ERROR_FILE;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (security_hash_reset(worker->hash) != TINYPKG_SUCCESS)
+    {
+        close(fd);
+        return TINYPKG_ERROR;
+    }
+
+    while ((n = read(fd, worker->buffer, VERIFY_HASH_BUFFER)) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            result = TINYPKG_ERROR_FILE;
+            break;
+        }
+        if (security_hash_update(worker->hash, worker->buffer, (size_t)n) != TINYPKG_SUCCESS)
+        {
+            result = TINYPKG_ERROR;
+            break;
+        }
+    }
+    close(fd);
+
+    if (result == TINYPKG_SUCCESS)
+    {
+        result = security_hash_final(worker->hash, digest, digest_size);
+    }
+    return result;
+}
+
+// Workers
+static void verify_item(verify_worker_t *worker, verify_item_t *item)
+{
+    verify_job_t *job = worker->job;
+    verify_result_t *result = &job->results[item->package];
+    char digest[VERIFY_DIGEST_SIZE];
+    int error = 0;
+    mode_t mode;
+
+    const char *name = verify_enter_dir(worker, item->path, &error);
+
+    if (job->mode == VERIFY_MODE_REMOVE)
+    {
+        if (name && unlinkat(worker->dir_fd, name, 0) == 0)
+        {
+            return;
+        }
+        error = name ? errno : error;
+        if (error == ENOENT || error == ENOTDIR)
+        {
+            VERIFY_COUNT(result, missing);
+            return;
+        }
+        log_warn("Failed to remove file: %s (%s)", item->path, strerror(error));
+        VERIFY_COUNT(result, errors);
+        return;
+    }
+
+    if (!name || verify_stat(worker->dir_fd, name, &mode) != 0)
+    {
+        error = name ? errno : error;
+        if (error == ENOENT || error == ENOTDIR)
+        {
+            if (!job->record)
+            {
+                log_warn("Missing file: %s", item->path);
+            }
+            VERIFY_COUNT(result, missing);
+        }
+        else
+        {
+            log_warn("Cannot check %s: %s", item->path, strerror(error));
+            VERIFY_COUNT(result, errors);
+        }
+        return;
+    }
+
+    if (job->record)
+    {
+        item->digest[0] = '\0';
+        if (S_ISREG(mode) &&
+            verify_hash_file(worker, name, item->digest, VERIFY_DIGEST_SIZE) != TINYPKG_SUCCESS)
+        {
+            item->digest[0] = '\0';
+            VERIFY_COUNT(result, errors);
+        }
+        return;
+    }
+
+    if (job->mode != VERIFY_MODE_CHECKSUMS)
+    {
+        return;
+    }
+
+    if (!S_ISREG(mode))
+    {
+        // A recorded sum means this was a regular file when installed
+        if (item->digest)
+        {
+            log_warn("No longer a regular file: %s", item->path);
+            VERIFY_COUNT(result, modified);
+        }
+        return;
+    }
+
+    if (!item->digest)
+    {
+        VERIFY_COUNT(result, unchecked);
+        return;
+    }
+
+    if (verify_hash_file(worker, name, digest, sizeof(digest)) != TINYPKG_SUCCESS)
+    {
+        log_warn("Cannot read %s: %s", item->path, strerror(errno));
+        VERIFY_COUNT(result, errors);
+    }
+    else if (strcmp(digest, item->digest) != 0)
+    {
+        log_warn("Modified file: %s", item->path);
+        VERIFY_COUNT(result, modified);
+    }
+}
+
+static void *verify_worker(void *arg)
+{
+    verify_worker_t worker;
+    verify_job_t *job = (verify_job_t *)arg;
+
+    memset(&worker, 0, sizeof(worker));
+    worker.job = job;
+    worker.dir_fd = -1;
+
+    if (job->record || job->mode == VERIFY_MODE_CHECKSUMS)
+    {
+        worker.hash = security_hash_create(HASH_TYPE_SHA256);
+        worker.buffer = TINYPKG_MALLOC(VERIFY_HASH_BUFFER);
+        if (!worker.hash || !worker.buffer)
+        {
+            // Leave the files to the other workers
+            security_hash_free(worker.hash);
+            TINYPKG_FREE(worker.buffer);
+            return NULL;
+        }
+    }
+
+    for (;;)
+    {
+        int start = __atomic_fetch_add(&job->next, VERIFY_CHUNK, __ATOMIC_RELAXED);
+        if (start >= job->count)
+        {
+            break;
+        }
+
+        int end = MIN(start + VERIFY_CHUNK, job->count);
+        for (int i = start; i < end; i++)
+        {
+            verify_item(&worker, &job->items[i]);
+        }
+    }
+
+    if (worker.dir_fd >= 0)
+    {
+        close(worker.dir_fd);
+    }
+    security_hash_free(worker.hash);
+    TINYPKG_FREE(worker.buffer);
+    return (void *)1;
+}
+
+static int verify_default_threads(const verify_job_t *job)
+{
+    int cpus = MAX(config_detect_cpu_count(), 1);
+
+    // Hashing is bound by the CPU, metadata lookups by device latency
+    if (job->record || job->mode == VERIFY_MODE_CHECKSUMS)
+    {
+        return cpus;
+    }
+    return cpus * VERIFY_STAT_THREADS_PER_CPU;
+}
+
+static int verify_run(verify_job_t *job, int threads)
+{
+    pthread_t workers[VERIFY_MAX_THREADS];
+    int started = 0;
+    int finished = 0;
+
+    if (threads <= 0)
+    {
+        threads = verify_default_threads(job);
+    }
+    threads = MIN(threads, VERIFY_MAX_THREADS);
+    threads = MIN(threads, (job->count + VERIFY_CHUNK - 1) / VERIFY_CHUNK);
+
+    job->next = 0;
+    for (int i = 1; i < threads; i++)
+    {
+        if (pthread_create(&workers[started], NULL, verify_worker, job) != 0)
+        {
+            log_warn("Failed to start verification worker: %s", strerror(errno));
+            break;
+        }
+        started++;
+    }
+
+    // The calling thread works too
+    if (verify_worker(job))
+    {
+        finished++;
+    }
+    for (int i = 0; i < started; i++)
+    {
+        void *ret = NULL;
+        pthread_join(workers[i], &ret);
+        if (ret)
+        {
+            finished++;
+        }
+    }
+
+    return (finished > 0 || job->count == 0) ? TINYPKG_SUCCESS : TINYPKG_ERROR_MEMORY;
+}
+
+static int verify_compare_items(const void *a, const void *b)
+{
+    return strcmp(((const verify_item_t *)a)->path, ((const verify_item_t *)b)->path);
+}
+
+// Recorded sums
+static void verify_sums_path(char *path, size_t size, const char *package_name)
+{
+    snprintf(path, size, "%s/%s%s", LIB_DIR, package_name, VERIFY_SUMS_SUFFIX);
+}
+
+static int verify_compare_sums(const void *a, const void *b)
+{
+    return strcmp(((const verify_sum_t *)a)->path, ((const verify_sum_t *)b)->path);
+}
+
+static void verify_free_sums(verify_sum_t *sums, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        TINYPKG_FREE(sums[i].path);
+    }
+    TINYPKG_FREE(sums);
+}
+
+// Load a package's sums sorted by path. A package installed before sums
+// were recorded has none, and every file counts as unchecked.
+static verify_sum_t *verify_load_sums(const char *package_name, int *count)
+{
+    char path[MAX_PATH];
+    char line[MAX_PATH + VERIFY_DIGEST_SIZE + 4];
+    verify_sum_t *sums = NULL;
+    int capacity = 0;
+    FILE *fp;
+
+    *count = 0;
+    verify_sums_path(path, sizeof(path), package_name);
+    fp = fopen(path, "r");
+    if (!fp)
+    {
+        return NULL;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        size_t length = strlen(line);
+        if (length > 0 && line[length - 1] == '\n')
+        {
+            line[--length] = '\0';
+        }
+
+        // "<64 hex digits>  <path>"
+        if (length < VERIFY_DIGEST_SIZE + 2 || line[VERIFY_DIGEST_SIZE - 1] != ' ' ||
+            line[VERIFY_DIGEST_SIZE] != ' ')
+        {
+            continue;
+        }
+
+        if (*count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            verify_sum_t *grown = TINYPKG_REALLOC(sums, capacity * sizeof(verify_sum_t));
+            if (!grown)
+            {
+                break;
+            }
+            sums = grown;
+        }
+
+        verify_sum_t *sum = &sums[*count];
+        sum->path = TINYPKG_STRDUP(line + VERIFY_DIGEST_SIZE + 1);
+        if (!sum->path)
+        {
+            break;
+        }
+        memcpy(sum->digest, line, VERIFY_DIGEST_SIZE - 1);
+        sum->digest[VERIFY_DIGEST_SIZE - 1] = '\0';
+        (*count)++;
+    }
+    fclose(fp);
+
+    if (sums)
+    {
+        qsort(sums, *count, sizeof(verify_sum_t), verify_compare_sums);
+    }
+    return sums;
+}
+
+// Public interface
+int verify_packages(const char **names, int count, verify_mode_t mode, int threads,
+                    verify_result_t *results)
+{
+    char ***lists;
+    verify_sum_t **sums;
+    int *sum_counts;
+    verify_item_t *items = NULL;
+    verify_job_t job;
+    int total = 0;
+    int result = TINYPKG_ERROR_MEMORY;
+
+    if (!names || !results || count <= 0)
+    {
+        return TINYPKG_ERROR;
+    }
+
+    memset(results, 0, (size_t)count * sizeof(verify_result_t));
+    lists = TINYPKG_CALLOC(count, sizeof(char **));
+    sums = TINYPKG_CALLOC(count, sizeof(verify_sum_t *));
+    sum_counts = TINYPKG_CALLOC(count, sizeof(int));
+    if (!lists || !sums || !sum_counts)
+    {
+        goto out;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        strncpy(results[i].package, names[i], sizeof(results[i].package) - 1);
+        lists[i] = package_get_file_list(names[i], &results[i].files);
+        if (!lists[i])
+        {
+            results[i].files = 0;
+            results[i].errors++;
+            continue;
+        }
+        if (mode == VERIFY_MODE_CHECKSUMS)
+        {
+            sums[i] = verify_load_sums(names[i], &sum_counts[i]);
+        }
+        total += results[i].files;
+    }
+
+    items = TINYPKG_MALLOC((size_t)MAX(total, 1) * sizeof(verify_item_t));
+    if (!items)
+    {
+        goto out;
+    }
+
+    int n = 0;
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = 0; j < results[i].files; j++)
+        {
+            verify_item_t *item = &items[n++];
+            item->path = lists[i][j];
+            item->digest = NULL;
+            item->package = i;
+
+            if (sums[i])
+            {
+                verify_sum_t key = {.path = lists[i][j]};
+                verify_sum_t *sum = bsearch(&key, sums[i], sum_counts[i],
+                                            sizeof(verify_sum_t), verify_compare_sums);
+                item->digest = sum ? sum->digest : NULL;
+            }
+        }
+    }
+
+    // Neighbouring paths share directories; keep them in one worker's chunk
+    qsort(items, total, sizeof(verify_item_t), verify_compare_items);
+
+    memset(&job, 0, sizeof(job));
+    job.mode = mode;
+    job.items = items;
+    job.count = total;
+    job.results = results;
+    result = verify_run(&job, threads);
+
+out:
+    for (int i = 0; lists && i < count; i++)
+    {
+        for (int j = 0; lists[i] && j < results[i].files; j++)
+        {
+            TINYPKG_FREE(lists[i][j]);
+        }
+        TINYPKG_FREE(lists[i]);
+        if (sums)
+        {
+            verify_free_sums(sums[i], sum_counts[i]);
+        }
+    }
+    TINYPKG_FREE(lists);
+    TINYPKG_FREE(sums);
+    TINYPKG_FREE(sum_counts);
+    TINYPKG_FREE(items);
+    return result;
+}
+
+int verify_remove_files(char **files, int count, int threads)
+{
+    verify_result_t result;
+    verify_item_t *items;
+    verify_job_t job;
+
+    if (!files || count <= 0)
+    {
+        return 0;
+    }
+
+    items = TINYPKG_MALLOC((size_t)count * sizeof(verify_item_t));
+    if (!items)
+    {
+        return -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        items[i].path = files[i];
+        items[i].digest = NULL;
+        items[i].package = 0;
+    }
+
+    memset(&result, 0, sizeof(result));
+    memset(&job, 0, sizeof(job));
+    job.mode = VERIFY_MODE_REMOVE;
+    job.items = items;
+    job.count = count;
+    job.results = &result;
+
+    int status = verify_run(&job, threads);
+    TINYPKG_FREE(items);
+    return status == TINYPKG_SUCCESS ? result.errors : -1;
+}
+
+int verify_record_sums(const char *package_name, char **files, int count, int threads)
+{
+    char path[MAX_PATH];
+    char temp_path[MAX_PATH];
+    verify_result_t result;
+    verify_item_t *items;
+    char *digests;
+    verify_job_t job;
+    FILE *fp;
+
+    if (!package_name || (count > 0 && !files))
+    {
+        return TINYPKG_ERROR;
+    }
+
+    items = TINYPKG_MALLOC((size_t)MAX(count, 1) * sizeof(verify_item_t));
+    digests = TINYPKG_MALLOC((size_t)MAX(count, 1) * VERIFY_DIGEST_SIZE);
+    if (!items || !digests)
+    {
+        TINYPKG_FREE(items);
+        TINYPKG_FREE(digests);
+        return TINYPKG_ERROR_MEMORY;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        items[i].path = files[i];
+        items[i].digest = digests + (size_t)i * VERIFY_DIGEST_SIZE;
+        items[i].digest[0] = '\0';
+        items[i].package = 0;
+    }
+
+    memset(&result, 0, sizeof(result));
+    memset(&job, 0, sizeof(job));
+    job.mode = VERIFY_MODE_CHECKSUMS;
+    job.record = 1;
+    job.items = items;
+    job.count = count;
+    job.results = &result;
+
+    int status = verify_run(&job, threads);
+    if (status == TINYPKG_SUCCESS)
+    {
+        verify_sums_path(path, sizeof(path), package_name);
+        if ((size_t)snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >=
+            sizeof(temp_path))
+        {
+            log_error("File sums path too long: %s", path);
+            status = TINYPKG_ERROR;
+        }
+        else if (!(fp = fopen(temp_path, "w")))
+        {
+            log_error("Failed to write file sums: %s", temp_path);
+            status = TINYPKG_ERROR_FILE;
+        }
+        else
+        {
+            // Symlinks and files that could not be read have no sum
+            for (int i = 0; i < count; i++)
+            {
+                if (items[i].digest[0])
+                {
+                    fprintf(fp, "%s  %s\n", items[i].digest, items[i].path);
+                }
+            }
+            if (fclose(fp) != 0 || rename(temp_path, path) != 0)
+            {
+                unlink(temp_path);
+                status = TINYPKG_ERROR_FILE;
+            }
+        }
+    }
+
+    if (result.errors > 0)
+    {
+        log_warn("Could not hash %d files of %s", result.errors, package_name);
+    }
+
+    TINYPKG_FREE(items);
+    TINYPKG_FREE(digests);
+    return status;
+}
+
+// Report
+static int verify_problems(const verify_result_t *result)
+{
+    return result->missing + result->modified + result->errors;
+}
+
+int verify_installed(const char *package_name, int checksums)
+{
+    verify_mode_t mode = checksums ? VERIFY_MODE_CHECKSUMS : VERIFY_MODE_EXISTS;
+    verify_result_t *results;
+    const char **names;
+    struct timespec start, end;
+    int count = 0;
+    int files = 0;
+    int failed = 0;
+    int unchecked = 0;
+
+    if (package_db_load() != TINYPKG_SUCCESS)
+    {
+        log_error("Failed to load package database");
+        return TINYPKG_ERROR;
+    }
+
+    if (package_name)
+    {
+        if (!package_db_find(package_name))
+        {
+            log_error("Package '%s' is not installed", package_name);
+            return TINYPKG_ERROR;
+        }
+        count = 1;
+    }
+    else
+    {
+        count = pkgdb_count();
+        if (count == 0)
+        {
+            printf("No packages installed\n");
+            return TINYPKG_SUCCESS;
+        }
+    }
+
+    names = TINYPKG_CALLOC(count, sizeof(const char *));
+    results = TINYPKG_CALLOC(count, sizeof(verify_result_t));
+    if (!names || !results)
+    {
+        TINYPKG_FREE(names);
+        TINYPKG_FREE(results);
+        return TINYPKG_ERROR_MEMORY;
+    }
+
+    if (package_name)
+    {
+        names[0] = package_name;
+    }
+    else
+    {
+        int i = 0;
+        for (package_db_entry_t *entry = package_db_get_all(); entry && i < count;
+             entry = entry->next)
+        {
+            names[i++] = entry->name;
+        }
+        count = i;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = verify_packages(names, count, mode, 0, results);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (result == TINYPKG_SUCCESS)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            const verify_result_t *r = &results[i];
+
+            files += r->files;
+            unchecked += r->unchecked;
+            if (verify_problems(r) == 0)
+            {
+                printf("%s: OK (%d files)\n", r->package, r->files);
+                continue;
+            }
+
+            failed++;
+            printf("%s: %d missing, %d modified, %d unreadable (%d files)\n", r->package,
+                   r->missing, r->modified, r->errors, r->files);
+        }
+
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("\nVerified %d files of %d packages in %.2fs: %d packages with problems\n",
+               files, count, seconds, failed);
+        if (unchecked > 0)
+        {
+            printf("%d files have no recorded checksum\n", unchecked);
+        }
+    }
+
+    TINYPKG_FREE(names);
+    TINYPKG_FREE(results);
+
+    if (result != TINYPKG_SUCCESS)
+    {
+        return result;
+    }
+    return failed > 0 ? TINYPKG_ERROR : TINYPKG_SUCCESS;
+}
@@ -0,0 +1,56 @@
+/*
+ * TinyPkg - File Verification Header
+ * Parallel integrity checks and removal over installed file manifests
+ */
+
+#ifndef TINYPKG_VERIFY_H
+#define TINYPKG_VERIFY_H
+
+// Per-file SHA-256 sums recorded at install time, in sha256sum format,
+// next to the LIB_DIR/<pkg>.files list
+#define VERIFY_SUMS_SUFFIX ".sums"
+
+// Workers claim this many consecutive (path-sorted) files at a time so
+// their cached directory descriptor keeps hitting
+#define VERIFY_CHUNK 256
+#define VERIFY_MAX_THREADS 64
+
+// Metadata checks wait on the disk, not the CPU: run this many workers
+// per core to keep the device queue full
+#define VERIFY_STAT_THREADS_PER_CPU 4
+
+typedef enum {
+    VERIFY_MODE_EXISTS = 0,     // Every listed file is present
+    VERIFY_MODE_CHECKSUMS,      // ... and regular files match their recorded sum
+    VERIFY_MODE_REMOVE          // Unlink every listed file
+} verify_mode_t;
+
+// Outcome for one package
+typedef struct verify_result {
+    char package[MAX_NAME];
+    int files;
+    int missing;
+    int modified;               // Wrong checksum, or no longer a regular file
+    int unchecked;              // Regular files without a recorded sum
+    int errors;                 // Could not be read or removed
+} verify_result_t;
+
+// Function declarations
+
+// Check or remove the files of count packages on up to threads workers
+// (0 picks a default for the mode). results[i] describes names[i].
+int verify_packages(const char **names, int count, verify_mode_t mode, int threads,
+                    verify_result_t *results);
+
+// Unlink a list of files in parallel; missing files are not an error.
+// Returns the number of files that could not be removed, or -1.
+int verify_remove_files(char **files, int count, int threads);
+
+// Hash the regular files among a package's installed files and store the
+// sums for later verification
+int verify_record_sums(const char *package_name, char **files, int count, int threads);
+
+// --verify: check one or every installed package and print a report
+int verify_installed(const char *package_name, int checksums);
+
+#endif /* TINYPKG_VERIFY_H */